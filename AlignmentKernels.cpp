@@ -0,0 +1,2181 @@
+/**
+ * @file AlignmentKernels.cpp
+ * @author Samuel Leong (samleocw@gmail.com)
+ * @brief Hand-vectorised inner loops of image alignment
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2020
+ */
+
+#include "AlignmentKernels.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * @brief Constructor for Planes class (empty)
+ */
+template <typename T> Planes<T>::Planes() {}
+
+/**
+ * @brief Constructor for Planes class
+ *
+ * @param[in] aNumPlanes Number of planes
+ * @param[in] aSize Values per plane
+ */
+template <typename T>
+Planes<T>::Planes(const size_t aNumPlanes, const size_t aSize) {
+    resize(aNumPlanes, aSize);
+}
+
+/**
+ * @brief Copy constructor
+ *
+ * @param[in] aOther Planes to copy
+ */
+template <typename T> Planes<T>::Planes(const Planes &aOther) {
+    *this = aOther;
+}
+
+/**
+ * @brief Copy assignment
+ *
+ * @param[in] aOther Planes to copy
+ * @return Planes& this
+ */
+template <typename T> Planes<T> &Planes<T>::operator=(const Planes &aOther) {
+    if (this != &aOther) {
+        resize(aOther.mNumPlanes, aOther.mSize);
+        if (mData) std::memcpy(mData, aOther.mData, bytes());
+    }
+
+    return *this;
+}
+
+/**
+ * @brief Destructor
+ */
+template <typename T> Planes<T>::~Planes() {
+    std::free(mData);
+}
+
+/**
+ * @brief Resize; contents are reset to zero (including padding) whenever the
+ * layout changes
+ *
+ * @param[in] aNumPlanes Number of planes
+ * @param[in] aSize Values per plane
+ */
+template <typename T>
+void Planes<T>::resize(const size_t aNumPlanes, const size_t aSize) {
+    const size_t valuesPerLine = KLT_PLANE_ALIGN / sizeof(T);
+    const size_t stride =
+        (aSize + valuesPerLine - 1) / valuesPerLine * valuesPerLine;
+
+    if (aNumPlanes == mNumPlanes && aSize == mSize) return;
+
+    std::free(mData);
+    mData = nullptr;
+
+    mNumPlanes = aNumPlanes;
+    mSize = aSize;
+    mStride = stride;
+
+    if (bytes() == 0) return;
+
+    mData = static_cast<T *>(std::aligned_alloc(KLT_PLANE_ALIGN, bytes()));
+    if (!mData) throw std::bad_alloc();
+
+    std::memset(mData, 0, bytes());
+}
+
+/**
+ * @brief Get number of planes
+ *
+ * @return size_t number of planes
+ */
+template <typename T> size_t Planes<T>::numPlanes() const {
+    return mNumPlanes;
+}
+
+/**
+ * @brief Get number of values per plane (without padding)
+ *
+ * @return size_t plane size
+ */
+template <typename T> size_t Planes<T>::size() const {
+    return mSize;
+}
+
+/**
+ * @brief Get padded plane length (a multiple of 64 bytes)
+ *
+ * @return size_t plane stride in values
+ */
+template <typename T> size_t Planes<T>::stride() const {
+    return mStride;
+}
+
+/**
+ * @brief Get size of whole buffer
+ *
+ * @return size_t buffer size in bytes
+ */
+template <typename T> size_t Planes<T>::bytes() const {
+    return mNumPlanes * mStride * sizeof(T);
+}
+
+/**
+ * @brief Get a plane
+ *
+ * @param[in] aIndex Plane index
+ * @return T* first value of plane (64-byte aligned)
+ */
+template <typename T> T *Planes<T>::plane(const size_t aIndex) {
+    assert(aIndex < mNumPlanes);
+    return mData + aIndex * mStride;
+}
+
+/**
+ * @brief Get a plane
+ *
+ * @param[in] aIndex Plane index
+ * @return const T* first value of plane (64-byte aligned)
+ */
+template <typename T> const T *Planes<T>::plane(const size_t aIndex) const {
+    assert(aIndex < mNumPlanes);
+    return mData + aIndex * mStride;
+}
+
+// The only plane types; their members are defined here, not in the header
+template class Planes<float>;
+template class Planes<int16_t>;
+template class Planes<uint16_t>;
+
+/**
+ * @brief Get number of KLT_KERNEL_BLOCK pixel blocks covering padded planes
+ *
+ * @param[in] aImages Planes
+ * @return size_t number of blocks
+ */
+size_t numKernelBlocks(const AlignedPlanes &aImages) {
+    return (aImages.stride() + KLT_KERNEL_BLOCK - 1) / KLT_KERNEL_BLOCK;
+}
+
+// Float vector of the widest available instruction set, for the plane
+// kernels (planes are aligned and padded to whole vectors)
+#if defined(__AVX__)
+#define KLT_LANES 8
+typedef __m256 vfloat_t;
+static inline vfloat_t vzero() { return _mm256_setzero_ps(); }
+static inline vfloat_t vset(const float a) { return _mm256_set1_ps(a); }
+static inline vfloat_t vload(const float *p) { return _mm256_load_ps(p); }
+static inline void vstore(float *p, const vfloat_t a) {
+    _mm256_storeu_ps(p, a);
+}
+static inline vfloat_t vadd(const vfloat_t a, const vfloat_t b) {
+    return _mm256_add_ps(a, b);
+}
+static inline vfloat_t vsub(const vfloat_t a, const vfloat_t b) {
+    return _mm256_sub_ps(a, b);
+}
+static inline vfloat_t vmul(const vfloat_t a, const vfloat_t b) {
+    return _mm256_mul_ps(a, b);
+}
+#ifdef __FMA__
+static inline vfloat_t vmuladd(const vfloat_t a, const vfloat_t b,
+                               const vfloat_t c) {
+    return _mm256_fmadd_ps(a, b, c);
+}
+static inline vfloat_t vmulsub(const vfloat_t a, const vfloat_t b,
+                               const vfloat_t c) {
+    return _mm256_fmsub_ps(a, b, c);
+}
+#else
+static inline vfloat_t vmuladd(const vfloat_t a, const vfloat_t b,
+                               const vfloat_t c) {
+    return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+}
+static inline vfloat_t vmulsub(const vfloat_t a, const vfloat_t b,
+                               const vfloat_t c) {
+    return _mm256_sub_ps(_mm256_mul_ps(a, b), c);
+}
+#endif
+#elif defined(__SSE2__)
+#define KLT_LANES 4
+typedef __m128 vfloat_t;
+static inline vfloat_t vzero() { return _mm_setzero_ps(); }
+static inline vfloat_t vset(const float a) { return _mm_set1_ps(a); }
+static inline vfloat_t vload(const float *p) { return _mm_load_ps(p); }
+static inline void vstore(float *p, const vfloat_t a) { _mm_storeu_ps(p, a); }
+static inline vfloat_t vadd(const vfloat_t a, const vfloat_t b) {
+    return _mm_add_ps(a, b);
+}
+static inline vfloat_t vsub(const vfloat_t a, const vfloat_t b) {
+    return _mm_sub_ps(a, b);
+}
+static inline vfloat_t vmul(const vfloat_t a, const vfloat_t b) {
+    return _mm_mul_ps(a, b);
+}
+static inline vfloat_t vmuladd(const vfloat_t a, const vfloat_t b,
+                               const vfloat_t c) {
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+}
+static inline vfloat_t vmulsub(const vfloat_t a, const vfloat_t b,
+                               const vfloat_t c) {
+    return _mm_sub_ps(_mm_mul_ps(a, b), c);
+}
+#else
+#define KLT_LANES 1
+typedef float vfloat_t;
+static inline vfloat_t vzero() { return 0.0f; }
+static inline vfloat_t vset(const float a) { return a; }
+static inline vfloat_t vload(const float *p) { return *p; }
+static inline void vstore(float *p, const vfloat_t a) { *p = a; }
+static inline vfloat_t vadd(const vfloat_t a, const vfloat_t b) {
+    return a + b;
+}
+static inline vfloat_t vsub(const vfloat_t a, const vfloat_t b) {
+    return a - b;
+}
+static inline vfloat_t vmul(const vfloat_t a, const vfloat_t b) {
+    return a * b;
+}
+static inline vfloat_t vmuladd(const vfloat_t a, const vfloat_t b,
+                               const vfloat_t c) {
+    return a * b + c;
+}
+static inline vfloat_t vmulsub(const vfloat_t a, const vfloat_t b,
+                               const vfloat_t c) {
+    return a * b - c;
+}
+#endif
+
+/**
+ * @brief Add aA * aB into a per-lane float sum, optionally with Kahan
+ * compensation (the running error is kept in aComp and subtracted from the
+ * next product)
+ *
+ * @param[in,out] aSum Per-lane sums
+ * @param[in,out] aComp Per-lane compensation (unused unless Compensated)
+ * @param[in] aA First factor
+ * @param[in] aB Second factor
+ */
+template <bool Compensated>
+static inline void addProduct(vfloat_t &aSum, vfloat_t &aComp,
+                              const vfloat_t aA, const vfloat_t aB) {
+    if (!Compensated) {
+        aSum = vmuladd(aA, aB, aSum);
+        return;
+    }
+
+    const vfloat_t y = vmulsub(aA, aB, aComp);
+    const vfloat_t t = vadd(aSum, y);
+    aComp = vsub(vsub(t, aSum), y);
+    aSum = t;
+}
+
+/**
+ * @brief Reduce per-lane float sums (minus their compensation) into double
+ *
+ * @param[in] aSum Per-lane sums
+ * @param[in] aComp Per-lane compensation
+ * @return double total
+ */
+static inline double reduceLanes(const vfloat_t aSum, const vfloat_t aComp) {
+    float sum[KLT_LANES], comp[KLT_LANES];
+    vstore(sum, aSum);
+    vstore(comp, aComp);
+
+    double total = 0;
+    for (int l = 0; l < KLT_LANES; l++)
+        total += static_cast<double>(sum[l]) - comp[l];
+
+    return total;
+}
+
+/**
+ * @brief Hessian terms of pixels [aBegin, aEnd), summed in float vector lanes
+ *
+ * @param[in] aJ Steepest descent images
+ * @param[in] aWeights Per-pixel weights (nullptr: all 1)
+ * @param[in] aBegin First pixel (multiple of KLT_LANES)
+ * @param[in] aEnd One past last pixel (multiple of KLT_LANES)
+ * @param[out] aTerms Upper triangle, row by row
+ */
+template <bool Compensated>
+static void accumulateHessianLanes(const float *const aJ[6],
+                                   const float *aWeights, const size_t aBegin,
+                                   const size_t aEnd,
+                                   double aTerms[KLT_HESSIAN_TERMS]) {
+    vfloat_t sum[KLT_HESSIAN_TERMS], comp[KLT_HESSIAN_TERMS];
+    for (int t = 0; t < KLT_HESSIAN_TERMS; t++) {
+        sum[t] = vzero();
+        comp[t] = vzero();
+    }
+
+    for (size_t i = aBegin; i < aEnd; i += KLT_LANES) {
+        const vfloat_t w = aWeights ? vload(aWeights + i) : vset(1.0f);
+
+        vfloat_t v[6];
+        for (int k = 0; k < 6; k++)
+            v[k] = vload(aJ[k] + i);
+
+        int t = 0;
+        for (int a = 0; a < 6; a++) {
+            const vfloat_t wva = vmul(w, v[a]);
+            for (int b = a; b < 6; b++, t++)
+                addProduct<Compensated>(sum[t], comp[t], wva, v[b]);
+        }
+    }
+
+    for (int t = 0; t < KLT_HESSIAN_TERMS; t++)
+        aTerms[t] = reduceLanes(sum[t], comp[t]);
+}
+
+/**
+ * @brief Sum the 21 upper-triangle Hessian terms of one block of
+ * KLT_KERNEL_BLOCK pixels
+ *
+ * @see Summation
+ *
+ * @param[in] aImages Steepest descent images (6 planes)
+ * @param[in] aWeights Per-pixel weights, aligned and zero-padded to the plane
+ * stride (nullptr: all 1)
+ * @param[in] aBlock Block index
+ * @param[out] aTerms Block sums, upper triangle row by row
+ * @param[in] aSummation How to sum within the block
+ */
+void accumulateHessianBlock(const AlignedPlanes &aImages,
+                            const float *aWeights, const size_t aBlock,
+                            double aTerms[KLT_HESSIAN_TERMS],
+                            const Summation aSummation) {
+    assert(aImages.numPlanes() == 6);
+
+    const float *j[6];
+    for (int k = 0; k < 6; k++)
+        j[k] = aImages.plane(k);
+
+    // Padding is zero, so whole vectors can be summed up to the stride
+    const size_t block = aBlock * KLT_KERNEL_BLOCK;
+    const size_t blockEnd =
+        std::min(aImages.stride(), block + KLT_KERNEL_BLOCK);
+
+    switch (aSummation) {
+        case SUMMATION_FIXED_ORDER:
+            for (int t = 0; t < KLT_HESSIAN_TERMS; t++)
+                aTerms[t] = 0;
+
+            for (size_t i = block; i < blockEnd; i++) {
+                const float w = aWeights ? aWeights[i] : 1.0f;
+
+                int t = 0;
+                for (int a = 0; a < 6; a++) {
+                    const float wva = w * j[a][i];
+                    for (int b = a; b < 6; b++)
+                        aTerms[t++] += static_cast<double>(wva) * j[b][i];
+                }
+            }
+            break;
+        case SUMMATION_COMPENSATED:
+            accumulateHessianLanes<true>(j, aWeights, block, blockEnd, aTerms);
+            break;
+        case SUMMATION_FLOAT:
+        default:
+            accumulateHessianLanes<false>(j, aWeights, block, blockEnd,
+                                          aTerms);
+            break;
+    }
+}
+
+/**
+ * @brief Accumulate the (weighted) Hessian from six aligned float steepest
+ * descent planes, summing the 21 upper-triangle terms over blocks of
+ * KLT_KERNEL_BLOCK pixels and the block sums in double, in block order
+ *
+ * @see accumulateHessianBlock()
+ *
+ * @param[in] aImages Steepest descent images (6 planes)
+ * @param[in] aWeights Per-pixel weights, aligned and zero-padded to the plane
+ * stride (nullptr: all 1)
+ * @param[out] aHessian Hessian
+ * @param[in] aPool Pool to sum blocks on (nullptr: calling thread only); the
+ * result is the same either way
+ * @param[in] aSummation How to sum within blocks
+ */
+void accumulateHessian(const AlignedPlanes &aImages, const float *aWeights,
+                       Eigen::Matrix<double, 6, 6> &aHessian,
+                       ThreadPool *aPool, const Summation aSummation) {
+    const size_t numBlocks = numKernelBlocks(aImages);
+    std::vector<double> blockTerms(numBlocks * KLT_HESSIAN_TERMS);
+
+    const auto sumBlocks = [&](const size_t aBegin, const size_t aEnd) {
+        for (size_t b = aBegin; b < aEnd; b++)
+            accumulateHessianBlock(aImages, aWeights, b,
+                                   &blockTerms[b * KLT_HESSIAN_TERMS],
+                                   aSummation);
+    };
+
+    if (aPool)
+        aPool->parallelFor(numBlocks, sumBlocks);
+    else
+        sumBlocks(0, numBlocks);
+
+    double terms[KLT_HESSIAN_TERMS] = { 0 };
+    for (size_t b = 0; b < numBlocks; b++)
+        for (int t = 0; t < KLT_HESSIAN_TERMS; t++)
+            terms[t] += blockTerms[b * KLT_HESSIAN_TERMS + t];
+
+    // Mirror upper triangle
+    int t = 0;
+    for (int a = 0; a < 6; a++) {
+        for (int b = a; b < 6; b++, t++) {
+            aHessian(a, b) = terms[t];
+            aHessian(b, a) = terms[t];
+        }
+    }
+}
+
+/**
+ * @brief J^T e of pixels [aBegin, aEnd), summed in float vector lanes
+ *
+ * @param[in] aJ Steepest descent images
+ * @param[in] aError Error image
+ * @param[in] aBegin First pixel (multiple of KLT_LANES)
+ * @param[in] aEnd One past last pixel (multiple of KLT_LANES)
+ * @param[out] aVectorB J^T e
+ */
+template <bool Compensated>
+static void projectErrorLanes(const float *const aJ[6], const float *aError,
+                              const size_t aBegin, const size_t aEnd,
+                              double aVectorB[6]) {
+    vfloat_t sum[6], comp[6];
+    for (int k = 0; k < 6; k++) {
+        sum[k] = vzero();
+        comp[k] = vzero();
+    }
+
+    for (size_t i = aBegin; i < aEnd; i += KLT_LANES) {
+        const vfloat_t e = vload(aError + i);
+        for (int k = 0; k < 6; k++)
+            addProduct<Compensated>(sum[k], comp[k], vload(aJ[k] + i), e);
+    }
+
+    for (int k = 0; k < 6; k++)
+        aVectorB[k] = reduceLanes(sum[k], comp[k]);
+}
+
+/**
+ * @brief Project one block of KLT_KERNEL_BLOCK pixels of an error image onto
+ * the steepest descent images
+ *
+ * @see Summation
+ *
+ * @param[in] aImages Steepest descent images (6 planes)
+ * @param[in] aError Error image, aligned and zero-padded to the plane stride
+ * @param[in] aBlock Block index
+ * @param[out] aVectorB Block sums of J^T e
+ * @param[in] aSummation How to sum within the block
+ */
+void projectErrorBlock(const AlignedPlanes &aImages, const float *aError,
+                       const size_t aBlock, double aVectorB[6],
+                       const Summation aSummation) {
+    assert(aImages.numPlanes() == 6);
+
+    const float *j[6];
+    for (int k = 0; k < 6; k++)
+        j[k] = aImages.plane(k);
+
+    const size_t block = aBlock * KLT_KERNEL_BLOCK;
+    const size_t blockEnd =
+        std::min(aImages.stride(), block + KLT_KERNEL_BLOCK);
+
+    switch (aSummation) {
+        case SUMMATION_FIXED_ORDER:
+            for (int k = 0; k < 6; k++) {
+                aVectorB[k] = 0;
+                for (size_t i = block; i < blockEnd; i++)
+                    aVectorB[k] += static_cast<double>(j[k][i]) * aError[i];
+            }
+            break;
+        case SUMMATION_COMPENSATED:
+            projectErrorLanes<true>(j, aError, block, blockEnd, aVectorB);
+            break;
+        case SUMMATION_FLOAT:
+        default:
+            projectErrorLanes<false>(j, aError, block, blockEnd, aVectorB);
+            break;
+    }
+}
+
+/**
+ * @brief Project an error image onto the steepest descent images, ie. compute
+ * b = J^T e, over blocks of KLT_KERNEL_BLOCK pixels and in double across
+ * blocks, in block order
+ *
+ * @see projectErrorBlock()
+ *
+ * @param[in] aImages Steepest descent images (6 planes)
+ * @param[in] aError Error image, aligned and zero-padded to the plane stride
+ * @param[out] aVectorB J^T e
+ * @param[in] aPool Pool to sum blocks on (nullptr: calling thread only); the
+ * result is the same either way
+ * @param[in] aSummation How to sum within blocks
+ */
+void projectError(const AlignedPlanes &aImages, const float *aError,
+                  Eigen::Matrix<double, 6, 1> &aVectorB, ThreadPool *aPool,
+                  const Summation aSummation) {
+    const size_t numBlocks = numKernelBlocks(aImages);
+    std::vector<double> blockSums(numBlocks * 6);
+
+    const auto sumBlocks = [&](const size_t aBegin, const size_t aEnd) {
+        for (size_t b = aBegin; b < aEnd; b++)
+            projectErrorBlock(aImages, aError, b, &blockSums[b * 6],
+                              aSummation);
+    };
+
+    if (aPool)
+        aPool->parallelFor(numBlocks, sumBlocks);
+    else
+        sumBlocks(0, numBlocks);
+
+    aVectorB.setZero();
+    for (size_t b = 0; b < numBlocks; b++)
+        for (int k = 0; k < 6; k++)
+            aVectorB(k) += blockSums[b * 6 + k];
+}
+
+/**
+ * @brief Round a float to the nearest IEEE half precision value (ties to
+ * even), the same as F16C conversion
+ *
+ * @param[in] aValue Value
+ * @return uint16_t fp16 bit pattern
+ */
+static uint16_t floatToHalf(const float aValue) {
+    uint32_t bits;
+    std::memcpy(&bits, &aValue, sizeof(bits));
+
+    const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+    const uint32_t magnitude = bits & 0x7fffffff;
+
+    // Infinity, and NaN (quiet, top payload bits kept)
+    if (magnitude == 0x7f800000) return sign | 0x7c00;
+    if (magnitude > 0x7f800000)
+        return sign | 0x7e00 | static_cast<uint16_t>((magnitude >> 13) & 0x3ff);
+
+    // Rounds to 65520 or above: infinity
+    if (magnitude >= 0x477ff000) return sign | 0x7c00;
+
+    // Below 2^-14: subnormal, in units of 2^-24 (the scaling is exact)
+    if (magnitude < 0x38800000)
+        return sign | static_cast<uint16_t>(std::nearbyint(
+                          std::fabs(aValue) * 16777216.0f));
+
+    // Normal: rebias the exponent and round off 13 mantissa bits; a carry
+    // into the exponent is still correct
+    uint32_t half = (magnitude - 0x38000000) >> 13;
+    const uint32_t rest = magnitude & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+
+    return sign | static_cast<uint16_t>(half);
+}
+
+/**
+ * @brief Convert an IEEE half precision value to float (exact)
+ *
+ * @param[in] aHalf fp16 bit pattern
+ * @return float value
+ */
+static float halfToFloat(const uint16_t aHalf) {
+    const uint32_t sign = static_cast<uint32_t>(aHalf & 0x8000) << 16;
+    const uint32_t exponent = (aHalf >> 10) & 0x1f;
+    const uint32_t mantissa = aHalf & 0x3ff;
+
+    // Zero and subnormals, in units of 2^-24
+    if (exponent == 0) {
+        const float value = std::ldexp(static_cast<float>(mantissa), -24);
+        return sign ? -value : value;
+    }
+
+    const uint32_t bits =
+        sign | ((exponent != 0x1f) ? ((exponent + 112) << 23) | (mantissa << 13)
+                : (mantissa ? 0x7fc00000 : 0x7f800000) | (mantissa << 13));
+
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+#if defined(__SSE2__) && !defined(__F16C__)
+/**
+ * @brief Convert four fp16 values (in the low half of 32-bit lanes) to float,
+ * bit-identical to F16C
+ *
+ * @param[in] aHalf fp16 bit patterns, zero-extended to 32 bits
+ * @return __m128 values
+ */
+static inline __m128 halfToFloat4(const __m128i aHalf) {
+    // Magnitude shifted into float position is the value times 2^-112 (also
+    // for subnormals), so one exact multiply rebiases the exponent
+    const __m128i magnitude =
+        _mm_slli_epi32(_mm_and_si128(aHalf, _mm_set1_epi32(0x7fff)), 13);
+    const __m128 value =
+        _mm_mul_ps(_mm_castsi128_ps(magnitude), _mm_set1_ps(0x1p112f));
+
+    // Infinity and NaN end up at or above 2^16: set the exponent to all ones,
+    // and the quiet bit for NaN
+    const __m128 infNaN = _mm_cmpge_ps(value, _mm_set1_ps(65536.0f));
+    const __m128 nan = _mm_cmpgt_ps(value, _mm_set1_ps(65536.0f));
+    const __m128i special = _mm_or_si128(
+        _mm_and_si128(_mm_castps_si128(infNaN), _mm_set1_epi32(0x7f800000)),
+        _mm_and_si128(_mm_castps_si128(nan), _mm_set1_epi32(0x400000)));
+
+    const __m128i sign =
+        _mm_slli_epi32(_mm_and_si128(aHalf, _mm_set1_epi32(0x8000)), 16);
+
+    return _mm_castsi128_ps(_mm_or_si128(
+        _mm_or_si128(_mm_castps_si128(value), special), sign));
+}
+
+/**
+ * @brief Round four floats to fp16 (ties to even), bit-identical to F16C
+ *
+ * @param[in] aValue Values
+ * @return __m128i fp16 bit patterns, in the low half of 32-bit lanes
+ */
+static inline __m128i floatToHalf4(const __m128 aValue) {
+    const __m128i bits = _mm_castps_si128(aValue);
+    const __m128i sign = _mm_and_si128(bits, _mm_set1_epi32(0x80000000));
+    const __m128i magnitude = _mm_xor_si128(bits, sign);
+
+    // Normal: rebias the exponent, and round off 13 mantissa bits by adding
+    // just under half an ulp, plus one if the kept part is odd
+    const __m128i odd =
+        _mm_and_si128(_mm_srli_epi32(magnitude, 13), _mm_set1_epi32(1));
+    const __m128i normal = _mm_srli_epi32(
+        _mm_add_epi32(_mm_add_epi32(magnitude, _mm_set1_epi32(-0x37fff001)),
+                      odd),
+        13);
+
+    // Subnormal: adding 0.5 rounds at 2^-24, the fp16 subnormal unit
+    const __m128i subnormal = _mm_sub_epi32(
+        _mm_castps_si128(
+            _mm_add_ps(_mm_castsi128_ps(magnitude), _mm_set1_ps(0.5f))),
+        _mm_set1_epi32(0x3f000000));
+
+    // 65536 and above is infinity; NaN stays quiet with its top payload bits
+    const __m128i nan = _mm_cmpgt_epi32(magnitude, _mm_set1_epi32(0x7f800000));
+    const __m128i payload = _mm_or_si128(
+        _mm_set1_epi32(0x200),
+        _mm_and_si128(_mm_srli_epi32(magnitude, 13), _mm_set1_epi32(0x3ff)));
+    const __m128i special =
+        _mm_or_si128(_mm_set1_epi32(0x7c00), _mm_and_si128(nan, payload));
+
+    const __m128i isSubnormal =
+        _mm_cmplt_epi32(magnitude, _mm_set1_epi32(0x38800000));
+    const __m128i isSpecial =
+        _mm_cmpgt_epi32(magnitude, _mm_set1_epi32(0x477fffff));
+
+    __m128i half = _mm_or_si128(_mm_and_si128(isSubnormal, subnormal),
+                                _mm_andnot_si128(isSubnormal, normal));
+    half = _mm_or_si128(_mm_and_si128(isSpecial, special),
+                        _mm_andnot_si128(isSpecial, half));
+
+    return _mm_or_si128(half, _mm_srli_epi32(sign, 16));
+}
+#endif
+
+/**
+ * @brief Load KLT_LANES fp16 values as floats
+ *
+ * @param[in] p First value (aligned to KLT_LANES values)
+ * @return vfloat_t values
+ */
+static inline vfloat_t vloadHalf(const uint16_t *p) {
+#if defined(__F16C__)
+    return _mm256_cvtph_ps(
+        _mm_load_si128(reinterpret_cast<const __m128i *>(p)));
+#elif defined(__SSE2__)
+    // Without F16C: SSE2 integer conversion, 4 values at a time
+    const __m128i zero = _mm_setzero_si128();
+#if KLT_LANES == 8
+    const __m128i halves =
+        _mm_load_si128(reinterpret_cast<const __m128i *>(p));
+    return _mm256_set_m128(halfToFloat4(_mm_unpackhi_epi16(halves, zero)),
+                           halfToFloat4(_mm_unpacklo_epi16(halves, zero)));
+#else
+    const __m128i halves =
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+    return halfToFloat4(_mm_unpacklo_epi16(halves, zero));
+#endif
+#else
+    alignas(KLT_PLANE_ALIGN) float values[KLT_LANES];
+    for (int l = 0; l < KLT_LANES; l++)
+        values[l] = halfToFloat(p[l]);
+    return vload(values);
+#endif
+}
+
+/**
+ * @brief Convert float planes to half precision (round to nearest even)
+ *
+ * @param[in] aPlanes Float planes
+ * @param[out] aHalf Half planes (resized to match)
+ */
+void convertToHalf(const AlignedPlanes &aPlanes, HalfPlanes &aHalf) {
+    aHalf.resize(aPlanes.numPlanes(), aPlanes.size());
+
+    for (size_t k = 0; k < aPlanes.numPlanes(); k++) {
+        const float *src = aPlanes.plane(k);
+        uint16_t *dst = aHalf.plane(k);
+
+        size_t i = 0;
+#if defined(__F16C__)
+        for (; i + 8 <= aPlanes.size(); i += 8)
+            _mm_storeu_si128(
+                reinterpret_cast<__m128i *>(dst + i),
+                _mm256_cvtps_ph(_mm256_load_ps(src + i),
+                                _MM_FROUND_TO_NEAREST_INT |
+                                    _MM_FROUND_NO_EXC));
+#elif defined(__SSE2__)
+        // Sign-extend from 16 bits, so the signed pack keeps the bits
+        for (; i + 8 <= aPlanes.size(); i += 8) {
+            const __m128i low = floatToHalf4(_mm_load_ps(src + i));
+            const __m128i high = floatToHalf4(_mm_load_ps(src + i + 4));
+            _mm_storeu_si128(
+                reinterpret_cast<__m128i *>(dst + i),
+                _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(low, 16), 16),
+                                _mm_srai_epi32(_mm_slli_epi32(high, 16), 16)));
+        }
+#endif
+        for (; i < aPlanes.size(); i++)
+            dst[i] = floatToHalf(src[i]);
+    }
+}
+
+/**
+ * @brief Convert half precision planes to float (exact)
+ *
+ * @param[in] aHalf Half planes
+ * @param[out] aPlanes Float planes (resized to match)
+ */
+void convertFromHalf(const HalfPlanes &aHalf, AlignedPlanes &aPlanes) {
+    aPlanes.resize(aHalf.numPlanes(), aHalf.size());
+
+    for (size_t k = 0; k < aHalf.numPlanes(); k++) {
+        const uint16_t *src = aHalf.plane(k);
+        float *dst = aPlanes.plane(k);
+
+        size_t i = 0;
+        for (; i + KLT_LANES <= aHalf.size(); i += KLT_LANES)
+            vstore(dst + i, vloadHalf(src + i));
+        for (; i < aHalf.size(); i++)
+            dst[i] = halfToFloat(src[i]);
+    }
+}
+
+/**
+ * @brief Error, squared error and J^T e of pixels [aBegin, aEnd) from half
+ * precision planes, summed in float vector lanes
+ *
+ * @param[in] aJ Steepest descent images (fp16)
+ * @param[in] aTemplate Template samples (fp16)
+ * @param[in,out] aError Warped samples in, error out
+ * @param[in] aBegin First pixel (multiple of KLT_LANES)
+ * @param[in] aEnd One past last pixel (multiple of KLT_LANES)
+ * @param[out] aSums Squared error, then J^T e
+ */
+template <bool Compensated>
+static void projectErrorHalfLanes(const uint16_t *const aJ[6],
+                                  const uint16_t *aTemplate, float *aError,
+                                  const size_t aBegin, const size_t aEnd,
+                                  double aSums[7]) {
+    vfloat_t sum[7], comp[7];
+    for (int k = 0; k < 7; k++) {
+        sum[k] = vzero();
+        comp[k] = vzero();
+    }
+
+    for (size_t i = aBegin; i < aEnd; i += KLT_LANES) {
+        const vfloat_t e = vsub(vload(aError + i), vloadHalf(aTemplate + i));
+        vstore(aError + i, e);
+
+        addProduct<Compensated>(sum[0], comp[0], e, e);
+        for (int k = 0; k < 6; k++)
+            addProduct<Compensated>(sum[k + 1], comp[k + 1],
+                                    vloadHalf(aJ[k] + i), e);
+    }
+
+    for (int k = 0; k < 7; k++)
+        aSums[k] = reduceLanes(sum[k], comp[k]);
+}
+
+/**
+ * @brief Fused error and J^T e of one block of KLT_KERNEL_BLOCK pixels, with
+ * template samples and steepest descent images in half precision: values are
+ * converted to float as they are loaded, so the planes stream at half the
+ * bandwidth of the float kernels
+ *
+ * @see projectErrorBlock()
+ *
+ * @param[in] aImages Steepest descent images (6 fp16 planes)
+ * @param[in] aTemplate Template samples (1 fp16 plane, same size)
+ * @param[in,out] aError Warped samples on entry, warped minus template on
+ * exit; aligned and zero-padded to the float plane stride
+ * @param[in] aBlock Block index
+ * @param[out] aSums Block sums: squared error, then J^T e
+ * @param[in] aSummation How to sum within the block
+ */
+void projectErrorHalfBlock(const HalfPlanes &aImages,
+                           const HalfPlanes &aTemplate, float *aError,
+                           const size_t aBlock, double aSums[7],
+                           const Summation aSummation) {
+    assert(aImages.numPlanes() == 6 && aTemplate.size() == aImages.size());
+
+    const uint16_t *j[6];
+    for (int k = 0; k < 6; k++)
+        j[k] = aImages.plane(k);
+    const uint16_t *samples = aTemplate.plane(0);
+
+    // Up to the float stride of the error image; padding is zero in both
+    const size_t floatsPerLine = KLT_PLANE_ALIGN / sizeof(float);
+    const size_t stride =
+        (aImages.size() + floatsPerLine - 1) / floatsPerLine * floatsPerLine;
+    const size_t block = aBlock * KLT_KERNEL_BLOCK;
+    const size_t blockEnd = std::min(stride, block + KLT_KERNEL_BLOCK);
+
+    switch (aSummation) {
+        case SUMMATION_FIXED_ORDER:
+            // fp16 to float is exact, so this matches on every build
+            for (int k = 0; k < 7; k++)
+                aSums[k] = 0;
+
+            for (size_t i = block; i < blockEnd; i++) {
+                const float e = aError[i] - halfToFloat(samples[i]);
+                aError[i] = e;
+                aSums[0] += static_cast<double>(e) * e;
+            }
+            for (int k = 0; k < 6; k++)
+                for (size_t i = block; i < blockEnd; i++)
+                    aSums[k + 1] +=
+                        static_cast<double>(halfToFloat(j[k][i])) * aError[i];
+            break;
+        case SUMMATION_COMPENSATED:
+            projectErrorHalfLanes<true>(j, samples, aError, block, blockEnd,
+                                        aSums);
+            break;
+        case SUMMATION_FLOAT:
+        default:
+            projectErrorHalfLanes<false>(j, samples, aError, block, blockEnd,
+                                         aSums);
+            break;
+    }
+}
+
+/**
+ * @brief Number of square tiles covering a sampling grid; the last row and
+ * column of tiles may be smaller. Tile t = ty * tilesX + tx covers grid rows
+ * [ty * aTileSize, (ty + 1) * aTileSize) and likewise columns, in every
+ * channel
+ *
+ * @param[in] aWidth Grid columns
+ * @param[in] aHeight Grid rows
+ * @param[in] aTileSize Tile side in grid points (> 0)
+ * @param[out] aTilesX Number of tiles along a row (optional)
+ * @return size_t number of tiles
+ */
+size_t numGridTiles(const size_t aWidth, const size_t aHeight,
+                    const size_t aTileSize, size_t *aTilesX) {
+    assert(aTileSize > 0);
+
+    const size_t tilesX = (aWidth + aTileSize - 1) / aTileSize;
+    const size_t tilesY = (aHeight + aTileSize - 1) / aTileSize;
+    if (aTilesX) *aTilesX = tilesX;
+
+    return tilesX * tilesY;
+}
+
+/**
+ * @brief Sum the 21 upper-triangle Hessian terms of each tile of the sampling
+ * grid, so that a tile can later be taken out of (or down-weighted in) the
+ * Hessian by subtracting its terms
+ * @note Scalar, exact float products summed in double in a fixed order (the
+ * same bits on every build, and whatever the pool); tiles are not contiguous
+ * in the planes, so the vector kernels do not apply
+ *
+ * @see numGridTiles()
+ *
+ * @param[in] aImages Steepest descent images (6 planes of grid size times
+ * channels, one grid after the other)
+ * @param[in] aWidth Grid columns
+ * @param[in] aHeight Grid rows
+ * @param[in] aTileSize Tile side in grid points
+ * @param[out] aTerms Tile sums, KLT_HESSIAN_TERMS per tile, tile by tile
+ * @param[in] aPool Pool to split rows of tiles over (nullptr: calling thread
+ * only)
+ */
+void accumulateTileHessians(const AlignedPlanes &aImages, const size_t aWidth,
+                            const size_t aHeight, const size_t aTileSize,
+                            std::vector<double> &aTerms, ThreadPool *aPool) {
+    assert(aImages.numPlanes() == 6);
+
+    const size_t N_GRID = aWidth * aHeight;
+    const size_t channels = N_GRID ? aImages.size() / N_GRID : 0;
+
+    size_t tilesX;
+    const size_t numTiles = numGridTiles(aWidth, aHeight, aTileSize, &tilesX);
+    const size_t tilesY = tilesX ? numTiles / tilesX : 0;
+
+    aTerms.assign(numTiles * KLT_HESSIAN_TERMS, 0);
+
+    const float *j[6];
+    for (int k = 0; k < 6; k++)
+        j[k] = aImages.plane(k);
+
+    const auto sumTileRows = [&](const size_t aBegin, const size_t aEnd) {
+        for (size_t ty = aBegin; ty < aEnd; ty++) {
+            const size_t rowBegin = ty * aTileSize;
+            const size_t rowEnd = std::min(aHeight, rowBegin + aTileSize);
+
+            for (size_t tx = 0; tx < tilesX; tx++) {
+                const size_t colBegin = tx * aTileSize;
+                const size_t colEnd = std::min(aWidth, colBegin + aTileSize);
+                double *terms =
+                    &aTerms[(ty * tilesX + tx) * KLT_HESSIAN_TERMS];
+
+                for (size_t c = 0; c < channels; c++) {
+                    for (size_t row = rowBegin; row < rowEnd; row++) {
+                        const size_t offset = c * N_GRID + row * aWidth;
+
+                        for (size_t i = offset + colBegin;
+                             i < offset + colEnd; i++) {
+                            int t = 0;
+                            for (int a = 0; a < 6; a++) {
+                                const float va = j[a][i];
+                                for (int b = a; b < 6; b++)
+                                    terms[t++] +=
+                                        static_cast<double>(va) * j[b][i];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    if (aPool)
+        aPool->parallelFor(tilesY, sumTileRows);
+    else
+        sumTileRows(0, tilesY);
+}
+
+/**
+ * @brief Box-centred, scale-normalised coordinate frame of a BBOX
+ *
+ * @param[in] aX0 BBOX left
+ * @param[in] aY0 BBOX top
+ * @param[in] aX1 BBOX right
+ * @param[in] aY1 BBOX bottom
+ * @param[out] aFrame Centre and scale
+ */
+void makeBoxFrame(const double aX0, const double aY0, const double aX1,
+                  const double aY1, BoxFrame &aFrame) {
+    aFrame.centre[0] = 0.5 * (aX0 + aX1);
+    aFrame.centre[1] = 0.5 * (aY0 + aY1);
+    aFrame.scale = 0.5 * std::max(std::abs(aX1 - aX0), std::abs(aY1 - aY0));
+
+    // Degenerate BBOX: stay in pixels
+    if (!(aFrame.scale > 0)) aFrame.scale = 1;
+}
+
+/**
+ * @brief Convert an affine warp of box coordinates to the same warp of image
+ * coordinates: x' = c + s * W_box((x - c) / s), ie. the linear part is
+ * unchanged and t = s * t_box + c - A * c
+ * @note Plain scalar arithmetic, so deterministic mode gives the same bits on
+ * every build
+ *
+ * @param[in] aFrame Box frame
+ * @param[in] aBoxWarp Warp of box coordinates
+ * @param[out] aImageWarp Warp of image coordinates
+ */
+void boxToImageWarp(const BoxFrame &aFrame, const Eigen::Matrix3d &aBoxWarp,
+                    Eigen::Matrix3d &aImageWarp) {
+    const double cx = aFrame.centre[0], cy = aFrame.centre[1];
+
+    aImageWarp = aBoxWarp;
+    aImageWarp(0, 2) = aFrame.scale * aBoxWarp(0, 2) + cx -
+                       (aBoxWarp(0, 0) * cx + aBoxWarp(0, 1) * cy);
+    aImageWarp(1, 2) = aFrame.scale * aBoxWarp(1, 2) + cy -
+                       (aBoxWarp(1, 0) * cx + aBoxWarp(1, 1) * cy);
+}
+
+/**
+ * @brief Convert an affine warp of image coordinates to the same warp of box
+ * coordinates (inverse of boxToImageWarp())
+ *
+ * @param[in] aFrame Box frame
+ * @param[in] aImageWarp Warp of image coordinates
+ * @param[out] aBoxWarp Warp of box coordinates
+ */
+void imageToBoxWarp(const BoxFrame &aFrame, const Eigen::Matrix3d &aImageWarp,
+                    Eigen::Matrix3d &aBoxWarp) {
+    const double cx = aFrame.centre[0], cy = aFrame.centre[1];
+
+    aBoxWarp = aImageWarp;
+    aBoxWarp(0, 2) = (aImageWarp(0, 2) - cx +
+                      (aImageWarp(0, 0) * cx + aImageWarp(0, 1) * cy)) /
+                     aFrame.scale;
+    aBoxWarp(1, 2) = (aImageWarp(1, 2) - cy +
+                      (aImageWarp(1, 0) * cx + aImageWarp(1, 1) * cy)) /
+                     aFrame.scale;
+}
+
+/**
+ * @brief Dot product in double over four interleaved partial sums, combined in
+ * a fixed order (the same bits on every build, without a serial dependency
+ * through one accumulator)
+ *
+ * @param[in] aA First vector
+ * @param[in] aB Second vector
+ * @param[in] aSize Length
+ * @return Dot product
+ */
+static double dotFixedOrder(const double *aA, const double *aB,
+                            const size_t aSize) {
+    double sums[4] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + 4 <= aSize; i += 4) {
+        sums[0] += aA[i] * aB[i];
+        sums[1] += aA[i + 1] * aB[i + 1];
+        sums[2] += aA[i + 2] * aB[i + 2];
+        sums[3] += aA[i + 3] * aB[i + 3];
+    }
+    for (; i < aSize; i++)
+        sums[i & 3] += aA[i] * aB[i];
+
+    return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
+
+/**
+ * @brief Orthonormal principal components of sample vectors about their mean,
+ * from the eigenvectors of their (small) Gram matrix. Plain scalar loops
+ * throughout, so the basis is the same on every build
+ *
+ * @param[in] aSamples Sample vectors (eg. recent templates), all the same size
+ * @param[in] aNumModes Max number of components
+ * @param[in] aMinVariance Components with less variance per sample point are
+ * dropped (eg. all of them if the samples are identical)
+ * @param[out] aBasis Components, one per column, strongest first (at most
+ * aSamples.size() - 1, possibly none)
+ */
+void buildAppearanceBasis(const std::vector<Eigen::VectorXd> &aSamples,
+                          const size_t aNumModes, const double aMinVariance,
+                          Eigen::MatrixXd &aBasis) {
+    const size_t m = aSamples.size();
+    const size_t n = (m > 0) ? aSamples[0].size() : 0;
+
+    aBasis.resize(n, 0);
+    if (m < 2 || aNumModes == 0) return;
+
+    // Centred samples (n x m), built a column at a time
+    std::vector<double> mean(aSamples[0].data(), aSamples[0].data() + n);
+    for (size_t j = 1; j < m; j++) {
+        const double *sample = aSamples[j].data();
+        for (size_t i = 0; i < n; i++)
+            mean[i] += sample[i];
+    }
+    for (size_t i = 0; i < n; i++)
+        mean[i] /= m;
+
+    Eigen::MatrixXd centred(n, m);
+    for (size_t j = 0; j < m; j++) {
+        const double *sample = aSamples[j].data();
+        double *column = &centred(0, j);
+        for (size_t i = 0; i < n; i++)
+            column[i] = sample[i] - mean[i];
+    }
+
+    Eigen::MatrixXd gram(m, m);
+    for (size_t a = 0; a < m; a++) {
+        for (size_t b = a; b < m; b++) {
+            const double sum =
+                dotFixedOrder(&centred(0, a), &centred(0, b), n);
+            gram(a, b) = sum;
+            gram(b, a) = sum;
+        }
+    }
+
+    Eigen::VectorXd values;
+    Eigen::MatrixXd vectors;
+    eigenSymmetricFixedOrder(gram, values, vectors);
+
+    // Components are the centred samples combined by the eigenvectors;
+    // re-orthonormalised (modified Gram-Schmidt) against rounding
+    const size_t numModes = std::min(aNumModes, m - 1);
+    Eigen::MatrixXd basis(n, numModes);
+    size_t kept = 0;
+
+    for (size_t k = 0; k < numModes; k++) {
+        if (!(values(k) > aMinVariance * n)) break;
+
+        double *component = &basis(0, kept);
+        for (size_t i = 0; i < n; i++)
+            component[i] = 0;
+        for (size_t j = 0; j < m; j++) {
+            const double *sample = &centred(0, j);
+            const double weight = vectors(j, k);
+            for (size_t i = 0; i < n; i++)
+                component[i] += weight * sample[i];
+        }
+
+        for (size_t c = 0; c < kept; c++) {
+            const double dot =
+                dotFixedOrder(&basis(0, c), &basis(0, kept), n);
+            for (size_t i = 0; i < n; i++)
+                basis(i, kept) -= dot * basis(i, c);
+        }
+
+        const double squaredNorm =
+            dotFixedOrder(&basis(0, kept), &basis(0, kept), n);
+        if (!(squaredNorm > 0)) break;
+
+        const double norm = std::sqrt(squaredNorm);
+        for (size_t i = 0; i < n; i++)
+            basis(i, kept) /= norm;
+
+        kept++;
+    }
+
+    aBasis = basis.leftCols(kept);
+}
+
+/**
+ * @brief Project an orthonormal basis out of float planes: each plane loses
+ * its components along the basis, so that it is orthogonal to all of it.
+ * Computed in double in plain scalar loops (the same on every build), then
+ * stored back in float
+ *
+ * @param[in] aBasis Orthonormal basis, one column per vector, as long as the
+ * planes
+ * @param[in,out] aImages Planes (eg. the steepest descent images)
+ */
+void projectOutBasis(const Eigen::MatrixXd &aBasis, AlignedPlanes &aImages) {
+    const size_t n = aImages.size();
+    assert(static_cast<size_t>(aBasis.rows()) == n);
+
+    std::vector<double> values(n);
+
+    for (size_t k = 0; k < aImages.numPlanes(); k++) {
+        float *plane = aImages.plane(k);
+        for (size_t i = 0; i < n; i++)
+            values[i] = plane[i];
+
+        for (Eigen::Index c = 0; c < aBasis.cols(); c++) {
+            const double dot = dotFixedOrder(&aBasis(0, c), values.data(), n);
+            for (size_t i = 0; i < n; i++)
+                values[i] -= dot * aBasis(i, c);
+        }
+
+        for (size_t i = 0; i < n; i++)
+            plane[i] = static_cast<float>(values[i]);
+    }
+}
+
+/**
+ * @brief Eigen decomposition of a small symmetric matrix by cyclic Jacobi
+ * rotations, in plain scalar loops
+ * @note Gives the same bits on every build (with FP contraction disabled),
+ * unlike Eigen's solvers
+ *
+ * @param[in] aMatrix Symmetric matrix
+ * @param[out] aValues Eigenvalues, largest first
+ * @param[out] aVectors Unit eigenvectors, one per column, in the same order
+ */
+void eigenSymmetricFixedOrder(const Eigen::MatrixXd &aMatrix,
+                              Eigen::VectorXd &aValues,
+                              Eigen::MatrixXd &aVectors) {
+    const Eigen::Index n = aMatrix.rows();
+    Eigen::MatrixXd a = aMatrix;
+    aVectors = Eigen::MatrixXd::Identity(n, n);
+
+    double total = 0;
+    for (Eigen::Index p = 0; p < n; p++)
+        for (Eigen::Index q = 0; q < n; q++)
+            total += a(p, q) * a(p, q);
+
+    for (int sweep = 0; sweep < KLT_JACOBI_MAX_SWEEPS; sweep++) {
+        double offDiagonal = 0;
+        for (Eigen::Index p = 0; p < n; p++)
+            for (Eigen::Index q = p + 1; q < n; q++)
+                offDiagonal += a(p, q) * a(p, q);
+
+        if (!(offDiagonal > 1e-30 * total)) break;
+
+        for (Eigen::Index p = 0; p < n; p++) {
+            for (Eigen::Index q = p + 1; q < n; q++) {
+                if (a(p, q) == 0) continue;
+
+                // Rotation that zeroes a(p, q)
+                const double theta = (a(q, q) - a(p, p)) / (2 * a(p, q));
+                const double t =
+                    ((theta >= 0) ? 1.0 : -1.0) /
+                    (std::abs(theta) + std::sqrt(theta * theta + 1));
+                const double c = 1 / std::sqrt(t * t + 1);
+                const double s = t * c;
+
+                for (Eigen::Index k = 0; k < n; k++) {
+                    const double akp = a(k, p), akq = a(k, q);
+                    a(k, p) = c * akp - s * akq;
+                    a(k, q) = s * akp + c * akq;
+                }
+                for (Eigen::Index k = 0; k < n; k++) {
+                    const double apk = a(p, k), aqk = a(q, k);
+                    a(p, k) = c * apk - s * aqk;
+                    a(q, k) = s * apk + c * aqk;
+                }
+                for (Eigen::Index k = 0; k < n; k++) {
+                    const double vkp = aVectors(k, p), vkq = aVectors(k, q);
+                    aVectors(k, p) = c * vkp - s * vkq;
+                    aVectors(k, q) = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+
+    // Largest first (selection sort, ties keep their order)
+    aValues = a.diagonal();
+    for (Eigen::Index i = 0; i < n; i++) {
+        Eigen::Index largest = i;
+        for (Eigen::Index j = i + 1; j < n; j++)
+            if (aValues(j) > aValues(largest)) largest = j;
+
+        if (largest != i) {
+            std::swap(aValues(i), aValues(largest));
+            aVectors.col(i).swap(aVectors.col(largest));
+        }
+    }
+}
+
+/**
+ * @brief Invert a 6x6 matrix by Gauss-Jordan elimination with partial
+ * pivoting, in plain scalar loops
+ * @note Unlike Eigen, whose operation order depends on the vector instruction
+ * set, gives the same bits on every build (with FP contraction disabled)
+ *
+ * @param[in] aMatrix Matrix (invertible)
+ * @param[out] aInverse Inverse
+ */
+void invertFixedOrder(const Eigen::Matrix<double, 6, 6> &aMatrix,
+                      Eigen::Matrix<double, 6, 6> &aInverse) {
+    double a[6][12];
+    for (int r = 0; r < 6; r++) {
+        for (int c = 0; c < 6; c++) {
+            a[r][c] = aMatrix(r, c);
+            a[r][c + 6] = (r == c) ? 1.0 : 0.0;
+        }
+    }
+
+    for (int p = 0; p < 6; p++) {
+        int pivot = p;
+        for (int r = p + 1; r < 6; r++)
+            if (std::abs(a[r][p]) > std::abs(a[pivot][p])) pivot = r;
+
+        if (pivot != p)
+            for (int c = 0; c < 12; c++)
+                std::swap(a[p][c], a[pivot][c]);
+
+        const double scale = 1.0 / a[p][p];
+        for (int c = 0; c < 12; c++)
+            a[p][c] *= scale;
+
+        for (int r = 0; r < 6; r++) {
+            if (r == p) continue;
+
+            const double factor = a[r][p];
+            for (int c = 0; c < 12; c++)
+                a[r][c] -= factor * a[p][c];
+        }
+    }
+
+    for (int r = 0; r < 6; r++)
+        for (int c = 0; c < 6; c++)
+            aInverse(r, c) = a[r][c + 6];
+}
+
+/**
+ * @brief One IC warp update in plain scalar loops: deltaP = H^-1 b, then
+ * aWarp *= inverse of the incremental warp of deltaP / aScale
+ *
+ * @see invertFixedOrder()
+ *
+ * @param[in] aHessianInverse Inverse Hessian
+ * @param[in] aVectorB J^T e
+ * @param[in] aScale Box scale: deltaP is in pixels at the box edge, the warp
+ * in box coordinates
+ * @param[in,out] aWarp Affine warp (box coordinates)
+ *
+ * @return double norm of deltaP
+ */
+double updateWarpFixedOrder(const Eigen::Matrix<double, 6, 6> &aHessianInverse,
+                            const Eigen::Matrix<double, 6, 1> &aVectorB,
+                            const double aScale, Eigen::Matrix3d &aWarp) {
+    double p[6];
+    double squaredNorm = 0;
+
+    for (int r = 0; r < 6; r++) {
+        p[r] = 0;
+        for (int c = 0; c < 6; c++)
+            p[r] += aHessianInverse(r, c) * aVectorB(c);
+        squaredNorm += p[r] * p[r];
+    }
+
+    for (int r = 0; r < 6; r++)
+        p[r] /= aScale;
+
+    // Incremental warp [1 + p0, p2, p4; p1, 1 + p3, p5] and its inverse
+    const double a = 1 + p[0], b = p[2], c = p[1], d = 1 + p[3];
+    const double det = a * d - b * c;
+
+    double inv[2][3];
+    inv[0][0] = d / det;
+    inv[0][1] = -b / det;
+    inv[1][0] = -c / det;
+    inv[1][1] = a / det;
+    inv[0][2] = -(inv[0][0] * p[4] + inv[0][1] * p[5]);
+    inv[1][2] = -(inv[1][0] * p[4] + inv[1][1] * p[5]);
+
+    const Eigen::Matrix3d warp = aWarp;
+    for (int r = 0; r < 2; r++) {
+        for (int col = 0; col < 3; col++) {
+            aWarp(r, col) = warp(r, 0) * inv[0][col] + warp(r, 1) * inv[1][col];
+            if (col == 2) aWarp(r, col) += warp(r, 2);
+        }
+    }
+
+    return std::sqrt(squaredNorm);
+}
+
+/**
+ * @brief Precompute indices and weights of one axis of an axis-aligned grid,
+ * with the same truncation and border reflection as
+ * ImageAlignment::getSubPixelValue()
+ *
+ * @param[in] aStart Position of first grid point
+ * @param[in] aDelta Grid spacing
+ * @param[in] aCount Number of grid points
+ * @param[in] aSize Image size along this axis
+ * @param[out] aAxis Indices and weights
+ * @param[in] aFloor Round positions down rather than towards zero, so that
+ * positions in (-1, 0) reflect instead of extrapolating
+ */
+void buildSeparableAxis(const double aStart, const double aDelta,
+                        const int aCount, const int aSize,
+                        SeparableAxis &aAxis, const bool aFloor) {
+    aAxis.index0.resize(aCount);
+    aAxis.index1.resize(aCount);
+    aAxis.weight.resize(aCount);
+
+    for (int k = 0; k < aCount; k++) {
+        const double pos = aStart + aDelta * k;
+        const int intPos = aFloor ? static_cast<int>(std::floor(pos))
+                                  : static_cast<int>(pos);
+
+        aAxis.index0[k] =
+            cv::borderInterpolate(intPos, aSize, cv::BORDER_REFLECT_101);
+        aAxis.index1[k] =
+            cv::borderInterpolate(intPos + 1, aSize, cv::BORDER_REFLECT_101);
+        aAxis.weight[k] = static_cast<float>(pos - intPos);
+    }
+}
+
+/**
+ * @brief Blend two image rows: aOut = aRow0 + aWeight * (aRow1 - aRow0)
+ *
+ * @param[in] aRow0 First row
+ * @param[in] aRow1 Second row
+ * @param[in] aWeight Weight of second row
+ * @param[in] aN Number of pixels
+ * @param[out] aOut Blended row
+ */
+static void blendRows(const float *aRow0, const float *aRow1,
+                      const float aWeight, const size_t aN, float *aOut) {
+    size_t c = 0;
+
+#if defined(__AVX__)
+    const __m256 w = _mm256_set1_ps(aWeight);
+    for (; c + 8 <= aN; c += 8) {
+        const __m256 r0 = _mm256_loadu_ps(aRow0 + c);
+        const __m256 r1 = _mm256_loadu_ps(aRow1 + c);
+        const __m256 diff = _mm256_sub_ps(r1, r0);
+        _mm256_storeu_ps(aOut + c, _mm256_add_ps(r0, _mm256_mul_ps(w, diff)));
+    }
+#elif defined(__SSE2__)
+    const __m128 w = _mm_set1_ps(aWeight);
+    for (; c + 4 <= aN; c += 4) {
+        const __m128 r0 = _mm_loadu_ps(aRow0 + c);
+        const __m128 r1 = _mm_loadu_ps(aRow1 + c);
+        _mm_storeu_ps(aOut + c,
+                      _mm_add_ps(r0, _mm_mul_ps(w, _mm_sub_ps(r1, r0))));
+    }
+#endif
+
+    for (; c < aN; c++)
+        aOut[c] = aRow0[c] + aWeight * (aRow1[c] - aRow0[c]);
+}
+
+/**
+ * @brief Separable bilinear sampling of a float image on an axis-aligned
+ * grid: each output row blends its two source rows once (vectorised, over all
+ * interleaved channels at once), then interpolates horizontally with the
+ * precomputed column weights
+ *
+ * @param[in] aImg Image (CV_32FC1, or interleaved CV_32FC(n))
+ * @param[in] aX Column indices and weights
+ * @param[in] aY Row indices and weights
+ * @param[out] aOut Samples, row by row (aY rows of aX columns), one such plane
+ * per channel
+ * @param[in] aRowBegin First grid row to sample
+ * @param[in] aRowEnd One past last grid row to sample (-1: all rows)
+ * @param[in] aColBegin First grid column to sample
+ * @param[in] aColEnd One past last grid column to sample (-1: all columns)
+ */
+template <typename T>
+static void sampleSeparableImpl(const cv::Mat &aImg, const SeparableAxis &aX,
+                                const SeparableAxis &aY, T *aOut,
+                                const int aRowBegin, const int aRowEnd,
+                                const int aColBegin, const int aColEnd) {
+    assert(aImg.depth() == CV_32F);
+
+    const int cn = aImg.channels();
+    const size_t nX = aX.weight.size();
+    const size_t planeSize = nX * aY.weight.size();
+    const size_t rowEnd = (aRowEnd < 0) ? aY.weight.size() : aRowEnd;
+    const size_t colBegin = aColBegin;
+    const size_t colEnd = (aColEnd < 0) ? nX : aColEnd;
+    if (colEnd <= colBegin || rowEnd <= static_cast<size_t>(aRowBegin))
+        return;
+
+    // Source columns touched by the sampled grid columns
+    int cMin = aX.index0[colBegin], cMax = aX.index0[colBegin];
+    for (size_t j = colBegin; j < colEnd; j++) {
+        cMin = std::min(cMin, std::min(aX.index0[j], aX.index1[j]));
+        cMax = std::max(cMax, std::max(aX.index0[j], aX.index1[j]));
+    }
+
+    std::vector<float> blended((cMax - cMin + 1) * cn);
+
+    for (size_t i = aRowBegin; i < rowEnd; i++) {
+        blendRows(aImg.ptr<float>(aY.index0[i]) + cMin * cn,
+                  aImg.ptr<float>(aY.index1[i]) + cMin * cn, aY.weight[i],
+                  blended.size(), blended.data());
+
+        for (int c = 0; c < cn; c++) {
+            const float *src = blended.data() + c;
+            T *out = aOut + c * planeSize + i * nX;
+
+            for (size_t j = colBegin; j < colEnd; j++) {
+                const float a = src[(aX.index0[j] - cMin) * cn];
+                const float b = src[(aX.index1[j] - cMin) * cn];
+                out[j] = a + aX.weight[j] * (b - a);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Separable bilinear sampling into floats
+ *
+ * @see sampleSeparableImpl()
+ *
+ * @param[in] aImg Image (CV_32FC1, or interleaved CV_32FC(n))
+ * @param[in] aX Column indices and weights
+ * @param[in] aY Row indices and weights
+ * @param[out] aOut Samples, row by row, one grid-sized plane per channel
+ * @param[in] aRowBegin First grid row to sample
+ * @param[in] aRowEnd One past last grid row to sample (-1: all rows)
+ * @param[in] aColBegin First grid column to sample
+ * @param[in] aColEnd One past last grid column to sample (-1: all columns)
+ */
+void sampleSeparable(const cv::Mat &aImg, const SeparableAxis &aX,
+                     const SeparableAxis &aY, float *aOut, const int aRowBegin,
+                     const int aRowEnd, const int aColBegin,
+                     const int aColEnd) {
+    sampleSeparableImpl(aImg, aX, aY, aOut, aRowBegin, aRowEnd, aColBegin,
+                        aColEnd);
+}
+
+/**
+ * @brief Separable bilinear sampling into doubles
+ *
+ * @see sampleSeparableImpl()
+ *
+ * @param[in] aImg Image (CV_32FC1, or interleaved CV_32FC(n))
+ * @param[in] aX Column indices and weights
+ * @param[in] aY Row indices and weights
+ * @param[out] aOut Samples, row by row, one grid-sized plane per channel
+ * @param[in] aRowBegin First grid row to sample
+ * @param[in] aRowEnd One past last grid row to sample (-1: all rows)
+ * @param[in] aColBegin First grid column to sample
+ * @param[in] aColEnd One past last grid column to sample (-1: all columns)
+ */
+void sampleSeparable(const cv::Mat &aImg, const SeparableAxis &aX,
+                     const SeparableAxis &aY, double *aOut, const int aRowBegin,
+                     const int aRowEnd, const int aColBegin,
+                     const int aColEnd) {
+    sampleSeparableImpl(aImg, aX, aY, aOut, aRowBegin, aRowEnd, aColBegin,
+                        aColEnd);
+}
+
+/// @brief Source pixels along one axis that the gradient at one grid point
+/// depends on, with their weights in the smoothing and in the derivative
+/// (bilinear and operator weights combined)
+struct GradientTaps {
+    int index[4];
+    float smooth[4];
+    float derive[4];
+};
+
+/**
+ * @brief Combine bilinear interpolation along one axis with a 3-tap gradient
+ * operator: grid point k of aAxis blends pixels index0[k] and index1[k], and
+ * each of them is filtered with its (border-reflected) neighbours, exactly as
+ * interpolating a full gradient image would
+ *
+ * @param[in] aAxis Indices and weights of the axis
+ * @param[in] aK Grid point
+ * @param[in] aSize Image size along the axis
+ * @param[in] aSide Smoothing weight of the two neighbours
+ * @param[in] aCentre Smoothing weight of the pixel itself
+ * @param[out] aTaps Up to four distinct pixels (unused taps have zero weights)
+ */
+static void buildGradientTaps(const SeparableAxis &aAxis, const size_t aK,
+                              const int aSize, const float aSide,
+                              const float aCentre, GradientTaps &aTaps) {
+    const int i0 = aAxis.index0[aK], i1 = aAxis.index1[aK];
+    const float w1 = aAxis.weight[aK], w0 = 1.0f - w1;
+
+    const int index[6] = {
+        cv::borderInterpolate(i0 - 1, aSize, cv::BORDER_REFLECT_101), i0,
+        cv::borderInterpolate(i0 + 1, aSize, cv::BORDER_REFLECT_101),
+        cv::borderInterpolate(i1 - 1, aSize, cv::BORDER_REFLECT_101), i1,
+        cv::borderInterpolate(i1 + 1, aSize, cv::BORDER_REFLECT_101)
+    };
+    const float smooth[6] = { w0 * aSide, w0 * aCentre, w0 * aSide,
+                              w1 * aSide, w1 * aCentre, w1 * aSide };
+    const float derive[6] = { -0.5f * w0, 0, 0.5f * w0, -0.5f * w1, 0,
+                              0.5f * w1 };
+
+    for (int t = 0; t < 4; t++) {
+        aTaps.index[t] = i0;
+        aTaps.smooth[t] = aTaps.derive[t] = 0;
+    }
+
+    // i1 is the reflected i0 + 1, so at most four pixels are distinct
+    int numTaps = 0;
+    for (int k = 0; k < 6; k++) {
+        int t = 0;
+        while (t < numTaps && aTaps.index[t] != index[k])
+            t++;
+
+        assert(t < 4);
+        if (t == numTaps) {
+            aTaps.index[t] = index[k];
+            numTaps++;
+        }
+
+        aTaps.smooth[t] += smooth[k];
+        aTaps.derive[t] += derive[k];
+    }
+}
+
+/**
+ * @brief Filter four image rows vertically in one pass: aSmoothed and aDerived
+ * are the weighted sums of the rows with the smoothing and derivative weights
+ *
+ * @param[in] aRows Source rows
+ * @param[in] aTaps Vertical taps (weights of the rows)
+ * @param[in] aN Number of floats
+ * @param[out] aSmoothed Vertically smoothed row
+ * @param[out] aDerived Vertically differentiated row
+ */
+static void filterRows(const float *const aRows[4], const GradientTaps &aTaps,
+                       const size_t aN, float *aSmoothed, float *aDerived) {
+    size_t c = 0;
+
+#if defined(__AVX__)
+    __m256 ws[4], wd[4];
+    for (int t = 0; t < 4; t++) {
+        ws[t] = _mm256_set1_ps(aTaps.smooth[t]);
+        wd[t] = _mm256_set1_ps(aTaps.derive[t]);
+    }
+
+    for (; c + 8 <= aN; c += 8) {
+        __m256 r = _mm256_loadu_ps(aRows[0] + c);
+        __m256 s = _mm256_mul_ps(ws[0], r);
+        __m256 d = _mm256_mul_ps(wd[0], r);
+        for (int t = 1; t < 4; t++) {
+            r = _mm256_loadu_ps(aRows[t] + c);
+            s = _mm256_add_ps(s, _mm256_mul_ps(ws[t], r));
+            d = _mm256_add_ps(d, _mm256_mul_ps(wd[t], r));
+        }
+        _mm256_storeu_ps(aSmoothed + c, s);
+        _mm256_storeu_ps(aDerived + c, d);
+    }
+#elif defined(__SSE2__)
+    __m128 ws[4], wd[4];
+    for (int t = 0; t < 4; t++) {
+        ws[t] = _mm_set1_ps(aTaps.smooth[t]);
+        wd[t] = _mm_set1_ps(aTaps.derive[t]);
+    }
+
+    for (; c + 4 <= aN; c += 4) {
+        __m128 r = _mm_loadu_ps(aRows[0] + c);
+        __m128 s = _mm_mul_ps(ws[0], r);
+        __m128 d = _mm_mul_ps(wd[0], r);
+        for (int t = 1; t < 4; t++) {
+            r = _mm_loadu_ps(aRows[t] + c);
+            s = _mm_add_ps(s, _mm_mul_ps(ws[t], r));
+            d = _mm_add_ps(d, _mm_mul_ps(wd[t], r));
+        }
+        _mm_storeu_ps(aSmoothed + c, s);
+        _mm_storeu_ps(aDerived + c, d);
+    }
+#endif
+
+    for (; c < aN; c++) {
+        float s = aTaps.smooth[0] * aRows[0][c];
+        float d = aTaps.derive[0] * aRows[0][c];
+        for (int t = 1; t < 4; t++) {
+            s += aTaps.smooth[t] * aRows[t][c];
+            d += aTaps.derive[t] * aRows[t][c];
+        }
+        aSmoothed[c] = s;
+        aDerived[c] = d;
+    }
+}
+
+/**
+ * @brief Image gradients at the points of an axis-aligned grid, computed from
+ * the image alone (no full gradient images): the bilinearly interpolated
+ * gradient of aOperator, as if sampled from filtered images
+ *
+ * Each grid row filters its (up to) four source rows vertically in one
+ * vectorised pass, over all interleaved channels, into a smoothed and a
+ * differentiated row; each grid point then combines (up to) four columns of
+ * those with precomputed horizontal taps.
+ * @note Float operations are in a fixed order, with separate multiplies and
+ * adds, so results do not depend on the instruction set
+ *
+ * @param[in] aImg Image (CV_32FC1, interleaved CV_32FC(n), or CV_8UC(n))
+ * @param[in] aX Column indices and weights
+ * @param[in] aY Row indices and weights
+ * @param[in] aOperator Gradient operator
+ * @param[out] aGradX x gradients, row by row, one grid-sized plane per channel
+ * @param[out] aGradY y gradients, same layout
+ * @param[in] aRowBegin First grid row to sample
+ * @param[in] aRowEnd One past last grid row to sample (-1: all rows)
+ */
+void sampleGradients(const cv::Mat &aImg, const SeparableAxis &aX,
+                     const SeparableAxis &aY, const GradientOperator aOperator,
+                     float *aGradX, float *aGradY, const int aRowBegin,
+                     const int aRowEnd) {
+    assert(aImg.depth() == CV_32F || aImg.depth() == CV_8U);
+
+    const int cn = aImg.channels();
+    const size_t nX = aX.weight.size();
+    const size_t planeSize = nX * aY.weight.size();
+    const size_t rowEnd = (aRowEnd < 0) ? aY.weight.size() : aRowEnd;
+    if (nX == 0 || rowEnd <= static_cast<size_t>(aRowBegin)) return;
+
+    float side, centre;
+    switch (aOperator) {
+        case GRADIENT_CENTRAL:
+            side = 0.0f;
+            centre = 1.0f;
+            break;
+        case GRADIENT_SCHARR:
+            side = 3.0f / 16;
+            centre = 10.0f / 16;
+            break;
+        case GRADIENT_SOBEL:
+        default:
+            side = 0.25f;
+            centre = 0.5f;
+            break;
+    }
+
+    // Horizontal taps, and source columns touched by them
+    std::vector<GradientTaps> columns(nX);
+    int cMin = aImg.cols, cMax = 0;
+    for (size_t j = 0; j < nX; j++) {
+        buildGradientTaps(aX, j, aImg.cols, side, centre, columns[j]);
+        for (int t = 0; t < 4; t++) {
+            cMin = std::min(cMin, columns[j].index[t]);
+            cMax = std::max(cMax, columns[j].index[t]);
+        }
+    }
+
+    // Column taps as offsets into the filtered rows
+    for (size_t j = 0; j < nX; j++)
+        for (int t = 0; t < 4; t++)
+            columns[j].index[t] = (columns[j].index[t] - cMin) * cn;
+
+    const size_t width = (cMax - cMin + 1) * cn;
+    std::vector<float> smoothed(width), derived(width);
+
+    // 8-bit images: only the span of the source rows in use is converted
+    std::vector<float> converted(aImg.depth() == CV_8U ? 4 * width : 0);
+
+    for (size_t i = aRowBegin; i < rowEnd; i++) {
+        GradientTaps rows;
+        buildGradientTaps(aY, i, aImg.rows, side, centre, rows);
+
+        const float *src[4];
+        for (int t = 0; t < 4; t++) {
+            if (converted.empty()) {
+                src[t] = aImg.ptr<float>(rows.index[t]) + cMin * cn;
+                continue;
+            }
+
+            const unsigned char *row =
+                aImg.ptr<unsigned char>(rows.index[t]) + cMin * cn;
+            float *dst = converted.data() + t * width;
+            for (size_t c = 0; c < width; c++)
+                dst[c] = row[c];
+            src[t] = dst;
+        }
+
+        filterRows(src, rows, width, smoothed.data(), derived.data());
+
+        for (int c = 0; c < cn; c++) {
+            const float *s = smoothed.data() + c;
+            const float *d = derived.data() + c;
+            float *gx = aGradX + c * planeSize + i * nX;
+            float *gy = aGradY + c * planeSize + i * nX;
+
+            for (size_t j = 0; j < nX; j++) {
+                const GradientTaps &col = columns[j];
+
+                float x = col.derive[0] * s[col.index[0]];
+                float y = col.smooth[0] * d[col.index[0]];
+                for (int t = 1; t < 4; t++) {
+                    x += col.derive[t] * s[col.index[t]];
+                    y += col.smooth[t] * d[col.index[t]];
+                }
+
+                gx[j] = x;
+                gy[j] = y;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Check that a fixed-point position has all four bilinear neighbours
+ * inside the image
+ *
+ * @param[in] aPx x-coordinate (16.16, rounding bias included)
+ * @param[in] aPy y-coordinate (16.16, rounding bias included)
+ * @param[in] aCols Image width
+ * @param[in] aRows Image height
+ *
+ * @return true if no border handling is needed
+ */
+static inline bool isInteriorFixed(const int aPx, const int aPy,
+                                   const int aCols, const int aRows) {
+    const int x = aPx >> KLT_FIXED_POSITION_BITS;
+    const int y = aPy >> KLT_FIXED_POSITION_BITS;
+    return x >= 0 && y >= 0 && x < aCols - 1 && y < aRows - 1;
+}
+
+/**
+ * @brief Integer bilinear interpolation of an 8-bit image at one point, with
+ * border reflection
+ *
+ * Rows are blended first, each rounded to KLT_FIXED_SAMPLE_BITS fractional
+ * bits (so that they fit int16), then blended vertically; the vector path of
+ * sampleFixed() does exactly the same integer operations.
+ *
+ * @param[in] aImg Image (CV_8UC1)
+ * @param[in] aPx x-coordinate (16.16, rounding bias included)
+ * @param[in] aPy y-coordinate (16.16, rounding bias included)
+ *
+ * @return int16_t sample in 1/16 grey levels
+ */
+static inline int16_t sampleFixedPoint(const cv::Mat &aImg, const int aPx,
+                                       const int aPy) {
+    const int shift = KLT_FIXED_POSITION_BITS - KLT_FIXED_WEIGHT_BITS;
+    const int one = 1 << KLT_FIXED_WEIGHT_BITS;
+    const int rowShift = KLT_FIXED_WEIGHT_BITS - KLT_FIXED_SAMPLE_BITS;
+
+    const int ix = aPx >> KLT_FIXED_POSITION_BITS;
+    const int iy = aPy >> KLT_FIXED_POSITION_BITS;
+    const int ax = (aPx >> shift) & (one - 1);
+    const int ay = (aPy >> shift) & (one - 1);
+
+    const int x0 = cv::borderInterpolate(ix, aImg.cols, cv::BORDER_REFLECT_101);
+    const int x1 =
+        cv::borderInterpolate(ix + 1, aImg.cols, cv::BORDER_REFLECT_101);
+    const unsigned char *r0 = aImg.ptr<unsigned char>(
+        cv::borderInterpolate(iy, aImg.rows, cv::BORDER_REFLECT_101));
+    const unsigned char *r1 = aImg.ptr<unsigned char>(
+        cv::borderInterpolate(iy + 1, aImg.rows, cv::BORDER_REFLECT_101));
+
+    const int top =
+        (r0[x0] * (one - ax) + r0[x1] * ax + (1 << (rowShift - 1))) >>
+        rowShift;
+    const int bottom =
+        (r1[x0] * (one - ax) + r1[x1] * ax + (1 << (rowShift - 1))) >>
+        rowShift;
+
+    return static_cast<int16_t>(
+        (top * (one - ay) + bottom * ay + (one >> 1)) >> KLT_FIXED_WEIGHT_BITS);
+}
+
+/**
+ * @brief Sample an 8-bit image on an affine grid with integer bilinear
+ * interpolation: positions in 16.16 fixed point, 8-bit weights, samples as
+ * int16 with KLT_FIXED_SAMPLE_BITS fractional bits
+ *
+ * Grid point (i, j) is at aOrigin + j * aColStep + i * aRowStep. Interior
+ * points are blended four at a time with pmaddwd (SSE2), border points one at
+ * a time with reflection; both give the same integers, so results do not
+ * depend on the instruction set.
+ *
+ * @param[in] aImg Image (CV_8UC1)
+ * @param[in] aOrigin Position of grid point (0, 0)
+ * @param[in] aColStep Position step between grid columns
+ * @param[in] aRowStep Position step between grid rows
+ * @param[in] aNX Grid width
+ * @param[in] aNY Grid height
+ * @param[out] aOut Samples, row by row
+ * @param[in] aRowBegin First grid row to sample
+ * @param[in] aRowEnd One past last grid row to sample (-1: all rows)
+ * @param[in] aColBegin First grid column to sample
+ * @param[in] aColEnd One past last grid column to sample (-1: all columns)
+ */
+void sampleFixed(const cv::Mat &aImg, const double aOrigin[2],
+                 const double aColStep[2], const double aRowStep[2],
+                 const int aNX, const int aNY, int16_t *aOut,
+                 const int aRowBegin, const int aRowEnd, const int aColBegin,
+                 const int aColEnd) {
+    assert(aImg.type() == CV_8UC1);
+
+    const int rowEnd = (aRowEnd < 0) ? aNY : aRowEnd;
+    const int colEnd = (aColEnd < 0) ? aNX : aColEnd;
+    const double one = 1 << KLT_FIXED_POSITION_BITS;
+
+    // Rounds positions to the nearest weight step when the weights are taken
+    // from the top fractional bits
+    const int bias = 1 << (KLT_FIXED_POSITION_BITS - KLT_FIXED_WEIGHT_BITS - 1);
+
+    // Positions must fit in 16.16 (int32)
+    const double limit = 1 << (30 - KLT_FIXED_POSITION_BITS);
+
+    const int sx = static_cast<int>(std::lround(aColStep[0] * one));
+    const int sy = static_cast<int>(std::lround(aColStep[1] * one));
+
+    for (int i = aRowBegin; i < rowEnd; i++) {
+        int16_t *out = aOut + static_cast<size_t>(i) * aNX;
+
+        const double x = aOrigin[0] + aRowStep[0] * i;
+        const double y = aOrigin[1] + aRowStep[1] * i;
+        const double xEnd = x + aColStep[0] * (aNX - 1);
+        const double yEnd = y + aColStep[1] * (aNX - 1);
+
+        // Far outside the image (eg. a diverging warp): clamp each point
+        if (std::max(std::abs(x), std::abs(xEnd)) >= limit ||
+            std::max(std::abs(y), std::abs(yEnd)) >= limit) {
+            for (int j = aColBegin; j < colEnd; j++) {
+                const double px = std::min(
+                    std::max(x + aColStep[0] * j, -limit), limit);
+                const double py = std::min(
+                    std::max(y + aColStep[1] * j, -limit), limit);
+                out[j] = sampleFixedPoint(
+                    aImg, static_cast<int>(std::lround(px * one)) + bias,
+                    static_cast<int>(std::lround(py * one)) + bias);
+            }
+            continue;
+        }
+
+        const int px = static_cast<int>(std::lround(x * one)) + bias;
+        const int py = static_cast<int>(std::lround(y * one)) + bias;
+
+        int j = aColBegin;
+
+#if defined(__SSE2__)
+        const int one8 = 1 << KLT_FIXED_WEIGHT_BITS;
+        const int rowShift = KLT_FIXED_WEIGHT_BITS - KLT_FIXED_SAMPLE_BITS;
+        const int shift = KLT_FIXED_POSITION_BITS - KLT_FIXED_WEIGHT_BITS;
+
+        const __m128i weightOne = _mm_set1_epi32(one8);
+        const __m128i weightMask = _mm_set1_epi32(one8 - 1);
+        const __m128i rowRound = _mm_set1_epi32(1 << (rowShift - 1));
+        const __m128i round = _mm_set1_epi32(one8 >> 1);
+        const size_t step = aImg.step;
+        const unsigned char *data = aImg.ptr<unsigned char>();
+
+        for (; j + 4 <= colEnd; j += 4) {
+            int pxs[4], pys[4];
+            for (int k = 0; k < 4; k++) {
+                pxs[k] = px + (j + k) * sx;
+                pys[k] = py + (j + k) * sy;
+            }
+
+            // Positions are linear in j, so two interior ends make all four
+            // interior
+            if (!isInteriorFixed(pxs[0], pys[0], aImg.cols, aImg.rows) ||
+                !isInteriorFixed(pxs[3], pys[3], aImg.cols, aImg.rows)) {
+                for (int k = 0; k < 4; k++)
+                    out[j + k] = sampleFixedPoint(aImg, pxs[k], pys[k]);
+                continue;
+            }
+
+            // Pixel pairs (left, right) as int16 pairs of each int32 lane
+            int top[4], bottom[4];
+            for (int k = 0; k < 4; k++) {
+                const unsigned char *p =
+                    data + (pys[k] >> KLT_FIXED_POSITION_BITS) * step +
+                    (pxs[k] >> KLT_FIXED_POSITION_BITS);
+                top[k] = p[0] | (p[1] << 16);
+                bottom[k] = p[step] | (p[step + 1] << 16);
+            }
+
+            // Weight pairs (1 - a, a), likewise
+            const __m128i ax = _mm_and_si128(
+                _mm_srli_epi32(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(pxs)),
+                    shift),
+                weightMask);
+            const __m128i ay = _mm_and_si128(
+                _mm_srli_epi32(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(pys)),
+                    shift),
+                weightMask);
+            const __m128i wx = _mm_or_si128(_mm_sub_epi32(weightOne, ax),
+                                            _mm_slli_epi32(ax, 16));
+            const __m128i wy = _mm_or_si128(_mm_sub_epi32(weightOne, ay),
+                                            _mm_slli_epi32(ay, 16));
+
+            const __m128i t = _mm_srai_epi32(
+                _mm_add_epi32(
+                    _mm_madd_epi16(_mm_loadu_si128(
+                                       reinterpret_cast<const __m128i *>(top)),
+                                   wx),
+                    rowRound),
+                rowShift);
+            const __m128i b = _mm_srai_epi32(
+                _mm_add_epi32(
+                    _mm_madd_epi16(
+                        _mm_loadu_si128(
+                            reinterpret_cast<const __m128i *>(bottom)),
+                        wx),
+                    rowRound),
+                rowShift);
+
+            const __m128i v = _mm_srai_epi32(
+                _mm_add_epi32(
+                    _mm_madd_epi16(_mm_or_si128(t, _mm_slli_epi32(b, 16)), wy),
+                    round),
+                KLT_FIXED_WEIGHT_BITS);
+
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(out + j),
+                             _mm_packs_epi32(v, v));
+        }
+#endif
+
+        for (; j < colEnd; j++)
+            out[j] = sampleFixedPoint(aImg, px + j * sx, py + j * sy);
+    }
+}
+
+/**
+ * @brief Quantise float planes (eg. steepest descent images) to int16, each
+ * with its own power-of-two scale: plane k is scaled by 2^aShifts[k] so that
+ * its largest magnitude is at most 2^KLT_FIXED_SD_BITS
+ * @note Power-of-two scales make dequantisation exact, so quantising
+ * dequantised planes again gives the same values and scales
+ *
+ * @param[in] aImages Float planes
+ * @param[out] aFixed Quantised planes (resized like aImages)
+ * @param[out] aShifts Scale exponent of each plane
+ */
+void quantisePlanes(const AlignedPlanes &aImages, FixedPlanes &aFixed,
+                    int aShifts[]) {
+    const size_t n = aImages.size();
+    aFixed.resize(aImages.numPlanes(), n);
+
+    for (size_t k = 0; k < aImages.numPlanes(); k++) {
+        const float *src = aImages.plane(k);
+        int16_t *dst = aFixed.plane(k);
+
+        float maxAbs = 0;
+        for (size_t i = 0; i < n; i++)
+            maxAbs = std::max(maxAbs, std::abs(src[i]));
+
+        // maxAbs = m * 2^e, m in [0.5, 1)
+        int exponent = 0;
+        if (maxAbs > 0) std::frexp(maxAbs, &exponent);
+        aShifts[k] = KLT_FIXED_SD_BITS - exponent;
+
+        // Scaling by a power of two is exact
+        const float scale = std::ldexp(1.0f, aShifts[k]);
+        size_t i = 0;
+
+#if defined(__SSE2__)
+        // cvtps2dq rounds like lrint() (to nearest even)
+        const __m128 scales = _mm_set1_ps(scale);
+        for (; i + 8 <= n; i += 8) {
+            const __m128i lo = _mm_cvtps_epi32(
+                _mm_mul_ps(_mm_loadu_ps(src + i), scales));
+            const __m128i hi = _mm_cvtps_epi32(
+                _mm_mul_ps(_mm_loadu_ps(src + i + 4), scales));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                             _mm_packs_epi32(lo, hi));
+        }
+#endif
+
+        for (; i < n; i++)
+            dst[i] = static_cast<int16_t>(std::lrint(src[i] * scale));
+    }
+}
+
+/**
+ * @brief Replace float planes by the (exact) values of their quantisation
+ *
+ * @see quantisePlanes()
+ *
+ * @param[in] aFixed Quantised planes
+ * @param[in] aShifts Scale exponent of each plane
+ * @param[out] aImages Float planes (resized like aFixed)
+ */
+void dequantisePlanes(const FixedPlanes &aFixed, const int aShifts[],
+                      AlignedPlanes &aImages) {
+    const size_t n = aFixed.size();
+    aImages.resize(aFixed.numPlanes(), n);
+
+    for (size_t k = 0; k < aFixed.numPlanes(); k++) {
+        const int16_t *src = aFixed.plane(k);
+        float *dst = aImages.plane(k);
+
+        const float scale = std::ldexp(1.0f, -aShifts[k]);
+        for (size_t i = 0; i < n; i++)
+            dst[i] = src[i] * scale;
+    }
+}
+
+/**
+ * @brief Fixed-point error and J^T e of one block of KLT_KERNEL_BLOCK pixels:
+ * e = warped - template in int16, squared error and products with the
+ * quantised steepest descent images by pmaddwd into int32 lanes, widened to
+ * int64 every KLT_FIXED_CHUNK pixels
+ * @note Integer sums are exact, so results do not depend on the instruction
+ * set, the order of blocks or the thread count
+ *
+ * @param[in] aImages Quantised steepest descent images (6 planes)
+ * @param[in] aTemplate Template samples (1 plane, same size)
+ * @param[in] aWarped Warped samples (1 plane, same size, zero padding)
+ * @param[in] aBlock Block index
+ * @param[out] aSums Squared error, then the six (scaled) J^T e terms
+ */
+void projectErrorFixedBlock(const FixedPlanes &aImages,
+                            const FixedPlanes &aTemplate,
+                            const FixedPlanes &aWarped, const size_t aBlock,
+                            int64_t aSums[7]) {
+    assert(aImages.numPlanes() == 6);
+    assert(aTemplate.stride() == aImages.stride() &&
+           aWarped.stride() == aImages.stride());
+
+    const int16_t *j[6];
+    for (int k = 0; k < 6; k++)
+        j[k] = aImages.plane(k);
+
+    const int16_t *t = aTemplate.plane(0);
+    const int16_t *w = aWarped.plane(0);
+
+    const size_t block = aBlock * KLT_KERNEL_BLOCK;
+    const size_t blockEnd =
+        std::min(aImages.stride(), block + KLT_KERNEL_BLOCK);
+
+    for (int k = 0; k < 7; k++)
+        aSums[k] = 0;
+
+    for (size_t chunk = block; chunk < blockEnd; chunk += KLT_FIXED_CHUNK) {
+        const size_t chunkEnd = std::min(blockEnd, chunk + KLT_FIXED_CHUNK);
+
+#if defined(__AVX2__)
+        __m256i acc[7];
+        for (int k = 0; k < 7; k++)
+            acc[k] = _mm256_setzero_si256();
+
+        for (size_t i = chunk; i < chunkEnd; i += 16) {
+            const __m256i e = _mm256_sub_epi16(
+                _mm256_load_si256(reinterpret_cast<const __m256i *>(w + i)),
+                _mm256_load_si256(reinterpret_cast<const __m256i *>(t + i)));
+
+            acc[0] = _mm256_add_epi32(acc[0], _mm256_madd_epi16(e, e));
+            for (int k = 0; k < 6; k++)
+                acc[k + 1] = _mm256_add_epi32(
+                    acc[k + 1],
+                    _mm256_madd_epi16(_mm256_load_si256(
+                                          reinterpret_cast<const __m256i *>(
+                                              j[k] + i)),
+                                      e));
+        }
+
+        for (int k = 0; k < 7; k++) {
+            alignas(32) int32_t lanes[8];
+            _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), acc[k]);
+            for (int l = 0; l < 8; l++)
+                aSums[k] += lanes[l];
+        }
+#elif defined(__SSE2__)
+        __m128i acc[7];
+        for (int k = 0; k < 7; k++)
+            acc[k] = _mm_setzero_si128();
+
+        for (size_t i = chunk; i < chunkEnd; i += 8) {
+            const __m128i e = _mm_sub_epi16(
+                _mm_load_si128(reinterpret_cast<const __m128i *>(w + i)),
+                _mm_load_si128(reinterpret_cast<const __m128i *>(t + i)));
+
+            acc[0] = _mm_add_epi32(acc[0], _mm_madd_epi16(e, e));
+            for (int k = 0; k < 6; k++)
+                acc[k + 1] = _mm_add_epi32(
+                    acc[k + 1],
+                    _mm_madd_epi16(
+                        _mm_load_si128(
+                            reinterpret_cast<const __m128i *>(j[k] + i)),
+                        e));
+        }
+
+        for (int k = 0; k < 7; k++) {
+            alignas(16) int32_t lanes[4];
+            _mm_store_si128(reinterpret_cast<__m128i *>(lanes), acc[k]);
+            for (int l = 0; l < 4; l++)
+                aSums[k] += lanes[l];
+        }
+#else
+        for (size_t i = chunk; i < chunkEnd; i++) {
+            const int32_t e = w[i] - t[i];
+            aSums[0] += e * e;
+            for (int k = 0; k < 6; k++)
+                aSums[k + 1] += j[k][i] * e;
+        }
+#endif
+    }
+}
@@ -0,0 +1,257 @@
+/**
+ * @file AlignmentKernels.hpp
+ * @author Samuel Leong (samleocw@gmail.com)
+ * @brief Hand-vectorised inner loops of image alignment
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2020
+ */
+
+#ifndef __ALIGNMENT_KERNELS_H__
+#define __ALIGNMENT_KERNELS_H__
+
+#include <Eigen/Dense>
+#include <cstddef>
+#include <cstdint>
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+#include "ThreadPool.hpp"
+
+/// @brief Number of unique entries of the (symmetric) 6x6 Hessian
+#define KLT_HESSIAN_TERMS 21
+
+/// @brief Alignment (bytes) of plane storage; planes are padded to a multiple
+/// of this
+#define KLT_PLANE_ALIGN 64
+
+/// @brief Pixels summed in float before adding into double totals. Also the
+/// unit of parallel reductions: blocks are fixed by this size alone and their
+/// sums combined in block order, so results do not depend on the thread count
+#define KLT_KERNEL_BLOCK 1024
+
+/// @brief Fractional bits of fixed-point sample positions (16.16)
+#define KLT_FIXED_POSITION_BITS 16
+
+/// @brief Fractional bits of fixed-point bilinear weights (8-bit weights)
+#define KLT_FIXED_WEIGHT_BITS 8
+
+/// @brief Fractional bits of fixed-point samples: int16 in 1/16 grey levels,
+/// so samples and errors stay within +-(255 << 4)
+#define KLT_FIXED_SAMPLE_BITS 4
+
+/// @brief Steepest descent values are quantised to int16 of magnitude at most
+/// 2^KLT_FIXED_SD_BITS, with a power-of-two scale per plane
+#define KLT_FIXED_SD_BITS 11
+
+/// @brief Max Jacobi sweeps of eigenSymmetricFixedOrder() (converges in well
+/// under 10 for small matrices)
+#define KLT_JACOBI_MAX_SWEEPS 50
+
+/// @brief Pixels summed in int32 vector lanes before widening to int64: with
+/// SSE2 each lane sums KLT_FIXED_CHUNK / 4 products of at most 2^11 * 4080
+/// (J^T e) or 4080^2 (squared error), both below 2^31
+#define KLT_FIXED_CHUNK 512
+
+/// @brief How the float plane kernels sum within a block of KLT_KERNEL_BLOCK
+/// pixels (block sums are always combined in double, in block order)
+enum Summation : uint32_t {
+    /// @brief Float vector lanes (fastest)
+    SUMMATION_FLOAT = 0,
+
+    /// @brief Float vector lanes with Kahan compensation: close to double
+    /// accuracy at float storage and bandwidth
+    SUMMATION_COMPENSATED = 1,
+
+    /// @brief Scalar, exact float products summed in double in pixel order:
+    /// the same bits on every build (deterministic mode)
+    SUMMATION_FIXED_ORDER = 2
+};
+
+/// @brief Image gradient operator, normalised to the derivative per pixel
+enum GradientOperator : uint32_t {
+    /// @brief 3x3 Sobel: [-1 0 1] / 2 derivative, [1 2 1] / 4 smoothing (ie.
+    /// cv::Sobel() / 8)
+    GRADIENT_SOBEL = 0,
+
+    /// @brief [-1 0 1] / 2 derivative without smoothing (cheapest, most
+    /// sensitive to noise)
+    GRADIENT_CENTRAL = 1,
+
+    /// @brief 3x3 Scharr: [-1 0 1] / 2 derivative, [3 10 3] / 16 smoothing
+    /// (cv::Scharr() / 32; most accurate gradient direction)
+    GRADIENT_SCHARR = 2
+};
+
+/// @brief Storage of template samples and steepest descent images of float
+/// frames (8-bit frames always use the fixed-point pipeline)
+enum StoragePrecision : uint32_t {
+    /// @brief Double template samples and float steepest descent images
+    STORAGE_FLOAT = 0,
+
+    /// @brief IEEE half precision (fp16) for both, converted to float inside
+    /// the kernels (F16C when the build targets it): 14 instead of 32 bytes
+    /// per grid point
+    STORAGE_HALF = 1
+};
+
+/**
+ * @brief Planes Class
+ *
+ * Equally sized planes of T (eg. the six steepest descent images) in one
+ * 64-byte aligned buffer. Each plane starts on a 64-byte boundary and is
+ * zero-padded to a multiple of 64 bytes (16 floats, 32 int16 or fp16 values),
+ * so that kernels stream whole vectors with aligned loads and need no scalar
+ * tail. Instantiated for the float, fixed-point and half precision pipelines
+ * only (see the typedefs below).
+ *
+ * @tparam T Value type (float, int16_t, or uint16_t fp16 bit patterns)
+ */
+template <typename T> class Planes {
+  private:
+    /// @brief Buffer of mNumPlanes * mStride values
+    T *mData = nullptr;
+
+    /// @brief Number of planes, values per plane, and padded plane length
+    size_t mNumPlanes = 0, mSize = 0, mStride = 0;
+
+  public:
+    // Constructor
+    Planes();
+    Planes(const size_t aNumPlanes, const size_t aSize);
+    Planes(const Planes &aOther);
+    Planes &operator=(const Planes &aOther);
+    ~Planes();
+
+    void resize(const size_t aNumPlanes, const size_t aSize);
+
+    size_t numPlanes() const;
+    size_t size() const;
+    size_t stride() const;
+    size_t bytes() const;
+
+    T *plane(const size_t aIndex);
+    const T *plane(const size_t aIndex) const;
+};
+
+/// @brief Float planes (steepest descent images, sampled frames)
+typedef Planes<float> AlignedPlanes;
+
+/// @brief int16 planes for the fixed-point pipeline
+typedef Planes<int16_t> FixedPlanes;
+
+/// @brief IEEE half precision bit patterns, for compact template storage
+typedef Planes<uint16_t> HalfPlanes;
+
+/// @brief Bilinear interpolation along one axis of an axis-aligned sampling
+/// grid: for grid point k, blend pixel index0[k] and index1[k] with weight[k]
+struct SeparableAxis {
+    std::vector<int> index0, index1;
+    std::vector<float> weight;
+};
+
+/// @brief Box-centred, scale-normalised coordinates of a BBOX: image point x is
+/// at u = (x - centre) / scale, with scale half the longer BBOX side, so that
+/// the BBOX spans [-1, 1] along its longer side
+struct BoxFrame {
+    double centre[2];
+    double scale;
+};
+
+// Separable (axis-aligned) sampling
+void buildSeparableAxis(const double aStart, const double aDelta,
+                        const int aCount, const int aSize,
+                        SeparableAxis &aAxis, const bool aFloor = false);
+void sampleSeparable(const cv::Mat &aImg, const SeparableAxis &aX,
+                     const SeparableAxis &aY, float *aOut,
+                     const int aRowBegin = 0, const int aRowEnd = -1,
+                     const int aColBegin = 0, const int aColEnd = -1);
+void sampleSeparable(const cv::Mat &aImg, const SeparableAxis &aX,
+                     const SeparableAxis &aY, double *aOut,
+                     const int aRowBegin = 0, const int aRowEnd = -1,
+                     const int aColBegin = 0, const int aColEnd = -1);
+void sampleGradients(const cv::Mat &aImg, const SeparableAxis &aX,
+                     const SeparableAxis &aY, const GradientOperator aOperator,
+                     float *aGradX, float *aGradY, const int aRowBegin = 0,
+                     const int aRowEnd = -1);
+
+// Fixed blocks of KLT_KERNEL_BLOCK pixels
+size_t numKernelBlocks(const AlignedPlanes &aImages);
+
+// Hessian
+void accumulateHessianBlock(const AlignedPlanes &aImages,
+                            const float *aWeights, const size_t aBlock,
+                            double aTerms[KLT_HESSIAN_TERMS],
+                            const Summation aSummation = SUMMATION_FLOAT);
+void accumulateHessian(const AlignedPlanes &aImages, const float *aWeights,
+                       Eigen::Matrix<double, 6, 6> &aHessian,
+                       ThreadPool *aPool = nullptr,
+                       const Summation aSummation = SUMMATION_FLOAT);
+
+// Steepest descent update
+void projectErrorBlock(const AlignedPlanes &aImages, const float *aError,
+                       const size_t aBlock, double aVectorB[6],
+                       const Summation aSummation = SUMMATION_FLOAT);
+void projectError(const AlignedPlanes &aImages, const float *aError,
+                  Eigen::Matrix<double, 6, 1> &aVectorB,
+                  ThreadPool *aPool = nullptr,
+                  const Summation aSummation = SUMMATION_FLOAT);
+
+// Fixed-point pipeline for 8-bit frames
+void sampleFixed(const cv::Mat &aImg, const double aOrigin[2],
+                 const double aColStep[2], const double aRowStep[2],
+                 const int aNX, const int aNY, int16_t *aOut,
+                 const int aRowBegin = 0, const int aRowEnd = -1,
+                 const int aColBegin = 0, const int aColEnd = -1);
+void quantisePlanes(const AlignedPlanes &aImages, FixedPlanes &aFixed,
+                    int aShifts[]);
+void dequantisePlanes(const FixedPlanes &aFixed, const int aShifts[],
+                      AlignedPlanes &aImages);
+void projectErrorFixedBlock(const FixedPlanes &aImages,
+                            const FixedPlanes &aTemplate,
+                            const FixedPlanes &aWarped, const size_t aBlock,
+                            int64_t aSums[7]);
+
+// Half-precision storage
+void convertToHalf(const AlignedPlanes &aPlanes, HalfPlanes &aHalf);
+void convertFromHalf(const HalfPlanes &aHalf, AlignedPlanes &aPlanes);
+void projectErrorHalfBlock(const HalfPlanes &aImages,
+                           const HalfPlanes &aTemplate, float *aError,
+                           const size_t aBlock, double aSums[7],
+                           const Summation aSummation = SUMMATION_FLOAT);
+
+// Square tiles of the sampling grid (robust tile weighting)
+size_t numGridTiles(const size_t aWidth, const size_t aHeight,
+                    const size_t aTileSize, size_t *aTilesX = nullptr);
+void accumulateTileHessians(const AlignedPlanes &aImages, const size_t aWidth,
+                            const size_t aHeight, const size_t aTileSize,
+                            std::vector<double> &aTerms,
+                            ThreadPool *aPool = nullptr);
+
+// Box-normalised warp parameterisation
+void makeBoxFrame(const double aX0, const double aY0, const double aX1,
+                  const double aY1, BoxFrame &aFrame);
+void boxToImageWarp(const BoxFrame &aFrame, const Eigen::Matrix3d &aBoxWarp,
+                    Eigen::Matrix3d &aImageWarp);
+void imageToBoxWarp(const BoxFrame &aFrame, const Eigen::Matrix3d &aImageWarp,
+                    Eigen::Matrix3d &aBoxWarp);
+
+// Appearance subspace (project-out IC)
+void buildAppearanceBasis(const std::vector<Eigen::VectorXd> &aSamples,
+                          const size_t aNumModes, const double aMinVariance,
+                          Eigen::MatrixXd &aBasis);
+void projectOutBasis(const Eigen::MatrixXd &aBasis, AlignedPlanes &aImages);
+
+// Fixed-order (ISA-independent) small linear algebra for deterministic mode
+void eigenSymmetricFixedOrder(const Eigen::MatrixXd &aMatrix,
+                              Eigen::VectorXd &aValues,
+                              Eigen::MatrixXd &aVectors);
+void invertFixedOrder(const Eigen::Matrix<double, 6, 6> &aMatrix,
+                      Eigen::Matrix<double, 6, 6> &aInverse);
+double updateWarpFixedOrder(const Eigen::Matrix<double, 6, 6> &aHessianInverse,
+                            const Eigen::Matrix<double, 6, 1> &aVectorB,
+                            const double aScale, Eigen::Matrix3d &aWarp);
+
+#endif
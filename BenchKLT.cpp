@@ -0,0 +1,1336 @@
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <opencv2/opencv.hpp>
+#include <stdlib.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "AlignmentKernels.hpp"
+#include "FixedPatchTracker.hpp"
+#include "FrameRing.hpp"
+#include "ImageAlignment.hpp"
+
+typedef std::chrono::steady_clock bench_clock_t;
+
+double elapsedUs(const bench_clock_t::time_point &aStart) {
+    return std::chrono::duration<double, std::micro>(bench_clock_t::now() -
+                                                     aStart)
+        .count();
+}
+
+bool readAll(int fd, void *buf, size_t size) {
+    char *p = static_cast<char *>(buf);
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool writeAll(int fd, const void *buf, size_t size) {
+    const char *p = static_cast<const char *>(buf);
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+/**
+ * Frame transport: a producer process "captures" (fills) a frame, a consumer
+ * process reads every pixel of it (cv::mean) and acknowledges over a pipe.
+ * Shared memory ring (in-place cv::Mat views) vs copying over a socketpair.
+ * Both variants use the same fill, read and ack; only the transport differs.
+ */
+void benchTransport(int width, int height, int type, size_t numFrames) {
+    const size_t frameBytes = cv::Mat(height, width, type).total() *
+                              cv::Mat(1, 1, type).elemSize();
+
+    // Shared memory ring
+    double ringUs = 0;
+    {
+        FrameRing ring;
+        if (!ring.create("/klt_bench_ring", 4, width, height, type)) {
+            std::cerr << "Failed to create ring" << std::endl;
+            return;
+        }
+
+        int ack[2];
+        if (pipe(ack) < 0) return;
+
+        if (fork() == 0) {
+            FrameRing reader;
+            reader.open("/klt_bench_ring");
+
+            uint64_t seq = 0;
+            for (size_t i = 0; i < numFrames; i++) {
+                seq = reader.waitFrame(seq);
+
+                cv::Mat view;
+                volatile double sum = 0;
+                if (reader.readFrame(seq, view)) sum = cv::mean(view)[0];
+                (void)sum;
+
+                char c = reader.isValid(seq) ? 1 : 0;
+                writeAll(ack[1], &c, 1);
+            }
+            _exit(0);
+        }
+
+        bench_clock_t::time_point start = bench_clock_t::now();
+        for (size_t i = 0; i < numFrames; i++) {
+            cv::Mat slot = ring.beginWrite();
+            slot = cv::Scalar(i & 0xff);
+            ring.endWrite();
+
+            char c;
+            readAll(ack[0], &c, 1);
+        }
+        ringUs = elapsedUs(start) / numFrames;
+
+        wait(nullptr);
+        close(ack[0]);
+        close(ack[1]);
+    }
+
+    // Socket copy
+    double socketUs = 0;
+    {
+        int sock[2], ack[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock) < 0 || pipe(ack) < 0)
+            return;
+
+        if (fork() == 0) {
+            cv::Mat frame(height, width, type);
+            for (size_t i = 0; i < numFrames; i++) {
+                readAll(sock[1], frame.data, frameBytes);
+
+                volatile double sum = cv::mean(frame)[0];
+                (void)sum;
+
+                char c = 1;
+                writeAll(ack[1], &c, 1);
+            }
+            _exit(0);
+        }
+
+        cv::Mat frame(height, width, type);
+        bench_clock_t::time_point start = bench_clock_t::now();
+        for (size_t i = 0; i < numFrames; i++) {
+            frame = cv::Scalar(i & 0xff);
+            writeAll(sock[0], frame.data, frameBytes);
+
+            char c;
+            readAll(ack[0], &c, 1);
+        }
+        socketUs = elapsedUs(start) / numFrames;
+
+        wait(nullptr);
+        close(sock[0]);
+        close(sock[1]);
+        close(ack[0]);
+        close(ack[1]);
+    }
+
+    std::cout << width << "x" << height << "x" << CV_MAT_CN(type) << " ("
+              << frameBytes / 1024 << " KiB): ring " << ringUs
+              << " us/frame, socket " << socketUs << " us/frame, speedup "
+              << socketUs / ringUs << "x" << std::endl;
+}
+
+/**
+ * Smooth random test frame pair: aFrameB is aFrameA shifted by (1, 1) pixels
+ */
+void makeFramePair(PreparedFrame &aFrameA, PreparedFrame &aFrameB) {
+    cv::Mat noise(480, 640, CV_8UC1);
+    cv::randu(noise, cv::Scalar(0), cv::Scalar(255));
+    cv::GaussianBlur(noise, noise, cv::Size(9, 9), 2.0);
+
+    ImageAlignment::prepareFrame(noise, aFrameA);
+    ImageAlignment::prepareFrame(noise(cv::Rect(1, 1, 639, 479)).clone(),
+                                 aFrameB);
+}
+
+/**
+ * Fixed-size patch tracker vs the dynamic (Eigen::MatrixXd) path of
+ * ImageAlignment, for a N x N patch: Jacobian only, and full track()
+ */
+template <int N> void benchPatch(size_t numReps) {
+    PreparedFrame frameA, frameB;
+    makeFramePair(frameA, frameB);
+
+    const float x0 = 200, y0 = 150;
+    const bbox_t bbox = { x0, y0, x0 + N, y0 + N };
+
+    // Jacobian
+    ImageAlignment tracker;
+    tracker.setDebugDisplay(false);
+    tracker.init(frameA, bbox);
+
+    Eigen::MatrixXd dynJacobian(N * N, 6);
+    bench_clock_t::time_point start = bench_clock_t::now();
+    for (size_t i = 0; i < numReps; i++)
+        tracker.computeJacobian(frameA.gradX, frameA.gradY, dynJacobian);
+    const double dynJacobianUs = elapsedUs(start) / numReps;
+
+    typename FixedPatchTracker<N, N>::jacobian_t fixedJacobian;
+    start = bench_clock_t::now();
+    for (size_t i = 0; i < numReps; i++)
+        FixedPatchTracker<N, N>::computeJacobian(frameA.gradX, frameA.gradY,
+                                                 x0, y0, fixedJacobian);
+    const double fixedJacobianUs = elapsedUs(start) / numReps;
+
+    // Full track (template + iterations), same frames and threshold
+    start = bench_clock_t::now();
+    for (size_t i = 0; i < numReps; i++) {
+        tracker.init(frameA, bbox);
+        tracker.track(frameB);
+    }
+    const double dynTrackUs = elapsedUs(start) / numReps;
+
+    FixedPatchTracker<N, N> patchTracker;
+    start = bench_clock_t::now();
+    for (size_t i = 0; i < numReps; i++) {
+        patchTracker.init(frameA, x0, y0);
+        patchTracker.track(frameB);
+    }
+    const double fixedTrackUs = elapsedUs(start) / numReps;
+
+    bbox_t patchBBOX;
+    patchTracker.getBBOX(patchBBOX);
+
+    std::cout << N << "x" << N << ": Jacobian dynamic " << dynJacobianUs
+              << " us, fixed " << fixedJacobianUs << " us ("
+              << dynJacobianUs / fixedJacobianUs << "x); track dynamic "
+              << dynTrackUs << " us, fixed " << fixedTrackUs << " us ("
+              << dynTrackUs / fixedTrackUs << "x); patch moved to ("
+              << patchBBOX[0] << ", " << patchBBOX[1] << ") in "
+              << patchTracker.getIterations() << " iterations, BBOX ("
+              << tracker.getBBOX()[0] << ", " << tracker.getBBOX()[1]
+              << ") in " << tracker.getStats().lastIterations << std::endl;
+}
+
+/**
+ * Warp parameterisation: condition number of the Hessian, and relative error
+ * of a Gauss-Newton step solved in single precision, with dW/dp in image
+ * coordinates vs box coordinates, for a BBOX far from the image origin (the
+ * landing BBOX)
+ */
+void benchParameterisation() {
+    PreparedFrame frameA, frameB;
+    makeFramePair(frameA, frameB);
+
+    const bbox_t bbox = { 440, 80, 560, 140 };
+
+    ImageAlignment tracker;
+    tracker.setDebugDisplay(false);
+    tracker.init(frameA, bbox);
+
+    Eigen::MatrixXd boxJacobian(120 * 60, 6);
+    tracker.computeJacobian(frameA.gradX, frameA.gradY, boxJacobian);
+
+    // Same columns in image coordinates: x = cx + s * u, y = cy + s * v
+    BoxFrame box;
+    makeBoxFrame(bbox[0], bbox[1], bbox[2], bbox[3], box);
+
+    Eigen::MatrixXd imageJacobian = boxJacobian;
+    imageJacobian.col(0) =
+        box.scale * boxJacobian.col(0) + box.centre[0] * boxJacobian.col(4);
+    imageJacobian.col(1) =
+        box.scale * boxJacobian.col(1) + box.centre[0] * boxJacobian.col(5);
+    imageJacobian.col(2) =
+        box.scale * boxJacobian.col(2) + box.centre[1] * boxJacobian.col(4);
+    imageJacobian.col(3) =
+        box.scale * boxJacobian.col(3) + box.centre[1] * boxJacobian.col(5);
+
+    // Residual of a 1% zoom and a (0.5, -0.3) pixel shift
+    Eigen::Matrix<double, 6, 1> motion;
+    motion << 0.01, 0, 0, 0.01, 0.5, -0.3;
+    const Eigen::VectorXd error = imageJacobian * motion;
+
+    const char *names[] = { "image", "box" };
+    const Eigen::MatrixXd *jacobians[] = { &imageJacobian, &boxJacobian };
+
+    for (int k = 0; k < 2; k++) {
+        const Eigen::MatrixXd &jacobian = *jacobians[k];
+
+        const Eigen::MatrixXd hessian = jacobian.transpose() * jacobian;
+        const Eigen::VectorXd singular =
+            Eigen::JacobiSVD<Eigen::MatrixXd>(hessian).singularValues();
+
+        const Eigen::VectorXd step =
+            hessian.inverse() * (jacobian.transpose() * error);
+
+        const Eigen::MatrixXf jacobianF = jacobian.cast<float>();
+        const Eigen::MatrixXf hessianF = jacobianF.transpose() * jacobianF;
+        const Eigen::VectorXf stepF =
+            hessianF.inverse() *
+            (jacobianF.transpose() * error.cast<float>());
+
+        std::cout << names[k] << " coordinates: cond(H) "
+                  << singular(0) / singular(5) << ", float step error "
+                  << (stepF.cast<double>() - step).norm() / step.norm()
+                  << std::endl;
+    }
+}
+
+/**
+ * Hessian of a N-pixel Jacobian: general GEMM (J^T J, double) vs the 21-term
+ * upper triangle plane kernel (float steepest descent images), unweighted and
+ * weighted
+ */
+void benchHessian(size_t numPixels, size_t numReps) {
+    const Eigen::MatrixXd jacobian =
+        Eigen::MatrixXd::Random(numPixels, 6).cast<float>().cast<double>();
+    const Eigen::VectorXd weights = Eigen::VectorXd::Random(numPixels)
+                                        .cwiseAbs()
+                                        .cast<float>()
+                                        .cast<double>();
+
+    AlignedPlanes images(6, numPixels), weightPlane(1, numPixels);
+    for (size_t i = 0; i < numPixels; i++) {
+        for (int k = 0; k < 6; k++)
+            images.plane(k)[i] = static_cast<float>(jacobian(i, k));
+        weightPlane.plane(0)[i] = static_cast<float>(weights(i));
+    }
+
+    Eigen::Matrix<double, 6, 6> gemm, kernel;
+
+    bench_clock_t::time_point start = bench_clock_t::now();
+    for (size_t i = 0; i < numReps; i++)
+        gemm = jacobian.transpose() * jacobian;
+    const double gemmUs = elapsedUs(start) / numReps;
+
+    start = bench_clock_t::now();
+    for (size_t i = 0; i < numReps; i++)
+        accumulateHessian(images, nullptr, kernel);
+    const double kernelUs = elapsedUs(start) / numReps;
+
+    const double maxDiff =
+        (gemm - kernel).cwiseAbs().maxCoeff() / gemm.cwiseAbs().maxCoeff();
+
+    start = bench_clock_t::now();
+    for (size_t i = 0; i < numReps; i++)
+        gemm = jacobian.transpose() * weights.asDiagonal() * jacobian;
+    const double weightedGemmUs = elapsedUs(start) / numReps;
+
+    start = bench_clock_t::now();
+    for (size_t i = 0; i < numReps; i++)
+        accumulateHessian(images, weightPlane.plane(0), kernel);
+    const double weightedKernelUs = elapsedUs(start) / numReps;
+
+    const double weightedMaxDiff =
+        (gemm - kernel).cwiseAbs().maxCoeff() / gemm.cwiseAbs().maxCoeff();
+
+    std::cout << numPixels << " px: GEMM " << gemmUs << " us, kernel "
+              << kernelUs << " us (" << gemmUs / kernelUs
+              << "x); weighted GEMM " << weightedGemmUs << " us, kernel "
+              << weightedKernelUs << " us (" << weightedGemmUs / weightedKernelUs
+              << "x); max relative diff " << maxDiff << ", weighted "
+              << weightedMaxDiff << std::endl;
+}
+
+/**
+ * Summation of the float plane kernels on N pixels: time per Hessian + J^T e,
+ * and their error against an extended precision reference. Double precision
+ * (Eigen, N x 6 double Jacobian) for comparison. Then iterations of a
+ * full-frame track with each summation.
+ */
+void benchSummation(size_t numPixels, size_t numReps) {
+    // Steepest descent images of realistic magnitude: gradient times position
+    // (up to ~1000 pixels), and a zero-mean error
+    std::mt19937 rng(42);
+    std::normal_distribution<float> gradient(0.0f, 20.0f), error(0.0f, 5.0f);
+    std::uniform_real_distribution<float> position(0.0f, 1000.0f);
+
+    AlignedPlanes images(6, numPixels), errorImage(1, numPixels);
+    Eigen::MatrixXd jacobian(numPixels, 6);
+    Eigen::VectorXd errorVector(numPixels);
+
+    for (size_t i = 0; i < numPixels; i++) {
+        const float gx = gradient(rng), gy = gradient(rng);
+        const float x = position(rng), y = position(rng);
+        const float row[6] = { gx * x, gy * x, gx * y, gy * y, gx, gy };
+
+        for (int k = 0; k < 6; k++) {
+            images.plane(k)[i] = row[k];
+            jacobian(i, k) = row[k];
+        }
+
+        errorImage.plane(0)[i] = error(rng);
+        errorVector(i) = errorImage.plane(0)[i];
+    }
+
+    // Reference: exact products summed in long double
+    long double refHessian[6][6] = { { 0 } }, refB[6] = { 0 };
+    for (size_t i = 0; i < numPixels; i++) {
+        for (int a = 0; a < 6; a++) {
+            refB[a] += jacobian(i, a) * errorVector(i);
+            for (int b = 0; b < 6; b++)
+                refHessian[a][b] += jacobian(i, a) * jacobian(i, b);
+        }
+    }
+
+    // Max error relative to the largest entry
+    const auto relError = [&](const Eigen::Matrix<double, 6, 6> &aHessian,
+                              const Eigen::Matrix<double, 6, 1> &aB,
+                              double &aHessianError, double &aBError) {
+        long double hMax = 0, hErr = 0, bMax = 0, bErr = 0;
+        for (int a = 0; a < 6; a++) {
+            bMax = std::max(bMax, std::fabs(refB[a]));
+            bErr = std::max(bErr, std::fabs(aB(a) - refB[a]));
+            for (int b = 0; b < 6; b++) {
+                hMax = std::max(hMax, std::fabs(refHessian[a][b]));
+                hErr = std::max(hErr,
+                                std::fabs(aHessian(a, b) - refHessian[a][b]));
+            }
+        }
+        aHessianError = static_cast<double>(hErr / hMax);
+        aBError = static_cast<double>(bErr / bMax);
+    };
+
+    Eigen::Matrix<double, 6, 6> hessian;
+    Eigen::Matrix<double, 6, 1> vectorB;
+    double hessianError, bError;
+
+    bench_clock_t::time_point start = bench_clock_t::now();
+    for (size_t i = 0; i < numReps; i++) {
+        hessian = jacobian.transpose() * jacobian;
+        vectorB = jacobian.transpose() * errorVector;
+    }
+    const double doubleUs = elapsedUs(start) / numReps;
+    relError(hessian, vectorB, hessianError, bError);
+
+    std::cout << numPixels << " px: double (Eigen) " << doubleUs
+              << " us, error H " << hessianError << ", b " << bError
+              << std::endl;
+
+    const char *names[] = { "float", "compensated", "fixed-order" };
+    const Summation summations[] = { SUMMATION_FLOAT, SUMMATION_COMPENSATED,
+                                     SUMMATION_FIXED_ORDER };
+
+    for (int m = 0; m < 3; m++) {
+        start = bench_clock_t::now();
+        for (size_t i = 0; i < numReps; i++) {
+            accumulateHessian(images, nullptr, hessian, nullptr,
+                              summations[m]);
+            projectError(images, errorImage.plane(0), vectorB, nullptr,
+                         summations[m]);
+        }
+        const double kernelUs = elapsedUs(start) / numReps;
+        relError(hessian, vectorB, hessianError, bError);
+
+        std::cout << numPixels << " px: " << names[m] << " " << kernelUs
+                  << " us (" << doubleUs / kernelUs << "x double), error H "
+                  << hessianError << ", b " << bError << std::endl;
+    }
+
+    // Effect on convergence of a full-frame track
+    PreparedFrame frameA, frameB;
+    makeFramePair(frameA, frameB);
+    const bbox_t bbox = { 8, 8, 632, 472 };
+
+    for (int m = 0; m < 3; m++) {
+        ImageAlignment tracker;
+        tracker.setDebugDisplay(false);
+        tracker.setSummation(summations[m]);
+        tracker.init(frameA, bbox);
+
+        start = bench_clock_t::now();
+        tracker.track(frameB);
+        const double trackUs = elapsedUs(start);
+
+        std::cout << "full frame, " << names[m] << ": "
+                  << tracker.getStats().lastIterations << " iterations, "
+                  << trackUs << " us, BBOX (" << tracker.getBBOX()[0] << ", "
+                  << tracker.getBBOX()[1] << ")" << std::endl;
+    }
+}
+
+/**
+ * Colour vs grayscale tracking of a 120x90 BBOX in 640x480 BGR frames (frame B
+ * is frame A shifted by (1, 1) pixels, both with sensor noise): preprocessing
+ * and track time, iterations and BBOX error per channel layout. Two scenes:
+ * independent texture in every channel, and chroma-only texture on flat
+ * luminance (the worst case for grayscale)
+ */
+void benchColour(size_t numReps) {
+    const char *names[] = { "gray", "interleaved", "planar" };
+    const ChannelLayout layouts[] = { CHANNELS_GRAY, CHANNELS_INTERLEAVED,
+                                      CHANNELS_PLANAR };
+
+    for (int scene = 0; scene < 2; scene++) {
+        cv::Mat noise(480, 640, CV_8UC3);
+        cv::randu(noise, cv::Scalar(0, 0, 0), cv::Scalar(255, 255, 255));
+        cv::GaussianBlur(noise, noise, cv::Size(9, 9), 2.0);
+
+        // Chroma only: keep blue and red texture, pick green for constant
+        // luminance (cv::cvtColor() weights)
+        if (scene == 1) {
+            for (int i = 0; i < noise.rows; i++) {
+                cv::Vec3b *row = noise.ptr<cv::Vec3b>(i);
+                for (int j = 0; j < noise.cols; j++) {
+                    const double green =
+                        (128 - 0.114 * row[j][0] - 0.299 * row[j][2]) / 0.587;
+                    row[j][1] = cv::saturate_cast<unsigned char>(green);
+                }
+            }
+        }
+
+        cv::Mat shifted = noise(cv::Rect(1, 1, 639, 479)).clone();
+
+        // Independent sensor noise of +-3 levels per frame
+        std::mt19937 rng(scene);
+        std::uniform_int_distribution<int> sensor(-3, 3);
+        for (cv::Mat *frame : { &noise, &shifted }) {
+            for (int i = 0; i < frame->rows; i++) {
+                unsigned char *row = frame->ptr<unsigned char>(i);
+                for (int j = 0; j < frame->cols * 3; j++)
+                    row[j] = cv::saturate_cast<unsigned char>(
+                        static_cast<double>(row[j] + sensor(rng)));
+            }
+        }
+
+        const bbox_t bbox = { 200, 150, 320, 240 };
+
+        for (int l = 0; l < 3; l++) {
+            PreparedFrame frameA, frameB;
+
+            bench_clock_t::time_point start = bench_clock_t::now();
+            for (size_t i = 0; i < numReps; i++)
+                ImageAlignment::prepareFrame(shifted, frameB, layouts[l],
+                                             false);
+            const double prepareUs = elapsedUs(start) / numReps;
+
+            ImageAlignment::prepareFrame(noise, frameA, layouts[l], false);
+
+            ImageAlignment tracker;
+            tracker.setDebugDisplay(false);
+
+            start = bench_clock_t::now();
+            for (size_t i = 0; i < numReps; i++) {
+                tracker.init(frameA, bbox);
+                tracker.track(frameB);
+            }
+            const double trackUs = elapsedUs(start) / numReps;
+
+            // Content moved by (-1, -1)
+            const double errorX = tracker.getBBOX()[0] - (bbox[0] - 1);
+            const double errorY = tracker.getBBOX()[1] - (bbox[1] - 1);
+
+            std::cout << (scene ? "chroma only, " : "textured, ") << names[l]
+                      << ": prepare " << prepareUs << " us, track " << trackUs
+                      << " us, " << tracker.getStats().lastIterations
+                      << " iterations, BBOX error "
+                      << std::sqrt(errorX * errorX + errorY * errorY)
+                      << " px" << std::endl;
+        }
+    }
+}
+
+/**
+ * Template gradients: full-image cv::Sobel (prepareFrame() with gradients, then
+ * interpolated at the sample points) vs the fused kernel computing each
+ * operator at the sample points only. Convergence per operator on a sub-pixel
+ * shifted frame pair, and the largest difference between the full-image and
+ * fused Sobel steepest descent images (both per-pixel derivatives)
+ */
+void benchGradient(size_t numReps) {
+    const char *names[] = { "sobel", "central", "scharr" };
+    const GradientOperator operators[] = { GRADIENT_SOBEL, GRADIENT_CENTRAL,
+                                           GRADIENT_SCHARR };
+
+    cv::Mat noise(480, 640, CV_8UC1);
+    cv::randu(noise, cv::Scalar(0), cv::Scalar(255));
+    cv::GaussianBlur(noise, noise, cv::Size(9, 9), 2.0);
+
+    // Content moved by (-1.3, 0.6) (resampled)
+    cv::Mat warp = cv::Mat::zeros(2, 3, CV_64FC1);
+    warp.at<double>(0, 0) = 1;
+    warp.at<double>(1, 1) = 1;
+    warp.at<double>(0, 2) = -1.3;
+    warp.at<double>(1, 2) = 0.6;
+
+    cv::Mat shifted;
+    cv::warpAffine(noise, shifted, warp, noise.size());
+
+    PreparedFrame frameA, frameB;
+    ImageAlignment::prepareFrame(noise, frameA, CHANNELS_GRAY, false);
+    ImageAlignment::prepareFrame(shifted, frameB, CHANNELS_GRAY, false);
+
+    const bbox_t bbox = { 200, 150, 320, 240 };
+
+    ImageAlignment tracker;
+    tracker.setDebugDisplay(false);
+    tracker.setBBOX(bbox);
+
+    AlignedPlanes jacobian;
+
+    // Full-image path: gradients of the whole frame, then sampled
+    PreparedFrame frameFull;
+    bench_clock_t::time_point start = bench_clock_t::now();
+    for (size_t i = 0; i < numReps; i++)
+        ImageAlignment::prepareFrame(noise, frameFull);
+    const double fullGradUs = elapsedUs(start) / numReps;
+
+    start = bench_clock_t::now();
+    for (size_t i = 0; i < numReps; i++)
+        tracker.computeJacobian(frameFull.gradX, frameFull.gradY, jacobian);
+    const double fullJacobianUs = elapsedUs(start) / numReps;
+
+    std::cout << "full-image sobel: gradients " << fullGradUs
+              << " us + jacobian " << fullJacobianUs << " us" << std::endl;
+
+    const AlignedPlanes fullJacobian = jacobian;
+
+    for (int o = 0; o < 3; o++) {
+        tracker.setGradientOperator(operators[o]);
+
+        start = bench_clock_t::now();
+        for (size_t i = 0; i < numReps; i++)
+            tracker.computeJacobian(frameA.image, jacobian);
+        const double fusedUs = elapsedUs(start) / numReps;
+
+        if (operators[o] == GRADIENT_SOBEL) {
+            double maxDiff = 0;
+            for (size_t k = 0; k < 6; k++) {
+                for (size_t i = 0; i < jacobian.size(); i++)
+                    maxDiff = std::max(
+                        maxDiff, double(std::fabs(jacobian.plane(k)[i] -
+                                                  fullJacobian.plane(k)[i])));
+            }
+            std::cout << "fused sobel vs full-image: max difference "
+                      << maxDiff << std::endl;
+        }
+
+        tracker.init(frameA, bbox);
+        tracker.track(frameB);
+
+        const double errorX = tracker.getBBOX()[0] - (bbox[0] - 1.3);
+        const double errorY = tracker.getBBOX()[1] - (bbox[1] + 0.6);
+
+        std::cout << "fused " << names[o] << ": jacobian " << fusedUs
+                  << " us, " << tracker.getStats().lastIterations
+                  << " iterations, BBOX error "
+                  << std::sqrt(errorX * errorX + errorY * errorY) << " px"
+                  << std::endl;
+    }
+}
+
+/**
+ * 8-bit frames: float pipeline (CHANNELS_GRAY) vs fixed-point pipeline
+ * (CHANNELS_GRAY_8U) on a sub-pixel shifted frame pair, for several BBOX
+ * sizes. Frame preparation and tracking (template plus iterations) are timed
+ * separately.
+ */
+void benchFixed(size_t numReps) {
+    const char *names[] = { "float", "fixed" };
+    const ChannelLayout layouts[] = { CHANNELS_GRAY, CHANNELS_GRAY_8U };
+
+    cv::Mat noise(480, 640, CV_8UC1);
+    cv::randu(noise, cv::Scalar(0), cv::Scalar(255));
+    cv::GaussianBlur(noise, noise, cv::Size(9, 9), 2.0);
+
+    // Content moved by (-1.3, 0.6) (resampled)
+    cv::Mat warp = cv::Mat::zeros(2, 3, CV_64FC1);
+    warp.at<double>(0, 0) = 1;
+    warp.at<double>(1, 1) = 1;
+    warp.at<double>(0, 2) = -1.3;
+    warp.at<double>(1, 2) = 0.6;
+
+    cv::Mat shifted;
+    cv::warpAffine(noise, shifted, warp, noise.size());
+
+    for (int l = 0; l < 2; l++) {
+        PreparedFrame frameA, frameB;
+
+        bench_clock_t::time_point start = bench_clock_t::now();
+        for (size_t i = 0; i < numReps; i++)
+            ImageAlignment::prepareFrame(shifted, frameB, layouts[l], false);
+        const double prepareUs = elapsedUs(start) / numReps;
+
+        ImageAlignment::prepareFrame(noise, frameA, layouts[l], false);
+
+        std::cout << names[l] << ": prepare " << prepareUs << " us"
+                  << std::endl;
+
+        for (const float size : { 16.0f, 32.0f, 64.0f, 128.0f }) {
+            const bbox_t bbox = { 300, 200, 300 + size, 200 + 0.75f * size };
+
+            ImageAlignment tracker;
+            tracker.setDebugDisplay(false);
+
+            start = bench_clock_t::now();
+            for (size_t i = 0; i < numReps; i++) {
+                tracker.init(frameA, bbox);
+                tracker.track(frameB);
+            }
+            const double trackUs = elapsedUs(start) / numReps;
+
+            const double errorX = tracker.getBBOX()[0] - (bbox[0] - 1.3);
+            const double errorY = tracker.getBBOX()[1] - (bbox[1] + 0.6);
+
+            std::cout << "  " << size << " x " << 0.75f * size << ": track "
+                      << trackUs << " us, "
+                      << tracker.getStats().lastIterations
+                      << " iterations ("
+                      << trackUs / tracker.getStats().lastIterations
+                      << " us each incl. template), BBOX error "
+                      << std::sqrt(errorX * errorX + errorY * errorY) << " px"
+                      << std::endl;
+        }
+    }
+}
+
+/**
+ * Template storage: float vs half precision. Per target: template memory,
+ * time per frame (template plus iterations), iterations and BBOX error. Then
+ * the fused error and J^T e kernel over many resident 32 x 24 targets, one
+ * pass each in turn (as one iteration of every target per frame), once the
+ * targets outgrow the caches.
+ */
+void benchHalf(size_t numReps) {
+    const char *names[] = { "float", "half" };
+    const StoragePrecision precisions[] = { STORAGE_FLOAT, STORAGE_HALF };
+
+    cv::Mat noise(480, 640, CV_8UC1);
+    cv::randu(noise, cv::Scalar(0), cv::Scalar(255));
+    cv::GaussianBlur(noise, noise, cv::Size(9, 9), 2.0);
+
+    // Content moved by (-1.3, 0.6) (resampled)
+    cv::Mat warp = cv::Mat::zeros(2, 3, CV_64FC1);
+    warp.at<double>(0, 0) = 1;
+    warp.at<double>(1, 1) = 1;
+    warp.at<double>(0, 2) = -1.3;
+    warp.at<double>(1, 2) = 0.6;
+
+    cv::Mat shifted;
+    cv::warpAffine(noise, shifted, warp, noise.size());
+
+    PreparedFrame frameA, frameB;
+    ImageAlignment::prepareFrame(noise, frameA);
+    ImageAlignment::prepareFrame(shifted, frameB);
+
+    for (const float size : { 16.0f, 32.0f, 64.0f, 128.0f }) {
+        const bbox_t bbox = { 300, 200, 300 + size, 200 + 0.75f * size };
+
+        std::cout << size << " x " << 0.75f * size << ":" << std::endl;
+
+        for (int p = 0; p < 2; p++) {
+            ImageAlignment tracker;
+            tracker.setDebugDisplay(false);
+            tracker.setStoragePrecision(precisions[p]);
+
+            bench_clock_t::time_point start = bench_clock_t::now();
+            for (size_t i = 0; i < numReps; i++) {
+                tracker.init(frameA, bbox);
+                tracker.track(frameB);
+            }
+            const double trackUs = elapsedUs(start) / numReps;
+
+            const double errorX = tracker.getBBOX()[0] - (bbox[0] - 1.3);
+            const double errorY = tracker.getBBOX()[1] - (bbox[1] + 0.6);
+
+            std::cout << "  " << names[p] << ": "
+                      << tracker.getTemplateBytes() << " bytes, track "
+                      << trackUs << " us, "
+                      << tracker.getStats().lastIterations
+                      << " iterations, BBOX error "
+                      << std::sqrt(errorX * errorX + errorY * errorY) << " px"
+                      << std::endl;
+        }
+    }
+
+    // Kernel only, over many targets of one block each
+    const size_t N_PIXELS = 32 * 24;
+
+    Eigen::VectorXd warped = Eigen::VectorXd::Random(N_PIXELS);
+    AlignedPlanes error(1, N_PIXELS);
+    float *errorData = error.plane(0);
+
+    for (const size_t numTargets : { 1, 64, 4096 }) {
+        std::vector<Eigen::VectorXd> templates(numTargets);
+        std::vector<AlignedPlanes> images(numTargets);
+        std::vector<HalfPlanes> halfTemplates(numTargets);
+        std::vector<HalfPlanes> halfImages(numTargets);
+
+        for (size_t t = 0; t < numTargets; t++) {
+            templates[t] = Eigen::VectorXd::Random(N_PIXELS);
+
+            AlignedPlanes samples(1, N_PIXELS);
+            Eigen::Map<Eigen::VectorXf>(samples.plane(0), N_PIXELS) =
+                templates[t].cast<float>();
+            convertToHalf(samples, halfTemplates[t]);
+
+            images[t].resize(6, N_PIXELS);
+            for (int k = 0; k < 6; k++)
+                Eigen::Map<Eigen::VectorXf>(images[t].plane(k), N_PIXELS)
+                    .setRandom();
+            convertToHalf(images[t], halfImages[t]);
+        }
+
+        const size_t passes = std::max<size_t>(1, numReps * 64 / numTargets);
+        double sums[7];
+        double checksum[2] = { 0, 0 };
+
+        // Float storage: error from double samples, then J^T e
+        bench_clock_t::time_point start = bench_clock_t::now();
+        for (size_t r = 0; r < passes; r++) {
+            for (size_t t = 0; t < numTargets; t++) {
+                double squaredNorm = 0;
+                for (size_t i = 0; i < N_PIXELS; i++) {
+                    const double e = warped(i) - templates[t](i);
+                    errorData[i] = static_cast<float>(e);
+                    squaredNorm += e * e;
+                }
+
+                projectErrorBlock(images[t], errorData, 0, &sums[1]);
+                checksum[0] += squaredNorm + sums[1];
+            }
+        }
+        const double floatNs =
+            elapsedUs(start) * 1000 / (passes * numTargets * N_PIXELS);
+
+        // Half storage: fused error and J^T e
+        start = bench_clock_t::now();
+        for (size_t r = 0; r < passes; r++) {
+            for (size_t t = 0; t < numTargets; t++) {
+                for (size_t i = 0; i < N_PIXELS; i++)
+                    errorData[i] = static_cast<float>(warped(i));
+
+                projectErrorHalfBlock(halfImages[t], halfTemplates[t],
+                                      errorData, 0, sums);
+                checksum[1] += sums[0] + sums[1];
+            }
+        }
+        const double halfNs =
+            elapsedUs(start) * 1000 / (passes * numTargets * N_PIXELS);
+
+        const double floatMiB =
+            numTargets *
+            (N_PIXELS * sizeof(double) + images[0].bytes()) / 1048576.0;
+        const double halfMiB = numTargets *
+                               (halfTemplates[0].bytes() +
+                                halfImages[0].bytes()) /
+                               1048576.0;
+
+        std::cout << numTargets << " targets of 32 x 24 (" << floatMiB
+                  << " / " << halfMiB << " MiB): float "
+                  << floatNs << " ns/point, half " << halfNs
+                  << " ns/point (" << floatNs / halfNs
+                  << "x), checksums " << checksum[0] / passes << " / "
+                  << checksum[1] / passes << std::endl;
+    }
+}
+
+/**
+ * Stopping criteria: iterations, time and BBOX error per frame under the
+ * parameter-norm test alone (the former behaviour), the corner test alone,
+ * the default policy (corners, stagnation and divergence) and the default plus
+ * a relative residual decrease of 1e-3. Scenarios: a sub-pixel shift, the same
+ * shift with sensor noise (sigma 8 grey levels), and a shift too large for the
+ * BBOX to converge.
+ */
+void benchConvergence(size_t numReps) {
+    const char *policyNames[] = { "parameters", "corners", "default",
+                                  "residual" };
+    ConvergencePolicy policies[4];
+    policies[0].corners = false;
+    policies[0].stagnationIters = 0;
+    policies[0].divergenceRatio = 0;
+    policies[1].stagnationIters = 0;
+    policies[1].divergenceRatio = 0;
+    policies[3].residualDecrease = 1e-3;
+
+    const char *stopNames[KLT_STOP_REASONS] = { "max-iters",  "parameters",
+                                                "corners",    "residual",
+                                                "stagnation", "divergence",
+                                                "deadline" };
+
+    cv::Mat noise(480, 640, CV_8UC1);
+    cv::randu(noise, cv::Scalar(0), cv::Scalar(255));
+    cv::GaussianBlur(noise, noise, cv::Size(9, 9), 2.0);
+
+    struct Scenario {
+        const char *name;
+        double shift[2];
+        double sigma;
+        float size;
+    };
+    const Scenario scenarios[] = { { "sub-pixel", { -1.3, 0.6 }, 0, 120 },
+                                   { "sub-pixel", { -1.3, 0.6 }, 0, 16 },
+                                   { "noisy", { -1.3, 0.6 }, 8, 120 },
+                                   { "large", { 14, -10 }, 0, 120 } };
+
+    for (const Scenario &scenario : scenarios) {
+        cv::Mat warp = cv::Mat::zeros(2, 3, CV_64FC1);
+        warp.at<double>(0, 0) = 1;
+        warp.at<double>(1, 1) = 1;
+        warp.at<double>(0, 2) = scenario.shift[0];
+        warp.at<double>(1, 2) = scenario.shift[1];
+
+        cv::Mat shifted;
+        cv::warpAffine(noise, shifted, warp, noise.size());
+        if (scenario.sigma > 0) {
+            cv::Mat sensor(shifted.size(), CV_16SC1);
+            cv::randn(sensor, cv::Scalar(0), cv::Scalar(scenario.sigma));
+            shifted.convertTo(shifted, CV_16SC1);
+            shifted += sensor;
+            shifted.convertTo(shifted, CV_8UC1);
+        }
+
+        PreparedFrame frameA, frameB;
+        ImageAlignment::prepareFrame(noise, frameA);
+        ImageAlignment::prepareFrame(shifted, frameB);
+
+        const bbox_t bbox = { 300, 200, 300 + scenario.size,
+                              200 + 0.75f * scenario.size };
+
+        std::cout << scenario.name << " (" << scenario.shift[0] << ", "
+                  << scenario.shift[1] << "), " << scenario.size << " x "
+                  << 0.75f * scenario.size << ":" << std::endl;
+
+        for (int p = 0; p < 4; p++) {
+            ImageAlignment tracker;
+            tracker.setDebugDisplay(false);
+            tracker.setConvergencePolicy(policies[p]);
+
+            bench_clock_t::time_point start = bench_clock_t::now();
+            for (size_t i = 0; i < numReps; i++) {
+                tracker.init(frameA, bbox);
+                tracker.track(frameB);
+            }
+            const double trackUs = elapsedUs(start) / numReps;
+
+            const double errorX =
+                tracker.getBBOX()[0] - (bbox[0] + scenario.shift[0]);
+            const double errorY =
+                tracker.getBBOX()[1] - (bbox[1] + scenario.shift[1]);
+
+            std::cout << "  " << policyNames[p] << ": "
+                      << tracker.getStats().lastIterations << " iterations, "
+                      << trackUs << " us, stop "
+                      << stopNames[tracker.getStats().lastStop]
+                      << ", BBOX error "
+                      << std::sqrt(errorX * errorX + errorY * errorY)
+                      << " px, residual " << tracker.getResidualRMS()
+                      << std::endl;
+        }
+    }
+}
+
+/**
+ * Appearance subspace: a texture drifting (0.7, -0.4) px per frame under
+ * changing gain, bias and a lighting ramp, tracked frame to frame with plain
+ * IC vs 1 to 3 appearance modes projected out. Reports iterations, time and
+ * BBOX error per frame (from frame 10, once the history is full).
+ */
+void benchAppearance(size_t numSequences) {
+    const int NUM_FRAMES = 40, FIRST_SCORED = 10;
+    const bbox_t bbox = { 300, 200, 420, 290 };
+
+    cv::Mat noise(480, 640, CV_8UC1);
+    cv::randu(noise, cv::Scalar(0), cv::Scalar(255));
+    cv::GaussianBlur(noise, noise, cv::Size(9, 9), 2.0);
+
+    struct Lighting {
+        const char *name;
+        double gain, bias, ramp;
+    };
+    const Lighting lightings[] = { { "constant", 0, 0, 0 },
+                                   { "moderate", 0.25, 20, 30 },
+                                   { "strong", 0.4, 30, 60 } };
+
+    for (const Lighting &lighting : lightings) {
+        std::vector<PreparedFrame> frames(NUM_FRAMES);
+        for (int k = 0; k < NUM_FRAMES; k++) {
+            cv::Mat warp = cv::Mat::zeros(2, 3, CV_64FC1);
+            warp.at<double>(0, 0) = 1;
+            warp.at<double>(1, 1) = 1;
+            warp.at<double>(0, 2) = 0.7 * k;
+            warp.at<double>(1, 2) = -0.4 * k;
+
+            cv::Mat shifted;
+            cv::warpAffine(noise, shifted, warp, noise.size());
+
+            // Texture scaled into [50, 203] so that gain changes rarely clip
+            const double gain = 1 + lighting.gain * std::sin(0.5 * k);
+            const double bias = lighting.bias * std::sin(0.3 * k + 1);
+            const double ramp = lighting.ramp * std::sin(0.4 * k);
+            for (int i = 0; i < shifted.rows; i++) {
+                unsigned char *row = shifted.ptr<unsigned char>(i);
+                for (int j = 0; j < shifted.cols; j++) {
+                    const double value =
+                        gain * (0.6 * row[j] + 50) + bias +
+                        ramp * ((j - 320) / 320.0 + 0.5 * (i - 240) / 240.0);
+                    row[j] = static_cast<unsigned char>(
+                        std::max(0.0, std::min(255.0, std::round(value))));
+                }
+            }
+            ImageAlignment::prepareFrame(shifted, frames[k]);
+        }
+
+        std::cout << lighting.name << " lighting:" << std::endl;
+
+        for (size_t modes = 0; modes <= 3; modes++) {
+            double iterations = 0, errorSum = 0, errorMax = 0, trackUs = 0;
+            size_t active = 0;
+
+            for (size_t r = 0; r < numSequences; r++) {
+                ImageAlignment tracker;
+                tracker.setDebugDisplay(false);
+                tracker.setAppearanceModes(modes);
+                tracker.init(frames[0], bbox);
+
+                for (int k = 1; k < NUM_FRAMES; k++) {
+                    bench_clock_t::time_point start = bench_clock_t::now();
+                    tracker.track(frames[k]);
+                    trackUs += elapsedUs(start);
+
+                    if (k < FIRST_SCORED) continue;
+                    const double errorX =
+                        tracker.getBBOX()[0] - (bbox[0] + 0.7 * k);
+                    const double errorY =
+                        tracker.getBBOX()[1] - (bbox[1] - 0.4 * k);
+                    const double error =
+                        std::sqrt(errorX * errorX + errorY * errorY);
+                    iterations += tracker.getStats().lastIterations;
+                    errorSum += error;
+                    errorMax = std::max(errorMax, error);
+                }
+                active = tracker.getActiveAppearanceModes();
+            }
+
+            const double numScored =
+                double(numSequences) * (NUM_FRAMES - FIRST_SCORED);
+            std::cout << "  " << modes << " modes (" << active
+                      << " active): " << iterations / numScored
+                      << " iterations, "
+                      << trackUs / (numSequences * (NUM_FRAMES - 1))
+                      << " us, BBOX error mean " << errorSum / numScored
+                      << " px, max " << errorMax << " px" << std::endl;
+        }
+    }
+}
+
+/**
+ * Partial occlusion: a texture drifting (0.6, -0.3) px per frame while a
+ * second, static texture slides in from the right over up to a fraction of the
+ * box width, tracked frame to frame without and with robust tile weighting.
+ * Reports iterations, time, BBOX error and the tiles dropped on the last frame.
+ */
+void benchOcclusion(size_t numSequences) {
+    const int NUM_FRAMES = 30, SLIDE_FRAMES = 15;
+    const bbox_t bbox = { 300, 200, 420, 290 };
+
+    cv::Mat background(480, 640, CV_8UC1), occluder(480, 640, CV_8UC1);
+    cv::randu(background, cv::Scalar(0), cv::Scalar(255));
+    cv::GaussianBlur(background, background, cv::Size(9, 9), 2.0);
+    cv::randu(occluder, cv::Scalar(0), cv::Scalar(255));
+    cv::GaussianBlur(occluder, occluder, cv::Size(5, 5), 1.0);
+
+    for (const double cover : { 0.0, 0.25, 0.4 }) {
+        std::vector<PreparedFrame> frames(NUM_FRAMES);
+        for (int k = 0; k < NUM_FRAMES; k++) {
+            cv::Mat warp = cv::Mat::zeros(2, 3, CV_64FC1);
+            warp.at<double>(0, 0) = 1;
+            warp.at<double>(1, 1) = 1;
+            warp.at<double>(0, 2) = 0.6 * k;
+            warp.at<double>(1, 2) = -0.3 * k;
+
+            cv::Mat shifted;
+            cv::warpAffine(background, shifted, warp, background.size());
+
+            const double width = bbox[2] - bbox[0];
+            const double left = bbox[2] + 0.6 * k -
+                                cover * width *
+                                    std::min(1.0, double(k) / SLIDE_FRAMES);
+            const double top = bbox[1] - 0.3 * k - 20;
+            const double bottom = bbox[3] - 0.3 * k + 20;
+            for (int i = 0; i < shifted.rows; i++) {
+                if (i < top || i > bottom) continue;
+                unsigned char *row = shifted.ptr<unsigned char>(i);
+                const unsigned char *occluded =
+                    occluder.ptr<unsigned char>(i);
+                for (int j = 0; j < shifted.cols; j++) {
+                    if (j >= left) row[j] = occluded[j];
+                }
+            }
+            ImageAlignment::prepareFrame(shifted, frames[k]);
+        }
+
+        std::cout << "cover " << cover << ":" << std::endl;
+
+        for (const size_t tileSize : { 0, 8, 16, 32 }) {
+            double iterations = 0, errorSum = 0, errorMax = 0, trackUs = 0;
+            size_t dropped = 0;
+
+            for (size_t r = 0; r < numSequences; r++) {
+                ImageAlignment tracker;
+                tracker.setDebugDisplay(false);
+                TileWeighting weighting;
+                weighting.tileSize = tileSize;
+                tracker.setTileWeighting(weighting);
+                tracker.init(frames[0], bbox);
+
+                for (int k = 1; k < NUM_FRAMES; k++) {
+                    bench_clock_t::time_point start = bench_clock_t::now();
+                    tracker.track(frames[k]);
+                    trackUs += elapsedUs(start);
+
+                    const double errorX =
+                        tracker.getBBOX()[0] - (bbox[0] + 0.6 * k);
+                    const double errorY =
+                        tracker.getBBOX()[1] - (bbox[1] - 0.3 * k);
+                    const double error =
+                        std::sqrt(errorX * errorX + errorY * errorY);
+                    iterations += tracker.getStats().lastIterations;
+                    errorSum += error;
+                    errorMax = std::max(errorMax, error);
+                }
+                dropped = tracker.getStats().lastDroppedTiles;
+            }
+
+            const double numScored = double(numSequences) * (NUM_FRAMES - 1);
+            std::cout << "  tile " << tileSize << ": "
+                      << iterations / numScored << " iterations, "
+                      << trackUs / numScored << " us, BBOX error mean "
+                      << errorSum / numScored << " px, max " << errorMax
+                      << " px, " << dropped << " tiles dropped" << std::endl;
+        }
+    }
+}
+
+/**
+ * Full-frame ROI (stabilisation): track without a pool vs on parallel pools of
+ * increasing size; the warps must be bit-identical to the serial one
+ */
+void benchParallel(size_t numReps) {
+    PreparedFrame frameA, frameB;
+    makeFramePair(frameA, frameB);
+
+    const bbox_t bbox = { 8, 8, 632, 472 };
+
+    Eigen::Matrix3d serialWarp;
+    double serialUs = 0;
+
+    const size_t maxThreads = std::thread::hardware_concurrency();
+    for (size_t numThreads = 0; numThreads <= std::max<size_t>(maxThreads, 4);
+         numThreads = numThreads ? numThreads * 2 : 1) {
+        std::unique_ptr<ThreadPool> pool;
+        if (numThreads > 0) pool.reset(new ThreadPool(numThreads));
+
+        ImageAlignment tracker;
+        tracker.setDebugDisplay(false);
+        tracker.setParallelPool(pool.get());
+
+        bench_clock_t::time_point start = bench_clock_t::now();
+        for (size_t i = 0; i < numReps; i++) {
+            tracker.init(frameA, bbox);
+            tracker.track(frameB);
+        }
+        const double trackUs = elapsedUs(start) / numReps;
+
+        if (numThreads == 0) {
+            serialWarp = tracker.getWarp();
+            serialUs = trackUs;
+            std::cout << "serial: " << trackUs << " us" << std::endl;
+            continue;
+        }
+
+        const bool identical =
+            std::memcmp(serialWarp.data(), tracker.getWarp().data(),
+                        sizeof(double) * 9) == 0;
+
+        std::cout << numThreads << " threads: " << trackUs << " us ("
+                  << serialUs / trackUs << "x), warp "
+                  << (identical ? "bit-identical" : "DIFFERS") << std::endl;
+    }
+}
+
+/**
+ * Deterministic mode: tracks a sequence of (sub-pixel) shifted frames several
+ * times, without a pool and on pools of several sizes, and checks that all
+ * trajectories are bit-identical. Prints the per-frame overhead over normal
+ * mode and a trajectory checksum to compare across machines and builds.
+ *
+ * @return true if all deterministic trajectories matched
+ */
+bool benchDeterministic(size_t numReps) {
+    cv::Mat noise(480, 640, CV_8UC1);
+    cv::randu(noise, cv::Scalar(0), cv::Scalar(255));
+    cv::GaussianBlur(noise, noise, cv::Size(9, 9), 2.0);
+
+    // Frame k: shifted by k / 2 pixels (resampled), so motion is sub-pixel
+    std::vector<PreparedFrame> frames(8);
+    for (size_t k = 0; k < frames.size(); k++) {
+        cv::Mat warp = cv::Mat::zeros(2, 3, CV_64FC1);
+        warp.at<double>(0, 0) = 1;
+        warp.at<double>(1, 1) = 1;
+        warp.at<double>(0, 2) = 0.5 * k;
+        warp.at<double>(1, 2) = -0.25 * k;
+
+        cv::Mat shifted;
+        cv::warpAffine(noise, shifted, warp, noise.size());
+        ImageAlignment::prepareFrame(shifted, frames[k]);
+    }
+
+    const bbox_t bbox = { 120, 100, 520, 380 };
+
+    // Track whole sequence; returns us per frame and FNV-1a of all warps
+    const auto run = [&](const bool aDeterministic, ThreadPool *aPool,
+                         uint64_t &aChecksum) {
+        ImageAlignment tracker;
+        tracker.setDebugDisplay(false);
+        tracker.setDeterministic(aDeterministic);
+        tracker.setParallelPool(aPool, 0); // Split whatever the grid size
+
+        aChecksum = 14695981039346656037ull;
+
+        bench_clock_t::time_point start = bench_clock_t::now();
+        for (size_t i = 0; i < numReps; i++) {
+            tracker.init(frames[0], bbox);
+
+            for (size_t k = 1; k < frames.size(); k++) {
+                tracker.track(frames[k]);
+
+                const unsigned char *bytes =
+                    reinterpret_cast<const unsigned char *>(
+                        tracker.getWarp().data());
+                for (size_t b = 0; b < 9 * sizeof(double); b++) {
+                    aChecksum ^= bytes[b];
+                    aChecksum *= 1099511628211ull;
+                }
+            }
+        }
+
+        return elapsedUs(start) / (numReps * (frames.size() - 1));
+    };
+
+    uint64_t normalChecksum, reference;
+    const double normalUs = run(false, nullptr, normalChecksum);
+    const double deterministicUs = run(true, nullptr, reference);
+
+    bool identical = true;
+    for (size_t numThreads = 1; numThreads <= 4; numThreads++) {
+        ThreadPool pool(numThreads);
+
+        uint64_t checksum;
+        run(true, &pool, checksum);
+        identical = identical && checksum == reference;
+    }
+
+    std::cout << "normal " << normalUs << " us/frame, deterministic "
+              << deterministicUs << " us/frame (overhead "
+              << 100.0 * (deterministicUs / normalUs - 1) << "%)"
+              << std::endl;
+    std::cout << "checksum " << std::hex << reference << std::dec
+              << ", runs and 1-4 threads "
+              << (identical ? "bit-identical" : "DIFFER") << std::endl;
+
+    return identical;
+}
+
+int main(int argc, char *argv[]) {
+    std::string bench((argc > 1) ? std::string(argv[1]) : "all");
+    size_t numFrames = (argc > 2) ? atoi(argv[2]) : 500;
+
+    if (bench == "all" || bench == "transport") {
+        std::cout << "== Frame transport (round trip incl. fill + read) =="
+                  << std::endl;
+        benchTransport(640, 480, CV_8UC1, numFrames);
+        benchTransport(1920, 1080, CV_8UC1, numFrames);
+        benchTransport(1920, 1080, CV_8UC3, numFrames);
+    }
+
+    if (bench == "all" || bench == "patch") {
+        std::cout << "== Fixed-size patch tracker vs dynamic (per call) =="
+                  << std::endl;
+        benchPatch<8>(numFrames);
+        benchPatch<16>(numFrames);
+        benchPatch<32>(numFrames);
+    }
+
+    if (bench == "all" || bench == "hessian") {
+        std::cout << "== Hessian accumulation (per call) ==" << std::endl;
+        benchHessian(16 * 16, numFrames);
+        benchHessian(120 * 60, numFrames);
+        benchHessian(320 * 240, numFrames);
+    }
+
+    if (bench == "all" || bench == "parameterisation") {
+        std::cout << "== Warp parameterisation (landing BBOX) ==" << std::endl;
+        benchParameterisation();
+    }
+
+    if (bench == "all" || bench == "summation") {
+        std::cout << "== Kernel summation accuracy vs speed (per call) =="
+                  << std::endl;
+        benchSummation(120 * 60, numFrames);
+        benchSummation(640 * 480, numFrames / 10 + 1);
+    }
+
+    if (bench == "all" || bench == "colour") {
+        std::cout << "== Colour vs grayscale tracking (per frame) =="
+                  << std::endl;
+        benchColour(numFrames / 10 + 1);
+    }
+
+    if (bench == "all" || bench == "gradient") {
+        std::cout << "== Template gradient operators (per template) =="
+                  << std::endl;
+        benchGradient(numFrames / 10 + 1);
+    }
+
+    if (bench == "all" || bench == "fixed") {
+        std::cout << "== 8-bit frames: float vs fixed-point (per frame) =="
+                  << std::endl;
+        benchFixed(numFrames / 10 + 1);
+    }
+
+    if (bench == "all" || bench == "half") {
+        std::cout << "== Template storage: float vs half precision =="
+                  << std::endl;
+        benchHalf(numFrames / 10 + 1);
+    }
+
+    if (bench == "all" || bench == "convergence") {
+        std::cout << "== Convergence policies (per frame) ==" << std::endl;
+        benchConvergence(numFrames / 10 + 1);
+    }
+
+    if (bench == "all" || bench == "appearance") {
+        std::cout << "== Appearance subspace under lighting changes "
+                     "(per frame) =="
+                  << std::endl;
+        benchAppearance(numFrames / 250 + 1);
+    }
+
+    if (bench == "all" || bench == "occlusion") {
+        std::cout << "== Robust tile weighting under partial occlusion "
+                     "(per frame) =="
+                  << std::endl;
+        benchOcclusion(numFrames / 250 + 1);
+    }
+
+    if (bench == "all" || bench == "parallel") {
+        std::cout << "== Full-frame ROI on parallel pools (per frame) =="
+                  << std::endl;
+        benchParallel(numFrames / 50 + 1);
+    }
+
+    if (bench == "all" || bench == "deterministic") {
+        std::cout << "== Deterministic mode (per frame) ==" << std::endl;
+        if (!benchDeterministic(numFrames / 50 + 1)) return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,470 @@
+/**
+ * @file FixedPatchTracker.hpp
+ * @author Samuel Leong (samleocw@gmail.com)
+ * @brief Inverse compositional alignment specialised for compile-time patch
+ * sizes (eg. 8x8, 16x16, 32x32), for sparse and patch workloads
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2020
+ */
+
+#ifndef __FIXED_PATCH_TRACKER_H__
+#define __FIXED_PATCH_TRACKER_H__
+
+#include <Eigen/Dense>
+#include <cmath>
+#include <opencv2/opencv.hpp>
+
+#include "ImageAlignment.hpp"
+
+/**
+ * @brief Fixed Patch Tracker Class
+ *
+ * Same Baker-Matthews IC alignment (affine warp) and sampling grid as
+ * ImageAlignment, for a W x H patch whose size is known at compile time: the
+ * template, Jacobian and all reductions live in fixed-size Eigen storage, and
+ * the sampling loops have compile-time bounds so the compiler can unroll and
+ * vectorise them. Axis-aligned grids (the template, and warps without
+ * rotation or shear) go through the separable kernels of ImageAlignment;
+ * border handling is confined to grid rows that leave the image.
+ *
+ * The patch keeps its size: after track(), its new position is the warped
+ * patch centre.
+ *
+ * @tparam W Patch width (pixels, >= 2)
+ * @tparam H Patch height (pixels, >= 2)
+ */
+template <int W, int H> class FixedPatchTracker {
+    static_assert(W >= 2 && H >= 2, "Patch must be at least 2x2");
+
+  public:
+    /// @brief Number of grid points (one per patch pixel)
+    static constexpr int N_PIXELS = W * H;
+
+    /// @brief Patch samples, flattened row by row
+    typedef Eigen::Matrix<float, N_PIXELS, 1> samples_t;
+
+    /// @brief Jacobian (steepest descent images), one column per parameter
+    typedef Eigen::Matrix<float, N_PIXELS, 6> jacobian_t;
+
+  private:
+    /// @brief Top-left corner of patch
+    float mX = 0, mY = 0;
+
+    /// @brief Frame the template is taken from
+    PreparedFrame mTemplateFrame;
+
+    /// @brief Template samples, Jacobian and inverse Hessian
+    samples_t mTemplate;
+    jacobian_t mJacobian;
+    Eigen::Matrix<double, 6, 6> mHessianInverse;
+
+    /// @brief Template data above matches template frame and position
+    bool mTemplateValid = false;
+
+    /// @brief Warp found by last track(), in image coordinates
+    Eigen::Matrix3d mWarp = Eigen::Matrix3d::Identity();
+
+    /// @brief RMS of error in last iteration, and iterations of last track()
+    double mResidualRMS = 0;
+    size_t mIterations = 0;
+
+    static bool isInterior(const cv::Mat &aImg, const double ax,
+                           const double ay);
+    static float sampleBorder(const cv::Mat &aImg, const double ax,
+                              const double ay);
+    void prepareTemplate();
+
+  public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    // Init
+    void init(const PreparedFrame &aFrame, const float aX, const float aY);
+
+    // Track
+    bool track(const PreparedFrame &aFrame, const float aThreshold = 0.01875,
+               const size_t aMaxIters = 100);
+
+    // Building blocks (also used for benchmarking)
+    static void sampleRect(const cv::Mat &aImg, const float aX, const float aY,
+                           const Eigen::Matrix3d &aWarp, samples_t &aSamples);
+    static void computeJacobian(const cv::Mat &aGradX, const cv::Mat &aGradY,
+                                const float aX, const float aY,
+                                jacobian_t &aJacobian);
+
+    // State
+    float getX() const;
+    float getY() const;
+    void getBBOX(bbox_t &aBbox) const;
+    const Eigen::Matrix3d &getWarp() const;
+    double getResidualRMS() const;
+    size_t getIterations() const;
+};
+
+/// @brief Common patch sizes
+typedef FixedPatchTracker<8, 8> PatchTracker8;
+typedef FixedPatchTracker<16, 16> PatchTracker16;
+typedef FixedPatchTracker<32, 32> PatchTracker32;
+
+/**
+ * @brief Check whether the bilinear neighbours of a point are all inside an
+ * image, so that it may be sampled without border handling
+ *
+ * @param[in] aImg Image
+ * @param[in] ax X coordinate
+ * @param[in] ay Y coordinate
+ *
+ * @return true if interior
+ */
+template <int W, int H>
+inline bool FixedPatchTracker<W, H>::isInterior(const cv::Mat &aImg,
+                                                const double ax,
+                                                const double ay) {
+    return ax >= 0 && ay >= 0 && ax < aImg.cols - 1 && ay < aImg.rows - 1;
+}
+
+/**
+ * @brief Bilinear sample of a CV_32FC1 image near its border, with
+ * BORDER_REFLECT_101 neighbours
+ *
+ * @param[in] aImg Image (CV_32FC1)
+ * @param[in] ax X coordinate
+ * @param[in] ay Y coordinate
+ *
+ * @return float interpolated value
+ */
+template <int W, int H>
+float FixedPatchTracker<W, H>::sampleBorder(const cv::Mat &aImg,
+                                            const double ax, const double ay) {
+    // Round down, so that positions in (-1, 0) reflect too
+    const int intX = static_cast<int>(std::floor(ax));
+    const int intY = static_cast<int>(std::floor(ay));
+
+    const float dx = static_cast<float>(ax - intX);
+    const float dy = static_cast<float>(ay - intY);
+
+    const int x0 =
+        cv::borderInterpolate(intX, aImg.cols, cv::BORDER_REFLECT_101);
+    const int x1 =
+        cv::borderInterpolate(intX + 1, aImg.cols, cv::BORDER_REFLECT_101);
+    const int y0 =
+        cv::borderInterpolate(intY, aImg.rows, cv::BORDER_REFLECT_101);
+    const int y1 =
+        cv::borderInterpolate(intY + 1, aImg.rows, cv::BORDER_REFLECT_101);
+
+    const float top =
+        aImg.at<float>(y0, x0) + dx * (aImg.at<float>(y0, x1) -
+                                       aImg.at<float>(y0, x0));
+    const float bottom =
+        aImg.at<float>(y1, x0) + dx * (aImg.at<float>(y1, x1) -
+                                       aImg.at<float>(y1, x0));
+    return top + dy * (bottom - top);
+}
+
+/**
+ * @brief Sample an image on the (warped) patch grid
+ * @note Same linearly-spaced grid as ImageAlignment with a W x H BBOX.
+ * Without rotation or shear the grid is axis-aligned and sampled by
+ * sampleSeparable(); otherwise rows whose ends are both interior are sampled
+ * without border handling, and only the others point by point by
+ * sampleBorder()
+ *
+ * @param[in] aImg Image (CV_32FC1)
+ * @param[in] aX Patch left
+ * @param[in] aY Patch top
+ * @param[in] aWarp Affine warp applied to grid points
+ * @param[out] aSamples Samples, row by row
+ */
+template <int W, int H>
+void FixedPatchTracker<W, H>::sampleRect(const cv::Mat &aImg, const float aX,
+                                         const float aY,
+                                         const Eigen::Matrix3d &aWarp,
+                                         samples_t &aSamples) {
+    const double deltaX = double(W) / (W - 1);
+    const double deltaY = double(H) / (H - 1);
+
+    if (aWarp(0, 1) == 0 && aWarp(1, 0) == 0) {
+        SeparableAxis axisX, axisY;
+        buildSeparableAxis(aWarp(0, 0) * aX + aWarp(0, 2),
+                           aWarp(0, 0) * deltaX, W, aImg.cols, axisX, true);
+        buildSeparableAxis(aWarp(1, 1) * aY + aWarp(1, 2),
+                           aWarp(1, 1) * deltaY, H, aImg.rows, axisY, true);
+        sampleSeparable(aImg, axisX, axisY, aSamples.data());
+        return;
+    }
+
+    const double stepX = aWarp(0, 0) * deltaX;
+    const double stepY = aWarp(1, 0) * deltaX;
+
+    const float *data = aImg.ptr<float>();
+    const size_t rowStep = aImg.step / sizeof(float);
+
+    for (int i = 0; i < H; i++) {
+        const double y = aY + deltaY * i;
+
+        // Warped position moves linearly along a grid row
+        const double x0 = aWarp(0, 1) * y + aWarp(0, 2) + aWarp(0, 0) * aX;
+        const double y0 = aWarp(1, 1) * y + aWarp(1, 2) + aWarp(1, 0) * aX;
+        float *out = aSamples.data() + i * W;
+
+        // Positions are linear in j, so two interior ends make the whole row
+        // interior
+        if (!isInterior(aImg, x0, y0) ||
+            !isInterior(aImg, x0 + stepX * (W - 1), y0 + stepY * (W - 1))) {
+            for (int j = 0; j < W; j++)
+                out[j] = sampleBorder(aImg, x0 + stepX * j, y0 + stepY * j);
+            continue;
+        }
+
+        for (int j = 0; j < W; j++) {
+            const double wx = x0 + stepX * j;
+            const double wy = y0 + stepY * j;
+
+            const int intX = static_cast<int>(wx);
+            const int intY = static_cast<int>(wy);
+            const float dx = static_cast<float>(wx - intX);
+            const float dy = static_cast<float>(wy - intY);
+
+            const float *row0 = data + intY * rowStep + intX;
+            const float *row1 = row0 + rowStep;
+
+            const float top = row0[0] + dx * (row0[1] - row0[0]);
+            const float bottom = row1[0] + dx * (row1[1] - row1[0]);
+            out[j] = top + dy * (bottom - top);
+        }
+    }
+}
+
+/**
+ * @brief Compute Jacobian of patch from (full image) template gradients
+ * @note The template grid is axis-aligned, so the gradients are sampled by
+ * sampleSeparable(), with the border in its index tables
+ *
+ * @see ImageAlignment::computeJacobian(const cv::Mat &, const cv::Mat &,
+ * Eigen::MatrixXd &)
+ *
+ * @param[in] aGradX Template image x gradient (CV_32FC1, unnormalised
+ * cv::Sobel as computed by ImageAlignment::prepareFrame())
+ * @param[in] aGradY Template image y gradient (CV_32FC1, idem)
+ * @param[in] aX Patch left
+ * @param[in] aY Patch top
+ * @param[out] aJacobian Jacobian
+ */
+template <int W, int H>
+void FixedPatchTracker<W, H>::computeJacobian(const cv::Mat &aGradX,
+                                              const cv::Mat &aGradY,
+                                              const float aX, const float aY,
+                                              jacobian_t &aJacobian) {
+    const double deltaX = double(W) / (W - 1);
+    const double deltaY = double(H) / (H - 1);
+
+    BoxFrame box;
+    makeBoxFrame(aX, aY, aX + W, aY + H, box);
+
+    SeparableAxis axisX, axisY;
+    buildSeparableAxis(aX, deltaX, W, aGradX.cols, axisX, true);
+    buildSeparableAxis(aY, deltaY, H, aGradX.rows, axisY, true);
+
+    samples_t delIx, delIy;
+    sampleSeparable(aGradX, axisX, axisY, delIx.data());
+    sampleSeparable(aGradY, axisX, axisY, delIy.data());
+
+    // Normalise cv::Sobel to a derivative per pixel (GRADIENT_SOBEL)
+    delIx *= 0.125f;
+    delIy *= 0.125f;
+
+    Eigen::Matrix<float, W, 1> u;
+    for (int j = 0; j < W; j++)
+        u(j) = static_cast<float>((aX + deltaX * j - box.centre[0]) /
+                                  box.scale);
+
+    for (int i = 0; i < H; i++) {
+        const float v =
+            static_cast<float>((aY + deltaY * i - box.centre[1]) / box.scale);
+
+        // delI * dWdp, dWdp = [u 0 v 0 1 0; 0 u 0 v 0 1] (box coordinates)
+        for (int j = 0; j < W; j++) {
+            const int k = i * W + j;
+
+            aJacobian(k, 0) = delIx(k) * u(j);
+            aJacobian(k, 1) = delIy(k) * u(j);
+            aJacobian(k, 2) = delIx(k) * v;
+            aJacobian(k, 3) = delIy(k) * v;
+            aJacobian(k, 4) = delIx(k);
+            aJacobian(k, 5) = delIy(k);
+        }
+    }
+}
+
+/**
+ * @brief Initialise patch
+ *
+ * @param[in] aFrame Preprocessed frame (with gradients) to take template from
+ * @param[in] aX Patch left
+ * @param[in] aY Patch top
+ */
+template <int W, int H>
+void FixedPatchTracker<W, H>::init(const PreparedFrame &aFrame, const float aX,
+                                   const float aY) {
+    mTemplateFrame = aFrame;
+    mX = aX;
+    mY = aY;
+
+    mWarp.setIdentity();
+    mResidualRMS = 0;
+    mIterations = 0;
+    mTemplateValid = false;
+}
+
+/**
+ * @brief Precompute template samples, Jacobian and inverse Hessian
+ */
+template <int W, int H> void FixedPatchTracker<W, H>::prepareTemplate() {
+    sampleRect(mTemplateFrame.image, mX, mY, Eigen::Matrix3d::Identity(),
+               mTemplate);
+    computeJacobian(mTemplateFrame.gradX, mTemplateFrame.gradY, mX, mY,
+                    mJacobian);
+
+    const Eigen::Matrix<double, 6, 6> Hessian =
+        (mJacobian.transpose() * mJacobian).template cast<double>();
+    mHessianInverse = Hessian.inverse();
+
+    mTemplateValid = true;
+}
+
+/**
+ * @brief Track patch into a new frame, which then becomes the template frame
+ *
+ * @param[in] aFrame Preprocessed new frame to track in
+ * @param[in] aThreshold Threshold to compare against
+ * @param[in] aMaxIters Maximum iterations before stop
+ *
+ * @return true if converged before aMaxIters
+ */
+template <int W, int H>
+bool FixedPatchTracker<W, H>::track(const PreparedFrame &aFrame,
+                                    const float aThreshold,
+                                    const size_t aMaxIters) {
+    if (!mTemplateValid) prepareTemplate();
+
+    // Estimated in box coordinates, sampled in image coordinates
+    BoxFrame box;
+    makeBoxFrame(mX, mY, mX + W, mY + H, box);
+
+    Eigen::Matrix3d warpMat = Eigen::Matrix3d::Identity();
+    Eigen::Matrix3d imageWarp = Eigen::Matrix3d::Identity();
+    samples_t warped;
+    bool converged = false;
+
+    mIterations = 0;
+
+    while (mIterations < aMaxIters) {
+        mIterations++;
+
+        boxToImageWarp(box, warpMat, imageWarp);
+        sampleRect(aFrame.image, mX, mY, imageWarp, warped);
+
+        const samples_t errorVector = warped - mTemplate;
+        mResidualRMS = std::sqrt(errorVector.squaredNorm() / N_PIXELS);
+
+        const Eigen::Matrix<double, 6, 1> vectorB =
+            (mJacobian.transpose() * errorVector).template cast<double>();
+
+        // Solve for new deltaP (pixels at the box edge)
+        const Eigen::Matrix<double, 6, 1> deltaP = mHessianInverse * vectorB;
+        const Eigen::Matrix<double, 6, 1> boxDeltaP = deltaP / box.scale;
+
+        Eigen::Matrix3d warpMatDelta;
+
+        warpMatDelta << 1 + boxDeltaP(0), boxDeltaP(2), boxDeltaP(4), //
+            boxDeltaP(1), 1 + boxDeltaP(3), boxDeltaP(5),             //
+            0, 0, 1;
+
+        warpMat *= warpMatDelta.inverse();
+
+        if (deltaP.norm() < aThreshold) {
+            converged = true;
+            break;
+        }
+    }
+
+    boxToImageWarp(box, warpMat, imageWarp);
+
+    // Move patch to warped centre
+    const Eigen::Vector3d centre(mX + W / 2.0, mY + H / 2.0, 1);
+    const Eigen::Vector3d newCentre = imageWarp * centre;
+
+    mX = static_cast<float>(newCentre(0) - W / 2.0);
+    mY = static_cast<float>(newCentre(1) - H / 2.0);
+
+    mWarp = imageWarp;
+    mTemplateFrame = aFrame;
+    mTemplateValid = false;
+
+    return converged;
+}
+
+/**
+ * @brief Get patch left
+ *
+ * @return float x coordinate of top-left corner
+ */
+template <int W, int H> float FixedPatchTracker<W, H>::getX() const {
+    return mX;
+}
+
+/**
+ * @brief Get patch top
+ *
+ * @return float y coordinate of top-left corner
+ */
+template <int W, int H> float FixedPatchTracker<W, H>::getY() const {
+    return mY;
+}
+
+/**
+ * @brief Get patch as BBOX (same layout as ImageAlignment)
+ *
+ * @param[out] aBbox BBOX
+ */
+template <int W, int H>
+void FixedPatchTracker<W, H>::getBBOX(bbox_t &aBbox) const {
+    aBbox[0] = mX;
+    aBbox[1] = mY;
+    aBbox[2] = mX + W;
+    aBbox[3] = mY + H;
+}
+
+/**
+ * @brief Get affine warp found by the last call to track()
+ *
+ * @return const Eigen::Matrix3d& warp
+ */
+template <int W, int H>
+const Eigen::Matrix3d &FixedPatchTracker<W, H>::getWarp() const {
+    return mWarp;
+}
+
+/**
+ * @brief Get RMS of the error in the last iteration of the last track()
+ *
+ * @return double residual RMS
+ */
+template <int W, int H>
+double FixedPatchTracker<W, H>::getResidualRMS() const {
+    return mResidualRMS;
+}
+
+/**
+ * @brief Get number of iterations of the last track()
+ *
+ * @return size_t iterations
+ */
+template <int W, int H>
+size_t FixedPatchTracker<W, H>::getIterations() const {
+    return mIterations;
+}
+
+#endif
@@ -0,0 +1,421 @@
+/**
+ * @file FrameRing.cpp
+ * @author Samuel Leong (samleocw@gmail.com)
+ * @brief Shared memory ring of frame slots for zero-copy frame transport
+ * between a capture process and tracker processes
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2020
+ */
+
+#include "FrameRing.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * @brief Round up to multiple of aAlign
+ */
+static size_t roundUp(const size_t aValue, const size_t aAlign) {
+    return (aValue + aAlign - 1) / aAlign * aAlign;
+}
+
+/**
+ * @brief futex() wrapper on a (process-shared) 32-bit word
+ *
+ * @param[in] aWord Futex word
+ * @param[in] aOp FUTEX_WAIT or FUTEX_WAKE
+ * @param[in] aVal Expected value (wait) or number of waiters to wake (wake)
+ * @param[in] aTimeout Relative timeout (wait only), nullptr for none
+ *
+ * @return long syscall result
+ */
+static long futex(std::atomic<uint32_t> *aWord, const int aOp,
+                  const uint32_t aVal, const timespec *aTimeout = nullptr) {
+    return syscall(SYS_futex, reinterpret_cast<uint32_t *>(aWord), aOp, aVal,
+                   aTimeout, nullptr, 0);
+}
+
+/**
+ * @brief Constructor for FrameRing class (not attached to any ring)
+ */
+FrameRing::FrameRing() {}
+
+/**
+ * @brief Destructor: unmaps, and unlinks the ring if this instance created it
+ */
+FrameRing::~FrameRing() {
+    close();
+}
+
+/**
+ * @brief Get ring header
+ *
+ * @return FrameRingHeader* header at start of mapping
+ */
+FrameRingHeader *FrameRing::header() const {
+    return static_cast<FrameRingHeader *>(mBase);
+}
+
+/**
+ * @brief Get header of the slot holding frame aSeq
+ *
+ * @param[in] aSeq Frame sequence number
+ * @return FrameSlotHeader* slot header
+ */
+FrameSlotHeader *FrameRing::slotHeader(const uint64_t aSeq) const {
+    FrameSlotHeader *slots = reinterpret_cast<FrameSlotHeader *>(
+        static_cast<unsigned char *>(mBase) + sizeof(FrameRingHeader));
+    return &slots[aSeq % header()->numSlots];
+}
+
+/**
+ * @brief Get first pixel of the slot holding frame aSeq
+ *
+ * @param[in] aSeq Frame sequence number
+ * @return unsigned char* slot data
+ */
+unsigned char *FrameRing::slotData(const uint64_t aSeq) const {
+    const FrameRingHeader *hdr = header();
+    return static_cast<unsigned char *>(mBase) + hdr->dataOffset +
+           (aSeq % hdr->numSlots) * hdr->slotStride;
+}
+
+/**
+ * @brief Create (or replace) a ring
+ *
+ * @param[in] aName Shared memory object name, eg. "/klt_cam0"
+ * @param[in] aNumSlots Number of frame slots
+ * @param[in] aWidth Frame width
+ * @param[in] aHeight Frame height
+ * @param[in] aType Frame OpenCV type (eg. CV_8UC1)
+ *
+ * @return true on success
+ */
+bool FrameRing::create(const std::string &aName, const uint32_t aNumSlots,
+                       const int aWidth, const int aHeight, const int aType) {
+    close();
+
+    if (aNumSlots == 0 || aWidth <= 0 || aHeight <= 0) return false;
+
+    const size_t elemSize = cv::Mat(1, 1, aType).elemSize();
+    const size_t step = roundUp(aWidth * elemSize, 64);
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+
+    const size_t dataOffset = roundUp(
+        sizeof(FrameRingHeader) + aNumSlots * sizeof(FrameSlotHeader),
+        pageSize);
+    const size_t slotStride = roundUp(step * aHeight, pageSize);
+    const size_t size = dataOffset + aNumSlots * slotStride;
+
+    shm_unlink(aName.c_str());
+    const int fd = shm_open(aName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) return false;
+
+    if (ftruncate(fd, size) < 0) {
+        ::close(fd);
+        shm_unlink(aName.c_str());
+        return false;
+    }
+
+    void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (base == MAP_FAILED) {
+        shm_unlink(aName.c_str());
+        return false;
+    }
+
+    mName = aName;
+    mBase = base;
+    mSize = size;
+    mOwner = true;
+
+    // Fresh object is zero-filled; construct atomics in place
+    FrameRingHeader *hdr = new (mBase) FrameRingHeader;
+    hdr->numSlots = aNumSlots;
+    hdr->width = aWidth;
+    hdr->height = aHeight;
+    hdr->type = aType;
+    hdr->step = static_cast<int32_t>(step);
+    hdr->dataOffset = dataOffset;
+    hdr->slotStride = slotStride;
+    hdr->writeSeq.store(0);
+    hdr->notify.store(0);
+
+    for (uint32_t i = 0; i < aNumSlots; i++)
+        new (slotHeader(i)) FrameSlotHeader{ { 0 } };
+
+    // Publish magic last so that readers never see a half-initialised ring
+    std::atomic_thread_fence(std::memory_order_release);
+    hdr->magic = KLT_RING_MAGIC;
+
+    return true;
+}
+
+/**
+ * @brief Attach to an existing ring
+ *
+ * @param[in] aName Shared memory object name
+ * @return true on success
+ */
+bool FrameRing::open(const std::string &aName) {
+    close();
+
+    const int fd = shm_open(aName.c_str(), O_RDWR, 0);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 ||
+        static_cast<size_t>(st.st_size) < sizeof(FrameRingHeader)) {
+        ::close(fd);
+        return false;
+    }
+
+    void *base =
+        mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (base == MAP_FAILED) return false;
+
+    mName = aName;
+    mBase = base;
+    mSize = st.st_size;
+    mOwner = false;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header()->magic != KLT_RING_MAGIC || !isLayoutValid()) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Check that the ring header describes a layout which fits in the
+ * mapping: slot headers before the data, rows within slots and slots within
+ * the object
+ * @note Guards readers against truncated or foreign objects
+ *
+ * @return true if valid
+ */
+bool FrameRing::isLayoutValid() const {
+    const FrameRingHeader *hdr = header();
+
+    // Up to 4 channels of any depth
+    if (hdr->numSlots == 0 || hdr->width <= 0 || hdr->height <= 0 ||
+        hdr->step <= 0 || hdr->type < 0 || hdr->type >= CV_MAKETYPE(0, 5))
+        return false;
+
+    const uint64_t rowBytes = static_cast<uint64_t>(hdr->width) *
+                              cv::Mat(1, 1, hdr->type).elemSize();
+    const uint64_t slotBytes = static_cast<uint64_t>(hdr->step) * hdr->height;
+    if (static_cast<uint64_t>(hdr->step) < rowBytes ||
+        hdr->slotStride < slotBytes)
+        return false;
+
+    const uint64_t slotHeaders = sizeof(FrameRingHeader) +
+                                 static_cast<uint64_t>(hdr->numSlots) *
+                                     sizeof(FrameSlotHeader);
+    if (hdr->dataOffset < slotHeaders || hdr->dataOffset > mSize) return false;
+
+    // numSlots * slotStride <= mSize - dataOffset, without overflowing
+    return hdr->slotStride <= (mSize - hdr->dataOffset) / hdr->numSlots;
+}
+
+/**
+ * @brief Detach from ring; the creator also unlinks it
+ */
+void FrameRing::close() {
+    if (mBase) munmap(mBase, mSize);
+    if (mOwner) shm_unlink(mName.c_str());
+
+    mBase = nullptr;
+    mSize = 0;
+    mOwner = false;
+    mPendingSeq = 0;
+}
+
+/**
+ * @brief Start writing the next frame in place
+ * @note Must be followed by endWrite(). Single writer only
+ *
+ * @return cv::Mat view of the slot to write the frame into
+ */
+cv::Mat FrameRing::beginWrite() {
+    assert(mBase && !mPendingSeq);
+
+    FrameRingHeader *hdr = header();
+    mPendingSeq = hdr->writeSeq.load(std::memory_order_relaxed) + 1;
+
+    // Invalidate slot before touching its data
+    slotHeader(mPendingSeq)->seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    return cv::Mat(hdr->height, hdr->width, hdr->type, slotData(mPendingSeq),
+                   hdr->step);
+}
+
+/**
+ * @brief Publish the frame started with beginWrite() and wake readers
+ *
+ * @return uint64_t sequence number of published frame
+ */
+uint64_t FrameRing::endWrite() {
+    assert(mBase && mPendingSeq);
+
+    FrameRingHeader *hdr = header();
+    const uint64_t seq = mPendingSeq;
+    mPendingSeq = 0;
+
+    slotHeader(seq)->seq.store(seq, std::memory_order_release);
+    hdr->writeSeq.store(seq, std::memory_order_release);
+    hdr->notify.fetch_add(1, std::memory_order_release);
+
+    futex(&hdr->notify, FUTEX_WAKE, INT_MAX);
+
+    return seq;
+}
+
+/**
+ * @brief Copy a frame into the next slot and publish it
+ *
+ * @param[in] aFrame Frame of the ring's size and type
+ * @return uint64_t sequence number of published frame, 0 on mismatch
+ */
+uint64_t FrameRing::write(const cv::Mat &aFrame) {
+    const FrameRingHeader *hdr = header();
+    if (aFrame.rows != hdr->height || aFrame.cols != hdr->width ||
+        aFrame.type() != hdr->type)
+        return 0;
+
+    cv::Mat slot = beginWrite();
+    aFrame.copyTo(slot);
+    return endWrite();
+}
+
+/**
+ * @brief Get sequence number of latest published frame
+ *
+ * @return uint64_t sequence number, 0 if none yet
+ */
+uint64_t FrameRing::latestSeq() const {
+    return header()->writeSeq.load(std::memory_order_acquire);
+}
+
+/**
+ * @brief Block until a frame newer than aAfterSeq is published
+ *
+ * @param[in] aAfterSeq Last frame seen by caller
+ * @param[in] aTimeoutMs Timeout in ms, -1 to wait forever
+ *
+ * @return uint64_t latest sequence number, or 0 on timeout
+ */
+uint64_t FrameRing::waitFrame(const uint64_t aAfterSeq, const int aTimeoutMs) {
+    typedef std::chrono::steady_clock clock;
+
+    FrameRingHeader *hdr = header();
+
+    // FUTEX_WAIT takes a relative timeout, so wake-ups (eg. EINTR) must not
+    // restart the full wait
+    const clock::time_point deadline =
+        clock::now() + std::chrono::milliseconds(std::max(aTimeoutMs, 0));
+
+    while (true) {
+        // Read futex word before checking, so a publish in between makes the
+        // wait return immediately
+        const uint32_t notify = hdr->notify.load(std::memory_order_acquire);
+        const uint64_t seq = hdr->writeSeq.load(std::memory_order_acquire);
+        if (seq > aAfterSeq) return seq;
+
+        timespec timeout;
+        if (aTimeoutMs >= 0) {
+            const clock::duration left = deadline - clock::now();
+            if (left <= clock::duration::zero()) return 0;
+
+            const long long ns =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(left)
+                    .count();
+            timeout.tv_sec = static_cast<time_t>(ns / 1000000000LL);
+            timeout.tv_nsec = static_cast<long>(ns % 1000000000LL);
+        }
+
+        const long ret = futex(&hdr->notify, FUTEX_WAIT, notify,
+                               (aTimeoutMs >= 0) ? &timeout : nullptr);
+        if (ret < 0 && errno == ETIMEDOUT) return 0;
+    }
+}
+
+/**
+ * @brief Get in-place view of a published frame
+ * @note The view is only guaranteed to have been valid if isValid(aSeq) still
+ * holds after the caller is done with it
+ *
+ * @param[in] aSeq Frame sequence number
+ * @param[out] aView View of frame in shared memory (no copy)
+ *
+ * @return true if the slot currently holds frame aSeq
+ */
+bool FrameRing::readFrame(const uint64_t aSeq, cv::Mat &aView) const {
+    if (aSeq == 0 ||
+        slotHeader(aSeq)->seq.load(std::memory_order_acquire) != aSeq)
+        return false;
+
+    const FrameRingHeader *hdr = header();
+    aView = cv::Mat(hdr->height, hdr->width, hdr->type, slotData(aSeq),
+                    hdr->step);
+    return true;
+}
+
+/**
+ * @brief Check that frame aSeq has not been overwritten (seqlock validation)
+ *
+ * @param[in] aSeq Frame sequence number
+ * @return true if everything read from the frame's view so far is consistent
+ */
+bool FrameRing::isValid(const uint64_t aSeq) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slotHeader(aSeq)->seq.load(std::memory_order_relaxed) == aSeq;
+}
+
+/**
+ * @brief Describe a published frame as a TrackingServer frame handle, so that
+ * ring frames can be tracked by the tracking service without copies
+ *
+ * @param[in] aSeq Frame sequence number
+ * @param[out] aHandle Frame handle
+ *
+ * @return true if the slot currently holds frame aSeq
+ */
+bool FrameRing::getFrameHandle(const uint64_t aSeq,
+                               FrameHandle &aHandle) const {
+    if (!isValid(aSeq) || mName.size() >= KLT_SHM_NAME_LEN) return false;
+
+    const FrameRingHeader *hdr = header();
+
+    std::memset(&aHandle, 0, sizeof(aHandle));
+    std::strncpy(aHandle.shmName, mName.c_str(), KLT_SHM_NAME_LEN - 1);
+    aHandle.offset = slotData(aSeq) - static_cast<unsigned char *>(mBase);
+    aHandle.width = hdr->width;
+    aHandle.height = hdr->height;
+    aHandle.type = hdr->type;
+    aHandle.step = hdr->step;
+    aHandle.frameSeq = aSeq;
+
+    return true;
+}
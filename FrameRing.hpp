@@ -0,0 +1,111 @@
+/**
+ * @file FrameRing.hpp
+ * @author Samuel Leong (samleocw@gmail.com)
+ * @brief Shared memory ring of frame slots for zero-copy frame transport
+ * between a capture process and tracker processes
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2020
+ */
+
+#ifndef __FRAME_RING_H__
+#define __FRAME_RING_H__
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "TrackingServer.hpp"
+
+/// @brief Ring magic ("KLTR")
+#define KLT_RING_MAGIC 0x4b4c5452u
+
+/// @brief Shared ring header, at the start of the shared memory object
+struct FrameRingHeader {
+    uint32_t magic;
+    uint32_t numSlots;
+
+    /// @brief Frame geometry, identical for all slots
+    int32_t width, height, type, step;
+
+    /// @brief Byte offset of first slot and distance between slots
+    uint64_t dataOffset, slotStride;
+
+    /// @brief Sequence number of latest published frame (0: none yet)
+    alignas(64) std::atomic<uint64_t> writeSeq;
+
+    /// @brief Futex word, bumped on every publish
+    alignas(64) std::atomic<uint32_t> notify;
+};
+
+/// @brief Per-slot header. Acts as a seqlock: 0 while the slot is being
+/// written, otherwise the sequence number of the frame it holds
+struct alignas(64) FrameSlotHeader {
+    std::atomic<uint64_t> seq;
+};
+
+/**
+ * @brief Frame Ring Class
+ *
+ * A POSIX shared memory object holding a ring of fixed-size frame slots.
+ * Frame n (n >= 1) is written into slot n % numSlots. The writer (capture
+ * process) writes frames directly into slots through cv::Mat views and
+ * publishes them with a sequence number and a futex wake-up; readers (tracker
+ * processes) wait on the futex and read frames in place, again through cv::Mat
+ * views.
+ *
+ * There is no back-pressure: a reader that falls numSlots frames behind sees
+ * its frame overwritten, which it detects with isValid() after use.
+ */
+class FrameRing {
+  private:
+    /// @brief Shared memory object name
+    std::string mName;
+
+    /// @brief Mapping of whole object
+    void *mBase = nullptr;
+    size_t mSize = 0;
+
+    /// @brief Created (and will unlink) the object
+    bool mOwner = false;
+
+    /// @brief Frame being written by beginWrite() (0: none)
+    uint64_t mPendingSeq = 0;
+
+    FrameRingHeader *header() const;
+    FrameSlotHeader *slotHeader(const uint64_t aSeq) const;
+    unsigned char *slotData(const uint64_t aSeq) const;
+    bool isLayoutValid() const;
+
+  public:
+    // Constructor
+    FrameRing();
+    ~FrameRing();
+
+    FrameRing(const FrameRing &) = delete;
+    FrameRing &operator=(const FrameRing &) = delete;
+
+    // Setup
+    bool create(const std::string &aName, const uint32_t aNumSlots,
+                const int aWidth, const int aHeight, const int aType);
+    bool open(const std::string &aName);
+    void close();
+
+    // Writer
+    cv::Mat beginWrite();
+    uint64_t endWrite();
+    uint64_t write(const cv::Mat &aFrame);
+
+    // Reader
+    uint64_t latestSeq() const;
+    uint64_t waitFrame(const uint64_t aAfterSeq, const int aTimeoutMs = -1);
+    bool readFrame(const uint64_t aSeq, cv::Mat &aView) const;
+    bool isValid(const uint64_t aSeq) const;
+
+    // Tracking service interop
+    bool getFrameHandle(const uint64_t aSeq, FrameHandle &aHandle) const;
+};
+
+#endif
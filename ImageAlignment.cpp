@@ -13,6 +13,119 @@
 #include "ImageAlignment.hpp"
 #include <stdio.h>
 
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+/// @brief Checkpoint magic ("KLTC") and format version
+#define KLT_CHECKPOINT_MAGIC 0x4b4c5443u
+#define KLT_CHECKPOINT_VERSION 10u
+
+/// @brief Iterations before a hypothesis may be cancelled
+#define KLT_HYPOTHESIS_MIN_ITERS 3
+
+/// @brief Hypotheses with residual above this many times the best finished
+/// one are cancelled
+#define KLT_HYPOTHESIS_CANCEL_RATIO 1.5
+
+/// @brief Deadline mode: number of pyramid levels (scales 1, 1/2, 1/4, ...),
+/// and minimum grid points along the shorter BBOX side of a coarse level
+#define KLT_DEADLINE_LEVELS 3
+#define KLT_DEADLINE_MIN_GRID 8
+
+/// @brief Deadline mode: margin of the region around the BBOX that coarse
+/// levels are built over, in BBOX sides
+#define KLT_DEADLINE_MARGIN 0.25f
+
+/// @brief Deadline mode: cost of preparing a level, in iterations
+#define KLT_DEADLINE_PREPARE_COST 3
+
+/// @brief ROI change detector grid size (per side)
+#define KLT_SKIP_GRID 16
+
+/**
+ * @brief Fixed-size checkpoint header, followed (if hasTemplate) by the
+ * template samples (doubles, one grid per channel), the six steepest descent
+ * images (floats, without padding) and the inverse Hessian (doubles)
+ * @note Raw host layout: only portable between identical builds
+ * @note The last fields are the settings the template data depends on; a
+ * tracker configured otherwise rejects the checkpoint
+ */
+struct CheckpointHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t hasTemplate;
+    uint64_t gridWidth, gridHeight, gridChannels;
+    uint64_t sampleStride;
+    uint64_t pixelBudget;
+    float bbox[4];
+    double warp[9];
+    uint64_t frameIndex;
+    double residualRMS;
+    double confidenceScale;
+    TrackStats stats;
+    uint32_t frameDepth;
+    ChannelLayout channelLayout;
+    StoragePrecision storagePrecision;
+    GradientOperator gradientOperator;
+    uint64_t appearanceModes;
+    uint64_t tileSize;
+};
+
+/**
+ * @brief Get the planes of a preprocessed image: the image itself, or views of
+ * the planes stacked vertically in a planar frame
+ *
+ * @param[in] aImg Image
+ * @param[in] aPlanes Number of planes stacked vertically
+ * @param[out] aViews Plane views (no copies)
+ */
+static void getPlaneViews(const cv::Mat &aImg, const int aPlanes,
+                          std::vector<cv::Mat> &aViews) {
+    const int rows = aImg.rows / aPlanes;
+
+    aViews.resize(aPlanes);
+    for (int p = 0; p < aPlanes; p++)
+        aViews[p] = (aPlanes == 1)
+                        ? aImg
+                        : aImg(cv::Rect(0, p * rows, aImg.cols, rows));
+}
+
+/**
+ * @brief Bilinear interpolation of all channels of an interleaved image at
+ * once, with weights shared by the channels
+ *
+ * @param[in] aImg Interleaved image
+ * @param[in] aX0 Left column
+ * @param[in] aX1 Right column
+ * @param[in] aY0 Top row
+ * @param[in] aY1 Bottom row
+ * @param[in] aWeights Top-left, top-right, bottom-left, bottom-right weights
+ * @param[out] aOut Value of channel c at aOut[c * aStride]
+ * @param[in] aStride Output stride between channels
+ */
+template <typename T>
+static void blendChannels(const cv::Mat &aImg, const int aX0, const int aX1,
+                          const int aY0, const int aY1,
+                          const double aWeights[4], double *aOut,
+                          const size_t aStride) {
+    const int cn = aImg.channels();
+
+    const T *tl = aImg.ptr<T>(aY0) + aX0 * cn;
+    const T *tr = aImg.ptr<T>(aY0) + aX1 * cn;
+    const T *bl = aImg.ptr<T>(aY1) + aX0 * cn;
+    const T *br = aImg.ptr<T>(aY1) + aX1 * cn;
+
+    for (int c = 0; c < cn; c++)
+        aOut[c * aStride] = aWeights[0] * tl[c] + aWeights[1] * tr[c] +
+                            aWeights[2] * bl[c] + aWeights[3] * br[c];
+}
+
 /**
  * @brief Constructor for ImageAlignment class (empty)
  */
@@ -60,6 +173,7 @@ void ImageAlignment::init(const cv::Mat &aImage) {
  */
 void ImageAlignment::init(const bbox_t &aBbox) {
     setBBOX(aBbox);
+    resetState();
 }
 
 /**
@@ -71,6 +185,22 @@ void ImageAlignment::init(const bbox_t &aBbox) {
 void ImageAlignment::init(const cv::Mat &aImage, const bbox_t &aBbox) {
     setCurrentImage(aImage);
     setBBOX(aBbox);
+    resetState();
+}
+
+/**
+ * @brief Initialiser
+ *
+ * @param[in] aFrame Initial (preprocessed) current frame
+ * @param[in] aBbox Initial BBOX
+ */
+void ImageAlignment::init(const PreparedFrame &aFrame, const bbox_t &aBbox) {
+    mCurrentImage = aFrame.image;
+    mCurrentFrame = aFrame;
+    mCurrentPyramid.clear();
+    mTemplateValid = false;
+    setBBOX(aBbox);
+    resetState();
 }
 
 /**
@@ -90,6 +220,9 @@ const bbox_t &ImageAlignment::getBBOX() {
 void ImageAlignment::setBBOX(const bbox_t &aBbox) {
     for (int i = 0; i < 4; i++)
         mBbox[i] = aBbox[i];
+
+    mTemplateValid = false;
+    publishState();
 }
 
 /**
@@ -106,6 +239,9 @@ void ImageAlignment::setBBOX(const float aTop, const float aLeft,
     mBbox[1] = aLeft;
     mBbox[2] = aBottom;
     mBbox[3] = aRight;
+
+    mTemplateValid = false;
+    publishState();
 }
 
 /**
@@ -140,6 +276,11 @@ const cv::Mat &ImageAlignment::getCurrentImage() {
  */
 void ImageAlignment::setCurrentImage(const cv::Mat &aImg) {
     mCurrentImage = aImg;
+
+    // Preprocessed frame and template are recomputed lazily from the new image
+    mCurrentFrame = PreparedFrame();
+    mCurrentPyramid.clear();
+    mTemplateValid = false;
 }
 
 /**
@@ -212,6 +353,27 @@ void ImageAlignment::convertImageForDisplay(const cv::Mat &aSrc,
     cv::normalize(aDest, aDest, 0, 255, cv::NORM_MINMAX, CV_8UC1);
 }
 
+/**
+ * @brief Check if intermediate images are displayed while tracking
+ *
+ * @return true if debug display is enabled
+ */
+bool ImageAlignment::getDebugDisplay() const {
+    return mDebugDisplay;
+}
+
+/**
+ * @brief Enable/disable display of intermediate images (template sub image,
+ * warped image) inside track()
+ * @note OpenCV HighGUI is not thread-safe; disable when tracking off the main
+ * thread
+ *
+ * @param[in] aDebugDisplay Enable debug display
+ */
+void ImageAlignment::setDebugDisplay(const bool aDebugDisplay) {
+    mDebugDisplay = aDebugDisplay;
+}
+
 /**
  * @brief Compute Jacobian used for image alignment and also optimally obtain
  * the sub image computed using ImageAlignment::getSubPixelValue()
@@ -236,6 +398,26 @@ void ImageAlignment::computeJacobian(const cv::Mat &aTemplateImage,
     cv::Sobel(aTemplateImage, templateGradX, CV_32FC1, 1, 0);
     cv::Sobel(aTemplateImage, templateGradY, CV_32FC1, 0, 1);
 
+    computeJacobian(templateGradX, templateGradY, aJacobian);
+}
+
+/**
+ * @brief Compute Jacobian from precomputed (full image) template gradients
+ * (unnormalised cv::Sobel, as computed by prepareFrame()); the result matches
+ * the fused computeJacobian() with GRADIENT_SOBEL
+ *
+ * @see ImageAlignment::computeJacobian(const cv::Mat &, Eigen::MatrixXd &)
+ *
+ * @param[in] aGradX Template image x gradient (CV_32F)
+ * @param[in] aGradY Template image y gradient (CV_32F)
+ * @param[out] aJacobian Jacobian matrix (Eigen output)
+ *
+ * @pre output params should be of type double, and should also be of the
+ * correct BBOX size
+ */
+void ImageAlignment::computeJacobian(const cv::Mat &aGradX,
+                                     const cv::Mat &aGradY,
+                                     Eigen::MatrixXd &aJacobian) {
     // Get BBOX
     const bbox_t &bbox = getBBOX();
     const float bboxWidth = bbox[2] - bbox[0];
@@ -257,24 +439,31 @@ void ImageAlignment::computeJacobian(const cv::Mat &aTemplateImage,
     // Loop over everything, linearly-spaced
     // https://stackoverflow.com/questions/27028226/python-linspace-in-c
     size_t total = 0;
-    const int nX = int(bboxWidth);
-    const int nY = int(bboxHeight);
+    int nX, nY;
+    getGridSize(bbox, nX, nY);
 
     const float deltaX = bboxWidth / (nX - 1);
     const float deltaY = bboxHeight / (nY - 1);
 
+    BoxFrame box;
+    getBoxFrame(bbox, box);
+
     for (int i = 0; i < nY; i++) {
         float y = bbox[1] + deltaY * i;
+        const float v = (y - box.centre[1]) / box.scale;
         for (int j = 0; j < nX; j++) {
             float x = bbox[0] + deltaX * j;
+            const float u = (x - box.centre[0]) / box.scale;
 
-            // Create dWdp matrix
-            dWdp << x, 0, y, 0, 1, 0, //
-                0, x, 0, y, 0, 1;
+            // Create dWdp matrix (box coordinates)
+            dWdp << u, 0, v, 0, 1, 0, //
+                0, u, 0, v, 0, 1;
 
             // TODO: Use getSubPixelValue instead
-            double delIx = getSubPixelValue(templateGradX, x, y);
-            double delIy = getSubPixelValue(templateGradY, x, y);
+            // Normalise cv::Sobel to a derivative per pixel (GRADIENT_SOBEL),
+            // like the fused computeJacobian()
+            double delIx = 0.125 * getSubPixelValue(aGradX, x, y);
+            double delIy = 0.125 * getSubPixelValue(aGradY, x, y);
 
             // Try using cv::getSubPix
             // double delIx = templateGradXSub.at<float>(i, j);
@@ -301,330 +490,2731 @@ void ImageAlignment::computeJacobian(const cv::Mat &aTemplateImage,
 }
 
 /**
- * @brief Using the iteratively saved BBOX, get template from "current" frame
- * (which is the previous frame) and perform Baker-Matthews IC image alignment:
+ * @brief Compute steepest descent images (the Jacobian, stored as six aligned
+ * float planes on the template grid) from precomputed template gradients
  *
- * Proceed to update new bbox (detection) accordingly
+ * @see ImageAlignment::computeJacobian(const cv::Mat &, const cv::Mat &,
+ * Eigen::MatrixXd &)
  *
- * @param[in] aNewImage New image to track in
- * @param[in] aThreshold Threshold to compare against
- * @param[in] aMaxIters Maximum iterations before stop
+ * @param[in] aGradX Template image x gradient (CV_32F, any layout)
+ * @param[in] aGradY Template image y gradient (CV_32F, any layout)
+ * @param[out] aImages Steepest descent images (resized to 6 planes of one grid
+ * per channel)
+ * @param[in] aPool Pool to split grid rows over (nullptr: calling thread
+ * only); the result is the same either way
+ * @param[in] aPlanes Number of planes stacked vertically in the gradients
  */
-void ImageAlignment::track(const cv::Mat &aNewImage, const float aThreshold,
-                           const size_t aMaxIters) {
-    // Set new images
-    //  - "Current" image becomes template
-    //  - New image becomes current image
-    const cv::Mat templateImage = getCurrentImage();
-    const cv::Mat &currentImage = aNewImage;
+void ImageAlignment::computeJacobian(const cv::Mat &aGradX,
+                                     const cv::Mat &aGradY,
+                                     AlignedPlanes &aImages, ThreadPool *aPool,
+                                     const int aPlanes) {
+    const bbox_t &bbox = getBBOX();
+    const float bboxWidth = bbox[2] - bbox[0];
+    const float bboxHeight = bbox[3] - bbox[1];
 
-    const cv::Size2d IMAGE_SIZE = currentImage.size();
+    int nX, nY;
+    getGridSize(bbox, nX, nY);
 
-    setTemplateImage(templateImage);
-    setCurrentImage(currentImage);
+    const float deltaX = bboxWidth / (nX - 1);
+    const float deltaY = bboxHeight / (nY - 1);
 
-    // Get BBOX
-    const bbox_t &bbox = getBBOX();
-    const cv::Size2d bboxSize(bbox[2] - bbox[0], bbox[3] - bbox[1]);
-    const cv::Point2f bboxCenter((bbox[2] + bbox[0]) / 2,
-                                 (bbox[3] + bbox[1]) / 2);
+    BoxFrame box;
+    getBoxFrame(bbox, box);
 
-    // Subpixel crop
-    cv::Mat templateImageFloat;
-    templateImage.convertTo(templateImageFloat, CV_32FC1);
+    // Channels are stacked grid after grid, like the template samples
+    std::vector<cv::Mat> planesX, planesY;
+    getPlaneViews(aGradX, aPlanes, planesX);
+    getPlaneViews(aGradY, aPlanes, planesY);
 
-    // Get actual template sub image
-    cv::Mat templateSubImage;
-    // getSubPixelRect(templateImageFloat, templateSubImage);
-    cv::getRectSubPix(templateImageFloat, bboxSize, bboxCenter,
-                      templateSubImage, CV_32FC1);
+    const int cn = aGradX.channels();
+    const int numChannels = cn * aPlanes;
+    const size_t N_GRID = nX * nY;
 
-    cv::Mat disImg;
-    convertImageForDisplay(templateSubImage, disImg);
-    cv::imshow("Sub image", disImg);
+    aImages.resize(6, numChannels * N_GRID);
 
-    // TODO: Remove after debugging
-    // freopen("output_TImg_cpp.txt", "w", stdout);
-    // std::cout << std::setprecision(5) << std::fixed
-    //           << "Template Sub Image: " << templateSubImage.size() <<
-    //           std::endl
-    //           << templateSubImage << std::endl;
+    float *sd[6];
+    for (int k = 0; k < 6; k++)
+        sd[k] = aImages.plane(k);
 
-    // cv::Mat disImage;
-    // convertImageForDisplay(templateSubImage, disImage);
-    // cv::imshow("Template sub image", disImage);
-    // displayTemplateImage();
+    // Axis-aligned grid: sample gradients straight into the last two planes
+    // with precomputed separable interpolation, then scale by x and y
+    const bool separable =
+        aGradX.depth() == CV_32F && aGradY.depth() == CV_32F;
 
-    /* Precompute Jacobian and obtain sub image */
-    // NOTE: This is the BBOX (not full image) size
-    const size_t bboxWidth = static_cast<size_t>(bboxSize.width);
-    const size_t bboxHeight = static_cast<size_t>(bboxSize.height);
-    const size_t N_PIXELS = (bboxWidth) * (bboxHeight);
+    SeparableAxis axisX, axisY;
+    if (separable) {
+        buildSeparableAxis(bbox[0], deltaX, nX, planesX[0].cols, axisX);
+        buildSeparableAxis(bbox[1], deltaY, nY, planesX[0].rows, axisY);
+    }
 
-    // Make sure matrices are of right size before passing into function
-    Eigen::MatrixXd Jacobian(N_PIXELS, 6);
-    // Eigen::MatrixXd templateSubImage(bboxWidth, bboxHeight);
+    // Every grid point is written independently, so rows may be split freely
+    const auto computeRows = [&](const size_t aRowBegin, const size_t aRowEnd) {
+        if (separable) {
+            for (int p = 0; p < aPlanes; p++) {
+                const size_t offset = p * cn * N_GRID;
+                sampleSeparable(planesX[p], axisX, axisY, sd[4] + offset,
+                                aRowBegin, aRowEnd);
+                sampleSeparable(planesY[p], axisX, axisY, sd[5] + offset,
+                                aRowBegin, aRowEnd);
+            }
+        }
 
-    computeJacobian(templateImageFloat, Jacobian);
+        std::vector<double> delIx(numChannels), delIy(numChannels);
+
+        for (size_t i = aRowBegin; i < aRowEnd; i++) {
+            const float y = bbox[1] + deltaY * i;
+            const float v = (y - box.centre[1]) / box.scale;
+            for (int j = 0; j < nX; j++) {
+                const float x = bbox[0] + deltaX * j;
+                const float u = (x - box.centre[0]) / box.scale;
+
+                if (!separable) {
+                    getSubPixelValues(planesX, x, y, delIx.data(), 1);
+                    getSubPixelValues(planesY, x, y, delIy.data(), 1);
+                }
+
+                for (int c = 0; c < numChannels; c++) {
+                    const size_t k = c * N_GRID + i * nX + j;
+
+                    // Normalise cv::Sobel to a derivative per pixel
+                    // (GRADIENT_SOBEL), like the fused computeJacobian()
+                    if (separable) {
+                        sd[4][k] *= 0.125f;
+                        sd[5][k] *= 0.125f;
+                    } else {
+                        sd[4][k] = 0.125f * delIx[c];
+                        sd[5][k] = 0.125f * delIy[c];
+                    }
+
+                    // delI * dWdp, dWdp = [u 0 v 0 1 0; 0 u 0 v 0 1]
+                    sd[0][k] = sd[4][k] * u;
+                    sd[1][k] = sd[5][k] * u;
+                    sd[2][k] = sd[4][k] * v;
+                    sd[3][k] = sd[5][k] * v;
+                }
+            }
+        }
+    };
 
-    // Cache the transposed matrix
-    Eigen::MatrixXd JacobianTransposed(6, N_PIXELS);
-    JacobianTransposed = Jacobian.transpose();
+    if (aPool)
+        aPool->parallelFor(nY, computeRows);
+    else
+        computeRows(0, nY);
+}
 
-    /* Iteratively find best match */
-    // Warp matrix (affine warp)
-    Eigen::Matrix3d warpMat = Eigen::Matrix3d::Identity();
-    // auto warpMatTrunc = warpMat.topRows(2); // NOTE: alias
+/**
+ * @brief Compute steepest descent images straight from the template image:
+ * gradients (of the selected operator) are computed at the grid points only,
+ * fused with the sampling, so no full gradient images are needed
+ *
+ * @see ImageAlignment::setGradientOperator()
+ * @see sampleGradients()
+ *
+ * @param[in] aImage Template image (CV_32F, any layout, or CV_8UC1)
+ * @param[out] aImages Steepest descent images (resized to 6 planes of one grid
+ * per channel)
+ * @param[in] aPool Pool to split grid rows over (nullptr: calling thread
+ * only); the result is the same either way
+ * @param[in] aPlanes Number of planes stacked vertically in aImage
+ */
+void ImageAlignment::computeJacobian(const cv::Mat &aImage,
+                                     AlignedPlanes &aImages, ThreadPool *aPool,
+                                     const int aPlanes) {
+    assert(aImage.depth() == CV_32F || aImage.type() == CV_8UC1);
+
+    const bbox_t &bbox = getBBOX();
+    const float bboxWidth = bbox[2] - bbox[0];
+    const float bboxHeight = bbox[3] - bbox[1];
 
-    for (size_t i = 0; i < aMaxIters; i++) {
-        // Warped images
-        cv::Mat warpedImage, warpedSubImage;
-        // Eigen::MatrixXd warpedSubImage(bboxWidth, bboxHeight);
+    int nX, nY;
+    getGridSize(bbox, nX, nY);
 
-        // Error Images
-        Eigen::MatrixXd errorVector; // NOTE: dynamic, will flatten later
+    const float deltaX = bboxWidth / (nX - 1);
+    const float deltaY = bboxHeight / (nY - 1);
 
-        // Convert to cv::Mat
-        // cv::Mat warpMatCV(2, 3, CV_64F);
-        // cv::eigen2cv(static_cast<Eigen::Matrix<double, 2, 3>>(warpMatTrunc),
-        //              warpMatCV);
+    BoxFrame box;
+    getBoxFrame(bbox, box);
 
-        cv::Mat warpMatCV(3, 3, CV_64F);
-        cv::eigen2cv(static_cast<Eigen::Matrix<double, 3, 3>>(warpMat),
-                     warpMatCV);
+    std::vector<cv::Mat> planes;
+    getPlaneViews(aImage, aPlanes, planes);
 
-        // std::cout << "Warp matrix\n" << warpMat << std::endl << warpMatTrunc
-        // << "\n\n";
+    const int cn = aImage.channels();
+    const int numChannels = cn * aPlanes;
+    const size_t N_GRID = nX * nY;
 
-        // Perform an affine warp
-        // TODO: do we need to inverse? opencv doc is confusing
-        const int cvFlag = cv::INTER_LINEAR + cv::WARP_INVERSE_MAP;
-        cv::warpPerspective(currentImage, warpedImage, warpMatCV, IMAGE_SIZE,
-                            cvFlag);
+    aImages.resize(6, numChannels * N_GRID);
 
-        // cv::warpAffine(currentImage, warpedImage, warpMatCV, IMAGE_SIZE,
-        //                cvFlag);
+    float *sd[6];
+    for (int k = 0; k < 6; k++)
+        sd[k] = aImages.plane(k);
 
-        cv::getRectSubPix(warpedImage, bboxSize, bboxCenter, warpedSubImage,
-                          CV_32F);
+    // The template grid is always axis-aligned
+    SeparableAxis axisX, axisY;
+    buildSeparableAxis(bbox[0], deltaX, nX, planes[0].cols, axisX);
+    buildSeparableAxis(bbox[1], deltaY, nY, planes[0].rows, axisY);
 
-        // getSubPixelRect(warpedImage, warpedSubImage);
+    const auto computeRows = [&](const size_t aRowBegin, const size_t aRowEnd) {
+        for (int p = 0; p < aPlanes; p++) {
+            const size_t offset = p * cn * N_GRID;
+            sampleGradients(planes[p], axisX, axisY, mGradientOperator,
+                            sd[4] + offset, sd[5] + offset, aRowBegin,
+                            aRowEnd);
+        }
 
-        // Delta P vector
-        Eigen::VectorXd deltaP(6);
+        for (int c = 0; c < numChannels; c++) {
+            for (size_t i = aRowBegin; i < aRowEnd; i++) {
+                const float y = bbox[1] + deltaY * i;
+                const float v = (y - box.centre[1]) / box.scale;
+                for (int j = 0; j < nX; j++) {
+                    const float x = bbox[0] + deltaX * j;
+                    const float u = (x - box.centre[0]) / box.scale;
+                    const size_t k = c * N_GRID + i * nX + j;
+
+                    // delI * dWdp, dWdp = [u 0 v 0 1 0; 0 u 0 v 0 1]
+                    sd[0][k] = sd[4][k] * u;
+                    sd[1][k] = sd[5][k] * u;
+                    sd[2][k] = sd[4][k] * v;
+                    sd[3][k] = sd[5][k] * v;
+                }
+            }
+        }
+    };
 
-        // Obtain errorImage which will then be converted to flattened image
-        // vector;
-        const cv::Mat errorImage = warpedSubImage - templateSubImage;
-        cv::cv2eigen(errorImage, errorVector);
-        errorVector.resize(N_PIXELS, 1);
+    if (aPool)
+        aPool->parallelFor(nY, computeRows);
+    else
+        computeRows(0, nY);
+}
 
-        // TODO: Remove after debug; currently displays warped image
-        cv::Mat disImage;
-        convertImageForDisplay(warpedImage, disImage);
-        cv::imshow("Warped image", disImage);
-        cv::waitKey(2);
+/**
+ * @brief Using the iteratively saved BBOX, get template from "current" frame
+ * (which is the previous frame) and perform Baker-Matthews IC image alignment:
+ *
+ * Proceed to update new bbox (detection) accordingly
+ *
+ * @see ImageAlignment::setConvergencePolicy()
+ *
+ * @param[in] aNewImage New image to track in
+ * @param[in] aThreshold Convergence threshold (pixels)
+ * @param[in] aMaxIters Maximum iterations before stop
+ */
+void ImageAlignment::track(const cv::Mat &aNewImage, const float aThreshold,
+                           const size_t aMaxIters) {
+    // Nothing changed in the BBOX: skip preprocessing too
+    if (skipIfUnchanged(aNewImage)) return;
 
-        // std::cout << "Err vec" << errorVector.transpose() << std::endl;
+    PreparedFrame frame;
+    prepareFrame(aNewImage, frame, mChannelLayout, false);
 
-        // Robust M Estimator Weights
-        Eigen::DiagonalMatrix<double, Eigen::Dynamic> weights;
+    trackPrepared(frame, aThreshold, aMaxIters);
 
-        // TODO: Use actual weights, dummy identity for now
-        // weights.setIdentity(N_PIXELS);
+    // Keep original (not preprocessed) image for display
+    mCurrentImage = aNewImage;
+}
 
-        const Eigen::MatrixXd weightedJTrans = JacobianTransposed; // * weights;
-        const Eigen::MatrixXd Hessian = weightedJTrans * Jacobian;
-        const Eigen::VectorXd vectorB = weightedJTrans * errorVector;
+/**
+ * @brief Precompute everything IC alignment needs from the template (the
+ * current frame at the current BBOX): template samples, Jacobian (steepest
+ * descent images) and inverse Hessian, on the current sampling grid
+ *
+ * Called lazily by track(); results stay valid until the BBOX, current frame
+ * or sampling stride changes, and are part of the checkpoint.
+ *
+ * @see ImageAlignment::saveState()
+ *
+ * @param[in] aLearnAppearance Add the template to the appearance history;
+ * false for the temporary coarse grids of trackDeadline(), which project out
+ * a basis learned from a resampled copy of the history instead
+ */
+void ImageAlignment::prepareTemplate(const bool aLearnAppearance) {
+    if (mCurrentFrame.image.empty())
+        prepareFrame(mCurrentImage, mCurrentFrame, mChannelLayout, false);
 
-        // Solve for new deltaP
-        deltaP = Hessian.inverse() * vectorB;
-        // std::cout << "deltaP\n" << deltaP.transpose() << std::endl <<
-        // std::endl; std::cout << "Hessian\n"
-        //           << Hessian << "HessianInverse" << Hessian.inverse()
-        //           << std::endl
-        //           << std::endl;
+    const int planes = mCurrentFrame.planes;
+    const bool fixedPoint = mCurrentFrame.image.depth() == CV_8U;
 
-        // Reshape data in order to inverse matrix
-        Eigen::Matrix3d warpMatDelta;
+    // Get actual template sub image, on the same linearly-spaced grid as the
+    // Jacobian
+    cv::Mat templateSubImage;
+    if (fixedPoint) {
+        // Integer samples, exact in double
+        int nX, nY;
+        getGridSize(getBBOX(), nX, nY);
+
+        FixedPlanes samples(1, nX * nY);
+        getFixedSubPixelRect(mCurrentFrame.image, samples.plane(0),
+                             Eigen::Matrix3d::Identity());
+        cv::Mat(nY, nX, CV_16SC1, samples.plane(0))
+            .convertTo(templateSubImage, CV_64FC1,
+                       1.0 / (1 << KLT_FIXED_SAMPLE_BITS));
+    } else {
+        getSubPixelRect(mCurrentFrame.image, templateSubImage, planes);
+    }
 
-        warpMatDelta << 1 + deltaP(0), deltaP(2), deltaP(4), //
-            deltaP(1), 1 + deltaP(3), deltaP(5),             //
-            0, 0, 1;
+    if (mDebugDisplay) {
+        cv::Mat disImg;
+        convertImageForDisplay(templateSubImage, disImg);
+        cv::imshow("Sub image", disImg);
+    }
 
-        const Eigen::Matrix3d warpMatDeltaInverse = warpMatDelta.inverse();
-        // std::cout << "deltaInverse:\n"
-        //           << warpMatDeltaInverse << std::endl
-        //           << std::endl;
+    // NOTE: This is the BBOX (not full image) size; channels are stacked
+    // vertically
+    mGridChannels = mCurrentFrame.image.channels() * planes;
+    mGridWidth = templateSubImage.cols;
+    mGridHeight = templateSubImage.rows / mGridChannels;
+    const size_t N_PIXELS = mGridWidth * mGridHeight * mGridChannels;
+
+    // Flatten row by row, the same order as the Jacobian rows
+    mTemplateSamples = Eigen::Map<const Eigen::VectorXd>(
+        templateSubImage.ptr<double>(), N_PIXELS);
+
+    ThreadPool *pool = getParallelPool(N_PIXELS);
+
+    computeJacobian(mCurrentFrame.image, mSteepestDescent, pool, planes);
+
+    // Project-out IC: the steepest descent images lose their components
+    // along the appearance basis, so appearance variation in the error no
+    // longer moves the warp; iterations are unchanged. Coarse grids only
+    // seed the base one, so they leave the history on the base grid
+    if (mAppearanceModes == 0) {
+        mAppearanceBasis.resize(0, 0);
+    } else if (aLearnAppearance) {
+        updateAppearanceBasis();
+        if (mAppearanceBasis.cols() > 0)
+            projectOutBasis(mAppearanceBasis, mSteepestDescent);
+    } else {
+        Eigen::MatrixXd basis;
+        buildCoarseAppearanceBasis(basis);
+        if (basis.cols() > 0) projectOutBasis(basis, mSteepestDescent);
+    }
 
-        warpMat *= warpMatDeltaInverse;
+    if (fixedPoint) quantiseTemplate(true);
+
+    // Half precision: the Hessian is built from the rounded images, after
+    // which only the fp16 copies are kept
+    const bool halfStorage =
+        !fixedPoint && mStoragePrecision == STORAGE_HALF;
+    if (halfStorage) {
+        storeHalfTemplate();
+    } else {
+        mHalfTemplate.resize(0, 0);
+        mHalfSteepestDescent.resize(0, 0);
+    }
 
-        if (deltaP.norm() < aThreshold) {
-            break;
-        }
+    // Without robust weights, the IC Hessian is constant over iterations;
+    // robust tile weights subtract tiles from it (see align())
+    Eigen::Matrix<double, 6, 6> Hessian;
+    prepareTileHessians();
+    if (!mTileHessians.empty())
+        Hessian = mTileHessianTotal;
+    else
+        accumulateHessian(mSteepestDescent, nullptr, Hessian, pool,
+                          getKernelSummation());
+
+    if (mDeterministic)
+        invertFixedOrder(Hessian, mHessianInverse);
+    else
+        mHessianInverse = Hessian.inverse();
+
+    if (halfStorage) {
+        mTemplateSamples.resize(0);
+        mSteepestDescent.resize(0, 0);
     }
 
-    // Update new BBOX
-    Eigen::MatrixXd bboxMat(3, 2);
+    mTemplateStride = mSampleStride;
+    mTemplateDepth = mCurrentFrame.image.depth();
+    mTemplateValid = true;
+}
 
-    bboxMat << bbox[0], bbox[2], //
-        bbox[1], bbox[3],        //
-        1, 1;
+/**
+ * @brief Derive the fixed-point template (for 8-bit frames) from the template
+ * samples and steepest descent images
+ *
+ * @see quantisePlanes()
+ *
+ * @param[in] aDequantise Also replace the steepest descent images by their
+ * quantised values, so that the Hessian matches the fixed-point J^T e
+ */
+void ImageAlignment::quantiseTemplate(const bool aDequantise) {
+    const size_t N_PIXELS = mTemplateSamples.size();
+
+    mFixedTemplate.resize(1, N_PIXELS);
+    int16_t *samples = mFixedTemplate.plane(0);
+    for (size_t i = 0; i < N_PIXELS; i++)
+        samples[i] = static_cast<int16_t>(std::lround(std::ldexp(
+            std::min(std::max(mTemplateSamples(i), 0.0), 255.0),
+            KLT_FIXED_SAMPLE_BITS)));
+
+    quantisePlanes(mSteepestDescent, mFixedSteepestDescent, mFixedShifts);
+    if (aDequantise)
+        dequantisePlanes(mFixedSteepestDescent, mFixedShifts,
+                         mSteepestDescent);
+}
 
-    Eigen::MatrixXd newBBOXHomo = warpMat * bboxMat;
+/**
+ * @brief Derive the half precision template (STORAGE_HALF) from the template
+ * samples and steepest descent images, and round the latter to the stored
+ * values, so that the Hessian matches the fp16 J^T e
+ *
+ * @see convertToHalf()
+ */
+void ImageAlignment::storeHalfTemplate() {
+    const size_t N_PIXELS = mTemplateSamples.size();
 
-    // std::cout << "bbox:\n" << newBBOXHomo << std::endl << std::endl;
+    AlignedPlanes samples(1, N_PIXELS);
+    float *samplesData = samples.plane(0);
+    for (size_t i = 0; i < N_PIXELS; i++)
+        samplesData[i] = static_cast<float>(mTemplateSamples(i));
 
-    setBBOX(newBBOXHomo(0, 0), newBBOXHomo(1, 0), newBBOXHomo(0, 1),
-            newBBOXHomo(1, 1));
+    convertToHalf(samples, mHalfTemplate);
+    convertToHalf(mSteepestDescent, mHalfSteepestDescent);
+    convertFromHalf(mHalfSteepestDescent, mSteepestDescent);
 }
 
-void ImageAlignment::printCVMat(const cv::Mat &aMat, const std::string &aName) {
-    std::cout << aName << std::endl;
-    for (int i = 0; i < aMat.rows; i++) {
-        // TODO: type check
-        const double *Mi = aMat.ptr<double>(i);
-        for (int j = 0; j < aMat.cols; j++)
-            std::cout << Mi[j] << ", ";
-        std::cout << std::endl;
+/**
+ * @brief Precompute the Hessian terms of each tile of the template and their
+ * total (robust tile weighting), from the steepest descent images as the
+ * kernels see them (ie. after rounding for fixed-point or half precision);
+ * clears them when tile weighting is disabled
+ *
+ * @see accumulateTileHessians()
+ */
+void ImageAlignment::prepareTileHessians() {
+    if (mTileWeighting.tileSize == 0 || mSteepestDescent.numPlanes() != 6) {
+        mTileHessians.clear();
+        return;
+    }
+
+    accumulateTileHessians(
+        mSteepestDescent, mGridWidth, mGridHeight, mTileWeighting.tileSize,
+        mTileHessians,
+        getParallelPool(mGridWidth * mGridHeight * mGridChannels));
+
+    // Total in tile order
+    double terms[KLT_HESSIAN_TERMS] = { 0 };
+    for (size_t t = 0; t < mTileHessians.size(); t += KLT_HESSIAN_TERMS)
+        for (int k = 0; k < KLT_HESSIAN_TERMS; k++)
+            terms[k] += mTileHessians[t + k];
+
+    int k = 0;
+    for (int r = 0; r < 6; r++) {
+        for (int c = r; c < 6; c++, k++) {
+            mTileHessianTotal(r, c) = terms[k];
+            mTileHessianTotal(c, r) = terms[k];
+        }
     }
-    std::cout << std::endl;
 }
 
 /**
- * @brief Check if a double is an integer.
- *
- * @param[in] aNum Number to check
- * @param[in] aInftyIsInt Consider infinity as an integer?
- * @note aInftyIsInt = true is a faster check.
+ * @brief Resample grid samples onto a grid of another size over the same BBOX
+ * (bilinear in grid coordinates; corner points stay on the BBOX corners)
  *
- * @ref
- * https://stackoverflow.com/questions/1521607/check-double-variable-if-it-contains-an-integer-and-not-floating-point
+ * @param[in] aSamples Samples, one grid per channel, flattened row by row
+ * @param[in] aWidth Grid columns of aSamples (at least 2)
+ * @param[in] aHeight Grid rows of aSamples (at least 2)
+ * @param[in] aChannels Number of channels
+ * @param[in] aNewWidth Grid columns to resample to
+ * @param[in] aNewHeight Grid rows to resample to
+ * @param[out] aOut Resampled samples
+ */
+static void resampleGrid(const Eigen::VectorXd &aSamples, const size_t aWidth,
+                         const size_t aHeight, const size_t aChannels,
+                         const size_t aNewWidth, const size_t aNewHeight,
+                         Eigen::VectorXd &aOut) {
+    aOut.resize(aNewWidth * aNewHeight * aChannels);
+
+    const double scaleX =
+        (aNewWidth > 1) ? double(aWidth - 1) / (aNewWidth - 1) : 0;
+    const double scaleY =
+        (aNewHeight > 1) ? double(aHeight - 1) / (aNewHeight - 1) : 0;
+
+    for (size_t c = 0; c < aChannels; c++) {
+        const double *src = aSamples.data() + c * aWidth * aHeight;
+        double *dst = aOut.data() + c * aNewWidth * aNewHeight;
+
+        for (size_t i = 0; i < aNewHeight; i++) {
+            const double y = i * scaleY;
+            const size_t y0 = std::min<size_t>(y, aHeight - 2);
+            const double ay = y - y0;
+
+            for (size_t j = 0; j < aNewWidth; j++) {
+                const double x = j * scaleX;
+                const size_t x0 = std::min<size_t>(x, aWidth - 2);
+                const double ax = x - x0;
+
+                const double *row0 = src + y0 * aWidth + x0;
+                const double *row1 = row0 + aWidth;
+
+                dst[i * aNewWidth + j] =
+                    (1 - ay) * ((1 - ax) * row0[0] + ax * row0[1]) +
+                    ay * ((1 - ax) * row1[0] + ax * row1[1]);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Add the template to the recent templates and learn the appearance
+ * basis from them (principal components about their mean). When the sampling
+ * grid changes size (eg. as the BBOX scales), recent templates are resampled
+ * onto the new grid; a template prepared again for the same frame replaces
+ * the latest one
  *
- * @return true If integer value (eg. 314.0000)
- * @return false If non-integer value (eg. 3.14159)
+ * @see buildAppearanceBasis()
  */
-bool isInteger(const double aNum, const bool aInftyIsInt) {
-    if (aInftyIsInt) {
-        return (trunc(aNum) == aNum);
+void ImageAlignment::updateAppearanceBasis() {
+    // Channels changed: restart
+    if (!mRecentTemplates.empty() &&
+        static_cast<size_t>(mRecentTemplates[0].size()) !=
+            mRecentGridWidth * mRecentGridHeight * mGridChannels) {
+        mRecentTemplates.clear();
+        mRecentTemplatesNext = 0;
     }
-    else {
-        double intpart;
-        // TODO: Set it to be epsilon instead?
-        return (std::modf(aNum, &intpart) == 0.0);
+
+    if (!mRecentTemplates.empty() && (mRecentGridWidth != mGridWidth ||
+                                      mRecentGridHeight != mGridHeight)) {
+        Eigen::VectorXd resampled;
+        for (Eigen::VectorXd &samples : mRecentTemplates) {
+            resampleGrid(samples, mRecentGridWidth, mRecentGridHeight,
+                         mGridChannels, mGridWidth, mGridHeight, resampled);
+            samples.swap(resampled);
+        }
     }
+    mRecentGridWidth = mGridWidth;
+    mRecentGridHeight = mGridHeight;
+    assert(static_cast<size_t>(mTemplateSamples.size()) ==
+           mGridWidth * mGridHeight * mGridChannels);
+
+    const size_t count = mRecentTemplates.size();
+    if (count > 0 && mRecentTemplatesFrame == mFrameIndex) {
+        const size_t latest = (mRecentTemplatesNext + count - 1) % count;
+        mRecentTemplates[latest] = mTemplateSamples;
+    } else if (count < mAppearanceHistory) {
+        mRecentTemplates.push_back(mTemplateSamples);
+        mRecentTemplatesNext = mRecentTemplates.size() % mAppearanceHistory;
+    } else {
+        mRecentTemplates[mRecentTemplatesNext] = mTemplateSamples;
+        mRecentTemplatesNext = (mRecentTemplatesNext + 1) % mAppearanceHistory;
+    }
+    mRecentTemplatesFrame = mFrameIndex;
+
+    buildAppearanceBasis(mRecentTemplates, mAppearanceModes,
+                         KLT_APPEARANCE_MIN_VARIANCE, mAppearanceBasis);
 }
 
 /**
- * @brief Get sub pixel value in cv Mat using bilinear interpolation
- *
- * @ref https://stackoverflow.com/a/13301755/3141253
+ * @brief Learn an appearance basis for a temporary sampling grid without
+ * touching the history: the recent templates are resampled into a copy and
+ * the current template takes the place updateAppearanceBasis() would give it
  *
- * @param[in] aImg Input image to get sub pixel value from
- * @pre Must be single channel
- * @param[in] ax x-coordinate (sub-pixel)
- * @param[in] ay y-coordiate (sub-pixel)
+ * @param[out] aBasis Basis on the current grid (no columns without history)
+ */
+void ImageAlignment::buildCoarseAppearanceBasis(Eigen::MatrixXd &aBasis) const {
+    aBasis.resize(0, 0);
+    if (mRecentTemplates.empty() ||
+        static_cast<size_t>(mRecentTemplates[0].size()) !=
+            mRecentGridWidth * mRecentGridHeight * mGridChannels)
+        return;
+
+    std::vector<Eigen::VectorXd> samples(mRecentTemplates.size());
+    for (size_t i = 0; i < samples.size(); i++)
+        resampleGrid(mRecentTemplates[i], mRecentGridWidth, mRecentGridHeight,
+                     mGridChannels, mGridWidth, mGridHeight, samples[i]);
+
+    const size_t count = samples.size();
+    if (mRecentTemplatesFrame == mFrameIndex)
+        samples[(mRecentTemplatesNext + count - 1) % count] = mTemplateSamples;
+    else if (count < mAppearanceHistory)
+        samples.push_back(mTemplateSamples);
+    else
+        samples[mRecentTemplatesNext] = mTemplateSamples;
+
+    buildAppearanceBasis(samples, mAppearanceModes, KLT_APPEARANCE_MIN_VARIANCE,
+                         aBasis);
+}
+
+/**
+ * @brief Get the template samples; with half precision storage they are
+ * converted into a buffer
  *
- * @return Sub pixel value from bilinear interpolation (double)
+ * @param[out] aBuffer Buffer (used for half precision storage only)
+ * @return const Eigen::VectorXd& template samples, flattened like
+ * mTemplateSamples
  */
-double ImageAlignment::getSubPixelValue(const cv::Mat &aImg, const double ax,
-                                        const double ay) {
-    assert(!aImg.empty());
-    assert(aImg.channels() == 1);
+const Eigen::VectorXd &
+ImageAlignment::getTemplateSamples(Eigen::VectorXd &aBuffer) const {
+    if (mHalfTemplate.numPlanes() == 0) return mTemplateSamples;
 
-    // TODO: Check if ax and ay are integer values
-    // if (isInteger(ax) && isInteger(ay)) {
-    //     // Check type to ensure that we are getting the right values
-    //     // otherwise we'd be accessing a wrong pointer
-    //     switch (aImg.type()) {
-    //         case CV_8S:
-    //         case CV_8U:
-    //             return aImg.at<int>(ay, ax);
-    //         case CV_64F:
-    //             return aImg.at<double>(ay, ax);
-    //         case CV_32F:
-    //         default:
-    //             return aImg.at<float>(ay, ax);
-    //     }
-    // }
+    AlignedPlanes samples;
+    convertFromHalf(mHalfTemplate, samples);
 
-    // Get the rounded down versions
-    // Doesn't really matter if int because the values of ax/ay are unlikely to
-    // be so large
-    const long intX = static_cast<int>(ax);
-    const long intY = static_cast<int>(ay);
+    aBuffer = Eigen::Map<const Eigen::VectorXf>(samples.plane(0),
+                                                samples.size())
+                  .cast<double>();
+    return aBuffer;
+}
 
-    // Interpolate in case at border
-    const int x0 =
-        cv::borderInterpolate(intX, aImg.cols, cv::BORDER_REFLECT_101);
-    const int x1 =
-        cv::borderInterpolate(intX + 1, aImg.cols, cv::BORDER_REFLECT_101);
-    const int y0 =
-        cv::borderInterpolate(intY, aImg.rows, cv::BORDER_REFLECT_101);
-    const int y1 =
-        cv::borderInterpolate(intY + 1, aImg.rows, cv::BORDER_REFLECT_101);
+/// @brief Robust tile weighting state of one alignment run
+struct TileState {
+    /// @brief Tile side in grid points, tiles per row, and number of tiles
+    size_t tileSize = 0, tilesX = 0, numTiles = 0;
 
-    // Get deltas
-    const double dx = ax - static_cast<double>(intX);
-    const double dy = ay - static_cast<double>(intY);
-    const double dx1 = 1.0 - dx;
-    const double dy1 = 1.0 - dy;
+    /// @brief Tiles dropped so far (not sampled any more)
+    std::vector<uint8_t> dropped;
 
-    // Get weights and pixels
-    const double tlWeight = dx1 * dy1;
-    const double trWeight = dx * dy1;
-    const double blWeight = dx1 * dy;
-    const double brWeight = dx * dy;
+    /// @brief Sum of squared errors (grey levels) and weight of each tile in
+    /// the last iteration, and the residual RMS of each kept tile
+    std::vector<double> sums, weights, rms;
+};
 
-    double tlPixel, trPixel, blPixel, brPixel;
+/**
+ * @brief Grid rectangle of one tile
+ *
+ * @param[in] aTiles Tile layout
+ * @param[in] aNX Grid columns
+ * @param[in] aNY Grid rows
+ * @param[in] aTile Tile index
+ * @param[out] aRect Row begin, row end, column begin, column end
+ */
+static void getTileRect(const TileState &aTiles, const size_t aNX,
+                        const size_t aNY, const size_t aTile,
+                        size_t aRect[4]) {
+    aRect[0] = (aTile / aTiles.tilesX) * aTiles.tileSize;
+    aRect[1] = std::min(aNY, aRect[0] + aTiles.tileSize);
+    aRect[2] = (aTile % aTiles.tilesX) * aTiles.tileSize;
+    aRect[3] = std::min(aNX, aRect[2] + aTiles.tileSize);
+}
 
-    // Check type to ensure that we are getting the right values
-    // otherwise we'd be accessing a wrong pointer
-    switch (aImg.type()) {
-        case CV_8S:
-        case CV_8U:
-            tlPixel = aImg.at<int>(y0, x0);
-            trPixel = aImg.at<int>(y0, x1);
-            blPixel = aImg.at<int>(y1, x0);
-            brPixel = aImg.at<int>(y1, x1);
-            break;
-        case CV_64F:
-            tlPixel = aImg.at<double>(y0, x0);
-            trPixel = aImg.at<double>(y0, x1);
-            blPixel = aImg.at<double>(y1, x0);
-            brPixel = aImg.at<double>(y1, x1);
-            break;
-        case CV_32F:
-        default:
-            tlPixel = aImg.at<float>(y0, x0);
-            trPixel = aImg.at<float>(y0, x1);
-            blPixel = aImg.at<float>(y1, x0);
-            brPixel = aImg.at<float>(y1, x1);
-            break;
+/**
+ * @brief Sum of squared errors of one tile, over all channels
+ *
+ * @param[in] aWarped Warped samples (one grid per channel)
+ * @param[in] aTemplate Template samples, same layout
+ * @param[in] aNX Grid columns
+ * @param[in] aNY Grid rows
+ * @param[in] aChannels Number of channels
+ * @param[in] aRect Tile rectangle (see getTileRect())
+ * @return double sum of squared errors (in sample units)
+ */
+template <typename W, typename T>
+static double sumTileErrors(const W *aWarped, const T *aTemplate,
+                            const size_t aNX, const size_t aNY,
+                            const size_t aChannels, const size_t aRect[4]) {
+    double sum = 0;
+
+    for (size_t c = 0; c < aChannels; c++) {
+        for (size_t row = aRect[0]; row < aRect[1]; row++) {
+            const size_t offset = (c * aNY + row) * aNX;
+            for (size_t i = offset + aRect[2]; i < offset + aRect[3]; i++) {
+                const double e = static_cast<double>(aWarped[i]) -
+                                 static_cast<double>(aTemplate[i]);
+                sum += e * e;
+            }
+        }
     }
 
-    // Return weighted pixel
-    return tlWeight * tlPixel + trWeight * trPixel + blWeight * blPixel +
-           brWeight * brPixel;
+    return sum;
 }
 
 /**
- * @brief Get sub pixel values of a rectangle specified by aBBOX
+ * @brief Blend the warped samples of one tile towards the template, so that
+ * its error is scaled by aWeight (0: the template itself, ie. no error)
+ *
+ * @param[in,out] aWarped Warped samples (one grid per channel)
+ * @param[in] aTemplate Template samples, same layout
+ * @param[in] aNX Grid columns
+ * @param[in] aNY Grid rows
+ * @param[in] aChannels Number of channels
+ * @param[in] aRect Tile rectangle (see getTileRect())
+ * @param[in] aWeight Weight of the error
+ */
+template <typename W, typename T>
+static void blendTileToTemplate(W *aWarped, const T *aTemplate,
+                                const size_t aNX, const size_t aNY,
+                                const size_t aChannels, const size_t aRect[4],
+                                const double aWeight) {
+    for (size_t c = 0; c < aChannels; c++) {
+        for (size_t row = aRect[0]; row < aRect[1]; row++) {
+            const size_t offset = (c * aNY + row) * aNX;
+            for (size_t i = offset + aRect[2]; i < offset + aRect[3]; i++) {
+                const double value =
+                    aTemplate[i] + aWeight * (aWarped[i] - aTemplate[i]);
+                aWarped[i] = std::is_integral<W>::value
+                                 ? static_cast<W>(std::lround(value))
+                                 : static_cast<W>(value);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Robust tile weights for one iteration: tiles whose residual RMS is
+ * an outlier against the median tile's are down-weighted or dropped, and their
+ * warped samples blended towards the template accordingly, so that the error
+ * (and J^T e) of the fused kernels carries the weights
+ *
+ * @see TileWeighting
+ *
+ * @param[in,out] aWarped Warped samples (one grid per channel); dropped tiles
+ * must hold the template from an earlier call
+ * @param[in] aTemplate Template samples, same layout
+ * @param[in] aNX Grid columns
+ * @param[in] aNY Grid rows
+ * @param[in] aChannels Number of channels
+ * @param[in] aUnit Grey levels per sample unit
+ * @param[in] aWeighting Outlier thresholds
+ * @param[in] aPermanent Whether tiles above the drop ratio are dropped for
+ * good; if not, they get weight 0 for this iteration only and are evaluated
+ * again (before the first update, the residuals say more about the initial
+ * warp than about the tiles)
+ * @param[in,out] aTiles Tile state: tiles dropped so far, and the weights and
+ * error sums found
+ * @param[in] aPool Pool to split rows of tiles over (nullptr: calling thread
+ * only); the result is the same either way
+ * @return double weighted residual RMS (grey levels; infinite once all tiles
+ * are dropped)
+ */
+template <typename W, typename T>
+static double weighTiles(W *aWarped, const T *aTemplate, const size_t aNX,
+                         const size_t aNY, const size_t aChannels,
+                         const double aUnit, const TileWeighting &aWeighting,
+                         const bool aPermanent, TileState &aTiles,
+                         ThreadPool *aPool) {
+    const size_t numBands = aTiles.numTiles / aTiles.tilesX;
+
+    const auto sumBands = [&](const size_t aBegin, const size_t aEnd) {
+        for (size_t t = aBegin * aTiles.tilesX; t < aEnd * aTiles.tilesX;
+             t++) {
+            if (aTiles.dropped[t]) continue;
+
+            size_t rect[4];
+            getTileRect(aTiles, aNX, aNY, t, rect);
+            aTiles.sums[t] = sumTileErrors(aWarped, aTemplate, aNX, aNY,
+                                           aChannels, rect) *
+                             (aUnit * aUnit);
+        }
+    };
+
+    if (aPool)
+        aPool->parallelFor(numBands, sumBands);
+    else
+        sumBands(0, numBands);
+
+    // Residual RMS of each kept tile; the median is the reference
+    std::vector<double> &rms = aTiles.rms;
+    rms.clear();
+    for (size_t t = 0; t < aTiles.numTiles; t++) {
+        if (aTiles.dropped[t]) continue;
+
+        size_t rect[4];
+        getTileRect(aTiles, aNX, aNY, t, rect);
+        const double count =
+            double((rect[1] - rect[0]) * (rect[3] - rect[2]) * aChannels);
+        rms.push_back(std::sqrt(aTiles.sums[t] / count));
+    }
+
+    // Nothing left to align on
+    if (rms.empty()) return std::numeric_limits<double>::infinity();
+
+    std::vector<double> sorted(rms);
+    std::nth_element(sorted.begin(), sorted.begin() + (sorted.size() - 1) / 2,
+                     sorted.end());
+    const double reference =
+        std::max(sorted[(sorted.size() - 1) / 2], aWeighting.minRMS);
+
+    double weightedSum = 0, weightedCount = 0;
+    size_t k = 0;
+
+    for (size_t t = 0; t < aTiles.numTiles; t++) {
+        if (aTiles.dropped[t]) continue;
+
+        size_t rect[4];
+        getTileRect(aTiles, aNX, aNY, t, rect);
+        const double r = rms[k++];
+
+        double weight = 1;
+        if (aWeighting.dropRatio > 0 && r > aWeighting.dropRatio * reference)
+            weight = 0;
+        else if (aWeighting.downWeightRatio > 0 &&
+                 r > aWeighting.downWeightRatio * reference)
+            weight = aWeighting.downWeightRatio * reference / r;
+
+        aTiles.weights[t] = weight;
+        if (weight < 1)
+            blendTileToTemplate(aWarped, aTemplate, aNX, aNY, aChannels, rect,
+                                weight);
+        if (weight == 0) {
+            aTiles.dropped[t] = aPermanent;
+            continue;
+        }
+
+        weightedSum += weight * aTiles.sums[t];
+        weightedCount += weight * (rect[1] - rect[0]) * (rect[3] - rect[2]) *
+                         aChannels;
+    }
+
+    return (weightedCount > 0) ? std::sqrt(weightedSum / weightedCount)
+                               : std::numeric_limits<double>::infinity();
+}
+
+/**
+ * @brief Largest displacement of a BBOX corner between two warps
+ * @note Plain scalar arithmetic, so deterministic mode gives the same bits on
+ * every build
+ *
+ * @param[in] aBox Box frame of the BBOX
+ * @param[in] aBBOX BBOX
+ * @param[in] aWarp0 First warp (box coordinates)
+ * @param[in] aWarp1 Second warp (box coordinates)
+ *
+ * @return double displacement in pixels
+ */
+static double maxCornerShift(const BoxFrame &aBox, const bbox_t &aBBOX,
+                             const Eigen::Matrix3d &aWarp0,
+                             const Eigen::Matrix3d &aWarp1) {
+    double maxShift = 0;
+
+    for (int c = 0; c < 4; c++) {
+        const double u = (aBBOX[(c & 1) ? 2 : 0] - aBox.centre[0]) / aBox.scale;
+        const double v = (aBBOX[(c & 2) ? 3 : 1] - aBox.centre[1]) / aBox.scale;
+
+        const double dx = (aWarp1(0, 0) - aWarp0(0, 0)) * u +
+                          (aWarp1(0, 1) - aWarp0(0, 1)) * v +
+                          (aWarp1(0, 2) - aWarp0(0, 2));
+        const double dy = (aWarp1(1, 0) - aWarp0(1, 0)) * u +
+                          (aWarp1(1, 1) - aWarp0(1, 1)) * v +
+                          (aWarp1(1, 2) - aWarp0(1, 2));
+
+        maxShift = std::max(maxShift, std::sqrt(dx * dx + dy * dy));
+    }
+
+    return maxShift * aBox.scale;
+}
+
+/**
+ * @brief Run IC alignment of the cached template against a frame, starting
+ * from a given warp
+ * @note Only reads tracker state, so several runs may proceed concurrently
+ *
+ * @param[in] aFrame Preprocessed frame to align against (same channels as
+ * the template)
+ * @param[in] aInitWarp Initial warp (affine, box coordinates)
+ * @param[in] aThreshold Convergence threshold in pixels: on the largest BBOX
+ * corner displacement by an update, or on the norm of the update (whose terms
+ * are displacements at the box edge), see setConvergencePolicy()
+ * @param[in] aMaxIters Maximum iterations before stop
+ * @param[in] aDisplay Show warped sub image every iteration (main thread only)
+ * @param[in] aBestResidual Lowest final residual of concurrent runs; the run is
+ * cancelled once it falls too far behind it (nullptr: never cancel). Such runs
+ * are on a pool already, so they never use the parallel pool
+ * @param[in] aDeadline Stop before an iteration that would end after this
+ * time (nullptr: no deadline)
+ *
+ * @return AlignResult final warp, residual, iteration count and why the run
+ * stopped; after stagnation or divergence, the warp with the lowest residual.
+ * Deadline runs also report their measured cost per grid point
+ */
+ImageAlignment::AlignResult
+ImageAlignment::align(const PreparedFrame &aFrame,
+                      const Eigen::Matrix3d &aInitWarp, const float aThreshold,
+                      const size_t aMaxIters, const bool aDisplay,
+                      std::atomic<double> *aBestResidual,
+                      const std::chrono::steady_clock::time_point *aDeadline) {
+    typedef std::chrono::steady_clock clock;
+
+    // Grid points times channels
+    const size_t N_PIXELS = mGridWidth * mGridHeight * mGridChannels;
+    assert(static_cast<size_t>(aFrame.image.channels() * aFrame.planes) ==
+           mGridChannels);
+
+    // 8-bit frame: integer samples and exact integer block sums
+    const bool fixedPoint = aFrame.image.depth() == CV_8U;
+    assert(!fixedPoint || mFixedTemplate.size() == N_PIXELS);
+
+    // Template data in half precision (float frames, STORAGE_HALF)
+    const bool halfStorage =
+        !fixedPoint && mHalfSteepestDescent.numPlanes() == 6;
+    assert(!halfStorage || mHalfTemplate.size() == N_PIXELS);
+
+    AlignResult result;
+    result.warp = aInitWarp;
+
+    // Parameters are estimated in box coordinates; sampling needs the warp in
+    // image coordinates
+    BoxFrame box;
+    getBoxFrame(getBBOX(), box);
+    Eigen::Matrix3d imageWarp;
+
+    // Best warp so far, kept for stagnation and divergence
+    const ConvergencePolicy &policy = mConvergencePolicy;
+    Eigen::Matrix3d bestWarp = aInitWarp;
+    double bestResidual = std::numeric_limits<double>::infinity();
+    double progressResidual = bestResidual;
+    double previousResidual = bestResidual;
+    size_t itersWithoutProgress = 0;
+
+    // Error image, aligned and padded like the steepest descent images
+    AlignedPlanes error(1, N_PIXELS);
+    float *errorData = error.plane(0);
+
+    // Per block: sum of squared errors, then J^T e
+    ThreadPool *pool = aBestResidual ? nullptr : getParallelPool(N_PIXELS);
+    const size_t numBlocks = numKernelBlocks(error);
+    std::vector<double> blockSums(numBlocks * 7);
+    const Summation summation = getKernelSummation();
+
+    FixedPlanes warpedFixed(fixedPoint ? 1 : 0, N_PIXELS);
+    std::vector<int64_t> fixedSums(fixedPoint ? numBlocks * 7 : 0);
+
+    // Warped sub image; kept over iterations, so that dropped tiles keep the
+    // template they were blended to
+    cv::Mat warpedSubImage;
+
+    // Robust tile weighting: the Hessian changes with the weights
+    TileState tiles;
+    if (mTileWeighting.tileSize > 0) {
+        tiles.tileSize = mTileWeighting.tileSize;
+        tiles.numTiles = numGridTiles(mGridWidth, mGridHeight,
+                                      tiles.tileSize, &tiles.tilesX);
+    }
+    const bool weighted =
+        tiles.numTiles > 0 &&
+        mTileHessians.size() == tiles.numTiles * KLT_HESSIAN_TERMS;
+    if (weighted) {
+        tiles.dropped.assign(tiles.numTiles, 0);
+        tiles.sums.assign(tiles.numTiles, 0);
+        tiles.weights.assign(tiles.numTiles, 1);
+    }
+    Eigen::Matrix<double, 6, 6> hessianInverse = mHessianInverse;
+
+    // Half precision template in float, for the tile residuals
+    AlignedPlanes halfTemplate;
+    if (weighted && halfStorage) convertFromHalf(mHalfTemplate, halfTemplate);
+
+    clock::time_point iterStart = clock::now();
+    clock::duration iterDuration = clock::duration::zero();
+    double timedUs = 0;
+
+    while (result.iterations < aMaxIters) {
+        if (aDeadline) {
+            const clock::time_point now = clock::now();
+
+            // Measured cost of the last iteration predicts the next one
+            if (result.iterations > 0) {
+                iterDuration = now - iterStart;
+                timedUs +=
+                    std::chrono::duration<double, std::micro>(iterDuration)
+                        .count();
+                result.timedIterations++;
+            }
+
+            if (now + iterDuration > *aDeadline) {
+                result.deadlineHit = true;
+                result.stop = STOP_DEADLINE;
+                break;
+            }
+
+            iterStart = now;
+        }
+
+        result.iterations++;
+
+        // Warped sub image: sample new frame at warped template grid only,
+        // rather than warping the full image
+        boxToImageWarp(box, result.warp, imageWarp);
+
+        // Dropped tiles are not sampled again
+        const uint8_t *dropped =
+            (weighted && result.droppedTiles > 0) ? tiles.dropped.data()
+                                                  : nullptr;
+        if (fixedPoint)
+            getFixedSubPixelRect(aFrame.image, warpedFixed.plane(0),
+                                 imageWarp, pool, dropped, tiles.tileSize);
+        else
+            getWarpedSubPixelRect(aFrame.image, warpedSubImage, imageWarp,
+                                  pool, aFrame.planes, dropped,
+                                  tiles.tileSize);
+
+        // Tile weights, carried into the error by the warped samples. Drops
+        // are only made permanent after the first update
+        double weightedResidual = 0;
+        if (weighted) {
+            const bool permanent = result.iterations > 1;
+            if (fixedPoint)
+                weightedResidual = weighTiles(
+                    warpedFixed.plane(0), mFixedTemplate.plane(0),
+                    mGridWidth, mGridHeight, mGridChannels,
+                    1.0 / (1 << KLT_FIXED_SAMPLE_BITS), mTileWeighting,
+                    permanent, tiles, pool);
+            else if (halfStorage)
+                weightedResidual = weighTiles(
+                    warpedSubImage.ptr<double>(), halfTemplate.plane(0),
+                    mGridWidth, mGridHeight, mGridChannels, 1.0,
+                    mTileWeighting, permanent, tiles, pool);
+            else
+                weightedResidual = weighTiles(
+                    warpedSubImage.ptr<double>(), mTemplateSamples.data(),
+                    mGridWidth, mGridHeight, mGridChannels, 1.0,
+                    mTileWeighting, permanent, tiles, pool);
+
+            result.droppedTiles = 0;
+            for (size_t t = 0; t < tiles.numTiles; t++)
+                result.droppedTiles += tiles.dropped[t];
+
+            // Down-weighted and dropped tiles come out of the Hessian: a
+            // subtraction of their precomputed terms, no rebuild
+            double removed[KLT_HESSIAN_TERMS] = { 0 };
+            bool reweighted = false;
+            for (size_t t = 0; t < tiles.numTiles; t++) {
+                if (tiles.weights[t] == 1) continue;
+
+                const double *terms = &mTileHessians[t * KLT_HESSIAN_TERMS];
+                for (int k = 0; k < KLT_HESSIAN_TERMS; k++)
+                    removed[k] += (1 - tiles.weights[t]) * terms[k];
+                reweighted = true;
+            }
+
+            if (reweighted) {
+                Eigen::Matrix<double, 6, 6> hessian = mTileHessianTotal;
+                int k = 0;
+                for (int r = 0; r < 6; r++) {
+                    for (int c = r; c < 6; c++, k++) {
+                        hessian(r, c) -= removed[k];
+                        hessian(c, r) = hessian(r, c);
+                    }
+                }
+
+                if (mDeterministic)
+                    invertFixedOrder(hessian, hessianInverse);
+                else
+                    hessianInverse = hessian.inverse();
+            } else {
+                hessianInverse = mHessianInverse;
+            }
+        }
+
+        // Error image, flattened row by row like the template, fused with the
+        // residual and J^T e over fixed blocks
+        const double *warpedData =
+            fixedPoint ? nullptr : warpedSubImage.ptr<double>();
+
+        const auto sumBlocks = [&](const size_t aBegin, const size_t aEnd) {
+            for (size_t b = aBegin; b < aEnd; b++) {
+                if (fixedPoint) {
+                    projectErrorFixedBlock(mFixedSteepestDescent,
+                                           mFixedTemplate, warpedFixed, b,
+                                           &fixedSums[b * 7]);
+                    continue;
+                }
+
+                const size_t begin = b * KLT_KERNEL_BLOCK;
+                const size_t end =
+                    std::min(N_PIXELS, begin + KLT_KERNEL_BLOCK);
+
+                if (halfStorage) {
+                    for (size_t i = begin; i < end; i++)
+                        errorData[i] = static_cast<float>(warpedData[i]);
+
+                    projectErrorHalfBlock(mHalfSteepestDescent, mHalfTemplate,
+                                          errorData, b, &blockSums[b * 7],
+                                          summation);
+                    continue;
+                }
+
+                double squaredNorm = 0;
+                for (size_t i = begin; i < end; i++) {
+                    const double e = warpedData[i] - mTemplateSamples(i);
+                    errorData[i] = static_cast<float>(e);
+                    squaredNorm += e * e;
+                }
+
+                blockSums[b * 7] = squaredNorm;
+                projectErrorBlock(mSteepestDescent, errorData, b,
+                                  &blockSums[b * 7 + 1], summation);
+            }
+        };
+
+        if (pool)
+            pool->parallelFor(numBlocks, sumBlocks);
+        else
+            sumBlocks(0, numBlocks);
+
+        // Combine in block order, so the result does not depend on the pool
+        double squaredNorm = 0;
+        Eigen::Matrix<double, 6, 1> vectorB;
+        vectorB.setZero();
+
+        if (fixedPoint) {
+            // Exact integer totals, scaled back to float only for the solve
+            int64_t sums[7] = { 0 };
+            for (size_t b = 0; b < numBlocks; b++)
+                for (int k = 0; k < 7; k++)
+                    sums[k] += fixedSums[b * 7 + k];
+
+            squaredNorm = std::ldexp(static_cast<double>(sums[0]),
+                                     -2 * KLT_FIXED_SAMPLE_BITS);
+            for (int k = 0; k < 6; k++)
+                vectorB(k) = std::ldexp(
+                    static_cast<double>(sums[k + 1]),
+                    -(mFixedShifts[k] + KLT_FIXED_SAMPLE_BITS));
+        }
+
+        for (size_t b = 0; b < numBlocks && !fixedPoint; b++) {
+            squaredNorm += blockSums[b * 7];
+            for (int k = 0; k < 6; k++)
+                vectorB(k) += blockSums[b * 7 + 1 + k];
+        }
+
+        // Weighted tiles: errors are scaled, so the residual is the weighted
+        // one over the kept tiles
+        result.residualRMS = weighted ? weightedResidual
+                                      : std::sqrt(squaredNorm / N_PIXELS);
+
+        // TODO: Remove after debug; currently displays warped sub image
+        if (aDisplay) {
+            if (fixedPoint)
+                cv::Mat(mGridHeight, mGridWidth, CV_16SC1,
+                        warpedFixed.plane(0))
+                    .convertTo(warpedSubImage, CV_64FC1,
+                               1.0 / (1 << KLT_FIXED_SAMPLE_BITS));
+
+            cv::Mat disImage;
+            convertImageForDisplay(warpedSubImage, disImage);
+            cv::imshow("Warped image", disImage);
+            cv::waitKey(2);
+        }
+
+        // Give up on a hypothesis that is clearly losing (depends on the
+        // timing of other runs, so never in deterministic mode)
+        if (aBestResidual && !mDeterministic &&
+            result.iterations >= KLT_HYPOTHESIS_MIN_ITERS &&
+            result.residualRMS > KLT_HYPOTHESIS_CANCEL_RATIO *
+                                     aBestResidual->load(
+                                         std::memory_order_relaxed)) {
+            result.cancelled = true;
+            return result;
+        }
+
+        // Residual tests; the residual belongs to the warp before this
+        // iteration's update
+        const double residual = result.residualRMS;
+
+        if (!std::isfinite(residual) ||
+            (policy.divergenceRatio > 0 &&
+             residual > policy.divergenceRatio * bestResidual)) {
+            result.stop = STOP_DIVERGENCE;
+            break;
+        }
+
+        if (residual < bestResidual) {
+            bestResidual = residual;
+            bestWarp = result.warp;
+        }
+
+        if (residual < (1 - KLT_STAGNATION_MIN_DECREASE) * progressResidual) {
+            progressResidual = residual;
+            itersWithoutProgress = 0;
+        } else if (policy.stagnationIters > 0 &&
+                   ++itersWithoutProgress >= policy.stagnationIters) {
+            result.stop = STOP_STAGNATION;
+            break;
+        }
+
+        if (policy.residualDecrease > 0 && residual <= previousResidual &&
+            previousResidual - residual <
+                policy.residualDecrease * previousResidual) {
+            result.converged = true;
+            result.stop = STOP_RESIDUAL;
+            break;
+        }
+        previousResidual = residual;
+
+        const Eigen::Matrix3d previousWarp = result.warp;
+        double updateNorm;
+
+        if (mDeterministic) {
+            // Deterministic: same bits whatever Eigen vectorises to
+            updateNorm = updateWarpFixedOrder(hessianInverse, vectorB,
+                                              box.scale, result.warp);
+        } else {
+            // Solve for new deltaP (pixels at the box edge)
+            const Eigen::Matrix<double, 6, 1> deltaP =
+                hessianInverse * vectorB;
+            const Eigen::Matrix<double, 6, 1> boxDeltaP = deltaP / box.scale;
+
+            // Reshape data in order to inverse matrix
+            Eigen::Matrix3d warpMatDelta;
+
+            warpMatDelta << 1 + boxDeltaP(0), boxDeltaP(2), boxDeltaP(4), //
+                boxDeltaP(1), 1 + boxDeltaP(3), boxDeltaP(5),             //
+                0, 0, 1;
+
+            const Eigen::Matrix3d warpMatDeltaInverse = warpMatDelta.inverse();
+
+            result.warp *= warpMatDeltaInverse;
+            updateNorm = deltaP.norm();
+        }
+
+        if (!std::isfinite(updateNorm)) {
+            result.stop = STOP_DIVERGENCE;
+            break;
+        }
+
+        const double shift =
+            policy.corners
+                ? maxCornerShift(box, getBBOX(), previousWarp, result.warp)
+                : updateNorm;
+
+        if (shift < aThreshold) {
+            result.converged = true;
+            result.stop = policy.corners ? STOP_CORNERS : STOP_PARAMETERS;
+            break;
+        }
+    }
+
+    if (result.timedIterations > 0)
+        result.usPerSample = timedUs / result.timedIterations / N_PIXELS;
+
+    // Gave up: fall back to the best warp seen
+    if (result.stop == STOP_STAGNATION || result.stop == STOP_DIVERGENCE) {
+        result.warp = bestWarp;
+        result.residualRMS = bestResidual;
+    }
+
+    // Publish final residual to competing runs (atomic min)
+    if (aBestResidual) {
+        double best = aBestResidual->load(std::memory_order_relaxed);
+        while (result.residualRMS < best &&
+               !aBestResidual->compare_exchange_weak(best, result.residualRMS))
+            ;
+    }
+
+    return result;
+}
+
+/**
+ * @brief Coarse exhaustive translation search of the template around the BBOX
+ * (sum of absolute differences on a subsampled template grid)
+ *
+ * @param[in] aFrame Preprocessed frame to search in (all channels are
+ * compared)
+ * @param[in] aNumPeaks Number of peaks to return
+ * @param[out] aSeeds Translation warps (box coordinates) of the best peaks,
+ * best first; peaks near zero translation or near a better peak are suppressed
+ */
+void ImageAlignment::coarseSearch(const PreparedFrame &aFrame,
+                                  const size_t aNumPeaks,
+                                  std::vector<Eigen::Matrix3d> &aSeeds) {
+    aSeeds.clear();
+    if (aNumPeaks == 0) return;
+
+    const bbox_t &bbox = getBBOX();
+
+    const float bboxWidth = bbox[2] - bbox[0];
+    const float bboxHeight = bbox[3] - bbox[1];
+
+    // Same grid as getSubPixelRect()
+    const float deltaX = bboxWidth / (mGridWidth - 1);
+    const float deltaY = bboxHeight / (mGridHeight - 1);
+
+    // About 8 x 8 template samples, translations on a quarter-BBOX grid
+    // within one BBOX size of the current position
+    const size_t sampleStep =
+        std::max<size_t>(1, std::min(mGridWidth, mGridHeight) / 8);
+    const float searchStep =
+        std::max(2.0f, std::min(bboxWidth, bboxHeight) / 4);
+    const int nSteps = static_cast<int>(
+        std::ceil(std::max(bboxWidth, bboxHeight) / searchStep));
+
+    const size_t N_GRID = mGridWidth * mGridHeight;
+
+    BoxFrame box;
+    getBoxFrame(bbox, box);
+
+    std::vector<cv::Mat> planes;
+    getPlaneViews(aFrame.image, aFrame.planes, planes);
+    std::vector<double> values(mGridChannels);
+
+    Eigen::VectorXd samplesBuffer;
+    const Eigen::VectorXd &samples = getTemplateSamples(samplesBuffer);
+
+    std::vector<std::pair<double, Eigen::Vector2d>> candidates;
+
+    for (int sy = -nSteps; sy <= nSteps; sy++) {
+        for (int sx = -nSteps; sx <= nSteps; sx++) {
+            const double tx = sx * searchStep;
+            const double ty = sy * searchStep;
+
+            double sad = 0;
+            size_t n = 0;
+
+            for (size_t i = 0; i < mGridHeight; i += sampleStep) {
+                const double y = bbox[1] + deltaY * i + ty;
+
+                for (size_t j = 0; j < mGridWidth; j += sampleStep) {
+                    const double x = bbox[0] + deltaX * j + tx;
+
+                    getSubPixelValues(planes, x, y, values.data(), 1);
+
+                    for (size_t c = 0; c < mGridChannels; c++) {
+                        const size_t k = c * N_GRID + i * mGridWidth + j;
+                        sad += std::abs(values[c] - samples(k));
+                        n++;
+                    }
+                }
+            }
+
+            candidates.emplace_back(sad / n, Eigen::Vector2d(tx, ty));
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(),
+              [](const std::pair<double, Eigen::Vector2d> &aLhs,
+                 const std::pair<double, Eigen::Vector2d> &aRhs) {
+                  return aLhs.first < aRhs.first;
+              });
+
+    // Zero translation is seeded separately
+    std::vector<Eigen::Vector2d> taken(1, Eigen::Vector2d::Zero());
+
+    for (size_t c = 0; c < candidates.size() && aSeeds.size() < aNumPeaks;
+         c++) {
+        const Eigen::Vector2d &t = candidates[c].second;
+
+        bool isNear = false;
+        for (size_t k = 0; k < taken.size(); k++) {
+            if ((t - taken[k]).lpNorm<Eigen::Infinity>() <= searchStep)
+                isNear = true;
+        }
+        if (isNear) continue;
+
+        taken.push_back(t);
+
+        // Translation warp, in box coordinates
+        Eigen::Matrix3d seed = Eigen::Matrix3d::Identity();
+        seed(0, 2) = t(0) / box.scale;
+        seed(1, 2) = t(1) / box.scale;
+        aSeeds.push_back(seed);
+    }
+}
+
+/**
+ * @brief Align from several seeds in parallel and keep the best: predicted
+ * motion (constant velocity, ie. the last warp), identity and coarse search
+ * peaks
+ *
+ * Every seed runs at most the per-hypothesis iteration cap; seeds falling far
+ * behind the best finished one are cancelled early. The winner is then refined
+ * with whatever is left of aMaxIters.
+ *
+ * @see ImageAlignment::setMultiHypothesis()
+ *
+ * @param[in] aFrame Preprocessed frame to align against
+ * @param[in] aThreshold Threshold to compare against
+ * @param[in] aMaxIters Maximum iterations of the winning hypothesis
+ *
+ * @return AlignResult best result; iterations are summed over all hypotheses.
+ * If none has a finite residual: identity warp, not converged, stopped by
+ * STOP_DIVERGENCE
+ */
+ImageAlignment::AlignResult
+ImageAlignment::alignHypotheses(const PreparedFrame &aFrame,
+                                const float aThreshold,
+                                const size_t aMaxIters) {
+    std::vector<Eigen::Matrix3d> seeds;
+    coarseSearch(aFrame, mHypothesisPeaks, seeds);
+
+    seeds.insert(seeds.begin(), Eigen::Matrix3d::Identity());
+    if (!mWarp.isApprox(Eigen::Matrix3d::Identity())) {
+        // The last warp, applied to the current BBOX
+        BoxFrame box;
+        getBoxFrame(getBBOX(), box);
+
+        Eigen::Matrix3d seed;
+        imageToBoxWarp(box, mWarp, seed);
+        seeds.insert(seeds.begin(), seed);
+    }
+
+    const size_t hypothesisIters = std::min(mHypothesisIters, aMaxIters);
+
+    std::atomic<double> bestResidual(std::numeric_limits<double>::infinity());
+
+    std::vector<std::future<AlignResult>> futures;
+    for (size_t i = 0; i < seeds.size(); i++) {
+        const Eigen::Matrix3d seed = seeds[i];
+        futures.push_back(mHypothesisPool->submit([&, seed]() {
+            return align(aFrame, seed, aThreshold, hypothesisIters, false,
+                         &bestResidual);
+        }));
+    }
+
+    AlignResult best;
+    best.residualRMS = std::numeric_limits<double>::infinity();
+    size_t iterations = 0;
+
+    for (size_t i = 0; i < futures.size(); i++) {
+        const AlignResult result = futures[i].get();
+
+        iterations += result.iterations;
+        mStats.hypothesesRun++;
+
+        if (result.cancelled) {
+            mStats.hypothesesCancelled++;
+            continue;
+        }
+
+        if (result.residualRMS < best.residualRMS) best = result;
+    }
+
+    // No hypothesis has a finite residual: divergence, the BBOX is kept
+    if (!std::isfinite(best.residualRMS)) {
+        best.iterations = iterations;
+        best.stop = STOP_DIVERGENCE;
+        return best;
+    }
+
+    // Refine winner with the remaining budget
+    if (!best.converged && best.iterations < aMaxIters) {
+        const AlignResult refined =
+            align(aFrame, best.warp, aThreshold, aMaxIters - best.iterations,
+                  mDebugDisplay);
+
+        iterations += refined.iterations;
+        best.warp = refined.warp;
+        best.residualRMS = refined.residualRMS;
+        best.converged = refined.converged;
+        best.stop = refined.stop;
+    }
+
+    best.iterations = iterations;
+
+    return best;
+}
+
+/**
+ * @brief Enable (or disable) multi-hypothesis tracking for frames with large
+ * or ambiguous motion
+ * @note The pool must not be the one track() itself runs on, as track() blocks
+ * on the hypotheses
+ *
+ * @see ImageAlignment::alignHypotheses()
+ *
+ * @param[in] aPool Thread pool to run hypotheses on (nullptr: disable)
+ * @param[in] aNumPeaks Number of coarse search peaks to seed from
+ * @param[in] aMaxIters Iteration cap per hypothesis
+ */
+void ImageAlignment::setMultiHypothesis(ThreadPool *aPool,
+                                        const size_t aNumPeaks,
+                                        const size_t aMaxIters) {
+    mHypothesisPool = aPool;
+    mHypothesisPeaks = aNumPeaks;
+    mHypothesisIters = aMaxIters;
+}
+
+/**
+ * @brief Enable data-parallel alignment of large sampling grids: the Jacobian
+ * and Hessian build, and the per-iteration warped sampling, residual and J^T e,
+ * are split over the pool
+ * @note Sums are taken over fixed blocks of KLT_KERNEL_BLOCK grid points and
+ * combined in block order, so results are bit-identical whatever the pool
+ * size, and identical to tracking without a pool
+ * @note The pool must not be the one track() itself runs on, as track() blocks
+ * on it
+ *
+ * @param[in] aPool Thread pool to split work over (nullptr: disable)
+ * @param[in] aMinPixels Sampling grid size from which the pool is used
+ */
+void ImageAlignment::setParallelPool(ThreadPool *aPool,
+                                     const size_t aMinPixels) {
+    mParallelPool = aPool;
+    mParallelMinPixels = aMinPixels;
+}
+
+/**
+ * @brief Get pool to split a grid of aNumPixels points over, if it is large
+ * enough to be worth it
+ *
+ * @param[in] aNumPixels Number of sampling grid points
+ * @return ThreadPool* pool, or nullptr to stay on the calling thread
+ */
+ThreadPool *ImageAlignment::getParallelPool(const size_t aNumPixels) const {
+    return (aNumPixels >= mParallelMinPixels) ? mParallelPool : nullptr;
+}
+
+/**
+ * @brief Enable (or disable) deterministic mode: identical inputs give
+ * bit-identical warps and BBOXes across runs, parallel pool sizes and builds
+ * (eg. with or without KLT_NATIVE)
+ *
+ * Reductions use the fixed-order scalar kernels (exact float products summed
+ * in double, over fixed blocks combined in block order), the Hessian inverse
+ * and warp updates use plain scalar loops instead of Eigen, and
+ * multi-hypothesis runs are never cancelled (cancellation depends on timing).
+ * @note Relies on FP contraction being disabled (see CMakeLists.txt) and on
+ * IEEE double arithmetic. trackDeadline() stays timing-dependent
+ *
+ * @param[in] aDeterministic Enable deterministic mode
+ */
+void ImageAlignment::setDeterministic(const bool aDeterministic) {
+    mDeterministic = aDeterministic;
+
+    // Hessian inverse depends on the mode
+    mTemplateValid = false;
+}
+
+/**
+ * @brief Get whether deterministic mode is enabled
+ *
+ * @return true if enabled
+ */
+bool ImageAlignment::isDeterministic() const {
+    return mDeterministic;
+}
+
+/**
+ * @brief Set how the Hessian and J^T e kernels sum within blocks of
+ * KLT_KERNEL_BLOCK grid points. SUMMATION_COMPENSATED keeps float storage but
+ * recovers most of the precision lost summing large ROIs, at some cost per
+ * iteration
+ * @note Deterministic mode always uses SUMMATION_FIXED_ORDER
+ *
+ * @param[in] aSummation Summation
+ */
+void ImageAlignment::setSummation(const Summation aSummation) {
+    mSummation = aSummation;
+
+    // Hessian depends on the summation
+    mTemplateValid = false;
+}
+
+/**
+ * @brief Get summation set by setSummation()
+ *
+ * @return Summation summation
+ */
+Summation ImageAlignment::getSummation() const {
+    return mSummation;
+}
+
+/**
+ * @brief Set how frames the tracker preprocesses itself (track() and
+ * trackDeadline() on raw images, and the initial image) keep their channels.
+ * Colour layouts put every channel in the residual, which constrains
+ * low-texture targets (eg. isoluminant edges) far better than grayscale
+ * @note Frames passed in preprocessed must use the same layout throughout:
+ * the template and the frames tracked in need the same channels
+ *
+ * @see ImageAlignment::prepareFrame()
+ *
+ * @param[in] aLayout Channel layout
+ */
+void ImageAlignment::setChannelLayout(const ChannelLayout aLayout) {
+    mChannelLayout = aLayout;
+
+    // Re-prepare the current frame with the new layout, unless it was passed
+    // in preprocessed
+    if (!mCurrentImage.empty() &&
+        mCurrentImage.data != mCurrentFrame.image.data) {
+        mCurrentFrame = PreparedFrame();
+        mCurrentPyramid.clear();
+    }
+    mTemplateValid = false;
+}
+
+/**
+ * @brief Set the operator for template image gradients. Gradients are
+ * computed at the template grid points only, fused with sampling, and are
+ * normalised to the derivative per pixel whatever the operator
+ *
+ * GRADIENT_CENTRAL is the cheapest but follows noise; GRADIENT_SOBEL (default)
+ * smooths across the gradient; GRADIENT_SCHARR has the most accurate gradient
+ * direction, which helps rotation and shear.
+ *
+ * @param[in] aOperator Gradient operator
+ */
+void ImageAlignment::setGradientOperator(const GradientOperator aOperator) {
+    mGradientOperator = aOperator;
+
+    // Jacobian depends on the operator
+    mTemplateValid = false;
+}
+
+/**
+ * @brief Get gradient operator set by setGradientOperator()
+ *
+ * @return GradientOperator operator
+ */
+GradientOperator ImageAlignment::getGradientOperator() const {
+    return mGradientOperator;
+}
+
+/**
+ * @brief Set the stopping criteria of alignment runs
+ *
+ * @see ConvergencePolicy
+ *
+ * @param[in] aPolicy Convergence, stagnation and divergence tests
+ */
+void ImageAlignment::setConvergencePolicy(const ConvergencePolicy &aPolicy) {
+    mConvergencePolicy = aPolicy;
+}
+
+/**
+ * @brief Get the stopping criteria of alignment runs
+ *
+ * @return const ConvergencePolicy& policy
+ */
+const ConvergencePolicy &ImageAlignment::getConvergencePolicy() const {
+    return mConvergencePolicy;
+}
+
+/**
+ * @brief Set the appearance subspace of project-out IC. The template
+ * variation over the last aHistory frames (eg. lighting) is summarised by its
+ * aNumModes strongest principal components, which are projected out of the
+ * steepest descent images once per template. The warp then ignores
+ * appearance changes within that subspace, at no extra cost per iteration
+ * @note The residual still includes the appearance variation. The history
+ * restarts with init(), is resampled onto the new grid when the sampling grid
+ * changes size, and is not part of checkpoints
+ *
+ * @param[in] aNumModes Number of appearance modes (0: plain IC)
+ * @param[in] aHistory Number of recent templates to learn them from (at
+ * least aNumModes + 1)
+ */
+void ImageAlignment::setAppearanceModes(const size_t aNumModes,
+                                        const size_t aHistory) {
+    mAppearanceModes = aNumModes;
+    mAppearanceHistory = std::max(aHistory, aNumModes + 1);
+
+    if (mRecentTemplates.size() > mAppearanceHistory) {
+        mRecentTemplates.clear();
+        mRecentTemplatesNext = 0;
+    }
+
+    // Steepest descent images depend on the basis
+    mTemplateValid = false;
+}
+
+/**
+ * @brief Get number of appearance modes set by setAppearanceModes()
+ *
+ * @return size_t number of modes (0: plain IC)
+ */
+size_t ImageAlignment::getAppearanceModes() const {
+    return mAppearanceModes;
+}
+
+/**
+ * @brief Get number of appearance modes projected out of the current
+ * template: fewer than set while the history fills up, or if recent templates
+ * hardly vary
+ *
+ * @return size_t number of modes
+ */
+size_t ImageAlignment::getActiveAppearanceModes() const {
+    return mAppearanceBasis.cols();
+}
+
+/**
+ * @brief Set robust tile weighting against partial occlusion. The sampling
+ * grid is split into square tiles whose Hessian terms are precomputed with
+ * the template; every iteration, tiles with an outlier residual are
+ * down-weighted or dropped, which subtracts their terms from the Hessian, and
+ * dropped tiles are no longer sampled for the rest of the frame
+ * @note The residual RMS (and confidence) is then the weighted one over the
+ * kept tiles
+ *
+ * @see TileWeighting
+ *
+ * @param[in] aWeighting Tile size (0: disabled) and outlier thresholds
+ */
+void ImageAlignment::setTileWeighting(const TileWeighting &aWeighting) {
+    mTileWeighting = aWeighting;
+
+    // Tile Hessians depend on the tile size
+    mTemplateValid = false;
+}
+
+/**
+ * @brief Get robust tile weighting set by setTileWeighting()
+ *
+ * @return const TileWeighting& tile size and outlier thresholds
+ */
+const TileWeighting &ImageAlignment::getTileWeighting() const {
+    return mTileWeighting;
+}
+
+/**
+ * @brief Set the storage of template samples and steepest descent images for
+ * float frames. STORAGE_HALF keeps them in fp16 only, less than half the
+ * memory per target, so that many more targets fit in cache; the kernels
+ * convert to float as they load, and sum as with float storage
+ * @note 8-bit frames always use the fixed-point pipeline
+ *
+ * @param[in] aPrecision Storage precision
+ */
+void ImageAlignment::setStoragePrecision(const StoragePrecision aPrecision) {
+    mStoragePrecision = aPrecision;
+
+    // Template data is stored when prepared
+    mTemplateValid = false;
+}
+
+/**
+ * @brief Get storage precision set by setStoragePrecision()
+ *
+ * @return StoragePrecision precision
+ */
+StoragePrecision ImageAlignment::getStoragePrecision() const {
+    return mStoragePrecision;
+}
+
+/**
+ * @brief Get the memory held by template data: samples, steepest descent
+ * images (float, fixed-point and half precision copies) and inverse Hessian
+ *
+ * @return size_t bytes
+ */
+size_t ImageAlignment::getTemplateBytes() const {
+    return mTemplateSamples.size() * sizeof(double) +
+           mSteepestDescent.bytes() + mFixedTemplate.bytes() +
+           mFixedSteepestDescent.bytes() + mHalfTemplate.bytes() +
+           mHalfSteepestDescent.bytes() + sizeof(mHessianInverse);
+}
+
+/**
+ * @brief Get channel layout set by setChannelLayout()
+ *
+ * @return ChannelLayout layout
+ */
+ChannelLayout ImageAlignment::getChannelLayout() const {
+    return mChannelLayout;
+}
+
+/**
+ * @brief Get summation the kernels actually use
+ *
+ * @return Summation fixed-order in deterministic mode, else as set
+ */
+Summation ImageAlignment::getKernelSummation() const {
+    return mDeterministic ? SUMMATION_FIXED_ORDER : mSummation;
+}
+
+/**
+ * @brief Track in an already preprocessed frame; allows one preprocessing pass
+ * per frame to be shared by many trackers
+ *
+ * @see ImageAlignment::prepareFrame()
+ * @see ImageAlignment::track(const cv::Mat &, const float, const size_t)
+ *
+ * @param[in] aFrame Preprocessed new frame to track in
+ * @param[in] aThreshold Threshold to compare against
+ * @param[in] aMaxIters Maximum iterations before stop
+ */
+void ImageAlignment::track(const PreparedFrame &aFrame, const float aThreshold,
+                           const size_t aMaxIters) {
+    if (skipIfUnchanged(aFrame.image, aFrame.planes)) return;
+
+    trackPrepared(aFrame, aThreshold, aMaxIters);
+}
+
+/**
+ * @brief Track in an already preprocessed frame, without change detection
+ *
+ * @param[in] aFrame Preprocessed new frame to track in
+ * @param[in] aThreshold Threshold to compare against
+ * @param[in] aMaxIters Maximum iterations before stop
+ */
+void ImageAlignment::trackPrepared(const PreparedFrame &aFrame,
+                                   const float aThreshold,
+                                   const size_t aMaxIters) {
+    /* Precompute template, Jacobian and Hessian (unless cached) */
+    if (!isTemplateValid()) prepareTemplate();
+
+    /* Iteratively find best match */
+    AlignResult result;
+
+    if (mHypothesisPool)
+        result = alignHypotheses(aFrame, aThreshold, aMaxIters);
+    else
+        result = align(aFrame, Eigen::Matrix3d::Identity(), aThreshold,
+                       aMaxIters, mDebugDisplay);
+
+    finishTrack(aFrame, result);
+}
+
+/**
+ * @brief Get number of sampling grid points over a BBOX for a given stride and
+ * pixel budget
+ *
+ * @see ImageAlignment::getGridSize()
+ *
+ * @param[in] aBBOX BBOX to sample
+ * @param[in] aStride Sampling stride
+ * @param[in] aPixelBudget Max number of points (0: no limit)
+ * @param[out] aNX Number of grid columns
+ * @param[out] aNY Number of grid rows
+ */
+static void computeGridSize(const bbox_t &aBBOX, const size_t aStride,
+                            const size_t aPixelBudget, int &aNX, int &aNY) {
+    const int stride = static_cast<int>(aStride);
+
+    aNX = int(aBBOX[2] - aBBOX[0]);
+    aNY = int(aBBOX[3] - aBBOX[1]);
+
+    // Same aspect ratio, at most aPixelBudget points (in 64 bits: large BBOXes
+    // overflow int)
+    const int64_t numPoints = static_cast<int64_t>(aNX) * aNY;
+    if (aPixelBudget > 0 && aNX > 0 && aNY > 0 &&
+        static_cast<uint64_t>(numPoints) > aPixelBudget) {
+        const double scale = std::sqrt(static_cast<double>(aPixelBudget) /
+                                       static_cast<double>(numPoints));
+        aNX = std::max(2, int(aNX * scale));
+        aNY = std::max(2, int(aNY * scale));
+    }
+
+    if (stride > 1) {
+        aNX = std::max(2, (aNX - 1) / stride + 1);
+        aNY = std::max(2, (aNY - 1) / stride + 1);
+    }
+}
+
+/**
+ * @brief Low-pass filter and halve a region of a preprocessed frame
+ * (cv::pyrDown) once per level; planar frames are filtered plane by plane
+ *
+ * @param[in] aFrame Preprocessed frame (no gradients needed)
+ * @param[in] aRegion Region to filter, within one plane
+ * @param[in] aLevels Number of levels
+ * @param[out] aPyramid Levels 1 to aLevels (region at 1/2, 1/4, ... scale)
+ */
+static void buildPyramid(const PreparedFrame &aFrame, const cv::Rect &aRegion,
+                         const size_t aLevels,
+                         std::vector<PreparedFrame> &aPyramid) {
+    const int planes = aFrame.planes;
+    const int rows = aFrame.image.rows / planes;
+
+    aPyramid.assign(aLevels, PreparedFrame());
+
+    for (int c = 0; c < planes; c++) {
+        cv::Mat level = aFrame.image(cv::Rect(aRegion.x, c * rows + aRegion.y,
+                                              aRegion.width, aRegion.height));
+
+        for (size_t p = 0; p < aLevels; p++) {
+            cv::Mat down;
+            cv::pyrDown(level, down);
+            level = down;
+
+            PreparedFrame &out = aPyramid[p];
+            out.planes = planes;
+            if (planes == 1) {
+                out.image = down;
+                continue;
+            }
+
+            if (c == 0)
+                out.image.create(planes * down.rows, down.cols, down.type());
+            cv::Mat plane = out.image(
+                cv::Rect(0, c * down.rows, down.cols, down.rows));
+            down.copyTo(plane);
+        }
+    }
+}
+
+/**
+ * @brief Get the region of a frame a deadline pyramid is built over: a BBOX
+ * grown by a margin, from a corner on the coarsest level's pixel grid (so
+ * that level coordinates are exact halvings), clipped to the frame
+ *
+ * @param[in] aBBOX BBOX
+ * @param[in] aMarginX Margin left and right, in pixels
+ * @param[in] aMarginY Margin above and below, in pixels
+ * @param[in] aLevels Number of pyramid levels
+ * @param[in] aFrame Preprocessed frame
+ * @return cv::Rect region within one plane (may be empty)
+ */
+static cv::Rect getPyramidRegion(const bbox_t &aBBOX, const float aMarginX,
+                                 const float aMarginY, const size_t aLevels,
+                                 const PreparedFrame &aFrame) {
+    const int align = 1 << aLevels;
+
+    const int x0 = std::max(0, int(std::floor(aBBOX[0] - aMarginX)));
+    const int y0 = std::max(0, int(std::floor(aBBOX[1] - aMarginY)));
+    const int x1 =
+        std::min(aFrame.image.cols, int(std::ceil(aBBOX[2] + aMarginX)) + 1);
+    const int y1 = std::min(aFrame.image.rows / aFrame.planes,
+                            int(std::ceil(aBBOX[3] + aMarginY)) + 1);
+
+    cv::Rect region;
+    region.x = x0 / align * align;
+    region.y = y0 / align * align;
+    region.width = x1 - region.x;
+    region.height = y1 - region.y;
+    return region;
+}
+
+/**
+ * @brief Map a BBOX into a pyramid level of a region
+ *
+ * @param[in] aBBOX BBOX in frame coordinates
+ * @param[in] aRegion Region the pyramid was built over
+ * @param[in] aLevel Pyramid level (scale 2^-aLevel)
+ * @param[out] aLevelBBOX BBOX in level coordinates
+ */
+static void scaleToLevel(const bbox_t &aBBOX, const cv::Rect &aRegion,
+                         const size_t aLevel, bbox_t &aLevelBBOX) {
+    const float scale = 1.0f / (1 << aLevel);
+
+    aLevelBBOX[0] = (aBBOX[0] - aRegion.x) * scale;
+    aLevelBBOX[1] = (aBBOX[1] - aRegion.y) * scale;
+    aLevelBBOX[2] = (aBBOX[2] - aRegion.x) * scale;
+    aLevelBBOX[3] = (aBBOX[3] - aRegion.y) * scale;
+}
+
+/**
+ * @brief Track within a time budget ("anytime" tracking)
+ *
+ * Aligns coarse to fine over an image pyramid (the template and new frames
+ * low-pass filtered and halved around the BBOX, at 1/4, 1/2 and full scale),
+ * sampled at the sampling stride over the BBOX scaled to match, so coarse
+ * grids do not alias. Warps are in box coordinates, which do not change with
+ * scale, so each level starts from the warp of the previous one. A finer
+ * level is only started if its estimated cost still fits in the budget, and
+ * iterations stop as soon as the next one would not fit; the latest warp is
+ * always kept.
+ *
+ * @see ImageAlignment::setSampleStride()
+ *
+ * @param[in] aFrame Preprocessed new frame to track in
+ * @param[in] aBudgetUs Time budget in microseconds
+ * @param[in] aThreshold Threshold to compare against
+ * @param[in] aMaxIters Maximum iterations per level
+ *
+ * @return TrackQuality whether the finest level converged, ran out of
+ * iterations, or was cut short by the deadline, or whether the frame was
+ * skipped as unchanged
+ */
+TrackQuality ImageAlignment::trackDeadline(const PreparedFrame &aFrame,
+                                           const double aBudgetUs,
+                                           const float aThreshold,
+                                           const size_t aMaxIters) {
+    if (skipIfUnchanged(aFrame.image, aFrame.planes)) return QUALITY_SKIPPED;
+
+    return trackPreparedDeadline(aFrame, aBudgetUs, aThreshold, aMaxIters);
+}
+
+/**
+ * @brief Track in an already preprocessed frame within a time budget, without
+ * change detection
+ *
+ * @param[in] aFrame Preprocessed new frame to track in
+ * @param[in] aBudgetUs Time budget in microseconds
+ * @param[in] aThreshold Threshold to compare against
+ * @param[in] aMaxIters Maximum iterations per level
+ *
+ * @return TrackQuality quality flag
+ */
+TrackQuality ImageAlignment::trackPreparedDeadline(const PreparedFrame &aFrame,
+                                                   const double aBudgetUs,
+                                                   const float aThreshold,
+                                                   const size_t aMaxIters) {
+    typedef std::chrono::steady_clock clock;
+
+    const clock::time_point start = clock::now();
+    const clock::time_point deadline =
+        start + std::chrono::duration_cast<clock::duration>(
+                    std::chrono::duration<double, std::micro>(aBudgetUs));
+
+    bbox_t bbox;
+    std::copy(getBBOX(), getBBOX() + 4, bbox);
+
+    // Coarse levels need the template frame; a restored tracker only has the
+    // cached template
+    size_t levels = 0;
+    if (!mCurrentFrame.image.empty() || !mCurrentImage.empty()) {
+        const float minSide = std::min(bbox[2] - bbox[0], bbox[3] - bbox[1]);
+
+        for (levels = KLT_DEADLINE_LEVELS - 1; levels > 0; levels--)
+            if (minSide / (mSampleStride << levels) >= KLT_DEADLINE_MIN_GRID)
+                break;
+    }
+
+    // The template is only sampled over the BBOX (plus filter support); the
+    // new frame needs room for the target to move
+    cv::Rect frameRegion;
+    std::vector<PreparedFrame> framePyramid;
+    if (levels > 0) {
+        if (mCurrentFrame.image.empty())
+            prepareFrame(mCurrentImage, mCurrentFrame, mChannelLayout, false);
+
+        const float support = float(2 << levels);
+        const cv::Rect templateRegion =
+            getPyramidRegion(bbox, support, support, levels, mCurrentFrame);
+        frameRegion = getPyramidRegion(
+            bbox, KLT_DEADLINE_MARGIN * (bbox[2] - bbox[0]) + support,
+            KLT_DEADLINE_MARGIN * (bbox[3] - bbox[1]) + support, levels,
+            aFrame);
+
+        const int minSize = 1 << levels;
+        if (templateRegion.width < minSize || templateRegion.height < minSize ||
+            frameRegion.width < minSize || frameRegion.height < minSize) {
+            levels = 0;
+        } else {
+            // The frame last tracked in usually covers the template already
+            const cv::Rect &cached = mCurrentPyramidRegion;
+            if (mCurrentPyramid.size() != levels ||
+                templateRegion.x < cached.x || templateRegion.y < cached.y ||
+                templateRegion.x + templateRegion.width >
+                    cached.x + cached.width ||
+                templateRegion.y + templateRegion.height >
+                    cached.y + cached.height) {
+                buildPyramid(mCurrentFrame, templateRegion, levels,
+                             mCurrentPyramid);
+                mCurrentPyramidRegion = templateRegion;
+            }
+            buildPyramid(aFrame, frameRegion, levels, framePyramid);
+        }
+    }
+
+    const size_t baseBudget = mPixelBudget;
+
+    AlignResult result;
+    TrackQuality quality = QUALITY_DEADLINE;
+    Eigen::Matrix3d warp = Eigen::Matrix3d::Identity();
+    size_t iterations = 0;
+
+    for (size_t level = levels + 1; level-- > 0;) {
+        // Level BBOX in template and new frame region coordinates, and
+        // pixel budget
+        bbox_t templateBbox, frameBbox;
+        size_t levelBudget = baseBudget;
+        if (level > 0) {
+            scaleToLevel(bbox, mCurrentPyramidRegion, level, templateBbox);
+            scaleToLevel(bbox, frameRegion, level, frameBbox);
+            if (baseBudget > 0)
+                levelBudget = std::max<size_t>(1, baseBudget >> (2 * level));
+        } else {
+            std::copy(bbox, bbox + 4, frameBbox);
+        }
+
+        // Estimated cost of preparing this level plus a couple of iterations
+        int nX, nY;
+        computeGridSize(frameBbox, mSampleStride, levelBudget, nX, nY);
+        const double estimateUs = mUsPerSample * nX * nY * mGridChannels *
+                                  (KLT_DEADLINE_PREPARE_COST + 2);
+
+        const double remainingUs =
+            std::chrono::duration<double, std::micro>(deadline - clock::now())
+                .count();
+
+        // Always run at least one level
+        if (level < levels && estimateUs > remainingUs) break;
+
+        if (level > 0) {
+            // Template and frame at this level, each in its own region (box
+            // warps do not depend on the origin); the cached base template is
+            // rebuilt afterwards
+            mPixelBudget = levelBudget;
+            std::swap(mCurrentFrame, mCurrentPyramid[level - 1]);
+
+            std::copy(templateBbox, templateBbox + 4, mBbox);
+            prepareTemplate(false);
+
+            std::copy(frameBbox, frameBbox + 4, mBbox);
+            result = align(framePyramid[level - 1], warp, aThreshold,
+                           aMaxIters, mDebugDisplay, nullptr, &deadline);
+
+            std::swap(mCurrentFrame, mCurrentPyramid[level - 1]);
+            mPixelBudget = baseBudget;
+            std::copy(bbox, bbox + 4, mBbox);
+            mTemplateValid = false;
+        } else {
+            if (!isTemplateValid()) {
+                if (mCurrentFrame.image.empty() && mCurrentImage.empty())
+                    break;
+                prepareTemplate();
+            }
+            result = align(aFrame, warp, aThreshold, aMaxIters, mDebugDisplay,
+                           nullptr, &deadline);
+        }
+
+        // Measured cost predicts the next levels and frames
+        if (result.timedIterations > 0) {
+            const double decay = std::pow(0.9, result.timedIterations);
+            mUsPerSample =
+                decay * mUsPerSample + (1 - decay) * result.usPerSample;
+        }
+
+        // A coarse level that stagnated or diverged is no seed
+        if (level == 0 || result.converged || result.deadlineHit)
+            warp = result.warp;
+        iterations += result.iterations;
+
+        if (result.deadlineHit) break;
+
+        if (level == 0)
+            quality = result.converged ? QUALITY_CONVERGED : QUALITY_MAX_ITERS;
+    }
+
+    result.warp = warp;
+    result.iterations = iterations;
+
+    finishTrack(aFrame, result);
+
+    // The new frame's levels may serve as the next template's
+    if (levels > 0) {
+        mCurrentPyramid.swap(framePyramid);
+        mCurrentPyramidRegion = frameRegion;
+    }
+
+    const double elapsedUs =
+        std::chrono::duration<double, std::micro>(clock::now() - start)
+            .count();
+
+    mStats.deadlineFrames++;
+    if (quality == QUALITY_DEADLINE) mStats.deadlineHits++;
+    if (elapsedUs > aBudgetUs) mStats.deadlineOverruns++;
+
+    return quality;
+}
+
+/**
+ * @brief Track within a time budget, including preprocessing of the frame
+ *
+ * @see ImageAlignment::trackDeadline(const PreparedFrame &, const double,
+ * const float, const size_t)
+ *
+ * @param[in] aNewImage New image to track in
+ * @param[in] aBudgetUs Time budget in microseconds
+ * @param[in] aThreshold Threshold to compare against
+ * @param[in] aMaxIters Maximum iterations per level
+ *
+ * @return TrackQuality quality flag
+ */
+TrackQuality ImageAlignment::trackDeadline(const cv::Mat &aNewImage,
+                                           const double aBudgetUs,
+                                           const float aThreshold,
+                                           const size_t aMaxIters) {
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+
+    if (skipIfUnchanged(aNewImage)) return QUALITY_SKIPPED;
+
+    PreparedFrame frame;
+    prepareFrame(aNewImage, frame, mChannelLayout, false);
+
+    const double prepareUs = std::chrono::duration<double, std::micro>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+
+    const TrackQuality quality = trackPreparedDeadline(
+        frame, aBudgetUs - prepareUs, aThreshold, aMaxIters);
+
+    // Keep original (not preprocessed) image for display
+    mCurrentImage = aNewImage;
+
+    return quality;
+}
+
+/**
+ * @brief Get intensity of a pixel of a grayscale (any depth), BGR (CV_8UC3,
+ * CV_32FC3) or planar BGR (CV_32FC1, planes stacked vertically) image; BGR
+ * uses the same weights as cv::cvtColor(), so that raw and preprocessed frames
+ * agree
+ *
+ * @param[in] aImg Image
+ * @param[in] aX Column
+ * @param[in] aY Row (within one plane)
+ * @param[in] aPlanes Number of planes stacked vertically in aImg
+ *
+ * @return double intensity
+ */
+static double getGrayValue(const cv::Mat &aImg, const int aX, const int aY,
+                           const int aPlanes) {
+    if (aPlanes >= 3) {
+        const int rows = aImg.rows / aPlanes;
+        return 0.114 * aImg.at<float>(aY, aX) +
+               0.587 * aImg.at<float>(aY + rows, aX) +
+               0.299 * aImg.at<float>(aY + 2 * rows, aX);
+    }
+
+    switch (aImg.type()) {
+        case CV_8UC1:
+            return aImg.at<unsigned char>(aY, aX);
+        case CV_8UC3: {
+            const cv::Vec3b &bgr = aImg.at<cv::Vec3b>(aY, aX);
+            return 0.114 * bgr[0] + 0.587 * bgr[1] + 0.299 * bgr[2];
+        }
+        case CV_32FC3: {
+            const cv::Vec3f &bgr = aImg.at<cv::Vec3f>(aY, aX);
+            return 0.114 * bgr[0] + 0.587 * bgr[1] + 0.299 * bgr[2];
+        }
+        case CV_64FC1:
+            return aImg.at<double>(aY, aX);
+        case CV_32FC1:
+        default:
+            return aImg.at<float>(aY, aX);
+    }
+}
+
+/**
+ * @brief Cheap ROI change detector: mean absolute difference between the
+ * current frame and a new one over a coarse grid of BBOX pixels
+ *
+ * @param[in] aImage New frame (raw or preprocessed)
+ * @param[in] aPlanes Number of planes stacked vertically in aImage (planar
+ * preprocessed frame)
+ * @return double mean absolute difference, or infinity if there is nothing to
+ * compare against
+ */
+double ImageAlignment::getROIChange(const cv::Mat &aImage,
+                                    const int aPlanes) {
+    // Raw current frame if kept, else the preprocessed one (which may be
+    // planar); both are compared as intensity, whatever the layout
+    const bool raw = !mCurrentImage.empty() &&
+                     mCurrentImage.data != mCurrentFrame.image.data;
+    const cv::Mat &reference = raw ? mCurrentImage : mCurrentFrame.image;
+    const int referencePlanes = raw ? 1 : mCurrentFrame.planes;
+
+    if (reference.empty() || aImage.empty() || aPlanes < 1 ||
+        reference.cols != aImage.cols ||
+        reference.rows / referencePlanes != aImage.rows / aPlanes)
+        return std::numeric_limits<double>::infinity();
+
+    const bbox_t &bbox = getBBOX();
+    const int rows = aImage.rows / aPlanes;
+
+    const int x0 = std::max(0, static_cast<int>(bbox[0]));
+    const int y0 = std::max(0, static_cast<int>(bbox[1]));
+    const int x1 = std::min(aImage.cols - 1, static_cast<int>(bbox[2]));
+    const int y1 = std::min(rows - 1, static_cast<int>(bbox[3]));
+
+    if (x1 < x0 || y1 < y0) return std::numeric_limits<double>::infinity();
+
+    double sad = 0;
+    size_t n = 0;
+
+    for (int i = 0; i < KLT_SKIP_GRID; i++) {
+        const int y = y0 + (y1 - y0) * i / (KLT_SKIP_GRID - 1);
+
+        for (int j = 0; j < KLT_SKIP_GRID; j++) {
+            const int x = x0 + (x1 - x0) * j / (KLT_SKIP_GRID - 1);
+
+            sad += std::abs(getGrayValue(aImage, x, y, aPlanes) -
+                            getGrayValue(reference, x, y, referencePlanes));
+            n++;
+        }
+    }
+
+    return sad / n;
+}
+
+/**
+ * @brief Skip a frame whose BBOX content did not change: the BBOX stays (warp
+ * carried forward as identity), the current frame and cached template are
+ * kept, and the skip is counted in the stats
+ *
+ * @see ImageAlignment::setSkipThreshold()
+ *
+ * @param[in] aImage New frame (raw or preprocessed)
+ * @param[in] aPlanes Number of planes stacked vertically in aImage
+ * @return true if the frame was skipped
+ */
+bool ImageAlignment::skipIfUnchanged(const cv::Mat &aImage,
+                                     const int aPlanes) {
+    if (mSkipThreshold <= 0 || getROIChange(aImage, aPlanes) > mSkipThreshold)
+        return false;
+
+    mWarp.setIdentity();
+    mFrameIndex++;
+
+    mStats.framesSkipped++;
+    mStats.lastIterations = 0;
+
+    publishState();
+
+    return true;
+}
+
+/**
+ * @brief Set ROI change threshold below which frames are skipped without
+ * alignment (static scenes)
+ *
+ * @param[in] aSkipThreshold Mean absolute intensity difference over the BBOX
+ * (0: never skip)
+ */
+void ImageAlignment::setSkipThreshold(const double aSkipThreshold) {
+    mSkipThreshold = aSkipThreshold;
+}
+
+/**
+ * @brief Apply an alignment result: update stats, BBOX and warp, make the new
+ * frame current and publish the new state
+ *
+ * @param[in] aFrame Preprocessed frame that was tracked in
+ * @param[in] aResult Alignment result (warp in box coordinates)
+ */
+void ImageAlignment::finishTrack(const PreparedFrame &aFrame,
+                                 const AlignResult &aResult) {
+    const bbox_t &bbox = getBBOX();
+
+    // Back to image coordinates for the BBOX update and getWarp()
+    BoxFrame box;
+    getBoxFrame(bbox, box);
+
+    Eigen::Matrix3d warpMat;
+    boxToImageWarp(box, aResult.warp, warpMat);
+
+    mResidualRMS = aResult.residualRMS;
+
+    mStats.framesTracked++;
+    mStats.totalIterations += aResult.iterations;
+    mStats.lastIterations = aResult.iterations;
+    if (aResult.converged) mStats.framesConverged++;
+    mStats.lastStop = aResult.stop;
+    mStats.stops[aResult.stop]++;
+    mStats.lastDroppedTiles = aResult.droppedTiles;
+    mStats.tilesDropped += aResult.droppedTiles;
+
+    // Update new BBOX
+    // NOTE: Not using setBBOX(); state is published once, below
+    if (mDeterministic) {
+        // Scalar arithmetic, see setDeterministic()
+        const double x0 = bbox[0], y0 = bbox[1], x1 = bbox[2], y1 = bbox[3];
+
+        mBbox[0] = warpMat(0, 0) * x0 + warpMat(0, 1) * y0 + warpMat(0, 2);
+        mBbox[1] = warpMat(1, 0) * x0 + warpMat(1, 1) * y0 + warpMat(1, 2);
+        mBbox[2] = warpMat(0, 0) * x1 + warpMat(0, 1) * y1 + warpMat(0, 2);
+        mBbox[3] = warpMat(1, 0) * x1 + warpMat(1, 1) * y1 + warpMat(1, 2);
+    } else {
+        Eigen::MatrixXd bboxMat(3, 2);
+
+        bboxMat << bbox[0], bbox[2], //
+            bbox[1], bbox[3],        //
+            1, 1;
+
+        Eigen::MatrixXd newBBOXHomo = warpMat * bboxMat;
+
+        mBbox[0] = newBBOXHomo(0, 0);
+        mBbox[1] = newBBOXHomo(1, 0);
+        mBbox[2] = newBBOXHomo(0, 1);
+        mBbox[3] = newBBOXHomo(1, 1);
+    }
+
+    mWarp = warpMat;
+    mFrameIndex++;
+
+    // Set new images
+    //  - "Current" image becomes template
+    //  - New image becomes current image
+    setTemplateImage(getCurrentImage());
+    mCurrentFrame = aFrame;
+    mCurrentImage = aFrame.image;
+    mCurrentPyramid.clear();
+
+    // New frame and BBOX: template must be recomputed
+    mTemplateValid = false;
+
+    publishState();
+}
+
+/**
+ * @brief Check whether the cached template data matches the current frame,
+ * BBOX and sampling grid
+ *
+ * @return true if track() can use the cached template data as is
+ */
+bool ImageAlignment::isTemplateValid() const {
+    return mTemplateValid && mTemplateStride == mSampleStride;
+}
+
+/**
+ * @brief Get number of sampling grid points over a BBOX: one per pixel along
+ * each side, scaled down to the pixel budget (if any), then divided by the
+ * sampling stride (at least 2), linearly spaced over the whole BBOX
+ *
+ * @param[in] aBBOX BBOX to sample
+ * @param[out] aNX Number of grid columns
+ * @param[out] aNY Number of grid rows
+ */
+void ImageAlignment::getGridSize(const bbox_t &aBBOX, int &aNX,
+                                 int &aNY) const {
+    computeGridSize(aBBOX, mSampleStride, mPixelBudget, aNX, aNY);
+}
+
+/**
+ * @brief Get the box-centred, scale-normalised frame of a BBOX, in which warps
+ * are estimated
+ *
+ * @see makeBoxFrame()
+ *
+ * @param[in] aBBOX BBOX
+ * @param[out] aFrame Centre and scale
+ */
+void ImageAlignment::getBoxFrame(const bbox_t &aBBOX, BoxFrame &aFrame) const {
+    makeBoxFrame(aBBOX[0], aBBOX[1], aBBOX[2], aBBOX[3], aFrame);
+}
+
+/**
+ * @brief Cap the number of template samples: large BBOXes are sampled on a
+ * coarser (still linearly-spaced) grid so that per-iteration cost stays
+ * roughly constant whatever the target scale
+ *
+ * @param[in] aMaxPixels Max grid points per frame (0: one per pixel)
+ */
+void ImageAlignment::setPixelBudget(const size_t aMaxPixels) {
+    mPixelBudget = aMaxPixels;
+    mTemplateValid = false;
+}
+
+/**
+ * @brief Get pixel budget
+ *
+ * @return size_t max grid points per frame (0: unlimited)
+ */
+size_t ImageAlignment::getPixelBudget() const {
+    return mPixelBudget;
+}
+
+/**
+ * @brief Set sampling grid stride: the template is sampled every aStride
+ * pixels (along each side) instead of every pixel
+ *
+ * @param[in] aStride Sampling stride (>= 1)
+ */
+void ImageAlignment::setSampleStride(const size_t aStride) {
+    mSampleStride = std::max<size_t>(1, aStride);
+}
+
+/**
+ * @brief Get sampling grid stride
+ *
+ * @return size_t sampling stride
+ */
+size_t ImageAlignment::getSampleStride() const {
+    return mSampleStride;
+}
+
+/**
+ * @brief Get affine warp found by the last call to track(), which maps the
+ * previous BBOX onto the current one (image coordinates; it is estimated in
+ * box coordinates, see getBoxFrame())
+ *
+ * @return const Eigen::Matrix3d& warp (identity after init)
+ */
+const Eigen::Matrix3d &ImageAlignment::getWarp() const {
+    return mWarp;
+}
+
+/**
+ * @brief Get number of frames tracked since initialisation
+ *
+ * @return uint64_t frame index
+ */
+uint64_t ImageAlignment::getFrameIndex() const {
+    return mFrameIndex;
+}
+
+/**
+ * @brief Get the latest published tracker state (BBOX, warp, confidence and
+ * frame index)
+ * @note Lock-free and safe to call from any thread while another thread is
+ * tracking, unlike getBBOX() which refers to state track() overwrites
+ *
+ * @return TrackerSnapshot consistent snapshot of tracker state
+ */
+TrackerSnapshot ImageAlignment::getSnapshot() const {
+    return mPublishedState.read();
+}
+
+/**
+ * @brief Publish current tracker state for concurrent readers
+ *
+ * @see ImageAlignment::getSnapshot()
+ */
+void ImageAlignment::publishState() {
+    TrackerSnapshot snapshot;
+
+    for (int i = 0; i < 4; i++)
+        snapshot.bbox[i] = mBbox[i];
+
+    for (int r = 0; r < 2; r++) {
+        for (int c = 0; c < 3; c++)
+            snapshot.warp[r * 3 + c] = static_cast<float>(mWarp(r, c));
+    }
+
+    snapshot.confidence = getConfidence();
+    snapshot.frameIndex = mFrameIndex;
+
+    mPublishedState.publish(snapshot);
+}
+
+/**
+ * @brief Reset per-target tracking state (warp, frame index, residual, stats)
+ * after (re-)initialisation and publish it
+ */
+void ImageAlignment::resetState() {
+    mWarp.setIdentity();
+    mFrameIndex = 0;
+    mRecentTemplates.clear();
+    mRecentTemplatesNext = 0;
+    mResidualRMS = 0;
+    mStats = TrackStats();
+
+    publishState();
+}
+
+/**
+ * @brief Get RMS of the error image in the last iteration of the last call to
+ * track()
+ *
+ * @return double residual RMS (intensity levels)
+ */
+double ImageAlignment::getResidualRMS() const {
+    return mResidualRMS;
+}
+
+/**
+ * @brief Get confidence of the last tracking result, derived from the residual
+ * RMS as 1 / (1 + (RMS / scale)^2)
+ *
+ * @see ImageAlignment::setConfidenceScale()
+ *
+ * @return float confidence in (0, 1]; 1 before any tracking
+ */
+float ImageAlignment::getConfidence() const {
+    const double ratio = mResidualRMS / mConfidenceScale;
+    return static_cast<float>(1.0 / (1.0 + ratio * ratio));
+}
+
+/**
+ * @brief Set residual RMS at which confidence drops to 0.5
+ *
+ * @param[in] aConfidenceScale Residual RMS scale (intensity levels)
+ */
+void ImageAlignment::setConfidenceScale(const double aConfidenceScale) {
+    mConfidenceScale = aConfidenceScale;
+}
+
+void ImageAlignment::printCVMat(const cv::Mat &aMat, const std::string &aName) {
+    std::cout << aName << std::endl;
+    for (int i = 0; i < aMat.rows; i++) {
+        // TODO: type check
+        const double *Mi = aMat.ptr<double>(i);
+        for (int j = 0; j < aMat.cols; j++)
+            std::cout << Mi[j] << ", ";
+        std::cout << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+/**
+ * @brief Check if a double is an integer.
+ *
+ * @param[in] aNum Number to check
+ * @param[in] aInftyIsInt Consider infinity as an integer?
+ * @note aInftyIsInt = true is a faster check.
+ *
+ * @ref
+ * https://stackoverflow.com/questions/1521607/check-double-variable-if-it-contains-an-integer-and-not-floating-point
+ *
+ * @return true If integer value (eg. 314.0000)
+ * @return false If non-integer value (eg. 3.14159)
+ */
+bool isInteger(const double aNum, const bool aInftyIsInt) {
+    if (aInftyIsInt) {
+        return (trunc(aNum) == aNum);
+    }
+    else {
+        double intpart;
+        // TODO: Set it to be epsilon instead?
+        return (std::modf(aNum, &intpart) == 0.0);
+    }
+}
+
+/**
+ * @brief Get sub pixel value in cv Mat using bilinear interpolation
+ *
+ * @ref https://stackoverflow.com/a/13301755/3141253
+ *
+ * @param[in] aImg Input image to get sub pixel value from
+ * @pre Must be single channel
+ * @param[in] ax x-coordinate (sub-pixel)
+ * @param[in] ay y-coordiate (sub-pixel)
+ *
+ * @return Sub pixel value from bilinear interpolation (double)
+ */
+double ImageAlignment::getSubPixelValue(const cv::Mat &aImg, const double ax,
+                                        const double ay) {
+    assert(!aImg.empty());
+    assert(aImg.channels() == 1);
+
+    // TODO: Check if ax and ay are integer values
+    // if (isInteger(ax) && isInteger(ay)) {
+    //     // Check type to ensure that we are getting the right values
+    //     // otherwise we'd be accessing a wrong pointer
+    //     switch (aImg.type()) {
+    //         case CV_8S:
+    //         case CV_8U:
+    //             return aImg.at<int>(ay, ax);
+    //         case CV_64F:
+    //             return aImg.at<double>(ay, ax);
+    //         case CV_32F:
+    //         default:
+    //             return aImg.at<float>(ay, ax);
+    //     }
+    // }
+
+    // Get the rounded down versions
+    // Doesn't really matter if int because the values of ax/ay are unlikely to
+    // be so large
+    const long intX = static_cast<int>(ax);
+    const long intY = static_cast<int>(ay);
+
+    // Interpolate in case at border
+    const int x0 =
+        cv::borderInterpolate(intX, aImg.cols, cv::BORDER_REFLECT_101);
+    const int x1 =
+        cv::borderInterpolate(intX + 1, aImg.cols, cv::BORDER_REFLECT_101);
+    const int y0 =
+        cv::borderInterpolate(intY, aImg.rows, cv::BORDER_REFLECT_101);
+    const int y1 =
+        cv::borderInterpolate(intY + 1, aImg.rows, cv::BORDER_REFLECT_101);
+
+    // Get deltas
+    const double dx = ax - static_cast<double>(intX);
+    const double dy = ay - static_cast<double>(intY);
+    const double dx1 = 1.0 - dx;
+    const double dy1 = 1.0 - dy;
+
+    // Get weights and pixels
+    const double tlWeight = dx1 * dy1;
+    const double trWeight = dx * dy1;
+    const double blWeight = dx1 * dy;
+    const double brWeight = dx * dy;
+
+    double tlPixel, trPixel, blPixel, brPixel;
+
+    // Check type to ensure that we are getting the right values
+    // otherwise we'd be accessing a wrong pointer
+    switch (aImg.type()) {
+        case CV_8S:
+            tlPixel = aImg.at<signed char>(y0, x0);
+            trPixel = aImg.at<signed char>(y0, x1);
+            blPixel = aImg.at<signed char>(y1, x0);
+            brPixel = aImg.at<signed char>(y1, x1);
+            break;
+        case CV_8U:
+            tlPixel = aImg.at<unsigned char>(y0, x0);
+            trPixel = aImg.at<unsigned char>(y0, x1);
+            blPixel = aImg.at<unsigned char>(y1, x0);
+            brPixel = aImg.at<unsigned char>(y1, x1);
+            break;
+        case CV_64F:
+            tlPixel = aImg.at<double>(y0, x0);
+            trPixel = aImg.at<double>(y0, x1);
+            blPixel = aImg.at<double>(y1, x0);
+            brPixel = aImg.at<double>(y1, x1);
+            break;
+        case CV_32F:
+        default:
+            tlPixel = aImg.at<float>(y0, x0);
+            trPixel = aImg.at<float>(y0, x1);
+            blPixel = aImg.at<float>(y1, x0);
+            brPixel = aImg.at<float>(y1, x1);
+            break;
+    }
+
+    // Return weighted pixel
+    return tlWeight * tlPixel + trWeight * trPixel + blWeight * blPixel +
+           brWeight * brPixel;
+}
+
+/**
+ * @brief Get sub pixel values of all channels of an image (split into planes)
+ * using bilinear interpolation
+ * @note Single channel planes use ImageAlignment::getSubPixelValue(), so
+ * grayscale results are unchanged; interleaved planes compute the weights once
+ * for all channels
+ *
+ * @param[in] aPlanes Planes of the image, any number of channels each
+ * @param[in] ax x-coordinate (sub-pixel)
+ * @param[in] ay y-coordinate (sub-pixel)
+ * @param[out] aOut Value of channel c (over all planes) at
+ * aOut[c * aChannelStride]
+ * @param[in] aChannelStride Output stride between channels
+ */
+void ImageAlignment::getSubPixelValues(const std::vector<cv::Mat> &aPlanes,
+                                       const double ax, const double ay,
+                                       double *aOut,
+                                       const size_t aChannelStride) {
+    for (size_t p = 0; p < aPlanes.size(); p++) {
+        const cv::Mat &img = aPlanes[p];
+
+        if (img.channels() == 1) {
+            *aOut = getSubPixelValue(img, ax, ay);
+            aOut += aChannelStride;
+            continue;
+        }
+
+        // Same truncation, border handling and weights as getSubPixelValue()
+        const long intX = static_cast<int>(ax);
+        const long intY = static_cast<int>(ay);
+
+        const int x0 =
+            cv::borderInterpolate(intX, img.cols, cv::BORDER_REFLECT_101);
+        const int x1 =
+            cv::borderInterpolate(intX + 1, img.cols, cv::BORDER_REFLECT_101);
+        const int y0 =
+            cv::borderInterpolate(intY, img.rows, cv::BORDER_REFLECT_101);
+        const int y1 =
+            cv::borderInterpolate(intY + 1, img.rows, cv::BORDER_REFLECT_101);
+
+        const double dx = ax - static_cast<double>(intX);
+        const double dy = ay - static_cast<double>(intY);
+
+        const double weights[4] = { (1.0 - dx) * (1.0 - dy), dx * (1.0 - dy),
+                                    (1.0 - dx) * dy, dx * dy };
+
+        switch (img.depth()) {
+            case CV_8U:
+                blendChannels<unsigned char>(img, x0, x1, y0, y1, weights,
+                                             aOut, aChannelStride);
+                break;
+            case CV_64F:
+                blendChannels<double>(img, x0, x1, y0, y1, weights, aOut,
+                                      aChannelStride);
+                break;
+            case CV_32F:
+            default:
+                blendChannels<float>(img, x0, x1, y0, y1, weights, aOut,
+                                     aChannelStride);
+                break;
+        }
+
+        aOut += img.channels() * aChannelStride;
+    }
+}
+
+/**
+ * @brief Get sub pixel values of a rectangle specified by aBBOX
  *
  * Sub pixel values are obtained using ImageAlignment::getSubPixelValue()
  *
  * @see ImageAlignment::getSubPixelValue()
  *
- * @param[in] aImg Input image
+ * @param[in] aImg Input image (any number of channels)
  * @param[out] aSubImg Output subimage
  * @param[in] aBBOX Input bounding box
+ * @param[in] aPlanes Number of planes stacked vertically in aImg
  *
- * @pre Single channel input and output images
- * @post Sub image should be initialised with correct size
+ * @post Sub image should be initialised with correct size; multi-channel
+ * images give one sub image per channel, stacked vertically
  * @post Sub image will be of type CV_64FC1
  */
 void ImageAlignment::getSubPixelRect(const cv::Mat &aImg, cv::Mat &aSubImg,
-                                     const bbox_t &aBBOX) {
+                                     const bbox_t &aBBOX, const int aPlanes) {
     // Init BBOX data
     const cv::Size2d bboxSize(aBBOX[2] - aBBOX[0], aBBOX[3] - aBBOX[1]);
     const cv::Point2f bboxCenter((aBBOX[2] + aBBOX[0]) / 2,
@@ -636,14 +3226,31 @@ void ImageAlignment::getSubPixelRect(const cv::Mat &aImg, cv::Mat &aSubImg,
     // Loop over everything, linearly-spaced
     // https://stackoverflow.com/questions/27028226/python-linspace-in-c
     size_t total = 0;
-    const int nX = int(bboxWidth);
-    const int nY = int(bboxHeight);
+    int nX, nY;
+    getGridSize(aBBOX, nX, nY);
 
     const float deltaX = bboxWidth / (nX - 1);
     const float deltaY = bboxHeight / (nY - 1);
 
+    std::vector<cv::Mat> planes;
+    getPlaneViews(aImg, aPlanes, planes);
+
+    const int cn = aImg.channels();
+
     // Initialise sub image properly
-    aSubImg.create(nY, nX, CV_64FC1);
+    aSubImg.create(cn * aPlanes * nY, nX, CV_64FC1);
+
+    // Axis-aligned grid: precomputed separable interpolation
+    if (aImg.depth() == CV_32F) {
+        SeparableAxis axisX, axisY;
+        buildSeparableAxis(aBBOX[0], deltaX, nX, planes[0].cols, axisX);
+        buildSeparableAxis(aBBOX[1], deltaY, nY, planes[0].rows, axisY);
+
+        for (int p = 0; p < aPlanes; p++)
+            sampleSeparable(planes[p], axisX, axisY,
+                            aSubImg.ptr<double>(p * cn * nY));
+        return;
+    }
 
     for (int i = 0; i < nY; i++) {
         double *Mi = aSubImg.ptr<double>(i);
@@ -651,11 +3258,8 @@ void ImageAlignment::getSubPixelRect(const cv::Mat &aImg, cv::Mat &aSubImg,
         for (int j = 0; j < nX; j++) {
             float x = aBBOX[0] + deltaX * j;
 
-            double subPix = getSubPixelValue(aImg, x, y);
-
-            // Store in matrix
-            Mi[j] = subPix;
-            // aSubImg.at<double>(i, j) = subPix;
+            // Store in matrix (channel c in sub image c)
+            getSubPixelValues(planes, x, y, Mi + j, nX * nY);
         }
     }
 }
@@ -670,8 +3274,576 @@ void ImageAlignment::getSubPixelRect(const cv::Mat &aImg, cv::Mat &aSubImg,
  *
  * @param[in] aImg Input image
  * @param[out] aSubImg Output subimage
+ * @param[in] aPlanes Number of planes stacked vertically in aImg
+ */
+void ImageAlignment::getSubPixelRect(const cv::Mat &aImg, cv::Mat &aSubImg,
+                                     const int aPlanes) {
+    const bbox_t &bbox = getBBOX();
+    getSubPixelRect(aImg, aSubImg, bbox, aPlanes);
+}
+
+/**
+ * @brief Visit the grid rectangles left in one band of tile rows after
+ * dropping tiles: aFunc(aRowBegin, aRowEnd, aColBegin, aColEnd) is called once
+ * per run of consecutive kept tiles
+ *
+ * @see numGridTiles()
+ *
+ * @param[in] aDropped Dropped flag of each tile
+ * @param[in] aTileSize Tile side in grid points
+ * @param[in] aNX Grid columns
+ * @param[in] aNY Grid rows
+ * @param[in] aBand Row of tiles
+ * @param[in] aFunc Function to call
+ */
+template <typename Func>
+static void forKeptTileRuns(const uint8_t *aDropped, const size_t aTileSize,
+                            const size_t aNX, const size_t aNY,
+                            const size_t aBand, const Func &aFunc) {
+    const size_t tilesX = (aNX + aTileSize - 1) / aTileSize;
+    const size_t rowBegin = aBand * aTileSize;
+    const size_t rowEnd = std::min(aNY, rowBegin + aTileSize);
+    const uint8_t *dropped = aDropped + aBand * tilesX;
+
+    for (size_t tx = 0; tx < tilesX;) {
+        if (dropped[tx]) {
+            tx++;
+            continue;
+        }
+
+        size_t runEnd = tx + 1;
+        while (runEnd < tilesX && !dropped[runEnd])
+            runEnd++;
+
+        aFunc(rowBegin, rowEnd, tx * aTileSize,
+              std::min(aNX, runEnd * aTileSize));
+        tx = runEnd;
+    }
+}
+
+/**
+ * @brief Get sub pixel values of the stored BBOX grid after warping it by
+ * aWarp, ie. the BBOX sub image of the image warped by aWarp
+ *
+ * Grid points are the same linearly-spaced points as in
+ * ImageAlignment::getSubPixelRect() and ImageAlignment::computeJacobian()
+ *
+ * @see ImageAlignment::getSubPixelValue()
+ *
+ * @param[in] aImg Input image (any number of channels)
+ * @param[out] aSubImg Output subimage (CV_64FC1, one per channel stacked
+ * vertically)
+ * @param[in] aWarp Affine warp applied to grid points
+ * @param[in] aPool Pool to split grid rows over (nullptr: calling thread
+ * only); the result is the same either way
+ * @param[in] aPlanes Number of planes stacked vertically in aImg
+ * @param[in] aDroppedTiles Dropped flag of each tile of aTileSize grid
+ * points (see numGridTiles()); dropped tiles are not sampled and keep their
+ * previous values (nullptr: sample all)
+ * @param[in] aTileSize Tile side in grid points
+ */
+void ImageAlignment::getWarpedSubPixelRect(const cv::Mat &aImg,
+                                           cv::Mat &aSubImg,
+                                           const Eigen::Matrix3d &aWarp,
+                                           ThreadPool *aPool,
+                                           const int aPlanes,
+                                           const uint8_t *aDroppedTiles,
+                                           const size_t aTileSize) {
+    const bbox_t &bbox = getBBOX();
+
+    const float bboxWidth = bbox[2] - bbox[0];
+    const float bboxHeight = bbox[3] - bbox[1];
+
+    int nX, nY;
+    getGridSize(bbox, nX, nY);
+
+    const float deltaX = bboxWidth / (nX - 1);
+    const float deltaY = bboxHeight / (nY - 1);
+
+    std::vector<cv::Mat> planes;
+    getPlaneViews(aImg, aPlanes, planes);
+
+    const int cn = aImg.channels();
+    const size_t N_GRID = nX * nY;
+
+    aSubImg.create(cn * aPlanes * nY, nX, CV_64FC1);
+
+    // No rotation or shear: the warped grid is still axis-aligned, so use
+    // precomputed separable interpolation
+    const bool separable =
+        aImg.depth() == CV_32F && aWarp(0, 1) == 0 && aWarp(1, 0) == 0;
+
+    SeparableAxis axisX, axisY;
+    if (separable) {
+        buildSeparableAxis(aWarp(0, 0) * bbox[0] + aWarp(0, 2),
+                           aWarp(0, 0) * deltaX, nX, planes[0].cols, axisX);
+        buildSeparableAxis(aWarp(1, 1) * bbox[1] + aWarp(1, 2),
+                           aWarp(1, 1) * deltaY, nY, planes[0].rows, axisY);
+    }
+
+    // Rows are sampled independently, so they may be split freely
+    const auto sampleRect = [&](const size_t aRowBegin, const size_t aRowEnd,
+                                const size_t aColBegin, const size_t aColEnd) {
+        if (separable) {
+            for (int p = 0; p < aPlanes; p++)
+                sampleSeparable(planes[p], axisX, axisY,
+                                aSubImg.ptr<double>(p * cn * nY), aRowBegin,
+                                aRowEnd, aColBegin, aColEnd);
+            return;
+        }
+
+        for (size_t i = aRowBegin; i < aRowEnd; i++) {
+            double *Mi = aSubImg.ptr<double>(i);
+            const double y = bbox[1] + deltaY * i;
+
+            // Warped position moves linearly along a grid row
+            double wx = aWarp(0, 1) * y + aWarp(0, 2) + aWarp(0, 0) * bbox[0];
+            double wy = aWarp(1, 1) * y + aWarp(1, 2) + aWarp(1, 0) * bbox[0];
+            const double stepX = aWarp(0, 0) * deltaX;
+            const double stepY = aWarp(1, 0) * deltaX;
+            if (aColBegin > 0) {
+                wx += stepX * aColBegin;
+                wy += stepY * aColBegin;
+            }
+
+            for (size_t j = aColBegin; j < aColEnd; j++) {
+                getSubPixelValues(planes, wx, wy, Mi + j, N_GRID);
+                wx += stepX;
+                wy += stepY;
+            }
+        }
+    };
+
+    // Dropped tiles: bands of tile rows, sampling runs of kept tiles only
+    if (aDroppedTiles) {
+        const size_t numBands = (nY + aTileSize - 1) / aTileSize;
+        const auto sampleBands = [&](const size_t aBegin, const size_t aEnd) {
+            for (size_t band = aBegin; band < aEnd; band++)
+                forKeptTileRuns(aDroppedTiles, aTileSize, nX, nY, band,
+                                sampleRect);
+        };
+
+        if (aPool)
+            aPool->parallelFor(numBands, sampleBands);
+        else
+            sampleBands(0, numBands);
+        return;
+    }
+
+    const auto sampleRows = [&](const size_t aRowBegin, const size_t aRowEnd) {
+        sampleRect(aRowBegin, aRowEnd, 0, nX);
+    };
+
+    if (aPool)
+        aPool->parallelFor(nY, sampleRows);
+    else
+        sampleRows(0, nY);
+}
+
+/**
+ * @brief Get fixed-point sub pixel values of the stored BBOX grid after
+ * warping it by aWarp (8-bit frames), ie. what
+ * ImageAlignment::getWarpedSubPixelRect() gives, with integer bilinear
+ * interpolation (8-bit weights) and KLT_FIXED_SAMPLE_BITS fractional bits
+ *
+ * @see sampleFixed()
+ *
+ * @param[in] aImg Input image (CV_8UC1)
+ * @param[out] aOut Samples, row by row (grid size)
+ * @param[in] aWarp Affine warp applied to grid points
+ * @param[in] aPool Pool to split grid rows over (nullptr: calling thread
+ * only); the result is the same either way
+ * @param[in] aDroppedTiles Dropped flag of each tile of aTileSize grid
+ * points (see numGridTiles()); dropped tiles are not sampled and keep their
+ * previous values (nullptr: sample all)
+ * @param[in] aTileSize Tile side in grid points
  */
-void ImageAlignment::getSubPixelRect(const cv::Mat &aImg, cv::Mat &aSubImg) {
+void ImageAlignment::getFixedSubPixelRect(const cv::Mat &aImg, int16_t *aOut,
+                                          const Eigen::Matrix3d &aWarp,
+                                          ThreadPool *aPool,
+                                          const uint8_t *aDroppedTiles,
+                                          const size_t aTileSize) {
     const bbox_t &bbox = getBBOX();
-    getSubPixelRect(aImg, aSubImg, bbox);
-}
\ No newline at end of file
+
+    int nX, nY;
+    getGridSize(bbox, nX, nY);
+
+    const double deltaX = (bbox[2] - bbox[0]) / (nX - 1);
+    const double deltaY = (bbox[3] - bbox[1]) / (nY - 1);
+
+    const double origin[2] = {
+        aWarp(0, 0) * bbox[0] + aWarp(0, 1) * bbox[1] + aWarp(0, 2),
+        aWarp(1, 0) * bbox[0] + aWarp(1, 1) * bbox[1] + aWarp(1, 2)
+    };
+    const double colStep[2] = { aWarp(0, 0) * deltaX, aWarp(1, 0) * deltaX };
+    const double rowStep[2] = { aWarp(0, 1) * deltaY, aWarp(1, 1) * deltaY };
+
+    // Rows are sampled independently, so they may be split freely
+    const auto sampleRect = [&](const size_t aRowBegin, const size_t aRowEnd,
+                                const size_t aColBegin, const size_t aColEnd) {
+        sampleFixed(aImg, origin, colStep, rowStep, nX, nY, aOut, aRowBegin,
+                    aRowEnd, aColBegin, aColEnd);
+    };
+
+    // Dropped tiles: bands of tile rows, sampling runs of kept tiles only
+    if (aDroppedTiles) {
+        const size_t numBands = (nY + aTileSize - 1) / aTileSize;
+        const auto sampleBands = [&](const size_t aBegin, const size_t aEnd) {
+            for (size_t band = aBegin; band < aEnd; band++)
+                forKeptTileRuns(aDroppedTiles, aTileSize, nX, nY, band,
+                                sampleRect);
+        };
+
+        if (aPool)
+            aPool->parallelFor(numBands, sampleBands);
+        else
+            sampleBands(0, numBands);
+        return;
+    }
+
+    const auto sampleRows = [&](const size_t aRowBegin, const size_t aRowEnd) {
+        sampleRect(aRowBegin, aRowEnd, 0, nX);
+    };
+
+    if (aPool)
+        aPool->parallelFor(nY, sampleRows);
+    else
+        sampleRows(0, nY);
+}
+
+/**
+ * @brief Preprocess a frame for tracking: convert to float and, if requested,
+ * compute its (full image, unnormalised cv::Sobel) gradients
+ * @note Output owns its data, so the input may be a temporary view (eg. into
+ * shared memory)
+ * @note ImageAlignment computes template gradients at its grid points itself;
+ * full gradients are only for the gradient-based computeJacobian() overloads
+ * and FixedPatchTracker
+ *
+ * With CHANNELS_GRAY, BGR frames are converted to grayscale. Otherwise every
+ * channel takes part in the residual: CHANNELS_INTERLEAVED keeps the pixel
+ * layout (one sampling pass reads all channels), CHANNELS_PLANAR stacks one
+ * CV_32FC1 plane per channel (gradients are computed per plane, so borders do
+ * not bleed between planes). CHANNELS_GRAY_8U skips the float conversion
+ * altogether, for the fixed-point pipeline.
+ *
+ * @param[in] aImage Input image (grayscale or BGR)
+ * @param[out] aFrame Preprocessed frame
+ * @param[in] aLayout Channel layout
+ * @param[in] aGradients Also compute full gradient images
+ */
+void ImageAlignment::prepareFrame(const cv::Mat &aImage, PreparedFrame &aFrame,
+                                  const ChannelLayout aLayout,
+                                  const bool aGradients) {
+    const int cn = aImage.channels();
+
+    aFrame.planes = 1;
+    aFrame.gradX = cv::Mat();
+    aFrame.gradY = cv::Mat();
+
+    if (aLayout == CHANNELS_PLANAR && cn > 1) {
+        const int rows = aImage.rows;
+
+        std::vector<cv::Mat> channels;
+        cv::split(aImage, channels);
+
+        aFrame.planes = cn;
+        aFrame.image.create(cn * rows, aImage.cols, CV_32FC1);
+        if (aGradients) {
+            aFrame.gradX.create(cn * rows, aImage.cols, CV_32FC1);
+            aFrame.gradY.create(cn * rows, aImage.cols, CV_32FC1);
+        }
+
+        for (int c = 0; c < cn; c++) {
+            const cv::Rect plane(0, c * rows, aImage.cols, rows);
+
+            cv::Mat channel;
+            channels[c].convertTo(channel, CV_32FC1);
+
+            cv::Mat image = aFrame.image(plane);
+            channel.copyTo(image);
+
+            if (aGradients) {
+                cv::Mat gradX = aFrame.gradX(plane);
+                cv::Mat gradY = aFrame.gradY(plane);
+                cv::Sobel(channel, gradX, CV_32F, 1, 0);
+                cv::Sobel(channel, gradY, CV_32F, 0, 1);
+            }
+        }
+        return;
+    }
+
+    if (aLayout == CHANNELS_INTERLEAVED) {
+        aImage.convertTo(aFrame.image, CV_32FC(cn));
+    } else {
+        cv::Mat gray = aImage;
+        if (cn == 3) cv::cvtColor(aImage, gray, cv::COLOR_BGR2GRAY);
+
+        // Same depth: a plain copy
+        gray.convertTo(aFrame.image,
+                       (aLayout == CHANNELS_GRAY_8U) ? CV_8UC1 : CV_32FC1);
+    }
+
+    // Sobel keeps the number of channels
+    if (aGradients) {
+        cv::Sobel(aFrame.image, aFrame.gradX, CV_32F, 1, 0);
+        cv::Sobel(aFrame.image, aFrame.gradY, CV_32F, 0, 1);
+    }
+}
+
+/**
+ * @brief Get tracking statistics since initialisation
+ *
+ * @return const TrackStats& statistics
+ */
+const TrackStats &ImageAlignment::getStats() const {
+    return mStats;
+}
+
+/**
+ * @brief Reset tracking statistics
+ */
+void ImageAlignment::resetStats() {
+    mStats = TrackStats();
+}
+
+/**
+ * @brief Serialise full tracker state (BBOX, warp, template samples, Jacobian,
+ * inverse Hessian, quality and stats) into a compact binary checkpoint
+ * @note Precomputes the template data first if it is not cached, so that a
+ * restored tracker needs neither the current frame nor any warm-up
+ *
+ * @see ImageAlignment::loadState()
+ *
+ * @param[out] aBuffer Checkpoint (resized to fit)
+ * @return size_t checkpoint size in bytes
+ */
+size_t ImageAlignment::saveState(std::vector<uint8_t> &aBuffer) {
+    if (!isTemplateValid() &&
+        (!mCurrentFrame.image.empty() || !mCurrentImage.empty()))
+        prepareTemplate();
+
+    CheckpointHeader header{};
+
+    header.magic = KLT_CHECKPOINT_MAGIC;
+    header.version = KLT_CHECKPOINT_VERSION;
+    header.headerSize = sizeof(CheckpointHeader);
+    header.hasTemplate = mTemplateValid ? 1 : 0;
+    header.gridWidth = mTemplateValid ? mGridWidth : 0;
+    header.gridHeight = mTemplateValid ? mGridHeight : 0;
+    header.gridChannels = mGridChannels;
+    header.sampleStride = mTemplateValid ? mTemplateStride : mSampleStride;
+    header.pixelBudget = mPixelBudget;
+
+    for (int i = 0; i < 4; i++)
+        header.bbox[i] = mBbox[i];
+
+    // Eigen default storage is column-major, as is the checkpoint
+    std::memcpy(header.warp, mWarp.data(), sizeof(header.warp));
+
+    header.frameIndex = mFrameIndex;
+    header.residualRMS = mResidualRMS;
+    header.confidenceScale = mConfidenceScale;
+    header.stats = mStats;
+
+    header.frameDepth = mTemplateValid ? mTemplateDepth : CV_32F;
+    header.channelLayout = mChannelLayout;
+    header.storagePrecision = mStoragePrecision;
+    header.gradientOperator = mGradientOperator;
+    header.appearanceModes = mAppearanceModes;
+    header.tileSize = mTileWeighting.tileSize;
+
+    const size_t N_PIXELS =
+        header.gridWidth * header.gridHeight * header.gridChannels;
+    const size_t samplesSize = N_PIXELS * sizeof(double);
+    const size_t planeSize = N_PIXELS * sizeof(float);
+    const size_t jacobianSize = 6 * planeSize;
+    const size_t hessianSize = header.hasTemplate ? 36 * sizeof(double) : 0;
+
+    aBuffer.resize(sizeof(header) + samplesSize + jacobianSize + hessianSize);
+
+    uint8_t *dst = aBuffer.data();
+    std::memcpy(dst, &header, sizeof(header));
+    dst += sizeof(header);
+
+    if (header.hasTemplate) {
+        // Half precision storage is saved in float and double (exactly)
+        Eigen::VectorXd samplesBuffer;
+        AlignedPlanes steepestDescentBuffer;
+        const AlignedPlanes *steepestDescent = &mSteepestDescent;
+        if (mHalfSteepestDescent.numPlanes() == 6) {
+            convertFromHalf(mHalfSteepestDescent, steepestDescentBuffer);
+            steepestDescent = &steepestDescentBuffer;
+        }
+
+        std::memcpy(dst, getTemplateSamples(samplesBuffer).data(),
+                    samplesSize);
+        dst += samplesSize;
+        for (int k = 0; k < 6; k++) {
+            std::memcpy(dst, steepestDescent->plane(k), planeSize);
+            dst += planeSize;
+        }
+        std::memcpy(dst, mHessianInverse.data(), hessianSize);
+    }
+
+    return aBuffer.size();
+}
+
+/**
+ * @brief Restore tracker state from a checkpoint made by saveState()
+ * @note The next track() continues exactly where the saved tracker left off;
+ * template data is copied in, not recomputed. Images are not part of the
+ * checkpoint
+ *
+ * @param[in] aData Checkpoint data
+ * @param[in] aSize Checkpoint size in bytes
+ *
+ * @return true on success; false (state unchanged) if the checkpoint is
+ * malformed, from an incompatible version, or saved by a tracker with another
+ * channel layout, storage precision, gradient operator, number of appearance
+ * modes or tile size
+ */
+bool ImageAlignment::loadState(const void *aData, const size_t aSize) {
+    if (!aData || aSize < sizeof(CheckpointHeader)) return false;
+
+    CheckpointHeader header;
+    std::memcpy(&header, aData, sizeof(header));
+
+    if (header.magic != KLT_CHECKPOINT_MAGIC ||
+        header.version != KLT_CHECKPOINT_VERSION ||
+        header.headerSize != sizeof(CheckpointHeader))
+        return false;
+
+    // The template data must be the one this tracker would compute: same
+    // frames, gradients, projected-out modes, rounding and tile Hessians
+    if (header.channelLayout != mChannelLayout ||
+        header.storagePrecision != mStoragePrecision ||
+        header.gradientOperator != mGradientOperator ||
+        header.appearanceModes != mAppearanceModes ||
+        header.tileSize != mTileWeighting.tileSize)
+        return false;
+
+    // Fixed-point templates are single channel
+    if ((header.frameDepth != CV_8U && header.frameDepth != CV_32F) ||
+        (header.frameDepth == CV_8U && header.gridChannels != 1))
+        return false;
+
+    // The BBOX must be sane before the grid is derived from it
+    for (int i = 0; i < 4; i++) {
+        if (!std::isfinite(header.bbox[i])) return false;
+    }
+
+    if (!(header.bbox[2] > header.bbox[0]) ||
+        !(header.bbox[3] > header.bbox[1]) ||
+        header.bbox[2] - header.bbox[0] >= float(INT_MAX / 2) ||
+        header.bbox[3] - header.bbox[1] >= float(INT_MAX / 2) ||
+        header.sampleStride > INT_MAX)
+        return false;
+
+    // Number of grid points from the checkpoint size (each has a sample and
+    // 6 steepest descent values), so that no product can overflow
+    const size_t hessianSize = header.hasTemplate ? 36 * sizeof(double) : 0;
+    const size_t pointSize = sizeof(double) + 6 * sizeof(float);
+    if (aSize < sizeof(header) + hessianSize ||
+        (aSize - sizeof(header) - hessianSize) % pointSize != 0)
+        return false;
+
+    const size_t N_PIXELS = (aSize - sizeof(header) - hessianSize) / pointSize;
+
+    if (header.hasTemplate) {
+        // The grid must match the data, and be the one the BBOX is sampled on
+        // (align() sizes its samples from the BBOX)
+        const uint64_t gridPoints = header.gridWidth * header.gridHeight;
+        if (N_PIXELS == 0 || header.gridWidth == 0 || header.gridHeight == 0 ||
+            header.gridWidth > N_PIXELS ||
+            header.gridHeight > N_PIXELS / header.gridWidth ||
+            N_PIXELS % gridPoints != 0 ||
+            header.gridChannels != N_PIXELS / gridPoints)
+            return false;
+
+        int nX, nY;
+        computeGridSize(header.bbox, std::max<uint64_t>(1, header.sampleStride),
+                        header.pixelBudget, nX, nY);
+        if (uint64_t(nX) != header.gridWidth ||
+            uint64_t(nY) != header.gridHeight)
+            return false;
+    } else if (N_PIXELS != 0) {
+        return false;
+    }
+
+    const size_t samplesSize = N_PIXELS * sizeof(double);
+    const size_t planeSize = N_PIXELS * sizeof(float);
+
+    const uint8_t *src = static_cast<const uint8_t *>(aData) + sizeof(header);
+
+    if (header.hasTemplate) {
+        mTemplateSamples.resize(N_PIXELS);
+        std::memcpy(mTemplateSamples.data(), src, samplesSize);
+        src += samplesSize;
+        mSteepestDescent.resize(6, N_PIXELS);
+        for (int k = 0; k < 6; k++) {
+            std::memcpy(mSteepestDescent.plane(k), src, planeSize);
+            src += planeSize;
+        }
+        std::memcpy(mHessianInverse.data(), src, hessianSize);
+    }
+
+    mGridWidth = header.gridWidth;
+    mGridHeight = header.gridHeight;
+    mGridChannels = std::max<uint64_t>(1, header.gridChannels);
+    mSampleStride = std::max<uint64_t>(1, header.sampleStride);
+    mTemplateStride = mSampleStride;
+    mPixelBudget = header.pixelBudget;
+    mTemplateDepth = header.frameDepth;
+    mTemplateValid = header.hasTemplate != 0;
+
+    // Fixed-point template for 8-bit frames; steepest descent images saved
+    // by a fixed-point tracker are already quantised, so this is exact
+    const bool fixedPoint = mTemplateValid && mTemplateDepth == CV_8U;
+    if (fixedPoint) {
+        quantiseTemplate(false);
+    } else {
+        mFixedTemplate.resize(0, 0);
+        mFixedSteepestDescent.resize(0, 0);
+    }
+
+    // Appearance history is not saved
+    mRecentTemplates.clear();
+    mRecentTemplatesNext = 0;
+    mAppearanceBasis.resize(0, 0);
+
+    // Tile Hessians are derived from the steepest descent images (the
+    // inverse Hessian stays as saved)
+    mTileHessians.clear();
+    if (mTemplateValid) prepareTileHessians();
+
+    // Half precision storage (float frames); exact, as the checkpoint was
+    // saved with it
+    mHalfTemplate.resize(0, 0);
+    mHalfSteepestDescent.resize(0, 0);
+    if (mTemplateValid && !fixedPoint && mStoragePrecision == STORAGE_HALF) {
+        storeHalfTemplate();
+        mTemplateSamples.resize(0);
+        mSteepestDescent.resize(0, 0);
+    }
+
+    for (int i = 0; i < 4; i++)
+        mBbox[i] = header.bbox[i];
+
+    std::memcpy(mWarp.data(), header.warp, sizeof(header.warp));
+
+    mFrameIndex = header.frameIndex;
+    mResidualRMS = header.residualRMS;
+    mConfidenceScale = header.confidenceScale;
+    mStats = header.stats;
+
+    // Images belong to the old process
+    mTemplateImage = cv::Mat();
+    mCurrentImage = cv::Mat();
+    mCurrentFrame = PreparedFrame();
+    mCurrentPyramid.clear();
+
+    publishState();
+
+    return true;
+}
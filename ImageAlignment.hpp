@@ -14,14 +14,194 @@
 #define __IMAGE_ALIGNMENT_H__
 
 #include <Eigen/Dense>
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <opencv2/core/eigen.hpp>
 #include <opencv2/opencv.hpp>
 #include <vector>
 
+#include "AlignmentKernels.hpp"
+#include "PublishedState.hpp"
+#include "ThreadPool.hpp"
+
+/// @brief Default sampling grid size from which alignment runs on the
+/// parallel pool
+#define KLT_PARALLEL_MIN_PIXELS 65536
+
+/// @brief Default number of recent templates the appearance basis is learned
+/// from
+#define KLT_APPEARANCE_HISTORY 8
+
+/// @brief Variance per grid point below which appearance modes are dropped
+/// (eg. on a static scene, where recent templates are identical)
+#define KLT_APPEARANCE_MIN_VARIANCE 1e-6
+
 /// @brief BBOX Type: Simple TLBR array
 typedef float bbox_t[4];
 
+/// @brief How prepareFrame() stores the channels of a frame
+enum ChannelLayout : uint32_t {
+    /// @brief Converted to grayscale (CV_32FC1)
+    CHANNELS_GRAY = 0,
+
+    /// @brief All channels, interleaved (CV_32FC(n), eg. BGR)
+    CHANNELS_INTERLEAVED = 1,
+
+    /// @brief All channels, as CV_32FC1 planes stacked vertically
+    CHANNELS_PLANAR = 2,
+
+    /// @brief Converted to 8-bit grayscale (CV_8UC1) and tracked with the
+    /// fixed-point pipeline: integer sampling and accumulation, float only
+    /// for the template and the 6x6 solve
+    CHANNELS_GRAY_8U = 3
+};
+
+/// @brief Frame preprocessed once, then shared by all trackers of that frame
+struct PreparedFrame {
+    /// @brief Float image: CV_32FC1 (grayscale, or planar channels stacked
+    /// vertically) or interleaved CV_32FC(n); or 8-bit grayscale CV_8UC1
+    /// (fixed-point pipeline)
+    cv::Mat image;
+
+    /// @brief Sobel gradients of image (same layout as image; empty if not
+    /// requested, ImageAlignment itself does not need them)
+    cv::Mat gradX, gradY;
+
+    /// @brief Number of planes stacked vertically in image (planar layout)
+    int planes = 1;
+};
+
+/// @brief Outcome of a time-budgeted track
+enum TrackQuality : uint32_t {
+    /// @brief Converged on the full sampling grid
+    QUALITY_CONVERGED = 0,
+
+    /// @brief Full sampling grid reached, but ran out of iterations
+    QUALITY_MAX_ITERS = 1,
+
+    /// @brief Cut short by the deadline (coarser grid or fewer iterations)
+    QUALITY_DEADLINE = 2,
+
+    /// @brief BBOX unchanged, alignment skipped
+    QUALITY_SKIPPED = 3
+};
+
+/// @brief Why an alignment run stopped
+enum StopReason : uint32_t {
+    /// @brief Ran out of iterations
+    STOP_MAX_ITERS = 0,
+
+    /// @brief Norm of the parameter update below the threshold
+    STOP_PARAMETERS = 1,
+
+    /// @brief No BBOX corner moved by more than the threshold
+    STOP_CORNERS = 2,
+
+    /// @brief Residual RMS decreased by less than the set fraction
+    STOP_RESIDUAL = 3,
+
+    /// @brief No progress of the residual RMS for the set number of
+    /// iterations; the best warp is kept
+    STOP_STAGNATION = 4,
+
+    /// @brief Residual RMS far above the best one, or not finite: aborted,
+    /// the best warp is kept
+    STOP_DIVERGENCE = 5,
+
+    /// @brief Cut short by the deadline
+    STOP_DEADLINE = 6
+};
+
+/// @brief Number of StopReason values
+#define KLT_STOP_REASONS 7
+
+/// @brief Relative decrease of the residual RMS that counts as progress for
+/// stagnation detection
+#define KLT_STAGNATION_MIN_DECREASE 1e-3
+
+/// @brief When an alignment run stops before its iteration cap. The threshold
+/// passed to track() is a displacement in pixels; the other tests are
+/// disabled when zero
+struct ConvergencePolicy {
+    /// @brief Compare the largest displacement of a BBOX corner by the last
+    /// update with the threshold, rather than the norm of the update
+    bool corners = true;
+
+    /// @brief Converged once an iteration lowers the residual RMS by less than
+    /// this fraction
+    double residualDecrease = 0;
+
+    /// @brief Stop after this many iterations without progress of the
+    /// residual RMS
+    size_t stagnationIters = 5;
+
+    /// @brief Abort once the residual RMS exceeds this multiple of the best
+    /// one so far
+    double divergenceRatio = 2;
+};
+
+/// @brief Robust weighting of square tiles of the sampling grid, against
+/// partial occlusion. Every iteration, each tile's residual RMS is compared
+/// with the median tile's: outliers are down-weighted, and gross outliers
+/// dropped, ie. no longer sampled for the rest of the frame. Disabled when
+/// tileSize is zero
+struct TileWeighting {
+    /// @brief Tile side in grid points (0: disabled)
+    size_t tileSize = 0;
+
+    /// @brief Tiles above this multiple of the median tile residual RMS get
+    /// weight downWeightRatio * median / RMS
+    double downWeightRatio = 1.5;
+
+    /// @brief Tiles above this multiple of the median tile residual RMS are
+    /// dropped (for the rest of the frame once the warp has been updated; on
+    /// the first iteration only for that iteration)
+    double dropRatio = 3;
+
+    /// @brief Floor of the median tile residual RMS (grey levels), so that
+    /// noise alone never makes a tile an outlier
+    double minRMS = 1;
+};
+
+/// @brief Tracking statistics since initialisation (or resetStats())
+struct TrackStats {
+    /// @brief Number of track() calls
+    uint64_t framesTracked = 0;
+
+    /// @brief Gauss-Newton iterations over all frames
+    uint64_t totalIterations = 0;
+
+    /// @brief Iterations of last track()
+    uint64_t lastIterations = 0;
+
+    /// @brief Frames which met the threshold before max iterations
+    uint64_t framesConverged = 0;
+
+    /// @brief Multi-hypothesis runs, and how many of them were cancelled
+    uint64_t hypothesesRun = 0;
+    uint64_t hypothesesCancelled = 0;
+
+    /// @brief Time-budgeted frames, how many were cut short by the deadline,
+    /// and how many overran it
+    uint64_t deadlineFrames = 0;
+    uint64_t deadlineHits = 0;
+    uint64_t deadlineOverruns = 0;
+
+    /// @brief Frames skipped because the BBOX content did not change
+    uint64_t framesSkipped = 0;
+
+    /// @brief Tiles dropped as outliers in the last track(), and over all
+    /// frames (see TileWeighting)
+    uint64_t lastDroppedTiles = 0;
+    uint64_t tilesDropped = 0;
+
+    /// @brief Why the last track() stopped, and how often each StopReason
+    /// ended a tracked frame
+    StopReason lastStop = STOP_MAX_ITERS;
+    uint64_t stops[KLT_STOP_REASONS] = { 0 };
+};
+
 /**
  * @brief Image Alignment Class
  *
@@ -34,6 +214,24 @@ typedef float bbox_t[4];
  */
 class ImageAlignment {
   private:
+    /// @brief Outcome of one IC alignment run (warp in box coordinates, see
+    /// getBoxFrame())
+    struct AlignResult {
+        Eigen::Matrix3d warp = Eigen::Matrix3d::Identity();
+        double residualRMS = 0;
+        size_t iterations = 0;
+        bool converged = false;
+        bool cancelled = false;
+        bool deadlineHit = false;
+        StopReason stop = STOP_MAX_ITERS;
+        size_t droppedTiles = 0;
+
+        /// Mean measured iteration cost per grid point, over timedIterations
+        /// iterations (deadline runs only)
+        double usPerSample = 0;
+        size_t timedIterations = 0;
+    };
+
     /// @brief BBOX of template image (top, left, bottom, right)
     bbox_t mBbox;
 
@@ -43,6 +241,176 @@ class ImageAlignment {
     /// @brief Current Image (current frame)
     cv::Mat mCurrentImage;
 
+    /// @brief Preprocessed current frame; becomes the template in track()
+    PreparedFrame mCurrentFrame;
+
+    /// @brief Coarse levels of a region of the current frame, kept from the
+    /// last trackDeadline() (empty: none)
+    std::vector<PreparedFrame> mCurrentPyramid;
+    cv::Rect mCurrentPyramidRegion;
+
+    /// @brief Show intermediate (sub/warped) images while tracking
+    bool mDebugDisplay = true;
+
+    /// @brief RMS of error image in last iteration of last track()
+    double mResidualRMS = 0;
+
+    /// @brief Residual RMS at which confidence drops to 0.5
+    double mConfidenceScale = 10.0;
+
+    /// @brief Warp found by last track(), in image coordinates
+    Eigen::Matrix3d mWarp = Eigen::Matrix3d::Identity();
+
+    /// @brief Frames tracked since initialisation
+    uint64_t mFrameIndex = 0;
+
+    /// @brief State published for concurrent readers
+    PublishedState mPublishedState;
+
+    /// @brief Tracking statistics
+    TrackStats mStats;
+
+    /// @brief Template sampled on the BBOX grid, flattened row by row, one
+    /// grid after the other for multi-channel frames
+    Eigen::VectorXd mTemplateSamples;
+
+    /// @brief Jacobian of template, as six steepest descent images on the
+    /// template grid
+    AlignedPlanes mSteepestDescent;
+
+    /// @brief Inverse (Gauss-Newton) Hessian of template
+    Eigen::Matrix<double, 6, 6> mHessianInverse;
+
+    /// @brief Fixed-point template samples and steepest descent images (8-bit
+    /// frames), and the power-of-two scale of each steepest descent plane
+    FixedPlanes mFixedTemplate, mFixedSteepestDescent;
+    int mFixedShifts[6] = { 0 };
+
+    /// @brief Half precision template samples and steepest descent images
+    /// (STORAGE_HALF; the float copies above are then released)
+    HalfPlanes mHalfTemplate, mHalfSteepestDescent;
+
+    /// @brief Sampling grid size of template, and number of channels sampled
+    /// on it
+    size_t mGridWidth = 0, mGridHeight = 0;
+    size_t mGridChannels = 1;
+
+    /// @brief Template data above matches current frame and BBOX
+    bool mTemplateValid = false;
+
+    /// @brief Depth of the frame the template was sampled from (CV_8U: the
+    /// fixed-point template above is in use)
+    int mTemplateDepth = CV_32F;
+
+    /// @brief Sampling grid stride, and the one template data was sampled at
+    size_t mSampleStride = 1;
+    size_t mTemplateStride = 1;
+
+    /// @brief Max sampling grid points (0: one per BBOX pixel)
+    size_t mPixelBudget = 0;
+
+    /// @brief ROI change below which frames are skipped (0: never skip)
+    double mSkipThreshold = 0;
+
+    /// @brief Running estimate of iteration cost per grid point (deadline
+    /// mode)
+    double mUsPerSample = 0.05;
+
+    /// @brief Pool for multi-hypothesis tracking (nullptr: disabled)
+    ThreadPool *mHypothesisPool = nullptr;
+
+    /// @brief Coarse search peaks seeded, and iteration cap per hypothesis
+    size_t mHypothesisPeaks = 2;
+    size_t mHypothesisIters = 20;
+
+    /// @brief Pool for data-parallel alignment of large grids (nullptr:
+    /// disabled), and the grid size from which it is used
+    ThreadPool *mParallelPool = nullptr;
+    size_t mParallelMinPixels = KLT_PARALLEL_MIN_PIXELS;
+
+    /// @brief Use fixed-order, instruction set independent arithmetic only
+    bool mDeterministic = false;
+
+    /// @brief Summation of the float kernels (outside deterministic mode)
+    Summation mSummation = SUMMATION_FLOAT;
+
+    /// @brief Layout of frames the tracker preprocesses itself
+    ChannelLayout mChannelLayout = CHANNELS_GRAY;
+
+    /// @brief Operator for template gradients (computed at grid points)
+    GradientOperator mGradientOperator = GRADIENT_SOBEL;
+
+    /// @brief Stopping criteria of alignment runs
+    ConvergencePolicy mConvergencePolicy;
+
+    /// @brief Storage of template data (float frames)
+    StoragePrecision mStoragePrecision = STORAGE_FLOAT;
+
+    /// @brief Appearance modes projected out of the steepest descent images
+    /// (0: plain IC), and the number of recent templates they are learned
+    /// from
+    size_t mAppearanceModes = 0;
+    size_t mAppearanceHistory = KLT_APPEARANCE_HISTORY;
+
+    /// @brief Recent templates (ring buffer), its next slot, the frame index
+    /// of the latest template, and the sampling grid they are on
+    std::vector<Eigen::VectorXd> mRecentTemplates;
+    size_t mRecentTemplatesNext = 0;
+    uint64_t mRecentTemplatesFrame = 0;
+    size_t mRecentGridWidth = 0, mRecentGridHeight = 0;
+
+    /// @brief Orthonormal appearance basis of the template (one mode per
+    /// column)
+    Eigen::MatrixXd mAppearanceBasis;
+
+    /// @brief Robust tile weighting, the Hessian terms of each tile of the
+    /// template (KLT_HESSIAN_TERMS per tile; empty when disabled), and their
+    /// total (the unweighted Hessian)
+    TileWeighting mTileWeighting;
+    std::vector<double> mTileHessians;
+    Eigen::Matrix<double, 6, 6> mTileHessianTotal;
+
+    void publishState();
+    void resetState();
+    void prepareTemplate(const bool aLearnAppearance = true);
+    void quantiseTemplate(const bool aDequantise);
+    void storeHalfTemplate();
+    void updateAppearanceBasis();
+    void buildCoarseAppearanceBasis(Eigen::MatrixXd &aBasis) const;
+    void prepareTileHessians();
+    const Eigen::VectorXd &
+    getTemplateSamples(Eigen::VectorXd &aBuffer) const;
+    bool isTemplateValid() const;
+    void getGridSize(const bbox_t &aBBOX, int &aNX, int &aNY) const;
+    void getBoxFrame(const bbox_t &aBBOX, BoxFrame &aFrame) const;
+    ThreadPool *getParallelPool(const size_t aNumPixels) const;
+    Summation getKernelSummation() const;
+
+    void getSubPixelValues(const std::vector<cv::Mat> &aPlanes,
+                           const double ax, const double ay, double *aOut,
+                           const size_t aChannelStride);
+
+    AlignResult align(const PreparedFrame &aFrame,
+                      const Eigen::Matrix3d &aInitWarp,
+                      const float aThreshold, const size_t aMaxIters,
+                      const bool aDisplay,
+                      std::atomic<double> *aBestResidual = nullptr,
+                      const std::chrono::steady_clock::time_point *aDeadline =
+                          nullptr);
+    void coarseSearch(const PreparedFrame &aFrame, const size_t aNumPeaks,
+                      std::vector<Eigen::Matrix3d> &aSeeds);
+    AlignResult alignHypotheses(const PreparedFrame &aFrame,
+                                const float aThreshold,
+                                const size_t aMaxIters);
+    void finishTrack(const PreparedFrame &aFrame, const AlignResult &aResult);
+    void trackPrepared(const PreparedFrame &aFrame, const float aThreshold,
+                       const size_t aMaxIters);
+    TrackQuality trackPreparedDeadline(const PreparedFrame &aFrame,
+                                       const double aBudgetUs,
+                                       const float aThreshold,
+                                       const size_t aMaxIters);
+    bool skipIfUnchanged(const cv::Mat &aImage, const int aPlanes = 1);
+
     void printCVMat(const cv::Mat &aMat,
                     const std::string &aName = "CV Matrix");
 
@@ -59,8 +427,10 @@ class ImageAlignment {
     void init(const cv::Mat &aImage);
     void init(const bbox_t &aBbox);
     void init(const cv::Mat &aImage, const bbox_t &aBbox);
+    void init(const PreparedFrame &aFrame, const bbox_t &aBbox);
 
     // BBOX Interface
+    // NOTE: Not thread-safe; use getSnapshot() from other threads
     const bbox_t &getBBOX();
     void setBBOX(const bbox_t &aBbox);
     void setBBOX(const float aTop, const float aLeft, const float aBottom,
@@ -88,19 +458,131 @@ class ImageAlignment {
 
     void convertImageForDisplay(const cv::Mat &aSrc, cv::Mat &aDest);
 
+    // Debug display of intermediate images inside track()
+    // NOTE: Must be disabled when tracking off the main thread
+    bool getDebugDisplay() const;
+    void setDebugDisplay(const bool aDebugDisplay);
+
     // Get sub pixel values of image
     double getSubPixelValue(const cv::Mat &aImg, const double ax,
                             const double ay);
 
-    void getSubPixelRect(const cv::Mat &aImg, cv::Mat &aSubImg, const bbox_t &aBBOX);
-    void getSubPixelRect(const cv::Mat &aImg, cv::Mat &aSubImg);
+    void getSubPixelRect(const cv::Mat &aImg, cv::Mat &aSubImg,
+                         const bbox_t &aBBOX, const int aPlanes = 1);
+    void getSubPixelRect(const cv::Mat &aImg, cv::Mat &aSubImg,
+                         const int aPlanes = 1);
+    void getWarpedSubPixelRect(const cv::Mat &aImg, cv::Mat &aSubImg,
+                               const Eigen::Matrix3d &aWarp,
+                               ThreadPool *aPool = nullptr,
+                               const int aPlanes = 1,
+                               const uint8_t *aDroppedTiles = nullptr,
+                               const size_t aTileSize = 0);
+    void getFixedSubPixelRect(const cv::Mat &aImg, int16_t *aOut,
+                              const Eigen::Matrix3d &aWarp,
+                              ThreadPool *aPool = nullptr,
+                              const uint8_t *aDroppedTiles = nullptr,
+                              const size_t aTileSize = 0);
+
+    // Preprocessing shared by all trackers of a frame
+    static void prepareFrame(const cv::Mat &aImage, PreparedFrame &aFrame,
+                             const ChannelLayout aLayout = CHANNELS_GRAY,
+                             const bool aGradients = true);
 
     // Track
     void computeJacobian(const cv::Mat &aTemplateImage,
                          Eigen::MatrixXd &aJacobian);
+    void computeJacobian(const cv::Mat &aGradX, const cv::Mat &aGradY,
+                         Eigen::MatrixXd &aJacobian);
+    void computeJacobian(const cv::Mat &aGradX, const cv::Mat &aGradY,
+                         AlignedPlanes &aImages, ThreadPool *aPool = nullptr,
+                         const int aPlanes = 1);
+    void computeJacobian(const cv::Mat &aImage, AlignedPlanes &aImages,
+                         ThreadPool *aPool = nullptr, const int aPlanes = 1);
 
     void track(const cv::Mat &aNewImage, const float aThreshold = 0.01875,
                const size_t aMaxIters = 100);
+    void track(const PreparedFrame &aFrame, const float aThreshold = 0.01875,
+               const size_t aMaxIters = 100);
+
+    // Time-budgeted tracking for live feeds
+    TrackQuality trackDeadline(const cv::Mat &aNewImage, const double aBudgetUs,
+                               const float aThreshold = 0.01875,
+                               const size_t aMaxIters = 100);
+    TrackQuality trackDeadline(const PreparedFrame &aFrame,
+                               const double aBudgetUs,
+                               const float aThreshold = 0.01875,
+                               const size_t aMaxIters = 100);
+
+    // Sampling grid density
+    void setSampleStride(const size_t aStride);
+    size_t getSampleStride() const;
+    void setPixelBudget(const size_t aMaxPixels);
+    size_t getPixelBudget() const;
+
+    // Static scene detection
+    double getROIChange(const cv::Mat &aImage, const int aPlanes = 1);
+    void setSkipThreshold(const double aSkipThreshold);
+
+    // Multi-hypothesis tracking for large/ambiguous motion
+    void setMultiHypothesis(ThreadPool *aPool, const size_t aNumPeaks = 2,
+                            const size_t aMaxIters = 20);
+
+    // Data-parallel alignment of large ROIs (eg. full-frame stabilisation)
+    void setParallelPool(ThreadPool *aPool,
+                         const size_t aMinPixels = KLT_PARALLEL_MIN_PIXELS);
+
+    // Bit-reproducible tracking (eg. for audits)
+    void setDeterministic(const bool aDeterministic);
+    bool isDeterministic() const;
+
+    // Accuracy of large-ROI accumulations
+    void setSummation(const Summation aSummation);
+    Summation getSummation() const;
+
+    // Colour tracking (all channels in the residual)
+    void setChannelLayout(const ChannelLayout aLayout);
+    ChannelLayout getChannelLayout() const;
+
+    // Template gradients
+    void setGradientOperator(const GradientOperator aOperator);
+    GradientOperator getGradientOperator() const;
+
+    // Stopping criteria of track()
+    void setConvergencePolicy(const ConvergencePolicy &aPolicy);
+    const ConvergencePolicy &getConvergencePolicy() const;
+
+    // Appearance subspace (project-out IC)
+    void setAppearanceModes(const size_t aNumModes,
+                            const size_t aHistory = KLT_APPEARANCE_HISTORY);
+    size_t getAppearanceModes() const;
+    size_t getActiveAppearanceModes() const;
+
+    // Robust tile weighting (partial occlusion)
+    void setTileWeighting(const TileWeighting &aWeighting);
+    const TileWeighting &getTileWeighting() const;
+
+    // Storage of template data (memory per target)
+    void setStoragePrecision(const StoragePrecision aPrecision);
+    StoragePrecision getStoragePrecision() const;
+    size_t getTemplateBytes() const;
+
+    // Tracking quality
+    double getResidualRMS() const;
+    float getConfidence() const;
+    void setConfidenceScale(const double aConfidenceScale);
+
+    // Tracker state
+    const Eigen::Matrix3d &getWarp() const;
+    uint64_t getFrameIndex() const;
+    TrackerSnapshot getSnapshot() const;
+
+    // Statistics
+    const TrackStats &getStats() const;
+    void resetStats();
+
+    // Checkpoint (binary, same build only)
+    size_t saveState(std::vector<uint8_t> &aBuffer);
+    bool loadState(const void *aData, const size_t aSize);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,51 @@
+/**
+ * @file KLTServer.cpp
+ * @author Samuel Leong (samleocw@gmail.com)
+ * @brief Tracking service daemon: serves TrackingServer on a Unix domain
+ * socket until SIGINT or SIGTERM
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2020
+ */
+
+#include <csignal>
+#include <stdlib.h>
+#include <string>
+
+#include "TrackingServer.hpp"
+
+static TrackingServer *gServer = nullptr;
+
+/**
+ * @brief Stop the server on SIGINT/SIGTERM
+ */
+void handleSignal(int) {
+    if (gServer) gServer->stop();
+}
+
+int main(int argc, char *argv[]) {
+    std::string socketPath((argc > 1) ? std::string(argv[1]) : "/tmp/klt.sock");
+    unsigned int numThreads =
+        (argc > 2) ? atoi(argv[2]) : std::thread::hardware_concurrency();
+    long batchWindowUs = (argc > 3) ? atol(argv[3]) : 1000;
+
+    TrackingServer server(socketPath, numThreads);
+    server.setBatchWindow(batchWindowUs);
+
+    if (!server.start()) return 1;
+
+    gServer = &server;
+    std::signal(SIGINT, handleSignal);
+    std::signal(SIGTERM, handleSignal);
+
+    std::cout << "Tracking server listening on " << socketPath << " ("
+              << numThreads << " threads, " << batchWindowUs
+              << "us batch window)" << std::endl;
+
+    server.run();
+
+    gServer = nullptr;
+    return 0;
+}
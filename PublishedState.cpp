@@ -0,0 +1,106 @@
+/**
+ * @file PublishedState.cpp
+ * @author Samuel Leong (samleocw@gmail.com)
+ * @brief Lock-free (seqlock) publication of tracker state, so that any number
+ * of reader threads can poll a tracker while it is tracking
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2020
+ */
+
+#include "PublishedState.hpp"
+
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+static_assert(std::is_trivially_copyable<TrackerSnapshot>::value,
+              "TrackerSnapshot is copied word by word");
+
+/**
+ * @brief Constructor for PublishedState class: publishes an all-zero snapshot
+ */
+PublishedState::PublishedState() : mSeq(0) {
+    for (size_t i = 0; i < N_WORDS; i++)
+        mWords[i].store(0, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Copy constructor: copies the currently published snapshot
+ *
+ * @param[in] aOther Published state to copy
+ */
+PublishedState::PublishedState(const PublishedState &aOther) : PublishedState() {
+    publish(aOther.read());
+}
+
+/**
+ * @brief Copy assignment: publishes the other's current snapshot
+ *
+ * @param[in] aOther Published state to copy
+ * @return PublishedState& this
+ */
+PublishedState &PublishedState::operator=(const PublishedState &aOther) {
+    if (this != &aOther) publish(aOther.read());
+    return *this;
+}
+
+/**
+ * @brief Publish a new snapshot
+ * @note Single writer only (the tracking thread)
+ *
+ * @param[in] aSnapshot Snapshot to publish
+ */
+void PublishedState::publish(const TrackerSnapshot &aSnapshot) {
+    uint64_t words[N_WORDS] = { 0 };
+    std::memcpy(words, &aSnapshot, sizeof(aSnapshot));
+
+    const uint64_t seq = mSeq.load(std::memory_order_relaxed);
+    mSeq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (size_t i = 0; i < N_WORDS; i++)
+        mWords[i].store(words[i], std::memory_order_relaxed);
+
+    mSeq.store(seq + 2, std::memory_order_release);
+}
+
+/**
+ * @brief Read the latest published snapshot without locking
+ * @note Safe to call from any number of threads concurrently with publish()
+ *
+ * @return TrackerSnapshot consistent snapshot
+ */
+TrackerSnapshot PublishedState::read() const {
+    uint64_t words[N_WORDS];
+
+    while (true) {
+        const uint64_t before = mSeq.load(std::memory_order_acquire);
+
+        if (!(before & 1)) {
+            for (size_t i = 0; i < N_WORDS; i++)
+                words[i] = mWords[i].load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (mSeq.load(std::memory_order_relaxed) == before) break;
+        }
+
+        std::this_thread::yield();
+    }
+
+    TrackerSnapshot snapshot;
+    std::memcpy(&snapshot, words, sizeof(snapshot));
+    return snapshot;
+}
+
+/**
+ * @brief Get number of snapshots published so far; lets readers cheaply poll
+ * for changes
+ *
+ * @return uint64_t publish count
+ */
+uint64_t PublishedState::version() const {
+    return mSeq.load(std::memory_order_acquire) / 2;
+}
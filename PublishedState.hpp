@@ -0,0 +1,66 @@
+/**
+ * @file PublishedState.hpp
+ * @author Samuel Leong (samleocw@gmail.com)
+ * @brief Lock-free (seqlock) publication of tracker state, so that any number
+ * of reader threads can poll a tracker while it is tracking
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2020
+ */
+
+#ifndef __PUBLISHED_STATE_H__
+#define __PUBLISHED_STATE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/// @brief Snapshot of tracker state, published after every frame
+struct TrackerSnapshot {
+    /// @brief BBOX (top, left, bottom, right)
+    float bbox[4];
+
+    /// @brief Affine warp of last frame (2x3, row-major)
+    float warp[6];
+
+    /// @brief Tracking confidence in (0, 1]
+    float confidence;
+
+    /// @brief Frames tracked since initialisation
+    uint64_t frameIndex;
+};
+
+/**
+ * @brief Published State Class
+ *
+ * Single-writer, multi-reader seqlock holding a TrackerSnapshot. The writer
+ * never waits for readers; readers never block the writer and retry only if a
+ * publish overlapped their read.
+ */
+class PublishedState {
+  private:
+    /// @brief Snapshot size in 64-bit words
+    static constexpr size_t N_WORDS =
+        (sizeof(TrackerSnapshot) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    /// @brief Sequence counter: odd while a publish is in progress
+    alignas(64) std::atomic<uint64_t> mSeq;
+
+    /// @brief Snapshot storage, as atomic words so that racing reads are
+    /// well-defined (and discarded by the sequence check)
+    std::atomic<uint64_t> mWords[N_WORDS];
+
+  public:
+    // Constructor
+    PublishedState();
+    PublishedState(const PublishedState &aOther);
+    PublishedState &operator=(const PublishedState &aOther);
+
+    void publish(const TrackerSnapshot &aSnapshot);
+    TrackerSnapshot read() const;
+    uint64_t version() const;
+};
+
+#endif
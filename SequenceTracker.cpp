@@ -0,0 +1,612 @@
+/**
+ * @file SequenceTracker.cpp
+ * @author Samuel Leong (samleocw@gmail.com)
+ * @brief Offline sequence runner which drives ImageAlignment over whole image
+ * sequences, optionally splitting them into chunks tracked in parallel
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2020
+ */
+
+#include "SequenceTracker.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+/**
+ * @brief Copy BBOX
+ *
+ * @param[in] aSrc Source BBOX
+ * @param[out] aDest Destination BBOX
+ */
+static void copyBBOX(const bbox_t &aSrc, bbox_t &aDest) {
+    for (int i = 0; i < 4; i++)
+        aDest[i] = aSrc[i];
+}
+
+/**
+ * @brief Downsample image by a number of pyramid levels
+ *
+ * @param[in] aSrc Source image
+ * @param[out] aDest Downsampled image
+ * @param[in] aLevels Number of cv::pyrDown() steps
+ */
+static void downsample(const cv::Mat &aSrc, cv::Mat &aDest,
+                       const int aLevels) {
+    aDest = aSrc;
+    for (int i = 0; i < aLevels; i++)
+        cv::pyrDown(aDest, aDest);
+}
+
+/**
+ * @brief Constructor for SharedFrameCache class
+ *
+ * @param[in] aFrameSource Underlying (thread-safe) frame source
+ * @param[in] aNumFrames Number of frames in sequence
+ * @param[in] aNumConsumers Number of consumers which fetch every frame
+ * @param[in] aCapacity Max number of held frames
+ */
+SharedFrameCache::SharedFrameCache(const frame_source_t &aFrameSource,
+                                   const size_t aNumFrames,
+                                   const int aNumConsumers,
+                                   const size_t aCapacity)
+    : mFrameSource(aFrameSource), mCapacity(aCapacity),
+      mUsesLeft(aNumFrames, aNumConsumers) {}
+
+/**
+ * @brief Get frame, decoding it if it is not held
+ * @note Decoding happens outside the lock; concurrent requests for the same
+ * held frame wait on the same decode. Released frames stay valid for the
+ * consumers which already hold them
+ *
+ * @param[in] aIndex Frame index (below the number of frames)
+ * @return cv::Mat frame (shares data with other consumers; do not modify)
+ */
+cv::Mat SharedFrameCache::get(const size_t aIndex) {
+    std::shared_future<cv::Mat> frame;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        const int usesLeft = --mUsesLeft[aIndex];
+
+        auto it = mFrames.find(aIndex);
+        if (it != mFrames.end()) {
+            frame = it->second;
+            if (usesLeft <= 0) mFrames.erase(it);
+        } else {
+            frame =
+                std::async(std::launch::deferred, mFrameSource, aIndex).share();
+
+            // Keep it for the consumers still to come, within the budget
+            if (usesLeft > 0 && mFrames.size() < mCapacity)
+                mFrames.emplace(aIndex, frame);
+        }
+    }
+
+    return frame.get();
+}
+
+/**
+ * @brief Constructor for SequenceTracker class
+ *
+ * @param[in] aFrameSource Thread-safe frame source
+ * @param[in] aNumFrames Number of frames in sequence
+ * @param[in] aNumThreads Number of worker threads
+ */
+SequenceTracker::SequenceTracker(const frame_source_t &aFrameSource,
+                                 const size_t aNumFrames,
+                                 const size_t aNumThreads)
+    : mFrameSource(aFrameSource), mNumFrames(aNumFrames), mPool(aNumThreads) {
+    mForwardTracker.setDebugDisplay(false);
+    mBackwardTracker.setDebugDisplay(false);
+}
+
+/**
+ * @brief Set chunk layout for chunked tracking
+ *
+ * @param[in] aChunkSize Frames per chunk (excluding overlap)
+ * @param[in] aOverlap Frames shared between consecutive chunks
+ */
+void SequenceTracker::setChunking(const size_t aChunkSize,
+                                  const size_t aOverlap) {
+    mChunkSize = std::max<size_t>(aChunkSize, 2);
+    mOverlap = std::max<size_t>(aOverlap, 1);
+}
+
+/**
+ * @brief Set pyramid depth of the coarse keyframe pass
+ *
+ * @param[in] aCoarseLevels Max number of pyramid levels
+ * @param[in] aMinCoarseSize Min BBOX side (pixels) on the coarsest level
+ */
+void SequenceTracker::setCoarseLevels(const int aCoarseLevels,
+                                      const float aMinCoarseSize) {
+    mCoarseLevels = std::max(aCoarseLevels, 0);
+    mMinCoarseSize = aMinCoarseSize;
+}
+
+/**
+ * @brief Set consistency thresholds used when stitching chunks
+ *
+ * @param[in] aTolerance Max disagreement (pixels) after offset removal
+ * @param[in] aMaxOffset Max offset as fraction of BBOX size
+ */
+void SequenceTracker::setStitchTolerance(const float aTolerance,
+                                         const float aMaxOffset) {
+    mStitchTolerance = aTolerance;
+    mMaxStitchOffset = aMaxOffset;
+}
+
+/**
+ * @brief Set keyframe provider (eg. re-detection) used instead of the coarse
+ * pass to initialise chunks
+ *
+ * @param[in] aProvider Keyframe provider; empty to use coarse pass
+ */
+void SequenceTracker::setKeyframeProvider(
+    const keyframe_provider_t &aProvider) {
+    mKeyframeProvider = aProvider;
+}
+
+/**
+ * @brief Set parameters passed on to ImageAlignment::track()
+ *
+ * @param[in] aThreshold Threshold to compare against
+ * @param[in] aMaxIters Maximum iterations before stop
+ */
+void SequenceTracker::setTrackParams(const float aThreshold,
+                                     const size_t aMaxIters) {
+    mThreshold = aThreshold;
+    mMaxIters = aMaxIters;
+}
+
+/**
+ * @brief Set the memory budget of bidirectional mode: frames decoded by one
+ * pass are held for the other one, up to this many at a time
+ * @note Passes meet in the middle of the sequence, so sharing every frame
+ * needs the whole sequence; frames beyond the budget are decoded twice
+ *
+ * @param[in] aMaxFrames Max number of held frames (0: half the sequence)
+ */
+void SequenceTracker::setFrameCacheSize(const size_t aMaxFrames) {
+    mFrameCacheSize = aMaxFrames;
+}
+
+/**
+ * @brief Get number of frames in sequence
+ *
+ * @return size_t number of frames
+ */
+size_t SequenceTracker::getNumFrames() const {
+    return mNumFrames;
+}
+
+/**
+ * @brief Track aCount frames, starting at aStart and moving by aStep
+ *
+ * @param[in,out] aTracker Tracker to (re-)initialise and use
+ * @param[in] aSource Frame source
+ * @param[in] aStart First frame (initialised with aStartBBOX)
+ * @param[in] aCount Number of frames to output
+ * @param[in] aStep Frame step: +1 (forward) or -1 (backward)
+ * @param[in] aStartBBOX BBOX in first frame
+ * @param[out] aOut Output array of aCount tracked frames, in tracking order
+ */
+void SequenceTracker::trackRange(ImageAlignment &aTracker,
+                                 const frame_source_t &aSource,
+                                 const size_t aStart, const size_t aCount,
+                                 const int aStep, const bbox_t &aStartBBOX,
+                                 TrackedFrame *aOut) {
+    aTracker.init(aSource(aStart), aStartBBOX);
+
+    copyBBOX(aStartBBOX, aOut[0].bbox);
+    aOut[0].confidence = 1.0f;
+
+    for (size_t k = 1; k < aCount; k++) {
+        const size_t idx = aStart + aStep * static_cast<long>(k);
+
+        aTracker.track(aSource(idx), mThreshold, mMaxIters);
+        copyBBOX(aTracker.getBBOX(), aOut[k].bbox);
+        aOut[k].confidence = aTracker.getConfidence();
+    }
+}
+
+/**
+ * @brief Track frames [aStart, aEnd) forwards with a fresh tracker
+ *
+ * @param[in] aStart First frame (initialised with aStartBBOX)
+ * @param[in] aEnd One past last frame
+ * @param[in] aStartBBOX BBOX in first frame
+ * @param[out] aOut Output array of (aEnd - aStart) tracked frames
+ */
+void SequenceTracker::trackRange(const size_t aStart, const size_t aEnd,
+                                 const bbox_t &aStartBBOX,
+                                 TrackedFrame *aOut) {
+    ImageAlignment tracker;
+    tracker.setDebugDisplay(false);
+
+    trackRange(tracker, mFrameSource, aStart, aEnd - aStart, 1, aStartBBOX,
+               aOut);
+}
+
+/**
+ * @brief Track the whole sequence on a single core (reference mode)
+ *
+ * @param[in] aInitBBOX BBOX in first frame
+ * @param[out] aResult Tracked frames
+ */
+void SequenceTracker::trackSequential(const bbox_t &aInitBBOX,
+                                      std::vector<TrackedFrame> &aResult) {
+    aResult.assign(mNumFrames, TrackedFrame());
+    if (mNumFrames == 0) return;
+
+    trackRange(0, mNumFrames, aInitBBOX, aResult.data());
+}
+
+/**
+ * @brief Obtain BBOXes of keyframes which initialise each chunk
+ *
+ * Uses the keyframe provider if one is set, falling back to the coarse pass
+ * if the provider fails on any keyframe.
+ *
+ * @param[in] aSource Frame source
+ * @param[in] aInitBBOX BBOX in first frame
+ * @param[in] aKeyframes Sorted keyframe indices (first one is frame 0)
+ * @param[out] aKeyBoxes BBOX of each keyframe
+ */
+void SequenceTracker::computeKeyframes(const frame_source_t &aSource,
+                                       const bbox_t &aInitBBOX,
+                                       const std::vector<size_t> &aKeyframes,
+                                       std::vector<TrackedFrame> &aKeyBoxes) {
+    aKeyBoxes.assign(aKeyframes.size(), TrackedFrame());
+
+    if (mKeyframeProvider) {
+        std::vector<std::future<bool>> found;
+        found.reserve(aKeyframes.size());
+
+        for (size_t k = 0; k < aKeyframes.size(); k++) {
+            found.push_back(
+                mPool.submit([this, &aSource, &aKeyframes, &aKeyBoxes, k]() {
+                    const size_t idx = aKeyframes[k];
+                    return mKeyframeProvider(idx, aSource(idx),
+                                             aKeyBoxes[k].bbox);
+                }));
+        }
+
+        bool allFound = true;
+        for (std::future<bool> &f : found)
+            allFound = f.get() && allFound;
+
+        if (allFound) {
+            copyBBOX(aInitBBOX, aKeyBoxes[0].bbox);
+            return;
+        }
+    }
+
+    coarsePass(aSource, aInitBBOX, aKeyframes, aKeyBoxes);
+}
+
+/**
+ * @brief Cheap coarse pass: track sequentially on a downsampled pyramid level
+ * up to the last keyframe, recording (upscaled) BBOXes at the keyframes
+ * @note Frame decoding and downsampling are spread over the pool; only the
+ * (cheap) coarse alignment itself is sequential
+ *
+ * @param[in] aSource Frame source
+ * @param[in] aInitBBOX BBOX in first frame
+ * @param[in] aKeyframes Sorted keyframe indices (first one is frame 0)
+ * @param[out] aKeyBoxes BBOX of each keyframe
+ */
+void SequenceTracker::coarsePass(const frame_source_t &aSource,
+                                 const bbox_t &aInitBBOX,
+                                 const std::vector<size_t> &aKeyframes,
+                                 std::vector<TrackedFrame> &aKeyBoxes) {
+    // Go as deep as allowed while the BBOX stays trackable
+    const float minSide = std::min(aInitBBOX[2] - aInitBBOX[0],
+                                   aInitBBOX[3] - aInitBBOX[1]);
+    int levels = 0;
+    while (levels < mCoarseLevels &&
+           minSide / static_cast<float>(1 << (levels + 1)) >= mMinCoarseSize)
+        levels++;
+
+    const float scale = static_cast<float>(1 << levels);
+
+    bbox_t coarseBBOX;
+    for (int i = 0; i < 4; i++)
+        coarseBBOX[i] = aInitBBOX[i] / scale;
+
+    ImageAlignment tracker;
+    tracker.setDebugDisplay(false);
+
+    const size_t lastFrame = aKeyframes.back();
+    const size_t batchSize = 4 * mPool.size();
+
+    size_t k = 0;
+    for (size_t batchStart = 0; batchStart <= lastFrame;
+         batchStart += batchSize) {
+        const size_t batchEnd = std::min(batchStart + batchSize, lastFrame + 1);
+
+        // Decode and downsample batch in parallel
+        std::vector<std::future<cv::Mat>> frames;
+        frames.reserve(batchEnd - batchStart);
+        for (size_t i = batchStart; i < batchEnd; i++) {
+            frames.push_back(mPool.submit([&aSource, i, levels]() {
+                cv::Mat coarse;
+                downsample(aSource(i), coarse, levels);
+                return coarse;
+            }));
+        }
+
+        for (size_t i = batchStart; i < batchEnd; i++) {
+            const cv::Mat coarse = frames[i - batchStart].get();
+
+            if (i == 0)
+                tracker.init(coarse, coarseBBOX);
+            else
+                tracker.track(coarse, mThreshold, mMaxIters);
+
+            if (k < aKeyframes.size() && aKeyframes[k] == i) {
+                const bbox_t &bbox = tracker.getBBOX();
+                for (int j = 0; j < 4; j++)
+                    aKeyBoxes[k].bbox[j] = bbox[j] * scale;
+                k++;
+            }
+        }
+    }
+
+    // Frame 0 is known exactly
+    copyBBOX(aInitBBOX, aKeyBoxes[0].bbox);
+}
+
+/**
+ * @brief Stitch a chunk onto the already stitched result
+ *
+ * Compares the chunk against the result over the overlap
+ * [aChunkStart, aOverlapEnd). If both agree up to a (small) constant offset,
+ * the offset is removed from the chunk and its frames from aOverlapEnd onwards
+ * are appended. Otherwise nothing is written.
+ *
+ * @param[in] aChunk Tracked frames of chunk, starting at aChunkStart
+ * @param[in] aChunkStart First frame of chunk
+ * @param[in] aOverlapEnd One past last overlapping frame
+ * @param[in,out] aResult Stitched result
+ *
+ * @return true if consistent and stitched, false if chunk must be re-tracked
+ */
+bool SequenceTracker::stitchChunk(const std::vector<TrackedFrame> &aChunk,
+                                  const size_t aChunkStart,
+                                  const size_t aOverlapEnd,
+                                  std::vector<TrackedFrame> &aResult) {
+    const size_t nOverlap = aOverlapEnd - aChunkStart;
+
+    // Mean offset of each BBOX coordinate over the overlap
+    float offset[4] = { 0, 0, 0, 0 };
+    for (size_t i = aChunkStart; i < aOverlapEnd; i++) {
+        for (int j = 0; j < 4; j++)
+            offset[j] += aResult[i].bbox[j] - aChunk[i - aChunkStart].bbox[j];
+    }
+
+    for (int j = 0; j < 4; j++)
+        offset[j] /= nOverlap;
+
+    // Offset must be small compared to the BBOX...
+    const bbox_t &refBBOX = aResult[aChunkStart].bbox;
+    const float maxOffset =
+        mMaxStitchOffset *
+        std::min(refBBOX[2] - refBBOX[0], refBBOX[3] - refBBOX[1]);
+
+    for (int j = 0; j < 4; j++) {
+        if (std::fabs(offset[j]) > maxOffset) return false;
+    }
+
+    // ...and both chunks must move consistently once it is removed
+    for (size_t i = aChunkStart; i < aOverlapEnd; i++) {
+        for (int j = 0; j < 4; j++) {
+            const float residual = aResult[i].bbox[j] -
+                                   aChunk[i - aChunkStart].bbox[j] - offset[j];
+            if (std::fabs(residual) > mStitchTolerance) return false;
+        }
+    }
+
+    for (size_t i = aOverlapEnd; i < aChunkStart + aChunk.size(); i++) {
+        const TrackedFrame &src = aChunk[i - aChunkStart];
+        for (int j = 0; j < 4; j++)
+            aResult[i].bbox[j] = src.bbox[j] + offset[j];
+        aResult[i].retracked = false;
+        aResult[i].confidence = src.confidence;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Track the whole sequence in parallel chunks, then stitch them
+ *
+ * @see SequenceTracker
+ *
+ * @param[in] aInitBBOX BBOX in first frame
+ * @param[out] aResult Tracked frames
+ */
+void SequenceTracker::trackChunked(const bbox_t &aInitBBOX,
+                                   std::vector<TrackedFrame> &aResult) {
+    aResult.assign(mNumFrames, TrackedFrame());
+    if (mNumFrames == 0) return;
+
+    // Chunk c covers [starts[c], ends[c]); ends overlap the next chunk
+    std::vector<size_t> starts, ends;
+    for (size_t s = 0; s < mNumFrames; s += mChunkSize)
+        starts.push_back(s);
+
+    const size_t nChunks = starts.size();
+    for (size_t c = 0; c < nChunks; c++) {
+        ends.push_back((c + 1 < nChunks)
+                           ? std::min(starts[c + 1] + mOverlap, mNumFrames)
+                           : mNumFrames);
+    }
+
+    std::vector<TrackedFrame> keyBoxes;
+    computeKeyframes(mFrameSource, aInitBBOX, starts, keyBoxes);
+
+    // Track all chunks in parallel
+    std::vector<std::vector<TrackedFrame>> chunks(nChunks);
+    std::vector<std::future<void>> done;
+    done.reserve(nChunks);
+
+    for (size_t c = 0; c < nChunks; c++) {
+        chunks[c].resize(ends[c] - starts[c]);
+        done.push_back(mPool.submit([this, c, &starts, &ends, &keyBoxes,
+                                     &chunks]() {
+            trackRange(starts[c], ends[c], keyBoxes[c].bbox, chunks[c].data());
+        }));
+    }
+
+    for (std::future<void> &f : done)
+        f.get();
+
+    // Stitch in order; first chunk starts from the exact BBOX
+    std::copy(chunks[0].begin(), chunks[0].end(), aResult.begin());
+
+    for (size_t c = 1; c < nChunks; c++) {
+        const size_t overlapEnd = ends[c - 1];
+
+        if (stitchChunk(chunks[c], starts[c], overlapEnd, aResult)) continue;
+
+        // Inconsistent: re-track from the last trusted BBOX
+        const size_t restart = overlapEnd - 1;
+        bbox_t restartBBOX;
+        copyBBOX(aResult[restart].bbox, restartBBOX);
+
+        trackRange(restart, ends[c], restartBBOX, &aResult[restart]);
+
+        for (size_t i = overlapEnd; i < ends[c]; i++)
+            aResult[i].retracked = true;
+    }
+}
+
+/**
+ * @brief Track the sequence forwards and backwards concurrently, then fuse
+ * both trajectories frame by frame weighted by their confidence
+ *
+ * Both directions, and the coarse pass which finds an unknown end BBOX, share
+ * decoded frames through a SharedFrameCache of at most the frame cache size,
+ * and the directions reuse this runner's trackers. Where the two trajectories
+ * disagree by more than the max stitch offset, or neither is confident, the
+ * more confident one is taken as is.
+ *
+ * @see SequenceTracker::setFrameCacheSize()
+ *
+ * @see SequenceTracker::setStitchTolerance()
+ *
+ * @param[in] aInitBBOX BBOX in first frame
+ * @param[in] aEndBBOX BBOX in last frame (nullptr: obtained from the keyframe
+ * provider or coarse pass, alongside the forward pass)
+ * @param[out] aResult Fused tracked frames
+ */
+void SequenceTracker::trackBothWays(const bbox_t &aInitBBOX,
+                                    const bbox_t *aEndBBOX,
+                                    std::vector<TrackedFrame> &aResult) {
+    aResult.assign(mNumFrames, TrackedFrame());
+    if (mNumFrames == 0) return;
+
+    // Each pass fetches every frame once: forward, backward, and the coarse
+    // pass for an unknown end BBOX. Other fetches (the keyframe provider's
+    // end frames, or a coarse pass after the provider fails) are not counted
+    // and only cost extra decodes
+    const bool coarseEnd = !aEndBBOX && !mKeyframeProvider;
+    const size_t cacheSize =
+        mFrameCacheSize > 0 ? mFrameCacheSize : (mNumFrames + 1) / 2;
+
+    SharedFrameCache cache(mFrameSource, mNumFrames, coarseEnd ? 3 : 2,
+                           cacheSize);
+    const frame_source_t cachedSource = [&cache](const size_t aIndex) {
+        return cache.get(aIndex);
+    };
+
+    // Backward pass (after the end BBOX if unknown) on its own thread, since
+    // the coarse pass waits on the pool; forward pass on this thread
+    std::vector<TrackedFrame> forward(mNumFrames), backward(mNumFrames);
+
+    std::future<void> backwardDone = std::async(
+        std::launch::async,
+        [this, &aInitBBOX, aEndBBOX, &cachedSource, &backward]() {
+            std::vector<TrackedFrame> keyBoxes;
+            const bbox_t *endBBOX = aEndBBOX;
+            if (!endBBOX) {
+                computeKeyframes(cachedSource, aInitBBOX,
+                                 { 0, mNumFrames - 1 }, keyBoxes);
+                endBBOX = &keyBoxes.back().bbox;
+            }
+
+            trackRange(mBackwardTracker, cachedSource, mNumFrames - 1,
+                       mNumFrames, -1, *endBBOX, backward.data());
+        });
+
+    trackRange(mForwardTracker, cachedSource, 0, mNumFrames, 1, aInitBBOX,
+               forward.data());
+
+    backwardDone.get();
+
+    // Fuse; backward results are stored in reverse frame order
+    for (size_t i = 0; i < mNumFrames; i++) {
+        const TrackedFrame &fwd = forward[i];
+        const TrackedFrame &bwd = backward[mNumFrames - 1 - i];
+        TrackedFrame &fused = aResult[i];
+
+        const float maxOffset =
+            mMaxStitchOffset * std::min(fwd.bbox[2] - fwd.bbox[0],
+                                        fwd.bbox[3] - fwd.bbox[1]);
+
+        bool agree = true;
+        for (int j = 0; j < 4; j++)
+            agree = agree && std::fabs(fwd.bbox[j] - bwd.bbox[j]) <= maxOffset;
+
+        // Both lost: no weights to fuse with
+        const float weightSum = fwd.confidence + bwd.confidence;
+
+        if (!agree || !(weightSum > 0)) {
+            fused = (fwd.confidence >= bwd.confidence) ? fwd : bwd;
+            continue;
+        }
+
+        for (int j = 0; j < 4; j++) {
+            fused.bbox[j] = (fwd.confidence * fwd.bbox[j] +
+                             bwd.confidence * bwd.bbox[j]) /
+                            weightSum;
+        }
+        fused.confidence = std::max(fwd.confidence, bwd.confidence);
+    }
+}
+
+/**
+ * @brief Track the sequence forwards and backwards concurrently, then fuse
+ * both trajectories
+ *
+ * @see SequenceTracker::trackBothWays()
+ *
+ * @param[in] aInitBBOX BBOX in first frame
+ * @param[in] aEndBBOX BBOX in last frame
+ * @param[out] aResult Fused tracked frames
+ */
+void SequenceTracker::trackBidirectional(const bbox_t &aInitBBOX,
+                                         const bbox_t &aEndBBOX,
+                                         std::vector<TrackedFrame> &aResult) {
+    trackBothWays(aInitBBOX, &aEndBBOX, aResult);
+}
+
+/**
+ * @brief Bidirectional tracking when the BBOX in the last frame is unknown; it
+ * is obtained from the keyframe provider or coarse pass, which runs alongside
+ * the forward pass and delays only the backward pass
+ *
+ * @see SequenceTracker::trackBothWays()
+ *
+ * @param[in] aInitBBOX BBOX in first frame
+ * @param[out] aResult Fused tracked frames
+ */
+void SequenceTracker::trackBidirectional(const bbox_t &aInitBBOX,
+                                         std::vector<TrackedFrame> &aResult) {
+    trackBothWays(aInitBBOX, nullptr, aResult);
+}
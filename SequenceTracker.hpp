@@ -0,0 +1,202 @@
+/**
+ * @file SequenceTracker.hpp
+ * @author Samuel Leong (samleocw@gmail.com)
+ * @brief Offline sequence runner which drives ImageAlignment over whole image
+ * sequences, optionally splitting them into chunks tracked in parallel
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2020
+ */
+
+#ifndef __SEQUENCE_TRACKER_H__
+#define __SEQUENCE_TRACKER_H__
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "ImageAlignment.hpp"
+#include "ThreadPool.hpp"
+
+/// @brief Frame source: returns the (single channel) frame at given index.
+/// Must be safe to call concurrently from multiple threads
+typedef std::function<cv::Mat(const size_t aIndex)> frame_source_t;
+
+/// @brief Keyframe provider (eg. re-detection): fills BBOX of the target in the
+/// given frame. Returns false if the target could not be found
+typedef std::function<bool(const size_t aIndex, const cv::Mat &aFrame,
+                           bbox_t &aBbox)>
+    keyframe_provider_t;
+
+/// @brief Tracking result of a single frame in a sequence
+struct TrackedFrame {
+    /// @brief BBOX of target in this frame
+    bbox_t bbox;
+
+    /// @brief Frame was re-tracked sequentially after a failed stitch
+    bool retracked = false;
+
+    /// @brief Tracking confidence in (0, 1]
+    /// @see ImageAlignment::getConfidence()
+    float confidence = 1.0f;
+};
+
+/**
+ * @brief Shared Frame Cache Class
+ *
+ * Hands out (shallow) copies of decoded frames to a fixed number of consumers
+ * which each fetch every frame once, in any order (eg. a forward and a
+ * backward pass). A frame is kept from its first fetch until the last
+ * consumer has fetched it, so it is decoded only once, while at most
+ * `mCapacity` frames are held: a frame first fetched while the cache is full
+ * is not kept, and is decoded again for the consumers which fetch it later.
+ */
+class SharedFrameCache {
+  private:
+    /// @brief Underlying frame source
+    frame_source_t mFrameSource;
+
+    /// @brief Max number of held frames
+    size_t mCapacity;
+
+    /// @brief Fetches still to come, per frame
+    std::vector<int> mUsesLeft;
+
+    /// @brief Held frames by index, decoded lazily by the first consumer to
+    /// get() them
+    std::map<size_t, std::shared_future<cv::Mat>> mFrames;
+
+    /// @brief Guards mUsesLeft and mFrames
+    std::mutex mMutex;
+
+  public:
+    // Constructor
+    SharedFrameCache(const frame_source_t &aFrameSource,
+                     const size_t aNumFrames, const int aNumConsumers,
+                     const size_t aCapacity);
+
+    cv::Mat get(const size_t aIndex);
+};
+
+/**
+ * @brief Sequence Tracker Class
+ *
+ * Tracks a single target through an offline image sequence.
+ *
+ * In chunked mode, the sequence is split into chunks of `mChunkSize` frames,
+ * each extended by `mOverlap` frames into the next chunk. Every chunk starts
+ * from a keyframe whose BBOX comes from a cheap coarse pass (tracking on a
+ * downsampled pyramid level) or from a user supplied keyframe provider. Chunks
+ * are then tracked in parallel at full resolution and stitched in order at the
+ * overlaps: a chunk which agrees with its predecessor up to a constant offset
+ * is shifted onto it, otherwise it is re-tracked sequentially from the last
+ * trusted BBOX.
+ *
+ * In bidirectional mode, the sequence is tracked forwards and backwards at the
+ * same time on two cores, sharing decoded frames within a budget of
+ * `mFrameCacheSize` frames, and both trajectories are fused by confidence.
+ */
+class SequenceTracker {
+  private:
+    /// @brief Frame source
+    frame_source_t mFrameSource;
+
+    /// @brief Number of frames in sequence
+    size_t mNumFrames;
+
+    /// @brief Worker pool for chunks and frame decoding
+    ThreadPool mPool;
+
+    /// @brief Frames per chunk (excluding overlap)
+    size_t mChunkSize = 250;
+
+    /// @brief Frames shared between consecutive chunks
+    size_t mOverlap = 10;
+
+    /// @brief Max pyramid levels used by coarse pass
+    int mCoarseLevels = 2;
+
+    /// @brief Min BBOX side (pixels) allowed on coarse pyramid level
+    float mMinCoarseSize = 16.0f;
+
+    /// @brief Max disagreement (pixels) between overlapping chunks, after
+    /// removing their mean offset
+    float mStitchTolerance = 3.0f;
+
+    /// @brief Max mean offset between overlapping chunks, as a fraction of the
+    /// BBOX size
+    float mMaxStitchOffset = 0.25f;
+
+    /// @brief Optional keyframe provider replacing the coarse pass
+    keyframe_provider_t mKeyframeProvider;
+
+    /// @brief Tracker convergence threshold
+    float mThreshold = 0.01875f;
+
+    /// @brief Tracker max iterations per frame
+    size_t mMaxIters = 100;
+
+    /// @brief Max decoded frames held for sharing in bidirectional mode (0:
+    /// half the sequence)
+    size_t mFrameCacheSize = 0;
+
+    /// @brief Reused trackers for bidirectional mode
+    ImageAlignment mForwardTracker, mBackwardTracker;
+
+    void trackRange(ImageAlignment &aTracker, const frame_source_t &aSource,
+                    const size_t aStart, const size_t aCount, const int aStep,
+                    const bbox_t &aStartBBOX, TrackedFrame *aOut);
+
+    void trackRange(const size_t aStart, const size_t aEnd,
+                    const bbox_t &aStartBBOX, TrackedFrame *aOut);
+
+    void computeKeyframes(const frame_source_t &aSource,
+                          const bbox_t &aInitBBOX,
+                          const std::vector<size_t> &aKeyframes,
+                          std::vector<TrackedFrame> &aKeyBoxes);
+
+    void coarsePass(const frame_source_t &aSource, const bbox_t &aInitBBOX,
+                    const std::vector<size_t> &aKeyframes,
+                    std::vector<TrackedFrame> &aKeyBoxes);
+
+    bool stitchChunk(const std::vector<TrackedFrame> &aChunk,
+                     const size_t aChunkStart, const size_t aOverlapEnd,
+                     std::vector<TrackedFrame> &aResult);
+
+    void trackBothWays(const bbox_t &aInitBBOX, const bbox_t *aEndBBOX,
+                       std::vector<TrackedFrame> &aResult);
+
+  public:
+    // Constructor
+    SequenceTracker(const frame_source_t &aFrameSource,
+                    const size_t aNumFrames,
+                    const size_t aNumThreads =
+                        std::thread::hardware_concurrency());
+
+    // Settings
+    void setChunking(const size_t aChunkSize, const size_t aOverlap);
+    void setCoarseLevels(const int aCoarseLevels,
+                         const float aMinCoarseSize = 16.0f);
+    void setStitchTolerance(const float aTolerance,
+                            const float aMaxOffset = 0.25f);
+    void setKeyframeProvider(const keyframe_provider_t &aProvider);
+    void setTrackParams(const float aThreshold, const size_t aMaxIters);
+    void setFrameCacheSize(const size_t aMaxFrames);
+
+    size_t getNumFrames() const;
+
+    // Track
+    void trackSequential(const bbox_t &aInitBBOX,
+                         std::vector<TrackedFrame> &aResult);
+    void trackChunked(const bbox_t &aInitBBOX,
+                      std::vector<TrackedFrame> &aResult);
+    void trackBidirectional(const bbox_t &aInitBBOX, const bbox_t &aEndBBOX,
+                            std::vector<TrackedFrame> &aResult);
+    void trackBidirectional(const bbox_t &aInitBBOX,
+                            std::vector<TrackedFrame> &aResult);
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+#include "ImageAlignment.hpp"
+#include "ThreadPool.hpp"
+
+/// @brief Trajectory checksum of the sequence below in deterministic mode, on
+/// any machine and build (update only when the tracking arithmetic changes on
+/// purpose)
+#define KLT_DETERMINISM_CHECKSUM 0x3f5d85ffab78c868ull
+
+/// @brief Synthetic sequence: texture size, number of frames
+#define TEST_WIDTH 320
+#define TEST_HEIGHT 240
+#define TEST_FRAMES 8
+
+/**
+ * @brief Make a smooth random texture in integer arithmetic only, so that it
+ * does not depend on the OpenCV build (xorshift noise, then two passes of a
+ * 1-4-6-4-1 binomial filter along each axis)
+ *
+ * @param[out] aTexture Texture (TEST_HEIGHT x TEST_WIDTH)
+ */
+void makeTexture(std::vector<int> &aTexture) {
+    aTexture.resize(TEST_WIDTH * TEST_HEIGHT);
+
+    uint32_t state = 2463534242u;
+    for (int &value : aTexture) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        value = state & 255;
+    }
+
+    static const int kernel[5] = { 1, 4, 6, 4, 1 };
+    std::vector<int> filtered(aTexture.size());
+
+    for (int pass = 0; pass < 4; pass++) {
+        const bool alongX = (pass % 2) == 0;
+
+        for (int y = 0; y < TEST_HEIGHT; y++) {
+            for (int x = 0; x < TEST_WIDTH; x++) {
+                int sum = 0;
+                for (int k = -2; k <= 2; k++) {
+                    const int sx = alongX ? std::min(std::max(x + k, 0),
+                                                     TEST_WIDTH - 1)
+                                          : x;
+                    const int sy = alongX ? y
+                                          : std::min(std::max(y + k, 0),
+                                                     TEST_HEIGHT - 1);
+                    sum += kernel[k + 2] * aTexture[sy * TEST_WIDTH + sx];
+                }
+                filtered[y * TEST_WIDTH + x] = (sum + 8) >> 4;
+            }
+        }
+        aTexture.swap(filtered);
+    }
+}
+
+/**
+ * @brief Make frame k of the sequence: the texture shifted by (k / 2, -k / 4)
+ * pixels, resampled bilinearly with exact quarter-pixel integer weights
+ *
+ * @param[in] aTexture Texture
+ * @param[in] aIndex Frame index
+ * @param[out] aFrame 8-bit grayscale frame
+ */
+void makeFrame(const std::vector<int> &aTexture, const int aIndex,
+               cv::Mat &aFrame) {
+    // Source position x - k / 2, y + k / 4, in quarter pixels
+    const int shiftX = -2 * aIndex, shiftY = aIndex;
+
+    aFrame.create(TEST_HEIGHT, TEST_WIDTH, CV_8UC1);
+
+    for (int y = 0; y < TEST_HEIGHT; y++) {
+        unsigned char *row = aFrame.ptr<unsigned char>(y);
+
+        for (int x = 0; x < TEST_WIDTH; x++) {
+            const int qx = 4 * x + shiftX, qy = 4 * y + shiftY;
+            const int x0 = qx >> 2, y0 = qy >> 2;
+            const int fx = qx & 3, fy = qy & 3;
+
+            const auto at = [&](const int aX, const int aY) {
+                return aTexture[std::min(std::max(aY, 0), TEST_HEIGHT - 1) *
+                                    TEST_WIDTH +
+                                std::min(std::max(aX, 0), TEST_WIDTH - 1)];
+            };
+
+            const int sum =
+                (4 - fy) * ((4 - fx) * at(x0, y0) + fx * at(x0 + 1, y0)) +
+                fy * ((4 - fx) * at(x0, y0 + 1) + fx * at(x0 + 1, y0 + 1));
+            row[x] = static_cast<unsigned char>((sum + 8) >> 4);
+        }
+    }
+}
+
+/**
+ * @brief Add bytes to an FNV-1a checksum
+ *
+ * @param[in] aData Bytes
+ * @param[in] aSize Number of bytes
+ * @param[in,out] aChecksum Checksum
+ */
+void addChecksum(const void *aData, const size_t aSize, uint64_t &aChecksum) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(aData);
+    for (size_t b = 0; b < aSize; b++) {
+        aChecksum ^= bytes[b];
+        aChecksum *= 1099511628211ull;
+    }
+}
+
+/**
+ * Deterministic mode regression test: tracks a fixed synthetic sequence with
+ * the float and the fixed-point pipelines, without a pool and on pools of 1
+ * to 4 threads, and compares the checksum of every warp and BBOX with the
+ * committed reference.
+ *
+ * @return 0 if every run matched the reference
+ */
+int main() {
+    std::vector<int> texture;
+    makeTexture(texture);
+
+    std::vector<cv::Mat> raw(TEST_FRAMES);
+    for (int k = 0; k < TEST_FRAMES; k++) makeFrame(texture, k, raw[k]);
+
+    const bbox_t bbox = { 60, 50, 260, 190 };
+    const ChannelLayout layouts[2] = { CHANNELS_GRAY, CHANNELS_GRAY_8U };
+
+    int failures = 0;
+    for (size_t numThreads = 0; numThreads <= 4; numThreads++) {
+        ThreadPool pool(numThreads > 0 ? numThreads : 1);
+        uint64_t checksum = 14695981039346656037ull;
+
+        for (const ChannelLayout layout : layouts) {
+            std::vector<PreparedFrame> frames(TEST_FRAMES);
+            for (int k = 0; k < TEST_FRAMES; k++)
+                ImageAlignment::prepareFrame(raw[k], frames[k], layout, false);
+
+            ImageAlignment tracker;
+            tracker.setDebugDisplay(false);
+            tracker.setDeterministic(true);
+            tracker.setChannelLayout(layout);
+            if (numThreads > 0) tracker.setParallelPool(&pool, 0);
+
+            tracker.init(frames[0], bbox);
+            for (int k = 1; k < TEST_FRAMES; k++) {
+                tracker.track(frames[k]);
+
+                addChecksum(tracker.getWarp().data(), 9 * sizeof(double),
+                            checksum);
+                addChecksum(tracker.getBBOX(), sizeof(bbox_t), checksum);
+            }
+        }
+
+        const bool match = checksum == KLT_DETERMINISM_CHECKSUM;
+        if (!match) failures++;
+
+        std::cout << numThreads << " threads: checksum " << std::hex
+                  << checksum << std::dec << (match ? " ok" : " MISMATCH")
+                  << std::endl;
+    }
+
+    if (failures > 0)
+        std::cout << "expected " << std::hex << KLT_DETERMINISM_CHECKSUM
+                  << std::dec << std::endl;
+
+    return failures > 0 ? 1 : 0;
+}
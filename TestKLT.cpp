@@ -7,6 +7,7 @@
 namespace fs = std::filesystem;
 
 #include "ImageAlignment.hpp"
+#include "SequenceTracker.hpp"
 
 void printBBOX(const bbox_t &bbox){
     std::cout << "BBOX: ";
@@ -28,15 +29,51 @@ int main(int argc, char *argv[]) {
     std::string imageSequence((argc > 1) ? std::string(argv[1]) : "landing");
     unsigned int startCnt = (argc > 2) ? atoi(argv[2]) : 0;
     unsigned int endCnt = (argc > 3) ? atoi(argv[3]) : 50;
+    std::string mode((argc > 4) ? std::string(argv[4]) : "live");
+    unsigned int chunkSize = (argc > 5) ? atoi(argv[5]) : 16;
+    double budgetUs = (argc > 5) ? atof(argv[5]) : 5000;
 
     std::cout << "Testing on sequence " << imageSequence << " from frames "
-              << startCnt << " to " << endCnt << std::endl;
+              << startCnt << " to " << endCnt << " (" << mode << ")"
+              << std::endl;
 
     fs::path imageFolder("../data");
     imageFolder /= imageSequence;
 
     std::string imageSuffix = ".jpg";
 
+    // Landing scene BBOX
+    const bbox_t initBBOX = { 440.0f, 80.0f, 560.0f, 140.0f };
+
+    // Offline modes: no display, just print resulting BBOXes
+    if (mode == "chunked" || mode == "bidirectional") {
+        frame_source_t frameSource = [&](const size_t aIndex) {
+            fs::path path;
+            getImagePath(imageFolder, startCnt + aIndex, imageSuffix, path);
+            return cv::imread(path, cv::IMREAD_GRAYSCALE);
+        };
+
+        SequenceTracker sequenceTracker(frameSource, endCnt - startCnt);
+        sequenceTracker.setChunking(chunkSize, chunkSize / 4);
+
+        std::vector<TrackedFrame> result;
+        if (mode == "chunked")
+            sequenceTracker.trackChunked(initBBOX, result);
+        else
+            sequenceTracker.trackBidirectional(initBBOX, result);
+
+        for (size_t i = 0; i < result.size(); i++) {
+            std::cout << startCnt + i << (result[i].retracked ? "* " : "  ");
+            printBBOX(result[i].bbox);
+        }
+
+        return 0;
+    }
+
+    // Colour mode: all BGR channels take part in the residual
+    const bool colour = (mode == "colour");
+    const int readFlags = colour ? cv::IMREAD_COLOR : cv::IMREAD_GRAYSCALE;
+
     unsigned int imageCnt = startCnt;
 
     // Previous Frame image
@@ -44,14 +81,35 @@ int main(int argc, char *argv[]) {
     getImagePath(imageFolder, imageCnt, imageSuffix, imagePath);
     cv::Mat image;
 
-    image = cv::imread(imagePath, cv::IMREAD_GRAYSCALE);
+    image = cv::imread(imagePath, readFlags);
 
     ImageAlignment tracker(image);
+    if (colour) tracker.setChannelLayout(CHANNELS_INTERLEAVED);
+
+    // 8-bit mode: fixed-point sampling and J^T e on grayscale frames
+    if (mode == "gray8u") tracker.setChannelLayout(CHANNELS_GRAY_8U);
+
+    // Half mode: template data in fp16
+    if (mode == "half") tracker.setStoragePrecision(STORAGE_HALF);
+
+    // Appearance mode: lighting changes projected out of the template
+    if (mode == "appearance") tracker.setAppearanceModes(2);
+
+    // Occlusion mode: outlier tiles down-weighted or dropped
+    if (mode == "occlusion") {
+        TileWeighting weighting;
+        weighting.tileSize = 16;
+        tracker.setTileWeighting(weighting);
+    }
+
+    // Multi-hypothesis mode: seeds run on their own pool
+    ThreadPool hypothesisPool(mode == "multi" ? 4 : 1);
+    if (mode == "multi") tracker.setMultiHypothesis(&hypothesisPool);
 
     // Landing scene test
     std::cout << "Press any key to continue. Press Q to quit." << std::endl << std::endl;
 
-    tracker.setBBOX(440.0f, 80.0f, 560.0f, 140.0f);
+    tracker.setBBOX(initBBOX);
 
     tracker.displayCurrentImage(true);
 
@@ -61,9 +119,14 @@ int main(int argc, char *argv[]) {
 
         std::cout << imagePath.string() << std::endl;
 
-        image = cv::imread(imagePath, cv::IMREAD_GRAYSCALE);
+        image = cv::imread(imagePath, readFlags);
 
-        tracker.track(image);
+        if (mode == "deadline") {
+            const TrackQuality quality = tracker.trackDeadline(image, budgetUs);
+            std::cout << "Quality: " << quality << std::endl;
+        } else {
+            tracker.track(image);
+        }
         // tracker.displayTemplateImage(false);
         tracker.displayCurrentImage(true);
 
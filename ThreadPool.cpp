@@ -0,0 +1,121 @@
+/**
+ * @file ThreadPool.cpp
+ * @author Samuel Leong (samleocw@gmail.com)
+ * @brief Minimal fixed-size thread pool used to spread independent tracking
+ * jobs over multiple cores
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2020
+ */
+
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <exception>
+
+/**
+ * @brief Constructor for ThreadPool class
+ *
+ * @param[in] aNumThreads Number of worker threads (at least 1)
+ */
+ThreadPool::ThreadPool(const size_t aNumThreads) : mStop(false) {
+    const size_t numThreads = (aNumThreads > 0) ? aNumThreads : 1;
+
+    mWorkers.reserve(numThreads);
+    for (size_t i = 0; i < numThreads; i++)
+        mWorkers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+/**
+ * @brief Destructor: finishes all queued tasks, then joins workers
+ */
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+
+    mCondition.notify_all();
+
+    for (std::thread &worker : mWorkers)
+        worker.join();
+}
+
+/**
+ * @brief Get number of worker threads
+ *
+ * @return size_t number of workers
+ */
+size_t ThreadPool::size() const {
+    return mWorkers.size();
+}
+
+/**
+ * @brief Run aBody over [0, aCount) split into one contiguous range per
+ * worker; the calling thread runs the first range itself, then waits for the
+ * others
+ * @note Must not be called from a task of the same pool (the waits could
+ * deadlock)
+ *
+ * @param[in] aCount Number of items
+ * @param[in] aBody Callable taking the range [begin, end) to process
+ */
+void ThreadPool::parallelFor(const size_t aCount,
+                             const std::function<void(size_t, size_t)> &aBody) {
+    const size_t numRanges = std::min(aCount, mWorkers.size());
+
+    if (numRanges <= 1) {
+        if (aCount > 0) aBody(0, aCount);
+        return;
+    }
+
+    std::vector<std::future<void>> done;
+    done.reserve(numRanges - 1);
+
+    for (size_t r = 1; r < numRanges; r++) {
+        const size_t begin = aCount * r / numRanges;
+        const size_t end = aCount * (r + 1) / numRanges;
+        done.push_back(submit([&aBody, begin, end]() { aBody(begin, end); }));
+    }
+
+    // Other ranges still reference aBody: wait for all before rethrowing
+    std::exception_ptr error;
+    try {
+        aBody(0, aCount / numRanges);
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    for (std::future<void> &result : done)
+        result.wait();
+
+    if (error) std::rethrow_exception(error);
+
+    for (std::future<void> &result : done)
+        result.get();
+}
+
+/**
+ * @brief Worker thread body: pop and run tasks until the pool is stopped and
+ * the queue is drained
+ */
+void ThreadPool::workerLoop() {
+    while (true) {
+        std::function<void()> task;
+
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondition.wait(lock,
+                            [this]() { return mStop || !mTasks.empty(); });
+
+            if (mStop && mTasks.empty()) return;
+
+            task = std::move(mTasks.front());
+            mTasks.pop();
+        }
+
+        task();
+    }
+}
@@ -0,0 +1,87 @@
+/**
+ * @file ThreadPool.hpp
+ * @author Samuel Leong (samleocw@gmail.com)
+ * @brief Minimal fixed-size thread pool used to spread independent tracking
+ * jobs over multiple cores
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2020
+ */
+
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Thread Pool Class
+ *
+ * Fixed number of worker threads pulling tasks from a shared FIFO queue.
+ * Tasks are submitted with `submit()`, which returns a future for the result.
+ */
+class ThreadPool {
+  private:
+    /// @brief Worker threads
+    std::vector<std::thread> mWorkers;
+
+    /// @brief Pending tasks
+    std::queue<std::function<void()>> mTasks;
+
+    /// @brief Guards task queue and stop flag
+    std::mutex mMutex;
+
+    /// @brief Signalled when a task is queued or the pool stops
+    std::condition_variable mCondition;
+
+    /// @brief Set when pool is being destroyed
+    bool mStop;
+
+    void workerLoop();
+
+  public:
+    // Constructor
+    ThreadPool(const size_t aNumThreads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t size() const;
+
+    void parallelFor(const size_t aCount,
+                     const std::function<void(size_t, size_t)> &aBody);
+
+    /**
+     * @brief Queue a task for execution on the pool
+     *
+     * @param[in] aTask Callable taking no arguments
+     * @return std::future holding the result of the task
+     */
+    template <typename F>
+    auto submit(F &&aTask) -> std::future<decltype(aTask())> {
+        typedef decltype(aTask()) result_t;
+
+        auto task = std::make_shared<std::packaged_task<result_t()>>(
+            std::forward<F>(aTask));
+        std::future<result_t> result = task->get_future();
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mTasks.emplace([task]() { (*task)(); });
+        }
+
+        mCondition.notify_one();
+        return result;
+    }
+};
+
+#endif
@@ -0,0 +1,704 @@
+/**
+ * @file TrackingServer.cpp
+ * @author Samuel Leong (samleocw@gmail.com)
+ * @brief Local tracking service: a daemon which tracks targets for many client
+ * processes over a Unix domain socket, batching requests for the same frame
+ * into one multi-target pass
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2020
+ */
+
+#include "TrackingServer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/// @brief Max bytes buffered per client: one request with the most targets,
+/// and the start of the next one
+#define KLT_MAX_CLIENT_INPUT                                                   \
+    (2 * (sizeof(RequestHeader) + KLT_MAX_TARGETS * sizeof(TargetRequest)))
+
+/// @brief Max time to wait for a client to make room for a reply (ms)
+#define KLT_CLIENT_WRITE_TIMEOUT_MS 1000
+
+/**
+ * @brief Read exactly aSize bytes from a (blocking) socket
+ *
+ * @param[in] aFd Socket
+ * @param[out] aBuf Destination
+ * @param[in] aSize Number of bytes
+ *
+ * @return true on success, false on error or EOF
+ */
+static bool readFully(const int aFd, void *aBuf, const size_t aSize) {
+    char *buf = static_cast<char *>(aBuf);
+    size_t done = 0;
+
+    while (done < aSize) {
+        const ssize_t n = recv(aFd, buf + done, aSize - done, MSG_WAITALL);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            return false;
+        }
+        done += n;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Write exactly aSize bytes to a socket
+ * @note On a non-blocking socket whose buffer is full, waits for room, up to
+ * KLT_CLIENT_WRITE_TIMEOUT_MS for the whole write
+ *
+ * @param[in] aFd Socket
+ * @param[in] aBuf Source
+ * @param[in] aSize Number of bytes
+ *
+ * @return true on success, false on error or timeout
+ */
+static bool writeFully(const int aFd, const void *aBuf, const size_t aSize) {
+    typedef std::chrono::steady_clock clock_t;
+
+    const char *buf = static_cast<const char *>(aBuf);
+    size_t done = 0;
+
+    const clock_t::time_point deadline =
+        clock_t::now() +
+        std::chrono::milliseconds(KLT_CLIENT_WRITE_TIMEOUT_MS);
+
+    while (done < aSize) {
+        const ssize_t n = send(aFd, buf + done, aSize - done, MSG_NOSIGNAL);
+        if (n >= 0) {
+            done += n;
+            continue;
+        }
+
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+
+        // Socket buffer full: wait for the peer to read
+        const long long left =
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - clock_t::now())
+                .count();
+        if (left <= 0) return false;
+
+        pollfd pfd = { aFd, POLLOUT, 0 };
+        const int ready = poll(&pfd, 1, static_cast<int>(left));
+        if (ready < 0 && errno != EINTR) return false;
+        if (ready > 0 && (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Fill a sockaddr_un with a socket path
+ *
+ * @param[in] aSocketPath Socket path
+ * @param[out] aAddr Socket address
+ *
+ * @return true if the path fits
+ */
+static bool makeAddress(const std::string &aSocketPath, sockaddr_un &aAddr) {
+    std::memset(&aAddr, 0, sizeof(aAddr));
+    aAddr.sun_family = AF_UNIX;
+
+    if (aSocketPath.size() >= sizeof(aAddr.sun_path)) return false;
+
+    std::strncpy(aAddr.sun_path, aSocketPath.c_str(),
+                 sizeof(aAddr.sun_path) - 1);
+    return true;
+}
+
+/**
+ * @brief Constructor for TrackingServer class
+ *
+ * @param[in] aSocketPath Path of Unix domain socket to listen on
+ * @param[in] aNumThreads Number of tracking threads
+ */
+TrackingServer::TrackingServer(const std::string &aSocketPath,
+                               const size_t aNumThreads)
+    : mSocketPath(aSocketPath), mPool(aNumThreads), mStop(false) {}
+
+/**
+ * @brief Destructor: closes all sockets and unmaps shared memory
+ */
+TrackingServer::~TrackingServer() {
+    for (const auto &client : mClients)
+        close(client.first);
+
+    if (mListenFd >= 0) {
+        close(mListenFd);
+        unlink(mSocketPath.c_str());
+    }
+
+    unmapAll();
+}
+
+/**
+ * @brief Set batch window
+ *
+ * @param[in] aBatchWindowUs Max time (us) to wait for requests of other
+ * clients once the first request of a batch arrived
+ */
+void TrackingServer::setBatchWindow(const long aBatchWindowUs) {
+    mBatchWindowUs = aBatchWindowUs;
+}
+
+/**
+ * @brief Set parameters passed on to ImageAlignment::track()
+ *
+ * @param[in] aThreshold Threshold to compare against
+ * @param[in] aMaxIters Maximum iterations before stop
+ */
+void TrackingServer::setTrackParams(const float aThreshold,
+                                    const size_t aMaxIters) {
+    mThreshold = aThreshold;
+    mMaxIters = aMaxIters;
+}
+
+/**
+ * @brief Create and bind listening socket (replacing a stale socket file)
+ *
+ * @return true on success
+ */
+bool TrackingServer::start() {
+    sockaddr_un addr;
+    if (!makeAddress(mSocketPath, addr)) {
+        std::cerr << "Socket path too long: " << mSocketPath << std::endl;
+        return false;
+    }
+
+    mListenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (mListenFd < 0) {
+        perror("socket");
+        return false;
+    }
+
+    unlink(mSocketPath.c_str());
+
+    if (bind(mListenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) <
+            0 ||
+        listen(mListenFd, SOMAXCONN) < 0) {
+        perror("bind/listen");
+        close(mListenFd);
+        mListenFd = -1;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Request run() to return. Safe to call from a signal handler
+ */
+void TrackingServer::stop() {
+    mStop = true;
+}
+
+/**
+ * @brief Accept a pending client connection, in non-blocking mode so that a
+ * slow client never stalls the others
+ *
+ * @return int client socket, or -1 on failure
+ */
+int TrackingServer::acceptClient() {
+    const int fd = accept(mListenFd, nullptr, nullptr);
+    if (fd < 0) return -1;
+
+    const int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    mClients[fd] = Client();
+    return fd;
+}
+
+/**
+ * @brief Disconnect client, forget its trackers and unmap the shared memory
+ * no other client refers to
+ *
+ * @param[in] aFd Client socket
+ */
+void TrackingServer::dropClient(const int aFd) {
+    close(aFd);
+    mClients.erase(aFd);
+
+    auto it = mTrackers.lower_bound(std::make_pair(aFd, 0u));
+    while (it != mTrackers.end() && it->first.first == aFd)
+        it = mTrackers.erase(it);
+
+    for (auto mapping = mMappings.begin(); mapping != mMappings.end();) {
+        mapping->second.clients.erase(aFd);
+
+        if (mapping->second.clients.empty()) {
+            munmap(mapping->second.addr, mapping->second.size);
+            mapping = mMappings.erase(mapping);
+        } else {
+            ++mapping;
+        }
+    }
+}
+
+/**
+ * @brief Append everything a client has sent so far to its input buffer,
+ * without blocking
+ *
+ * @param[in] aFd Client socket
+ *
+ * @return true on success, false if the client disconnected, failed or sent
+ * more than one request ahead
+ */
+bool TrackingServer::receive(const int aFd) {
+    std::vector<char> &input = mClients[aFd].input;
+    char buf[4096];
+
+    while (true) {
+        const ssize_t n = recv(aFd, buf, sizeof(buf), 0);
+
+        if (n > 0) {
+            input.insert(input.end(), buf, buf + n);
+            if (input.size() > KLT_MAX_CLIENT_INPUT) return false;
+            continue;
+        }
+
+        if (n < 0 && errno == EINTR) continue;
+
+        // Nothing more for now; anything else is EOF or an error
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+}
+
+/**
+ * @brief Take one complete request off a client's input buffer
+ *
+ * @param[in] aFd Client socket
+ * @param[out] aRequest Request
+ *
+ * @return int 1 if a request was taken, 0 if it has not fully arrived yet,
+ * -1 if the client misbehaved
+ */
+int TrackingServer::parseRequest(const int aFd, PendingRequest &aRequest) {
+    std::vector<char> &input = mClients[aFd].input;
+    if (input.size() < sizeof(RequestHeader)) return 0;
+
+    RequestHeader header;
+    std::memcpy(&header, input.data(), sizeof(header));
+
+    if (header.magic != KLT_PROTOCOL_MAGIC ||
+        header.numTargets > KLT_MAX_TARGETS)
+        return -1;
+
+    const size_t targetBytes = header.numTargets * sizeof(TargetRequest);
+    if (input.size() < sizeof(header) + targetBytes) return 0;
+
+    aRequest.fd = aFd;
+    aRequest.header = header;
+    aRequest.header.frame.shmName[KLT_SHM_NAME_LEN - 1] = '\0';
+
+    aRequest.targets.resize(header.numTargets);
+    if (targetBytes > 0)
+        std::memcpy(aRequest.targets.data(), input.data() + sizeof(header),
+                    targetBytes);
+
+    input.erase(input.begin(), input.begin() + sizeof(header) + targetBytes);
+    return 1;
+}
+
+/**
+ * @brief Get a cv::Mat view of a frame in shared memory. Mappings are cached
+ * per object, and remapped when the object behind the name was recreated or
+ * resized
+ *
+ * @param[in] aHandle Frame handle
+ * @param[out] aView View of frame (no copy)
+ * @param[in] aClients Clients referring to the frame (the mapping is kept
+ * until all clients referring to it disconnect)
+ *
+ * @return true on success
+ */
+bool TrackingServer::mapFrame(const FrameHandle &aHandle, cv::Mat &aView,
+                              const std::vector<int> &aClients) {
+    const int depth = CV_MAT_DEPTH(aHandle.type);
+    const int channels = CV_MAT_CN(aHandle.type);
+    const bool supported = (depth == CV_8U || depth == CV_32F) &&
+                           (channels == 1 || channels == 3);
+
+    if (!supported || aHandle.width <= 0 || aHandle.height <= 0 ||
+        aHandle.step <= 0)
+        return false;
+
+    // Rows must not overlap. With 32-bit sizes the span of the rows fits in
+    // 64 bits; only adding the offset can overflow
+    const uint64_t rowBytes = static_cast<uint64_t>(aHandle.width) *
+                              channels * (depth == CV_8U ? 1 : 4);
+    if (static_cast<uint64_t>(aHandle.step) < rowBytes) return false;
+
+    const uint64_t span =
+        static_cast<uint64_t>(aHandle.step) * (aHandle.height - 1) + rowBytes;
+    if (aHandle.offset > UINT64_MAX - span) return false;
+
+    const uint64_t needed = aHandle.offset + span;
+
+    const std::string name(aHandle.shmName);
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || static_cast<uint64_t>(st.st_size) < needed) {
+        close(fd);
+        return false;
+    }
+
+    // The name may have been unlinked and recreated since it was mapped
+    auto it = mMappings.find(name);
+    if (it != mMappings.end() &&
+        (it->second.device != st.st_dev || it->second.inode != st.st_ino ||
+         it->second.size != static_cast<size_t>(st.st_size))) {
+        munmap(it->second.addr, it->second.size);
+        mMappings.erase(it);
+        it = mMappings.end();
+    }
+
+    if (it == mMappings.end()) {
+        void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+
+        Mapping mapping;
+        mapping.addr = addr;
+        mapping.size = static_cast<size_t>(st.st_size);
+        mapping.device = st.st_dev;
+        mapping.inode = st.st_ino;
+        it = mMappings.emplace(name, mapping).first;
+    }
+
+    close(fd);
+    it->second.clients.insert(aClients.begin(), aClients.end());
+
+    char *base = static_cast<char *>(it->second.addr) + aHandle.offset;
+    aView = cv::Mat(aHandle.height, aHandle.width, aHandle.type, base,
+                    aHandle.step);
+    return true;
+}
+
+/**
+ * @brief Unmap all cached shared memory mappings
+ */
+void TrackingServer::unmapAll() {
+    for (auto &mapping : mMappings)
+        munmap(mapping.second.addr, mapping.second.size);
+
+    mMappings.clear();
+}
+
+/**
+ * @brief Process a batch of requests: group by frame, preprocess each frame
+ * once, track all targets of the group in parallel and reply to each client
+ *
+ * @param[in] aBatch Requests (at most one per client)
+ */
+void TrackingServer::processBatch(std::vector<PendingRequest> &aBatch) {
+    typedef std::pair<std::string, uint64_t> frame_key_t;
+    std::map<frame_key_t, std::vector<PendingRequest *>> groups;
+
+    for (PendingRequest &request : aBatch) {
+        const FrameHandle &frame = request.header.frame;
+        groups[frame_key_t(frame.shmName, frame.frameSeq)].push_back(&request);
+    }
+
+    std::vector<std::vector<TargetReply>> replies(aBatch.size());
+
+    // A tracker must not be used by two tasks at once
+    std::set<std::pair<int, uint32_t>> used;
+
+    for (auto &group : groups) {
+        // Map and preprocess frame once for the whole group (trackers compute
+        // template gradients themselves)
+        std::vector<int> clients;
+        for (const PendingRequest *request : group.second)
+            clients.push_back(request->fd);
+
+        cv::Mat view;
+        PreparedFrame frame;
+        const bool validFrame =
+            mapFrame(group.second.front()->header.frame, view, clients);
+        if (validFrame)
+            ImageAlignment::prepareFrame(view, frame, CHANNELS_GRAY, false);
+
+        std::vector<std::future<void>> done;
+
+        for (PendingRequest *request : group.second) {
+            std::vector<TargetReply> &reply = replies[request - aBatch.data()];
+            reply.resize(request->targets.size());
+
+            for (size_t t = 0; t < request->targets.size(); t++) {
+                const TargetRequest &target = request->targets[t];
+                TargetReply &targetReply = reply[t];
+
+                targetReply.targetId = target.targetId;
+                targetReply.confidence = 0;
+                std::copy(target.bbox, target.bbox + 4, targetReply.bbox);
+
+                const auto key = std::make_pair(request->fd, target.targetId);
+
+                if (!used.insert(key).second) {
+                    targetReply.status = STATUS_DUPLICATE_TARGET;
+                    continue;
+                }
+
+                if (target.command == TARGET_DROP) {
+                    mTrackers.erase(key);
+                    targetReply.status = STATUS_OK;
+                    continue;
+                }
+
+                if (!validFrame) {
+                    targetReply.status = STATUS_BAD_FRAME;
+                    continue;
+                }
+
+                // Trackers are created here so that the map is only touched
+                // by this thread
+                std::unique_ptr<ImageAlignment> &tracker = mTrackers[key];
+                const bool init = (target.command == TARGET_INIT);
+
+                if (!tracker) {
+                    if (!init) {
+                        mTrackers.erase(key);
+                        targetReply.status = STATUS_UNKNOWN_TARGET;
+                        continue;
+                    }
+
+                    tracker.reset(new ImageAlignment());
+                    tracker->setDebugDisplay(false);
+                }
+
+                ImageAlignment *trackerPtr = tracker.get();
+                done.push_back(mPool.submit([this, trackerPtr, init, &target,
+                                             &targetReply, &frame]() {
+                    if (init)
+                        trackerPtr->init(frame, target.bbox);
+                    else
+                        trackerPtr->track(frame, mThreshold, mMaxIters);
+
+                    const bbox_t &bbox = trackerPtr->getBBOX();
+                    std::copy(bbox, bbox + 4, targetReply.bbox);
+                    targetReply.confidence = trackerPtr->getConfidence();
+                    targetReply.status = STATUS_OK;
+                }));
+            }
+        }
+
+        for (std::future<void> &f : done)
+            f.get();
+    }
+
+    // Reply to each client
+    for (size_t r = 0; r < aBatch.size(); r++) {
+        ReplyHeader header;
+        header.magic = KLT_PROTOCOL_MAGIC;
+        header.numTargets = static_cast<uint32_t>(replies[r].size());
+        header.frameSeq = aBatch[r].header.frame.frameSeq;
+
+        // One write, so that the timeout covers the whole reply
+        std::vector<char> reply(sizeof(header) +
+                                replies[r].size() * sizeof(TargetReply));
+        std::memcpy(reply.data(), &header, sizeof(header));
+        if (!replies[r].empty())
+            std::memcpy(reply.data() + sizeof(header), replies[r].data(),
+                        replies[r].size() * sizeof(TargetReply));
+
+        const int fd = aBatch[r].fd;
+        if (!writeFully(fd, reply.data(), reply.size())) dropClient(fd);
+    }
+}
+
+/**
+ * @brief Serve clients until stop() is called
+ *
+ * Once a request has fully arrived, waits up to the batch window for requests
+ * of the other connected clients, then processes all of them as one batch.
+ * Requests are read without blocking, piece by piece as they arrive.
+ */
+void TrackingServer::run() {
+    typedef std::chrono::steady_clock clock_t;
+
+    while (!mStop) {
+        std::vector<PendingRequest> batch;
+        std::vector<int> waiting;
+
+        clock_t::time_point deadline = clock_t::time_point::max();
+
+        // Add a client's next request to the batch if it has fully arrived;
+        // returns whether the client is still waiting for one
+        auto collect = [&](const int aFd) {
+            PendingRequest request;
+            const int status = parseRequest(aFd, request);
+
+            if (status == 0) return true;
+            if (status < 0) {
+                dropClient(aFd);
+                return false;
+            }
+
+            if (batch.empty())
+                deadline = clock_t::now() +
+                           std::chrono::microseconds(mBatchWindowUs);
+
+            batch.push_back(std::move(request));
+            return false;
+        };
+
+        // Requests which arrived while the last batch was processed
+        std::vector<int> clients;
+        for (const auto &client : mClients)
+            clients.push_back(client.first);
+
+        for (const int fd : clients) {
+            if (collect(fd)) waiting.push_back(fd);
+        }
+
+        while (!mStop) {
+            // Poll listening socket and clients without a pending request
+            std::vector<pollfd> fds;
+            fds.push_back(pollfd{ mListenFd, POLLIN, 0 });
+            for (const int fd : waiting)
+                fds.push_back(pollfd{ fd, POLLIN, 0 });
+
+            int timeoutMs = 100;
+            if (!batch.empty()) {
+                const long remainingUs =
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        deadline - clock_t::now())
+                        .count();
+                if (remainingUs <= 0 || waiting.empty()) break;
+                timeoutMs = static_cast<int>((remainingUs + 999) / 1000);
+            }
+
+            if (poll(fds.data(), fds.size(), timeoutMs) <= 0) continue;
+
+            if (fds[0].revents & POLLIN) {
+                const int fd = acceptClient();
+                if (fd >= 0) waiting.push_back(fd);
+            }
+
+            for (size_t i = 1; i < fds.size(); i++) {
+                if (!fds[i].revents) continue;
+
+                const int fd = fds[i].fd;
+
+                bool stillWaiting = false;
+                if (!receive(fd))
+                    dropClient(fd);
+                else
+                    stillWaiting = collect(fd);
+
+                if (!stillWaiting)
+                    waiting.erase(
+                        std::find(waiting.begin(), waiting.end(), fd));
+            }
+        }
+
+        if (!batch.empty()) processBatch(batch);
+    }
+}
+
+/**
+ * @brief Constructor for TrackingClient class
+ */
+TrackingClient::TrackingClient() {}
+
+/**
+ * @brief Destructor: disconnects
+ */
+TrackingClient::~TrackingClient() {
+    disconnect();
+}
+
+/**
+ * @brief Connect to a tracking server
+ *
+ * @param[in] aSocketPath Server socket path
+ * @return true on success
+ */
+bool TrackingClient::connect(const std::string &aSocketPath) {
+    disconnect();
+
+    sockaddr_un addr;
+    if (!makeAddress(aSocketPath, addr)) return false;
+
+    mFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (mFd < 0) return false;
+
+    if (::connect(mFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) <
+        0) {
+        disconnect();
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Disconnect from server; the server forgets this client's targets
+ */
+void TrackingClient::disconnect() {
+    if (mFd >= 0) close(mFd);
+    mFd = -1;
+}
+
+/**
+ * @brief Send a frame with its target list and wait for the reply
+ *
+ * @param[in] aFrame Frame handle
+ * @param[in] aTargets Targets to init/track/drop in frame
+ * @param[out] aReplies Per-target results, in request order
+ *
+ * @return true on success
+ */
+bool TrackingClient::track(const FrameHandle &aFrame,
+                           const std::vector<TargetRequest> &aTargets,
+                           std::vector<TargetReply> &aReplies) {
+    if (mFd < 0 || aTargets.size() > KLT_MAX_TARGETS) return false;
+
+    RequestHeader request;
+    request.magic = KLT_PROTOCOL_MAGIC;
+    request.numTargets = static_cast<uint32_t>(aTargets.size());
+    request.frame = aFrame;
+
+    if (!writeFully(mFd, &request, sizeof(request)) ||
+        !writeFully(mFd, aTargets.data(),
+                    aTargets.size() * sizeof(TargetRequest)))
+        return false;
+
+    ReplyHeader reply;
+    if (!readFully(mFd, &reply, sizeof(reply)) ||
+        reply.magic != KLT_PROTOCOL_MAGIC ||
+        reply.numTargets != aTargets.size())
+        return false;
+
+    aReplies.resize(reply.numTargets);
+    return readFully(mFd, aReplies.data(),
+                     aReplies.size() * sizeof(TargetReply));
+}
@@ -0,0 +1,226 @@
+/**
+ * @file TrackingServer.hpp
+ * @author Samuel Leong (samleocw@gmail.com)
+ * @brief Local tracking service: a daemon which tracks targets for many client
+ * processes over a Unix domain socket, batching requests for the same frame
+ * into one multi-target pass
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2020
+ */
+
+#ifndef __TRACKING_SERVER_H__
+#define __TRACKING_SERVER_H__
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#include "ImageAlignment.hpp"
+#include "ThreadPool.hpp"
+
+/// @brief Protocol magic ("KLT1")
+#define KLT_PROTOCOL_MAGIC 0x4b4c5431u
+
+/// @brief Max length of shared memory object name (including terminator)
+#define KLT_SHM_NAME_LEN 64
+
+/// @brief Max targets in a single request
+#define KLT_MAX_TARGETS 1024
+
+/// @brief What to do with a target in a request
+enum TargetCommand : uint32_t {
+    /// @brief Track existing target in frame
+    TARGET_TRACK = 0,
+
+    /// @brief (Re-)initialise target with given BBOX in frame
+    TARGET_INIT = 1,
+
+    /// @brief Forget target
+    TARGET_DROP = 2
+};
+
+/// @brief Per-target result status
+enum TargetStatus : uint32_t {
+    STATUS_OK = 0,
+    STATUS_UNKNOWN_TARGET = 1,
+    STATUS_BAD_FRAME = 2,
+    STATUS_DUPLICATE_TARGET = 3
+};
+
+/**
+ * @brief Frame stored in POSIX shared memory. Requests with the same object
+ * name and frame sequence number refer to the same frame and are batched.
+ * @note The producer must not modify the frame until the reply is received
+ */
+struct FrameHandle {
+    /// @brief Shared memory object name (as passed to shm_open)
+    char shmName[KLT_SHM_NAME_LEN];
+
+    /// @brief Byte offset of first pixel within the object
+    uint64_t offset;
+
+    /// @brief Frame size, OpenCV type (CV_8UC1, CV_8UC3, CV_32FC1) and row
+    /// step in bytes
+    int32_t width, height, type, step;
+
+    /// @brief Frame sequence number
+    uint64_t frameSeq;
+};
+
+/// @brief Request header, followed by numTargets TargetRequest
+struct RequestHeader {
+    uint32_t magic;
+    uint32_t numTargets;
+    FrameHandle frame;
+};
+
+/// @brief Target entry of a request. Target IDs are private to each client
+struct TargetRequest {
+    uint32_t targetId;
+    uint32_t command;
+
+    /// @brief BBOX, only used by TARGET_INIT
+    float bbox[4];
+};
+
+/// @brief Reply header, followed by numTargets TargetReply (in request order)
+struct ReplyHeader {
+    uint32_t magic;
+    uint32_t numTargets;
+    uint64_t frameSeq;
+};
+
+/// @brief Target entry of a reply
+struct TargetReply {
+    uint32_t targetId;
+    uint32_t status;
+    float bbox[4];
+    float confidence;
+};
+
+/**
+ * @brief Tracking Server Class
+ *
+ * Accepts clients on a Unix domain socket. Each client sends one request per
+ * frame (a shared memory frame handle plus its target list) and waits for the
+ * reply. Requests arriving within a short batch window are grouped by frame:
+ * each frame is mapped and preprocessed once, and all targets of all clients
+ * on it are tracked in parallel on the thread pool.
+ */
+class TrackingServer {
+  private:
+    /// @brief Request received from a client, waiting to be batched
+    struct PendingRequest {
+        int fd;
+        RequestHeader header;
+        std::vector<TargetRequest> targets;
+    };
+
+    /// @brief Connected client: bytes received but not parsed yet (sockets
+    /// are non-blocking, so a request may arrive in pieces)
+    struct Client {
+        std::vector<char> input;
+    };
+
+    /// @brief Cached shared memory mapping, with the identity of the object it
+    /// maps and the clients which refer to it
+    struct Mapping {
+        void *addr;
+        size_t size;
+        dev_t device;
+        ino_t inode;
+        std::set<int> clients;
+    };
+
+    /// @brief Socket path
+    std::string mSocketPath;
+
+    /// @brief Listening socket
+    int mListenFd = -1;
+
+    /// @brief Connected clients by socket
+    std::map<int, Client> mClients;
+
+    /// @brief Trackers by (client, target ID)
+    std::map<std::pair<int, uint32_t>, std::unique_ptr<ImageAlignment>>
+        mTrackers;
+
+    /// @brief Shared memory mappings by object name
+    std::map<std::string, Mapping> mMappings;
+
+    /// @brief Worker pool for per-target tracking
+    ThreadPool mPool;
+
+    /// @brief Max time (us) to wait for other clients once a request arrived
+    long mBatchWindowUs = 1000;
+
+    /// @brief Tracker convergence threshold
+    float mThreshold = 0.01875f;
+
+    /// @brief Tracker max iterations per frame
+    size_t mMaxIters = 100;
+
+    /// @brief Set to stop run()
+    std::atomic<bool> mStop;
+
+    int acceptClient();
+    void dropClient(const int aFd);
+    bool receive(const int aFd);
+    int parseRequest(const int aFd, PendingRequest &aRequest);
+    bool mapFrame(const FrameHandle &aHandle, cv::Mat &aView,
+                  const std::vector<int> &aClients);
+    void unmapAll();
+    void processBatch(std::vector<PendingRequest> &aBatch);
+
+  public:
+    // Constructor
+    TrackingServer(const std::string &aSocketPath,
+                   const size_t aNumThreads =
+                       std::thread::hardware_concurrency());
+    ~TrackingServer();
+
+    // Settings
+    void setBatchWindow(const long aBatchWindowUs);
+    void setTrackParams(const float aThreshold, const size_t aMaxIters);
+
+    // Run
+    bool start();
+    void run();
+    void stop();
+};
+
+/**
+ * @brief Tracking Client Class
+ *
+ * Blocking client of TrackingServer: one outstanding request at a time.
+ */
+class TrackingClient {
+  private:
+    /// @brief Connected socket
+    int mFd = -1;
+
+  public:
+    // Constructor
+    TrackingClient();
+    ~TrackingClient();
+
+    TrackingClient(const TrackingClient &) = delete;
+    TrackingClient &operator=(const TrackingClient &) = delete;
+
+    bool connect(const std::string &aSocketPath);
+    void disconnect();
+
+    bool track(const FrameHandle &aFrame,
+               const std::vector<TargetRequest> &aTargets,
+               std::vector<TargetReply> &aReplies);
+};
+
+#endif